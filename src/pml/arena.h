@@ -0,0 +1,475 @@
+#ifndef PML_ARENA_H
+#define PML_ARENA_H
+
+/** \file pml/arena.h
+ *  Bump-pointer arena allocator for request-scoped memory (C++ only).
+ *
+ *  Memory is handed out by advancing a pointer through a list of chunks, which
+ *  are allocated from a parent allocator (the global hooks by default, even
+ *  inside a ScopedAllocator). free() is a no-op - instead, mark() records the
+ *  current position and release() rewinds to it in O(1), keeping the chunks for
+ *  reuse:
+ *
+ *      pml::Arena arena;
+ *
+ *      pml::Arena::Mark m = arena.mark();
+ *      Node *n = pml_new<Node>(&arena)(a, b);
+ *      ...
+ *      arena.release(m); // drops n, and anything else allocated since mark()
+ *
+ *  Objects which need their destructors to run when the arena is released can
+ *  be registered with track(). (Don't also pml_delete() a tracked object.)
+ *
+ *  InlineArena<N> is a smaller relative, for scratch memory: its first N bytes
+ *  live inside the object (typically on the stack), with a heap fallback.
+ */
+
+#include "pml/malloc.h"
+
+#ifdef __cplusplus
+
+#include <string.h> /* for memcpy() */
+
+PML_BEGIN_NAMESPACE
+struct Arena: IAllocator {
+
+    /** Default chunk size. Requests larger than this get a chunk of their own. */
+    enum { CHUNK_SIZE = 16384 };
+
+    /** Alignment of every allocation. */
+    enum { ALIGN = 2 * sizeof(void*) };
+
+private:
+    struct Chunk {
+        Chunk *next;
+        char *end;
+    };
+
+    struct Dtor {
+        void (*destroy)(void*);
+        void *ptr;
+        Dtor *prev;
+    };
+
+public:
+    /** A position in the arena, as returned by mark(). */
+    struct Mark {
+        Chunk *chunk;
+        char *ptr;
+        Dtor *dtors;
+    };
+
+    explicit Arena(size_t chunk_size = CHUNK_SIZE,
+        Allocator *parent = 0, Hint hint = 0):
+        m_parent(parent ? parent : PML_CALL(global_allocator)()),
+        m_hint(hint),
+        m_chunk_size(chunk_size),
+        m_first(0),
+        m_chunk(0),
+        m_ptr(0),
+        m_end(0),
+        m_last(0),
+        m_dtors(0) {}
+
+    virtual ~Arena() {
+        reset();
+
+        while(m_first) {
+            Chunk *next = m_first->next;
+            PML_CALL(free)(m_first, m_parent, m_hint);
+            m_first = next;
+        }
+    }
+
+    virtual void *malloc(size_t size, Hint h = 0) {
+        size_t asize = align(size ? size : 1);
+
+        if(asize < size) {
+            return 0;
+        }
+
+        size = asize;
+
+        if(size <= static_cast<size_t>(m_end - m_ptr)) {
+            m_last = m_ptr;
+            m_ptr += size;
+            return m_last;
+        }
+
+        return grow(size);
+    }
+
+    /* Individual frees are a no-op, use release() instead. */
+    virtual void free(void *ptr, Hint h = 0) {}
+
+    /* The most recent allocation is resized in place, anything else is copied
+     * to a new block. As we don't track allocation sizes, the copy is bounded
+     * by the end of the chunk holding ptr (as it was before the new block was
+     * taken from it), so we never read outside the arena, or into the copy.
+     */
+    virtual void *realloc(void *ptr, size_t size, Hint h = 0) {
+        if(!ptr) {
+            return malloc(size, h);
+        }
+
+        if(try_expand(ptr, size, h)) {
+            return ptr;
+        }
+
+        char *p = static_cast<char*>(ptr);
+        size_t avail = static_cast<size_t>(chunk_end(p) - p);
+        void *out = malloc(size, h);
+
+        if(out) {
+            memcpy(out, ptr, size < avail ? size : avail);
+        }
+
+        return out;
+    }
+
+    /* Only the most recent allocation can be resized, within its chunk. */
+    virtual bool try_expand(void *ptr, size_t size, Hint h = 0) {
+        char *p = static_cast<char*>(ptr);
+        size_t asize = align(size);
+
+        if( p == m_last && asize >= size &&
+            asize <= static_cast<size_t>(m_end - p) ) {
+
+            m_ptr = p + asize;
+            return true;
+        }
+
+        return false;
+    }
+
+    /* Pad the allocation to the requested alignment. */
+    virtual void *aligned_malloc(size_t align, size_t size, Hint h = 0) {
+        if(align <= ALIGN) {
+            return malloc(size, h);
+        }
+
+        if(size > ~static_cast<size_t>(0) - align) {
+            return 0;
+        }
+
+        char *p = static_cast<char*>(malloc(size + align - ALIGN, h));
+        size_t pad = (align - (reinterpret_cast<size_t>(p) & (align - 1))) & (align - 1);
+
+        return p ? p + pad : 0;
+    }
+
+    virtual void aligned_free(void *ptr, Hint h = 0) {}
+
+    /** Record the current position in the arena.
+     */
+    Mark mark() const {
+        Mark m = { m_chunk, m_ptr, m_dtors };
+        return m;
+    }
+
+    /** Rewind the arena to a position returned by mark(). Destructors of objects
+     *  tracked since the mark are run (in reverse order), and all memory
+     *  allocated since then becomes available again. Chunks are kept for reuse.
+     */
+    void release(const Mark &m) {
+        while(m_dtors != m.dtors) {
+            Dtor *d = m_dtors;
+            m_dtors = d->prev;
+            d->destroy(d->ptr);
+        }
+
+        m_chunk = m.chunk;
+        m_ptr = m.ptr;
+        m_end = m_chunk ? m_chunk->end : 0;
+        m_last = 0;
+    }
+
+    /** Release everything allocated from the arena.
+     */
+    void reset() {
+        Mark m = { 0, 0, 0 };
+        release(m);
+    }
+
+    /** Register ptr (allocated from this arena) to be destroyed when the arena
+     *  is released past this point. Returns ptr, so this can wrap pml_new():
+     *
+     *      Obj *o = arena.track(pml_new<Obj>(&arena)(...));
+     */
+    template<typename T>
+    T *track(T *ptr) {
+        if(ptr) {
+            if(Dtor *d = static_cast<Dtor*>(malloc(sizeof(Dtor)))) {
+                d->destroy = &destroy<T>;
+                d->ptr = ptr;
+                d->prev = m_dtors;
+                m_dtors = d;
+            }
+        }
+        return ptr;
+    }
+
+private:
+    Allocator *m_parent;
+    Hint m_hint;
+    size_t m_chunk_size;
+    Chunk *m_first; /* all chunks, in order of use */
+    Chunk *m_chunk; /* current chunk */
+    char *m_ptr; /* next free byte in current chunk */
+    char *m_end; /* end of current chunk */
+    char *m_last; /* most recent allocation (for realloc()) */
+    Dtor *m_dtors; /* tracked objects, most recent first */
+
+    Arena(const Arena&);
+    Arena &operator=(const Arena&);
+
+    static size_t align(size_t size) {
+        return (size + (ALIGN - 1)) & ~static_cast<size_t>(ALIGN - 1);
+    }
+
+    static char *data(Chunk *c) {
+        return reinterpret_cast<char*>(c) + align(sizeof(Chunk));
+    }
+
+    template<typename T>
+    static void destroy(void *ptr) {
+        static_cast<T*>(ptr)->~T();
+    }
+
+    /* Move on to the next chunk with room for size bytes - either one kept
+     * from a previous release(), or a new one.
+     */
+    void *grow(size_t size) {
+        Chunk *next = m_chunk ? m_chunk->next : m_first;
+
+        if(!next || size > static_cast<size_t>(next->end - data(next))) {
+            size_t capacity = size > m_chunk_size ? size : m_chunk_size;
+            size_t bytes = align(sizeof(Chunk)) + capacity;
+
+            if(bytes < capacity) {
+                return 0;
+            }
+
+            Chunk *c = static_cast<Chunk*>(PML_CALL(malloc)(bytes, m_parent, m_hint));
+            if(!c) {
+                return 0;
+            }
+
+            c->end = data(c) + capacity;
+            c->next = next;
+
+            if(m_chunk) {
+                m_chunk->next = c;
+            } else {
+                m_first = c;
+            }
+            next = c;
+        }
+
+        m_chunk = next;
+        m_last = data(next);
+        m_ptr = m_last + size;
+        m_end = next->end;
+
+        return m_last;
+    }
+
+    /* End of the chunk holding p. */
+    char *chunk_end(char *p) const {
+        for(Chunk *c = m_first; c; c = c->next) {
+            if(p >= data(c) && p < c->end) {
+                return c == m_chunk ? m_ptr : c->end;
+            }
+        }
+        return p;
+    }
+};
+
+
+/** An allocator whose first N bytes are held inside the object itself - so
+ *  when it's a local variable, small scratch allocations never touch the heap:
+ *
+ *      pml::InlineArena<512> scratch;
+ *      Node *n = pml_new<Node>(&scratch)(a, b);
+ *      ...
+ *      pml_delete(&scratch)(n);
+ *
+ *  Allocations are bumped through the buffer, and once it's exhausted they
+ *  fall back to a parent allocator (the global hooks by default). Freeing is
+ *  transparent: blocks outside the buffer go back to the parent, while freeing
+ *  the most recent block in the buffer rewinds over it (other inline frees are
+ *  no-ops, the space is reclaimed when the arena goes out of scope).
+ *
+ *  This is an AllocatorBase, so pml_new()/pml_delete() call it directly when
+ *  the type is known, and it can also be passed anywhere an Allocator is.
+ */
+template<size_t N>
+struct InlineArena: AllocatorBase<InlineArena<N> > {
+
+    /** Alignment of every inline allocation. */
+    enum { ALIGN = 2 * sizeof(void*) };
+
+    explicit InlineArena(Allocator *parent = 0):
+        m_parent(parent ? parent : PML_CALL(global_allocator)()),
+        m_ptr(begin()),
+        m_last(0) {}
+
+    void *malloc(size_t size, Hint h = 0) {
+        size_t asize = align(size ? size : 1);
+
+        if(asize >= size && asize <= available()) {
+            m_last = m_ptr;
+            m_ptr += asize;
+            return m_last;
+        }
+
+        return PML_CALL(malloc)(size, m_parent, h);
+    }
+
+    void free(void *ptr, Hint h = 0) {
+        if(owns(ptr)) {
+            if(ptr == m_last) {
+                m_ptr = m_last;
+                m_last = 0;
+            }
+        } else {
+            PML_CALL(free)(ptr, m_parent, h);
+        }
+    }
+
+    void free_sized(void *ptr, size_t size, Hint h = 0) {
+        if(owns(ptr)) {
+            free(ptr, h);
+        } else {
+            PML_CALL(free_sized)(ptr, size, m_parent, h);
+        }
+    }
+
+    /* The last inline block is resized in place if it still fits, anything
+     * else moves (copying no more than the bytes allocated after ptr). */
+    void *realloc(void *ptr, size_t size, Hint h = 0) {
+        if(!ptr) {
+            return malloc(size, h);
+        }
+
+        if(!owns(ptr)) {
+            return PML_CALL(realloc)(ptr, size, m_parent, h);
+        }
+
+        if(try_expand(ptr, size, h)) {
+            return ptr;
+        }
+
+        char *p = static_cast<char*>(ptr);
+        size_t avail = static_cast<size_t>(m_ptr - p);
+        void *out = malloc(size, h);
+
+        if(out) {
+            memcpy(out, ptr, size < avail ? size : avail);
+            free(ptr, h);
+        }
+
+        return out;
+    }
+
+    /* Pad the allocation to the requested alignment. */
+    void *aligned_malloc(size_t align, size_t size, Hint h = 0) {
+        if(align <= ALIGN) {
+            return malloc(size, h);
+        }
+
+        size_t pad = (align - (reinterpret_cast<size_t>(m_ptr) & (align - 1))) & (align - 1);
+        size_t asize = InlineArena::align(size ? size : 1);
+
+        if(asize >= size && pad <= available() && asize <= available() - pad) {
+            m_last = m_ptr + pad;
+            m_ptr = m_last + asize;
+            return m_last;
+        }
+
+        return PML_CALL(aligned_malloc)(align, size, m_parent, h);
+    }
+
+    void aligned_free(void *ptr, Hint h = 0) {
+        if(owns(ptr)) {
+            free(ptr, h);
+        } else {
+            PML_CALL(aligned_free)(ptr, m_parent, h);
+        }
+    }
+
+    /* Only the last inline block can be resized, within the buffer. */
+    bool try_expand(void *ptr, size_t size, Hint h = 0) {
+        char *p = static_cast<char*>(ptr);
+        size_t asize = align(size);
+
+        if( p == m_last && asize >= size &&
+            asize <= static_cast<size_t>(end() - p) ) {
+
+            m_ptr = p + asize;
+            return true;
+        }
+
+        return false;
+    }
+
+    size_t usable_size(void *ptr, Hint h = 0) {
+        if(owns(ptr)) {
+            return ptr == m_last ? static_cast<size_t>(m_ptr - m_last) : 0;
+        }
+
+        return PML_CALL(usable_size)(ptr, m_parent, h);
+    }
+
+    /** True if ptr is inside the inline buffer. */
+    bool owns(const void *ptr) const {
+        const char *p = static_cast<const char*>(ptr);
+        return p >= m_buffer.bytes && p < m_buffer.bytes + N;
+    }
+
+    /** Bytes left in the inline buffer. */
+    size_t available() const {
+        return static_cast<size_t>(end() - m_ptr);
+    }
+
+    /** Rewind the inline buffer. Blocks from the parent are unaffected, and
+     *  still need to be freed.
+     */
+    void reset() {
+        m_ptr = begin();
+        m_last = 0;
+    }
+
+private:
+    union {
+        char bytes[N];
+        void *p;
+        double d;
+        long double ld;
+    } m_buffer;
+
+    Allocator *m_parent;
+    char *m_ptr; /* next free byte in the buffer */
+    char *m_last; /* most recent inline allocation */
+
+    InlineArena(const InlineArena&);
+    InlineArena &operator=(const InlineArena&);
+
+    static size_t align(size_t size) {
+        return (size + (ALIGN - 1)) & ~static_cast<size_t>(ALIGN - 1);
+    }
+
+    char *begin() {
+        size_t base = reinterpret_cast<size_t>(m_buffer.bytes);
+        return m_buffer.bytes + (align(base) - base);
+    }
+
+    const char *end() const {
+        return m_buffer.bytes + N;
+    }
+};
+PML_END_NAMESPACE
+
+#endif/*__cplusplus*/
+
+#endif/*PML_ARENA_H*/
@@ -0,0 +1,508 @@
+#include "pml/epoch.h"
+#include "pml/sys_impl.h"
+
+#include <sched.h>
+
+#if defined(__linux__)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#endif/*__linux__*/
+
+/*----------------------------------------------------------------------------*/
+/* Constants */
+
+enum {
+    /* Retired blocks are recorded in page-sized bags. */
+    EP_BAG_SIZE = 4096,
+
+    /* The record of an active thread holds (epoch << 1) | EP_ACTIVE, and an
+     * inactive one holds 0. */
+    EP_ACTIVE = 1,
+
+    /* Epochs start here, so no bag ever looks like it's from the future. */
+    EP_FIRST_EPOCH = 3,
+};
+
+
+/*----------------------------------------------------------------------------*/
+/* Types */
+
+typedef struct EpEntry {
+
+    void *ptr;
+    PML_TYPE(Allocator) *alloc;
+    PML_TYPE(Hint) hint;
+
+} EpEntry;
+
+
+typedef struct EpBag EpBag;
+
+enum { EP_BAG_ENTRIES = (EP_BAG_SIZE - 2 * sizeof(void*)) / sizeof(EpEntry) };
+
+struct EpBag {
+
+    EpBag *next;
+    size_t count;
+    EpEntry entries[EP_BAG_ENTRIES];
+};
+
+
+typedef struct EpRecord EpRecord;
+
+/** A thread's registration with a domain. Records are never unlinked from
+ *  their domain - when a thread exits, its record is released for reuse, along
+ *  with any blocks still waiting in it.
+ */
+struct EpRecord {
+
+    pml_Record link; /* in the domain's records */
+    uint64_t epoch; /* read by reclaiming threads */
+
+    unsigned depth __attribute__((aligned(pml_CACHE_LINE))); /* nesting of read-side sections */
+    unsigned pending; /* retires since the last attempt to reclaim */
+    uint64_t limbo_epoch[3]; /* the epoch each limbo list was retired in */
+    EpBag *limbo[3]; /* indexed by epoch % 3 */
+    EpBag *spare; /* emptied bags, for reuse */
+};
+
+
+struct PmlEpochDomain {
+
+    uint64_t epoch;
+    pml_Record *records;
+
+    unsigned index; /* in s_ep_domains */
+    uint64_t serial; /* distinguishes a domain from an earlier one at index */
+};
+
+
+/** A thread's record for the domain at each index.
+ */
+typedef struct EpSlot {
+
+    uint64_t serial;
+    EpRecord *record;
+
+} EpSlot;
+
+
+static PML_TYPE(EpochDomain) s_ep_default = {
+    EP_FIRST_EPOCH, 0, 0, 1,
+};
+
+static pml_Mutex s_ep_lock = pml_MUTEX_INIT;
+static PML_TYPE(EpochDomain) *s_ep_domains[PML_EPOCH_DOMAINS] = { &s_ep_default };
+static uint64_t s_ep_serial = 1;
+
+static pml_TLS EpSlot s_ep_slots[PML_EPOCH_DOMAINS];
+static pml_TLS bool s_ep_registered;
+
+static void ep_thread_exit(void *slots);
+
+static pthread_once_t s_ep_once = PTHREAD_ONCE_INIT;
+static pml_ThreadExit s_ep_exit = pml_THREAD_EXIT_INIT(ep_thread_exit);
+
+/* Set if readers can rely on ep_heavy_fence() (so need only a compiler
+ * barrier). */
+static bool s_ep_asymmetric;
+
+
+/*----------------------------------------------------------------------------*/
+/* Fences */
+
+/** Order a reader's store of its epoch before the loads in its section.
+ */
+static inline void ep_light_fence() {
+
+    if(pml_LOAD(&s_ep_asymmetric)) {
+        __asm__ __volatile__("" ::: "memory");
+    } else {
+        pml_FENCE();
+    }
+}
+
+
+/** Make every reader's epoch store visible before we look at the records (a
+ *  full fence on every running thread, when the OS supports it).
+ */
+static void ep_heavy_fence() {
+
+#if defined(__linux__) && defined(__NR_membarrier)
+    if(pml_LOAD(&s_ep_asymmetric)) {
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+        return;
+    }
+#endif/*__linux__ && __NR_membarrier*/
+
+    pml_FENCE();
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Bags */
+
+static EpBag *ep_bag_alloc(EpRecord *rec) {
+
+    EpBag *bag = rec->spare;
+
+    if(bag) {
+        rec->spare = bag->next;
+    } else if(!(bag = (EpBag*)pml_os_map(EP_BAG_SIZE, EP_BAG_SIZE))) {
+        return 0;
+    }
+
+    bag->next = 0;
+    bag->count = 0;
+    return bag;
+}
+
+
+/** Free every block in limbo list i, and keep its bags for reuse.
+ */
+static size_t ep_free_limbo(EpRecord *rec, unsigned i) {
+
+    size_t count = 0;
+    EpBag *bag = rec->limbo[i];
+
+    while(bag) {
+        EpBag *next = bag->next;
+
+        for(size_t j = 0; j < bag->count; j++) {
+            EpEntry *e = &bag->entries[j];
+            PML_CALL(free)(e->ptr, e->alloc, e->hint);
+        }
+
+        count += bag->count;
+        bag->next = rec->spare;
+        rec->spare = bag;
+        bag = next;
+    }
+
+    rec->limbo[i] = 0;
+    return count;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Registration */
+
+static void ep_thread_exit(void *slots) {
+
+    pml_LOCK(&s_ep_lock);
+
+    for(unsigned i = 0; i < PML_EPOCH_DOMAINS; i++) {
+        EpSlot *slot = &s_ep_slots[i];
+
+        if( slot->serial && s_ep_domains[i] &&
+            s_ep_domains[i]->serial == slot->serial ) {
+
+            slot->record->depth = 0;
+            pml_STORE_REL(&slot->record->epoch, 0);
+            pml_record_release(&slot->record->link);
+        }
+
+        slot->serial = 0;
+    }
+
+    pml_UNLOCK(&s_ep_lock);
+
+    s_ep_registered = false;
+}
+
+
+static void ep_init_once() {
+
+#if defined(__linux__) && defined(__NR_membarrier)
+    s_ep_asymmetric = 0 == syscall(__NR_membarrier,
+        MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0);
+#endif/*__linux__ && __NR_membarrier*/
+}
+
+
+/** Register the calling thread with domain - taking over a released record if
+ *  there is one, otherwise adding a new one.
+ */
+static EpRecord *ep_register(PML_TYPE(EpochDomain) *domain) {
+
+    if(!s_ep_registered) {
+        pthread_once(&s_ep_once, ep_init_once);
+        pml_thread_exit_set(&s_ep_exit, s_ep_slots);
+        s_ep_registered = true;
+    }
+
+    EpRecord *rec = (EpRecord*)pml_record_claim(&domain->records);
+
+    if(!rec) {
+        rec = (EpRecord*)pml_os_map(
+            pml_ALIGN_UP(sizeof(EpRecord), EP_BAG_SIZE), EP_BAG_SIZE);
+
+        if(!rec) {
+            return 0;
+        }
+
+        pml_record_push(&domain->records, &rec->link);
+    }
+
+    EpSlot *slot = &s_ep_slots[domain->index];
+    slot->serial = domain->serial;
+    slot->record = rec;
+
+    return rec;
+}
+
+
+static inline PML_TYPE(EpochDomain) *ep_domain(PML_TYPE(EpochDomain) *domain) {
+
+    return domain ? domain : &s_ep_default;
+}
+
+
+static inline EpRecord *ep_record(PML_TYPE(EpochDomain) *domain) {
+
+    EpSlot *slot = &s_ep_slots[domain->index];
+    return slot->serial == domain->serial ? slot->record : ep_register(domain);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Reclamation */
+
+/** Advance the domain's epoch if every active thread has seen the current one.
+ */
+static void ep_try_advance(PML_TYPE(EpochDomain) *domain) {
+
+    uint64_t epoch = pml_LOAD_ACQ(&domain->epoch);
+    uint64_t current = (epoch << 1) | EP_ACTIVE;
+
+    ep_heavy_fence();
+
+    for(pml_Record *r = pml_LOAD_ACQ(&domain->records); r; r = r->next) {
+        uint64_t seen = pml_LOAD_ACQ(&((EpRecord*)r)->epoch);
+
+        if(seen && seen != current) {
+            return;
+        }
+    }
+
+    pml_CAS(&domain->epoch, &epoch, epoch + 1);
+}
+
+
+/** Free the calling thread's blocks retired at least two epochs ago (by then,
+ *  every reader which could have seen them has left its section).
+ */
+static size_t ep_reclaim(PML_TYPE(EpochDomain) *domain, EpRecord *rec) {
+
+    uint64_t epoch = pml_LOAD_ACQ(&domain->epoch);
+    size_t count = 0;
+
+    for(unsigned i = 0; i < 3; i++) {
+        if(rec->limbo[i] && rec->limbo_epoch[i] + 2 <= epoch) {
+            count += ep_free_limbo(rec, i);
+        }
+    }
+
+    return count;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Domains */
+
+PML_TYPE(EpochDomain) *PML_APINAME(epoch_create)() {
+
+    PML_TYPE(EpochDomain) *domain = 0;
+
+    pml_LOCK(&s_ep_lock);
+
+    for(unsigned i = 1; i < PML_EPOCH_DOMAINS; i++) {
+        if(!s_ep_domains[i]) {
+            domain = (PML_TYPE(EpochDomain)*)pml_os_map(
+                pml_ALIGN_UP(sizeof(*domain), EP_BAG_SIZE), EP_BAG_SIZE);
+
+            if(domain) {
+                domain->epoch = EP_FIRST_EPOCH;
+                domain->index = i;
+                domain->serial = ++s_ep_serial;
+                s_ep_domains[i] = domain;
+            }
+            break;
+        }
+    }
+
+    pml_UNLOCK(&s_ep_lock);
+
+    return domain;
+}
+
+
+void PML_APINAME(epoch_destroy)(PML_TYPE(EpochDomain) *domain) {
+
+    if(!domain || domain == &s_ep_default) {
+        return;
+    }
+
+    pml_LOCK(&s_ep_lock);
+    s_ep_domains[domain->index] = 0;
+    pml_UNLOCK(&s_ep_lock);
+
+    EpRecord *rec = (EpRecord*)domain->records;
+
+    while(rec) {
+        EpRecord *next = (EpRecord*)rec->link.next;
+
+        for(unsigned i = 0; i < 3; i++) {
+            ep_free_limbo(rec, i);
+        }
+
+        while(rec->spare) {
+            EpBag *bag = rec->spare;
+            rec->spare = bag->next;
+            pml_os_unmap(bag, EP_BAG_SIZE);
+        }
+
+        pml_os_unmap(rec, pml_ALIGN_UP(sizeof(EpRecord), EP_BAG_SIZE));
+        rec = next;
+    }
+
+    pml_os_unmap(domain, pml_ALIGN_UP(sizeof(*domain), EP_BAG_SIZE));
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Read-side sections */
+
+void PML_APINAME(epoch_enter)(PML_TYPE(EpochDomain) *domain) {
+
+    domain = ep_domain(domain);
+    EpRecord *rec = ep_record(domain);
+
+    if(rec && !rec->depth++) {
+        uint64_t epoch = pml_LOAD(&domain->epoch);
+        pml_STORE(&rec->epoch, (epoch << 1) | EP_ACTIVE);
+        ep_light_fence();
+    }
+}
+
+
+void PML_APINAME(epoch_exit)(PML_TYPE(EpochDomain) *domain) {
+
+    domain = ep_domain(domain);
+    EpRecord *rec = ep_record(domain);
+
+    if(rec && rec->depth && !--rec->depth) {
+        pml_STORE_REL(&rec->epoch, 0);
+    }
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Retiring */
+
+bool PML_APINAME(epoch_retire)(PML_TYPE(EpochDomain) *domain, void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(!ptr) {
+        return true;
+    }
+
+    domain = ep_domain(domain);
+    EpRecord *rec = ep_record(domain);
+
+    if(!rec) {
+        return false;
+    }
+
+    /* (ptr was unlinked before this, so any reader which sees a later epoch
+     * can't find it) */
+    pml_FENCE();
+
+    uint64_t epoch = pml_LOAD(&domain->epoch);
+    unsigned i = (unsigned)(epoch % 3);
+
+    /* a list from an older epoch in this slot is at least three behind */
+    if(rec->limbo_epoch[i] != epoch) {
+        ep_free_limbo(rec, i);
+        rec->limbo_epoch[i] = epoch;
+    }
+
+    EpBag *bag = rec->limbo[i];
+
+    if(!bag || EP_BAG_ENTRIES == bag->count) {
+        EpBag *added = ep_bag_alloc(rec);
+        if(!added) {
+            return false;
+        }
+
+        added->next = bag;
+        rec->limbo[i] = bag = added;
+    }
+
+    EpEntry *e = &bag->entries[bag->count++];
+    e->ptr = ptr;
+    e->alloc = alloc;
+    e->hint = hint;
+
+    /* a null alloc means the scoped allocator in effect now, not wherever the
+     * block is eventually freed */
+    if(!alloc && !(e->alloc = PML_CALL(get_scoped_allocator)())) {
+        e->alloc = PML_CALL(global_allocator)();
+    }
+
+    if(++rec->pending >= PML_EPOCH_BATCH) {
+        rec->pending = 0;
+        ep_try_advance(domain);
+        ep_reclaim(domain, rec);
+    }
+
+    return true;
+}
+
+
+bool PML_APINAME(retire)(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    return PML_APINAME(epoch_retire)(0, ptr, alloc, hint);
+}
+
+
+size_t PML_APINAME(epoch_collect)(PML_TYPE(EpochDomain) *domain) {
+
+    domain = ep_domain(domain);
+    EpRecord *rec = ep_record(domain);
+
+    if(!rec) {
+        return 0;
+    }
+
+    rec->pending = 0;
+    ep_try_advance(domain);
+    return ep_reclaim(domain, rec);
+}
+
+
+size_t PML_APINAME(epoch_synchronize)(PML_TYPE(EpochDomain) *domain) {
+
+    domain = ep_domain(domain);
+    EpRecord *rec = ep_record(domain);
+
+    if(!rec) {
+        return 0;
+    }
+
+    PML_ASSERT(!rec->depth);
+
+    uint64_t target = pml_LOAD_ACQ(&domain->epoch) + 2;
+
+    while(pml_LOAD_ACQ(&domain->epoch) < target) {
+        ep_try_advance(domain);
+
+        if(pml_LOAD_ACQ(&domain->epoch) < target) {
+            sched_yield();
+        }
+    }
+
+    rec->pending = 0;
+    return ep_reclaim(domain, rec);
+}
@@ -0,0 +1,148 @@
+#ifndef PML_EPOCH_H
+#define PML_EPOCH_H
+
+/** \file pml/epoch.h
+ *  Epoch-based reclamation, for deferred freeing under lock-free readers.
+ *
+ *  A block unlinked from a shared structure can't be freed while a reader
+ *  might still be looking at it. Instead, it is retired, and freed (through the
+ *  normal PML free hook) once every thread registered with the domain has
+ *  passed a quiescent point - i.e. has been outside a read-side section since
+ *  the block was retired:
+ *
+ *      // reader
+ *      pml_epoch_enter(0);
+ *      for(Node *n = load_acquire(&list->head); n; n = ...) { ... }
+ *      pml_epoch_exit(0);
+ *
+ *      // writer
+ *      Node *old = unlink(list, key);
+ *      pml_retire(old, alloc);
+ *
+ *  Threads register with a domain the first time they use it, and deregister
+ *  when they exit. Entering and exiting a read-side section is a relaxed load
+ *  and a store (sections can be nested). The cost of ordering them is paid by
+ *  the reclaiming side where the OS allows it (membarrier() on Linux); otherwise
+ *  entering also costs a full fence.
+ *
+ *  Retired blocks are kept in per-thread lists, one for each of the last three
+ *  epochs, and every PML_EPOCH_BATCH retires the thread tries to advance the
+ *  domain's epoch and frees the lists which have become safe. A thread which
+ *  exits with blocks still pending hands them on to the next thread to
+ *  register.
+ *
+ *  The default domain (passed as 0) is always available; others can be created
+ *  to keep unrelated structures from holding each other's epochs back.
+ */
+
+#include "pml/malloc.h"
+
+/** Number of retires between attempts to reclaim. */
+#define PML_EPOCH_BATCH 64
+
+/** Maximum number of domains in existence at once (including the default). */
+#define PML_EPOCH_DOMAINS 16
+
+
+PML_BEGIN_NAMESPACE
+PML_FORWARD_STRUCT(EpochDomain);
+PML_END_NAMESPACE
+
+
+/*----------------------------------------------------------------------------*/
+/* Domains */
+
+/** Create a domain. Returns 0 if PML_EPOCH_DOMAINS are already in use.
+ */
+PML_API(PML_Q_TYPE(EpochDomain)*, epoch_create)();
+
+/** Free everything still retired in domain, and destroy it. No thread may be
+ *  using the domain (the default domain can't be destroyed).
+ */
+PML_API(void, epoch_destroy)(PML_Q_TYPE(EpochDomain) *domain);
+
+
+/*----------------------------------------------------------------------------*/
+/* Read-side sections */
+
+PML_API(void, epoch_enter)(PML_Q_TYPE(EpochDomain) *domain PML_DEFAULT(0));
+PML_API(void, epoch_exit)(PML_Q_TYPE(EpochDomain) *domain PML_DEFAULT(0));
+
+
+/*----------------------------------------------------------------------------*/
+/* Retiring */
+
+/** Free ptr through alloc once no reader in domain can still hold it. Returns
+ *  false (and ptr isn't freed) if there's no memory to record it. A null alloc
+ *  is resolved when ptr is retired (to the scoped allocator, if one is set).
+ */
+PML_API(bool, epoch_retire)(PML_Q_TYPE(EpochDomain) *domain, void *ptr,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+/** epoch_retire() in the default domain. */
+PML_API(bool, retire)(void *ptr,
+    PML_Q_TYPE(Allocator) *alloc PML_DEFAULT(0), PML_Q_TYPE(Hint) hint PML_DEFAULT(0));
+
+/** Try to advance the domain's epoch, and free whatever the calling thread has
+ *  retired which is now safe. Returns the number of blocks freed.
+ */
+PML_API(size_t, epoch_collect)(PML_Q_TYPE(EpochDomain) *domain PML_DEFAULT(0));
+
+/** Wait until every block the calling thread has retired in domain can be
+ *  freed, and free them. Returns the number of blocks freed. This must not be
+ *  called from inside a read-side section (of this domain).
+ */
+PML_API(size_t, epoch_synchronize)(PML_Q_TYPE(EpochDomain) *domain PML_DEFAULT(0));
+
+
+#ifdef __cplusplus
+
+inline bool PML_APINAME(retire)(void *ptr, PML_Q_TYPE(Hint) hint) {
+    return PML_CALL(retire)(ptr, 0, hint);
+}
+
+
+PML_BEGIN_NAMESPACE
+/** Read-side section for the lifetime of a scope.
+ */
+struct EpochGuard {
+
+    explicit EpochGuard(EpochDomain *domain = 0): m_domain(domain) {
+        PML_CALL(epoch_enter)(m_domain);
+    }
+
+    ~EpochGuard() {
+        PML_CALL(epoch_exit)(m_domain);
+    }
+
+private:
+    EpochDomain *m_domain;
+
+    EpochGuard(const EpochGuard&);
+    EpochGuard &operator=(const EpochGuard&);
+};
+PML_END_NAMESPACE
+
+#else/*__cplusplus*/
+
+#ifdef PML_HAS_C99
+/** Variadic macro version of pml_retire() (see pml_free()). */
+#define pml_retire(...) \
+    pml_VA_EXPAND(pml_retire, __VA_ARGS__)
+
+#define pml_retire_1(PTR_) pml_retire(PTR_, 0, 0)
+#define pml_retire_3(PTR_, ALLOC_, HINT_) pml_retire(PTR_, ALLOC_, HINT_)
+
+#ifdef PML_HAS_C11
+#define pml_retire_2(PTR_, ARG_) _Generic((ARG_), \
+    PmlAllocator*: pml_retire(PTR_, ARG_, 0), \
+    default: pml_retire(PTR_, 0, ARG_))
+#else/*PML_HAS_C11*/
+#define pml_retire_2(PTR_, ALLOC_) pml_retire(PTR_, ALLOC_, 0)
+#endif/*PML_HAS_C11*/
+#endif/*PML_HAS_C99*/
+
+#endif/*__cplusplus*/
+
+
+#endif/*PML_EPOCH_H*/
@@ -1,10 +1,245 @@
 #include "pml/malloc.h"
+#include "pml/profile.h"
+#include "pml/sys_impl.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <memory.h>
 #include <assert.h>
+#ifdef __GLIBC__
+#include <malloc.h> /* for malloc_usable_size() */
+#endif/*__GLIBC__*/
+
+/*----------------------------------------------------------------------------*/
+/* Mapped blocks */
+
+/* Blocks from the default hooks at or above the mmap threshold get a mapping of
+ * their own. The user pointer follows a PmlMapHeader (at an aligned offset into
+ * the first page), and is registered in a page map, so free() can tell them
+ * apart from malloc() blocks. The map is a two-level radix tree over 64k
+ * chunks: every mapping is bigger than a chunk, so no two user pointers share
+ * one, and each entry holds the exact offset of the pointer in its chunk (a
+ * malloc() block in the same chunk never matches).
+ */
+
+static size_t s_pml_mmap_threshold = PML_MMAP_THRESHOLD;
+
+#if defined(__linux__) && defined(__GLIBC__)
+#define pml_MMAP_
+
+enum {
+    PML_MAP_SHIFT = 16,
+    PML_MAP_BITS = 16,
+    PML_MAP_SIZE = 1 << PML_MAP_BITS,
+    PML_MAP_PAGE = 4096,
+};
+
+
+typedef struct PmlMapHeader {
+
+    size_t bytes; /* size of the mapping */
+    size_t offset; /* from the start of the mapping to the user pointer */
+
+} PmlMapHeader;
+
+
+static uint16_t *s_pml_map[PML_MAP_SIZE];
+static pml_Mutex s_pml_map_lock = pml_MUTEX_INIT;
+
+
+#define pml_MAP_HEADER(PTR_) ((PmlMapHeader*)(PTR_) - 1)
+
+
+/* The page map entry for ptr, if it's a mapped block. */
+static inline uint16_t pml_map_entry_(const void *ptr) {
+
+    return (uint16_t)((((uintptr_t)ptr & ((1 << PML_MAP_SHIFT) - 1)) >> 4) + 1);
+}
+
+
+static inline bool pml_mapped_(const void *ptr) {
+
+    uint64_t chunk = (uintptr_t)ptr >> PML_MAP_SHIFT;
+
+    if(chunk >> (2 * PML_MAP_BITS)) {
+        return false;
+    }
+
+    uint16_t *leaf = pml_LOAD(&s_pml_map[chunk >> PML_MAP_BITS]);
+    return leaf && pml_LOAD(&leaf[chunk & (PML_MAP_SIZE - 1)]) == pml_map_entry_(ptr);
+}
+
+
+/* Register (or unregister) ptr in the page map.
+ * (Call with s_pml_map_lock held.)
+ */
+static bool pml_map_set_(const void *ptr, bool mapped) {
+
+    uint64_t chunk = (uintptr_t)ptr >> PML_MAP_SHIFT;
+
+    if(chunk >> (2 * PML_MAP_BITS)) {
+        return false;
+    }
+
+    uint16_t **slot = &s_pml_map[chunk >> PML_MAP_BITS];
+    uint16_t *leaf = *slot;
+
+    if(!leaf) {
+        leaf = (uint16_t*)pml_os_map(PML_MAP_SIZE * sizeof(uint16_t), PML_MAP_PAGE);
+        if(!leaf) {
+            return false;
+        }
+        pml_STORE_REL(slot, leaf);
+    }
+
+    pml_STORE(&leaf[chunk & (PML_MAP_SIZE - 1)],
+        (uint16_t)(mapped ? pml_map_entry_(ptr) : 0));
+    return true;
+}
+
+
+static inline bool pml_map_wanted_(size_t size) {
+
+    return size >= pml_LOAD(&s_pml_mmap_threshold);
+}
+
+
+/* Map a block of size bytes, aligned to align (up to the page size). The pages
+ * are fresh from the kernel, so already zeroed.
+ */
+static void *pml_map_alloc_(size_t size, size_t align) {
+
+    size_t offset = align > sizeof(PmlMapHeader) ? align : sizeof(PmlMapHeader);
+    size_t bytes = pml_ALIGN_UP(size + offset, PML_MAP_PAGE);
+
+    if(bytes < size) {
+        return 0; /* overflow */
+    }
+
+    char *base = (char*)mmap(0, bytes,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(MAP_FAILED == (void*)base) {
+        return 0;
+    }
+
+    char *ptr = base + offset;
+    pml_MAP_HEADER(ptr)->bytes = bytes;
+    pml_MAP_HEADER(ptr)->offset = offset;
+
+    pml_LOCK(&s_pml_map_lock);
+    bool registered = pml_map_set_(ptr, true);
+    pml_UNLOCK(&s_pml_map_lock);
+
+    if(!registered) {
+        munmap(base, bytes);
+        return 0;
+    }
+
+    return ptr;
+}
+
+
+static void pml_map_free_(void *ptr) {
+
+    PmlMapHeader header = *pml_MAP_HEADER(ptr);
+
+    /* (unregistered first, as the range may be reused as soon as it's unmapped) */
+    pml_LOCK(&s_pml_map_lock);
+    pml_map_set_(ptr, false);
+    pml_UNLOCK(&s_pml_map_lock);
+
+    munmap((char*)ptr - header.offset, header.bytes);
+}
+
+
+static inline size_t pml_map_usable_(void *ptr) {
+
+    return pml_MAP_HEADER(ptr)->bytes - pml_MAP_HEADER(ptr)->offset;
+}
+
+
+/* Resize a mapped block with mremap() - in place, or (with MREMAP_MAYMOVE) by
+ * moving its pages, never by copying. Returns the (possibly moved) block, or 0
+ * if it couldn't be resized (in which case ptr is unchanged).
+ */
+static void *pml_map_resize_(void *ptr, size_t size, int flags) {
+
+    PmlMapHeader header = *pml_MAP_HEADER(ptr);
+    size_t bytes = pml_ALIGN_UP(size + header.offset, PML_MAP_PAGE);
+
+    if(bytes < size) {
+        return 0; /* overflow */
+    }
+
+    if(bytes == header.bytes) {
+        return ptr;
+    }
+
+    /* The lock is held across mremap(), so a range it releases can't be
+     * registered by another thread before we unregister it. */
+    pml_LOCK(&s_pml_map_lock);
+
+    char *base = (char*)mremap(
+        (char*)ptr - header.offset, header.bytes, bytes, flags);
+    char *out = 0;
+
+    if(MAP_FAILED != (void*)base) {
+        out = base + header.offset;
+        pml_MAP_HEADER(out)->bytes = bytes;
+
+        if(out != ptr) {
+            pml_map_set_(ptr, false);
+
+            if(!pml_map_set_(out, true)) {
+                /* (we can't lose the block, so move it back to the heap) */
+                void *heap = malloc(size);
+                if(heap) {
+                    memcpy(heap, out, size);
+                }
+                munmap(base, bytes);
+                out = heap;
+            }
+        }
+    }
+
+    pml_UNLOCK(&s_pml_map_lock);
+
+    return out;
+}
+
+#endif/*__linux__ && __GLIBC__*/
+
+
+void PML_APINAME(set_mmap_threshold)(size_t size) {
+
+    if(!size) {
+        size = SIZE_MAX;
+    } else if(size < PML_MMAP_MIN) {
+        size = PML_MMAP_MIN;
+    }
+
+    pml_STORE(&s_pml_mmap_threshold, size);
+}
+
+
+size_t PML_APINAME(get_mmap_threshold)() {
+
+    size_t size = pml_LOAD(&s_pml_mmap_threshold);
+    return SIZE_MAX == size ? 0 : size;
+}
+
+
+bool PML_APINAME(is_mapped_)(const void *ptr) {
+
+#ifdef pml_MMAP_
+    return ptr && pml_mapped_(ptr);
+#else/*pml_MMAP_*/
+    return false;
+#endif/*pml_MMAP_*/
+}
+
 
 /*----------------------------------------------------------------------------*/
 /* Default malloc/free impls */
@@ -23,6 +258,12 @@ static void pml_assert_(const PmlAssertHookInfo *info) {
 static void *pml_malloc_(size_t size,
     PML_TYPE(Allocator) *a, PML_TYPE(Hint) h) {
 
+#ifdef pml_MMAP_
+    if(pml_map_wanted_(size)) {
+        return pml_map_alloc_(size, 0);
+    }
+#endif/*pml_MMAP_*/
+
     return malloc(size);
 }
 
@@ -30,94 +271,448 @@ static void *pml_malloc_(size_t size,
 static void pml_free_(void *ptr,
     PML_TYPE(Allocator) *a, PML_TYPE(Hint) h) {
 
+#ifdef pml_MMAP_
+    if(pml_mapped_(ptr)) {
+        pml_map_free_(ptr);
+        return;
+    }
+#endif/*pml_MMAP_*/
+
     free(ptr);
 }
 
 
+/* Mapped blocks don't need zeroing. */
 static void *pml_calloc_(size_t count, size_t size,
     PML_TYPE(Allocator) *a, PML_TYPE(Hint) h) {
 
+#ifdef pml_MMAP_
+    size_t bytes = count * size;
+
+    if((!size || bytes / size == count) && pml_map_wanted_(bytes)) {
+        return pml_map_alloc_(bytes, 0);
+    }
+#endif/*pml_MMAP_*/
+
     return calloc(count, size);
 }
 
 
+/* Mapped blocks are resized with mremap(), and a heap block which grows past
+ * the threshold is copied into a mapping (once). A mapped block which shrinks
+ * below the threshold moves back to the heap.
+ */
 static void *pml_realloc_(void *ptr, size_t size,
     PML_TYPE(Allocator) *a, PML_TYPE(Hint) h) {
 
+#ifdef pml_MMAP_
+    if(pml_mapped_(ptr)) {
+        if(!size) {
+            pml_map_free_(ptr);
+            return 0;
+        }
+
+        if(pml_map_wanted_(size)) {
+            return pml_map_resize_(ptr, size, MREMAP_MAYMOVE);
+        }
+
+        void *out = malloc(size);
+        if(out) {
+            memcpy(out, ptr, size); /* (size is below the mapped size) */
+            pml_map_free_(ptr);
+        }
+        return out;
+    }
+
+    if(ptr && pml_map_wanted_(size)) {
+        void *out = pml_map_alloc_(size, 0);
+        if(out) {
+            size_t old = malloc_usable_size(ptr);
+            memcpy(out, ptr, old < size ? old : size);
+            free(ptr);
+        }
+        return out;
+    }
+#endif/*pml_MMAP_*/
+
     return realloc(ptr, size);
 }
 
 
+#ifndef _WIN32
+static void *pml_aligned_malloc_(size_t align, size_t size,
+    PML_TYPE(Allocator) *a, PML_TYPE(Hint) h) {
+
+    void *ptr = 0;
+
+#ifdef pml_MMAP_
+    if(align <= PML_MAP_PAGE && pml_map_wanted_(size)) {
+        return pml_map_alloc_(size, align);
+    }
+#endif/*pml_MMAP_*/
+
+    /* posix_memalign() needs at least pointer alignment */
+    if(align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+
+    return posix_memalign(&ptr, align, size) ? 0 : ptr;
+}
+#else/*_WIN32*/
+/* (emulated with malloc()/free(), so blocks can be freed the same way) */
+#define pml_aligned_malloc_ 0
+#endif/*_WIN32*/
+
+
+#ifdef __GLIBC__
+static size_t pml_usable_size_(void *ptr,
+    PML_TYPE(Allocator) *a, PML_TYPE(Hint) h) {
+
+#ifdef pml_MMAP_
+    if(pml_mapped_(ptr)) {
+        return pml_map_usable_(ptr);
+    }
+#endif/*pml_MMAP_*/
+
+    return malloc_usable_size(ptr);
+}
+
+
+/* glibc can't resize in place on request, but the block may have room. A
+ * mapped block can grow in place if the pages after it are free. */
+static bool pml_try_expand_(void *ptr, size_t size,
+    PML_TYPE(Allocator) *a, PML_TYPE(Hint) h) {
+
+#ifdef pml_MMAP_
+    if(pml_mapped_(ptr)) {
+        return size <= pml_map_usable_(ptr) || 0 != pml_map_resize_(ptr, size, 0);
+    }
+#endif/*pml_MMAP_*/
+
+    return size <= malloc_usable_size(ptr);
+}
+#else/*__GLIBC__*/
+#define pml_usable_size_ 0
+#define pml_try_expand_ 0
+#endif/*__GLIBC__*/
+
+
 /*----------------------------------------------------------------------------*/
 /* Hooks */
 
-static PML_TYPE(MallocHook) s_pml_malloc_hook = pml_malloc_;
-static PML_TYPE(FreeHook) s_pml_free_hook = pml_free_;
-static PML_TYPE(CallocHook) s_pml_calloc_hook = pml_calloc_;
-static PML_TYPE(ReallocHook) s_pml_realloc_hook = pml_realloc_;
-static PML_TYPE(DebugHook) s_pml_debug_hook = 0;
+/* The hooks are published as a single table pointer, so each call makes one
+ * (acquire) load to find its hooks, and the setters never race with callers.
+ * Superseded tables are not reclaimed, as another thread may still be reading
+ * from them - they are small, and hooks are not expected to change often.
+ */
+
+#define PML_TABLE_PAGE 4096
+
+static const PML_TYPE(HookTable) s_pml_default_hooks = {
+    /* posix_memalign() blocks are freed with free(), so no aligned_free */
+    { pml_malloc_, pml_free_, pml_calloc_, pml_realloc_, 0, pml_aligned_malloc_, 0,
+      pml_usable_size_, pml_try_expand_, 0, 0 },
+    0,
 #ifdef PML_ASSERT_HOOK_S
-static PML_TYPE(AssertHook) s_pml_assert_hook = pml_assert_;
-#endif//PML_ASSERT_HOOK_S
+    pml_assert_,
+#else/*PML_ASSERT_HOOK_S*/
+    0,
+#endif/*PML_ASSERT_HOOK_S*/
+};
 
+static const PML_TYPE(HookTable) *s_pml_hooks = &s_pml_default_hooks;
+static pml_Mutex s_pml_hooks_lock = pml_MUTEX_INIT;
 
-bool PML_APINAME(set_debug_hook)(PML_TYPE(DebugHook) hook) {
+/* Per-thread override (if s_pml_thread_hooks is set, it points at the copy). */
+static pml_TLS PML_TYPE(HookTable) s_pml_thread_table;
+static pml_TLS const PML_TYPE(HookTable) *s_pml_thread_hooks;
+
+/* Debug events requested by set_debug_events(), and the number of threads
+ * with a debug hook in their override table (guarded by s_pml_hooks_lock).
+ */
+static unsigned s_pml_debug_mask = PML_DEBUG_EVENTS_ALL;
+static size_t s_pml_debug_threads;
+
+unsigned PML_APINAME(debug_events_);
+
+
+/* The hook table in effect for the calling thread. */
+static inline const PML_TYPE(HookTable) *pml_hooks_() {
+
+    const PML_TYPE(HookTable) *table = s_pml_thread_hooks;
+    return table ? table : pml_LOAD_ACQ(&s_pml_hooks);
+}
+
+
+/* Copy table into out, filling in any missing allocation hooks. */
+static void pml_copy_hooks_(PML_TYPE(HookTable) *out,
+    const PML_TYPE(HookTable) *table) {
+
+    *out = table ? *table : s_pml_default_hooks;
+
+    if(!out->hooks.malloc) { out->hooks.malloc = pml_malloc_; }
+    if(!out->hooks.free) { out->hooks.free = pml_free_; }
+    if(!out->hooks.calloc) { out->hooks.calloc = pml_calloc_; }
+    if(!out->hooks.realloc) { out->hooks.realloc = pml_realloc_; }
+}
+
+
+/* Recompute the debug event mask, which is empty unless some thread can see a
+ * debug hook. Call with s_pml_hooks_lock held.
+ */
+static void pml_update_debug_events_() {
+
+    bool listening = s_pml_hooks->debug_hook || s_pml_debug_threads;
+    pml_STORE(&PML_APINAME(debug_events_), listening ? s_pml_debug_mask : 0);
+}
+
+
+/* Publish a copy of table as the global hooks. Call with s_pml_hooks_lock
+ * held. Tables are carved from pages mapped directly from the OS, as the
+ * allocation hooks themselves are what's being replaced.
+ */
+static bool pml_publish_hooks_(const PML_TYPE(HookTable) *table) {
+
+    static char *s_page;
+    static char *s_page_end;
+
+    size_t size = pml_ALIGN_UP(sizeof(PML_TYPE(HookTable)), sizeof(void*));
+
+    if((size_t)(s_page_end - s_page) < size) {
+        s_page = (char*)pml_os_map(PML_TABLE_PAGE, PML_TABLE_PAGE);
+        if(!s_page) {
+            s_page_end = 0;
+            return false;
+        }
+        s_page_end = s_page + PML_TABLE_PAGE;
+    }
+
+    PML_TYPE(HookTable) *out = (PML_TYPE(HookTable)*)s_page;
+    s_page += size;
+
+    pml_copy_hooks_(out, table);
+    pml_STORE_REL(&s_pml_hooks, out);
+    pml_update_debug_events_();
 
-    s_pml_debug_hook = hook;
     return true;
 }
 
 
+bool PML_APINAME(set_hooks)(const PML_TYPE(HookTable) *table) {
+
+    pml_LOCK(&s_pml_hooks_lock);
+    bool result = pml_publish_hooks_(table);
+    pml_UNLOCK(&s_pml_hooks_lock);
+
+    return result;
+}
+
+
+void PML_APINAME(get_hooks)(PML_TYPE(HookTable) *table) {
+
+    PML_ASSERT(table);
+    *table = *pml_LOAD_ACQ(&s_pml_hooks);
+}
+
+
+bool PML_APINAME(set_thread_hooks)(const PML_TYPE(HookTable) *table) {
+
+    bool was_listening = s_pml_thread_hooks && s_pml_thread_table.debug_hook;
+    bool listening = table && table->debug_hook;
+
+    if(listening != was_listening) {
+        pml_LOCK(&s_pml_hooks_lock);
+        s_pml_debug_threads += listening ? 1 : (size_t)-1;
+        pml_update_debug_events_();
+        pml_UNLOCK(&s_pml_hooks_lock);
+    }
+
+    if(table) {
+        pml_copy_hooks_(&s_pml_thread_table, table);
+        s_pml_thread_hooks = &s_pml_thread_table;
+    } else {
+        s_pml_thread_hooks = 0;
+    }
+    return true;
+}
+
+
+/* The single-hook setters modify a copy of the current table, and publish it.
+ * (A null allocation hook restores the default.) Replacing malloc or free also
+ * drops the optional hooks, which belong with the old pair.
+ */
+#define pml_SET_HOOK_(FIELD_, HOOK_, CLEAR_OPTIONAL_) \
+    PML_TYPE(HookTable) table; \
+    pml_LOCK(&s_pml_hooks_lock); \
+    table = *s_pml_hooks; \
+    table.FIELD_ = HOOK_; \
+    if(CLEAR_OPTIONAL_) { \
+        table.hooks.free_sized = 0; \
+        table.hooks.aligned_malloc = 0; \
+        table.hooks.aligned_free = 0; \
+        table.hooks.usable_size = 0; \
+        table.hooks.try_expand = 0; \
+        table.hooks.malloc_batch = 0; \
+        table.hooks.free_batch = 0; \
+    } \
+    bool result = pml_publish_hooks_(&table); \
+    pml_UNLOCK(&s_pml_hooks_lock); \
+    return result
+
+
+bool PML_APINAME(set_debug_hook)(PML_TYPE(DebugHook) hook) {
+
+    pml_SET_HOOK_(debug_hook, hook, false);
+}
+
+
+void PML_APINAME(set_debug_events)(unsigned mask) {
+
+    pml_LOCK(&s_pml_hooks_lock);
+    s_pml_debug_mask = mask;
+    pml_update_debug_events_();
+    pml_UNLOCK(&s_pml_hooks_lock);
+}
+
+
+unsigned PML_APINAME(get_debug_events)() {
+
+    return pml_LOAD(&s_pml_debug_mask);
+}
+
+
 bool PML_APINAME(set_assert_hook)(PML_TYPE(AssertHook) hook) {
 
 #ifdef PML_ASSERT_HOOK_S
-    s_pml_assert_hook = hook;
-#endif//PML_ASSERT_HOOK_S
+    pml_SET_HOOK_(assert_hook, hook, false);
+#else//PML_ASSERT_HOOK_S
     return true;
+#endif//PML_ASSERT_HOOK_S
 }
 
 
 bool PML_APINAME(set_malloc_hook)(PML_TYPE(MallocHook) hook) {
 
-    if(!hook) {
-        hook = pml_malloc_;
-    }
-    PML_ASSERT(hook);
-    s_pml_malloc_hook = hook;
-    return true;
+    pml_SET_HOOK_(hooks.malloc, hook, true);
 }
 
 
 bool PML_APINAME(set_free_hook)(PML_TYPE(FreeHook) hook) {
 
-    if(!hook) {
-        hook = pml_free_;
-    }
-    PML_ASSERT(hook);
-    s_pml_free_hook = hook;
-    return true;
+    pml_SET_HOOK_(hooks.free, hook, true);
 }
 
 
 bool PML_APINAME(set_calloc_hook)(PML_TYPE(CallocHook) hook) {
 
-    if(!hook) {
-        hook = pml_calloc_;
-    }
-    PML_ASSERT(hook);
-    s_pml_calloc_hook = hook;
-    return true;
+    pml_SET_HOOK_(hooks.calloc, hook, false);
 }
 
 
 bool PML_APINAME(set_realloc_hook)(PML_TYPE(ReallocHook) hook) {
 
-    if(!hook) {
-        hook = pml_realloc_;
+    pml_SET_HOOK_(hooks.realloc, hook, false);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Heap profiler sampling */
+
+/* Only blocks from the global hooks are sampled - blocks from an explicit
+ * allocator (an arena, say) may never be passed to free(). While the profiler
+ * is stopped this costs one relaxed load per call.
+ */
+
+/* Bytes until this thread takes its next sample. */
+static pml_TLS int64_t s_pml_sample_countdown;
+
+
+static inline void pml_sample_(void *ptr, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if( ptr && !alloc && pml_LOAD(&pml_profile_rate_) &&
+        (s_pml_sample_countdown -= (int64_t)size) < 0 ) {
+
+        s_pml_sample_countdown = PML_CALL(profile_sample_)(ptr, size, hint);
+    }
+}
+
+
+static inline void pml_unsample_(void *ptr, PML_TYPE(Allocator) *alloc) {
+
+    if(ptr && !alloc && pml_LOAD(&pml_profile_live_)) {
+        PML_CALL(profile_forget_)(ptr);
     }
-    PML_ASSERT(hook);
-    s_pml_realloc_hook = hook;
-    return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Hint ids */
+
+/* Callsites registered at runtime follow the linker's table. */
+static const char *s_pml_hint_names[PML_HINT_IDS];
+static size_t s_pml_hint_names_count;
+static pml_Mutex s_pml_hint_lock = pml_MUTEX_INIT;
+
+
+static inline size_t pml_hint_sites_() {
+
+#if defined(__GNUC__) && defined(__ELF__)
+    return (size_t)(__stop_pml_hints - __start_pml_hints);
+#else/*__GNUC__ && __ELF__*/
+    return 0;
+#endif/*__GNUC__ && __ELF__*/
+}
+
+
+size_t PML_APINAME(hint_count)() {
+
+    return pml_hint_sites_() + pml_LOAD_ACQ(&s_pml_hint_names_count);
+}
+
+
+size_t PML_APINAME(hint_id)(PML_TYPE(Hint) hint) {
+
+    size_t id = (size_t)hint;
+    return id <= PML_CALL(hint_count)() ? id : 0;
+}
+
+
+const char *PML_APINAME(hint_name)(PML_TYPE(Hint) hint) {
+
+    size_t id = PML_CALL(hint_id)(hint);
+    size_t sites = pml_hint_sites_();
+
+    if(!id) {
+        return hint;
+    }
+
+#if defined(__GNUC__) && defined(__ELF__)
+    if(id <= sites) {
+        return __start_pml_hints[id - 1].name;
+    }
+#endif/*__GNUC__ && __ELF__*/
+
+    return s_pml_hint_names[id - sites - 1];
+}
+
+
+PML_TYPE(Hint) PML_APINAME(hint_register_)(const char *name) {
+
+    PML_TYPE(Hint) hint = name;
+
+    pml_LOCK(&s_pml_hint_lock);
+    size_t count = s_pml_hint_names_count;
+
+    if(count < PML_HINT_IDS) {
+        s_pml_hint_names[count] = name;
+        pml_STORE_REL(&s_pml_hint_names_count, count + 1);
+        hint = (PML_TYPE(Hint))(pml_hint_sites_() + count + 1);
+    }
+
+    pml_UNLOCK(&s_pml_hint_lock);
+
+    return hint;
 }
 
 
@@ -129,7 +724,9 @@ void PML_APINAME(debug_hook)(PML_TYPE(DebugHookType) type,
     size_t count, size_t size, void *ptr, void *in,
     PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
 
-    if(s_pml_debug_hook) {
+    PML_TYPE(DebugHook) debug_hook = pml_hooks_()->debug_hook;
+
+    if(debug_hook) {
         PML_TYPE(DebugHookInfo) info;
         info.type = type;
         info.count = count;
@@ -138,7 +735,7 @@ void PML_APINAME(debug_hook)(PML_TYPE(DebugHookType) type,
         info.in = in;
         info.alloc = alloc;
         info.hint = hint;
-        s_pml_debug_hook(&info);
+        debug_hook(&info);
     }
 }
 #endif/*PML_DEBUG_HOOK_S*/
@@ -151,29 +748,115 @@ void PML_APINAME(debug_hook)(PML_TYPE(DebugHookType) type,
 void PML_APINAME(assert_hook)(bool test, const char *expr,
     const char *file, size_t line) {
 
+    PML_TYPE(AssertHook) assert_hook;
+
     if( !test &&
-        s_pml_assert_hook ) {
+        (assert_hook = pml_hooks_()->assert_hook) ) {
 
         PML_TYPE(AssertHookInfo) info;
         info.expr = expr;
         info.file = file;
         info.line = line;
-        s_pml_assert_hook(&info);
+        assert_hook(&info);
     }
 }
 #endif/*PML_ASSERT_HOOK_S*/
 
 
+/*----------------------------------------------------------------------------*/
+/* Scoped allocators */
+
+/* The calling thread's scoped allocator, which calls with a null alloc use in
+ * place of the global hooks. Earlier scopes are kept by whoever set this one
+ * (see ScopedAllocator), so resolving alloc is a single TLS load.
+ */
+static pml_TLS PML_TYPE(Allocator) *s_pml_scoped;
+
+/* global_allocator() forwards to the global hooks, and is never replaced by the
+ * scoped allocator. */
+static void *pml_global_malloc_(size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    return pml_hooks_()->hooks.malloc(size, 0, hint);
+}
+
+
+static void pml_global_free_(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    pml_hooks_()->hooks.free(ptr, 0, hint);
+}
+
+
+static void *pml_global_calloc_(size_t count, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    return pml_hooks_()->hooks.calloc(count, size, 0, hint);
+}
+
+
+static void *pml_global_realloc_(void *ptr, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    return pml_hooks_()->hooks.realloc(ptr, size, 0, hint);
+}
+
+
+static PML_TYPE(Allocator) s_pml_global_allocator = {
+    pml_global_malloc_, pml_global_free_, pml_global_calloc_, pml_global_realloc_,
+    0, 0, 0, 0, 0, 0, 0,
+};
+
+
+/* The allocator a call with alloc should use (0 for the global hooks). */
+static inline PML_TYPE(Allocator) *pml_scope_(PML_TYPE(Allocator) *alloc) {
+
+    if(!alloc) {
+        return s_pml_scoped;
+    }
+
+    return alloc != &s_pml_global_allocator ? alloc : 0;
+}
+
+
+PML_TYPE(Allocator) *PML_APINAME(set_scoped_allocator)(PML_TYPE(Allocator) *alloc) {
+
+    PML_TYPE(Allocator) *previous = s_pml_scoped;
+    s_pml_scoped = (alloc != &s_pml_global_allocator) ? alloc : 0;
+    return previous;
+}
+
+
+PML_TYPE(Allocator) *PML_APINAME(get_scoped_allocator)() {
+
+    return s_pml_scoped;
+}
+
+
+PML_TYPE(Allocator) *PML_APINAME(global_allocator)() {
+
+    return &s_pml_global_allocator;
+}
+
+
+const PML_TYPE(Allocator) *PML_APINAME(default_allocator_)() {
+
+    return &s_pml_default_hooks.hooks;
+}
+
+
 /*----------------------------------------------------------------------------*/
 /* malloc() */
 
 void *PML_APINAME(malloc)(size_t size,
     PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
 
-    PML_TYPE(MallocHook) hook = alloc ? alloc->malloc : s_pml_malloc_hook;
+    alloc = pml_scope_(alloc);
+    PML_TYPE(MallocHook) hook = alloc ? alloc->malloc : pml_hooks_()->hooks.malloc;
     PML_ASSERT(hook);
 
     void *ptr = hook(size, alloc, hint);
+    pml_sample_(ptr, size, alloc, hint);
     PML_DEBUG_HOOK(MALLOC, 0, size, ptr, 0, alloc, hint);
 
     return ptr;
@@ -186,24 +869,177 @@ void *PML_APINAME(malloc)(size_t size,
 void PML_APINAME(free)(void *ptr,
     PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
 
-    PML_TYPE(FreeHook) hook = alloc ? alloc->free : s_pml_free_hook;
+    alloc = pml_scope_(alloc);
+    PML_TYPE(FreeHook) hook = alloc ? alloc->free : pml_hooks_()->hooks.free;
     PML_ASSERT(hook);
 
+    pml_unsample_(ptr, alloc);
     hook(ptr, alloc, hint);
     PML_DEBUG_HOOK(FREE, 0, 0, ptr, 0, alloc, hint);
 }
 
 
+/*----------------------------------------------------------------------------*/
+/* free_sized() */
+
+void PML_APINAME(free_sized)(void *ptr, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    alloc = pml_scope_(alloc);
+    const PML_TYPE(Allocator) *hooks = alloc ? alloc : &pml_hooks_()->hooks;
+
+    pml_unsample_(ptr, alloc);
+
+    if(size && hooks->free_sized) {
+        hooks->free_sized(ptr, size, alloc, hint);
+    } else {
+        PML_ASSERT(hooks->free);
+        hooks->free(ptr, alloc, hint);
+    }
+
+    PML_DEBUG_HOOK(FREE, 0, size, ptr, 0, alloc, hint);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* aligned_malloc() */
+
+void *PML_APINAME(aligned_malloc)(size_t align, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    alloc = pml_scope_(alloc);
+    PML_ASSERT(align && !(align & (align - 1))); /* power of two */
+
+    PML_TYPE(AlignedMallocHook) hook =
+        alloc ? alloc->aligned_malloc : pml_hooks_()->hooks.aligned_malloc;
+
+    void *ptr = hook ?
+        hook(align, size, alloc, hint) :
+        PML_CALL(emulate_aligned_malloc)(align, size, alloc, hint);
+
+    pml_sample_(ptr, size, alloc, hint);
+    PML_DEBUG_HOOK(ALIGNED_MALLOC, align, size, ptr, 0, alloc, hint);
+
+    return ptr;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* aligned_free() */
+
+void PML_APINAME(aligned_free)(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    alloc = pml_scope_(alloc);
+    const PML_TYPE(Allocator) *hooks = alloc ? alloc : &pml_hooks_()->hooks;
+
+    pml_unsample_(ptr, alloc);
+
+    if(!hooks->aligned_malloc) {
+        PML_CALL(emulate_aligned_free)(ptr, alloc, hint);
+    } else if(hooks->aligned_free) {
+        hooks->aligned_free(ptr, alloc, hint);
+    } else {
+        PML_ASSERT(hooks->free);
+        hooks->free(ptr, alloc, hint);
+    }
+
+    PML_DEBUG_HOOK(ALIGNED_FREE, 0, 0, ptr, 0, alloc, hint);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* usable_size() */
+
+size_t PML_APINAME(usable_size)(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    alloc = pml_scope_(alloc);
+    PML_TYPE(UsableSizeHook) hook =
+        alloc ? alloc->usable_size : pml_hooks_()->hooks.usable_size;
+
+    return (ptr && hook) ? hook(ptr, alloc, hint) : 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* malloc_batch() */
+
+/* The fallbacks call the single-block hooks directly, so the debug hook sees
+ * one event for the whole batch either way.
+ */
+size_t PML_APINAME(malloc_batch)(size_t count, size_t size, void **out,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    alloc = pml_scope_(alloc);
+    const PML_TYPE(Allocator) *hooks = alloc ? alloc : &pml_hooks_()->hooks;
+    size_t done = 0;
+
+    PML_ASSERT(out || !count);
+
+    if(hooks->malloc_batch) {
+        done = hooks->malloc_batch(count, size, out, alloc, hint);
+    } else {
+        PML_ASSERT(hooks->malloc);
+        while(done < count && (out[done] = hooks->malloc(size, alloc, hint))) {
+            done++;
+        }
+    }
+
+    for(size_t i = done; i < count; i++) {
+        out[i] = 0;
+    }
+
+    for(size_t i = 0; i < done && pml_LOAD(&pml_profile_rate_); i++) {
+        pml_sample_(out[i], size, alloc, hint);
+    }
+
+    PML_DEBUG_HOOK(MALLOC_BATCH, done, size, out, 0, alloc, hint);
+
+    return done;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* free_batch() */
+
+void PML_APINAME(free_batch)(void **ptrs, size_t count,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    alloc = pml_scope_(alloc);
+    const PML_TYPE(Allocator) *hooks = alloc ? alloc : &pml_hooks_()->hooks;
+
+    PML_ASSERT(ptrs || !count);
+
+    for(size_t i = 0; i < count && pml_LOAD(&pml_profile_live_); i++) {
+        pml_unsample_(ptrs[i], alloc);
+    }
+
+    if(hooks->free_batch) {
+        hooks->free_batch(ptrs, count, alloc, hint);
+    } else {
+        PML_ASSERT(hooks->free);
+        for(size_t i = 0; i < count; i++) {
+            hooks->free(ptrs[i], alloc, hint);
+        }
+    }
+
+    PML_DEBUG_HOOK(FREE_BATCH, count, 0, 0, ptrs, alloc, hint);
+}
+
+
 /*----------------------------------------------------------------------------*/
 /* calloc() */
 
 void *PML_APINAME(calloc)(size_t count, size_t size,
     PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
 
-    PML_TYPE(CallocHook) hook = alloc ? alloc->calloc : s_pml_calloc_hook;
+    alloc = pml_scope_(alloc);
+    PML_TYPE(CallocHook) hook = alloc ? alloc->calloc : pml_hooks_()->hooks.calloc;
     PML_ASSERT(hook);
 
     void *ptr = hook(count, size, alloc, hint);
+    pml_sample_(ptr, count * size, alloc, hint);
     PML_DEBUG_HOOK(CALLOC, count, size, ptr, 0, alloc, hint);
 
     return ptr;
@@ -216,10 +1052,18 @@ void *PML_APINAME(calloc)(size_t count, size_t size,
 void *PML_APINAME(realloc)(void *ptr, size_t size,
     PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
 
-    PML_TYPE(ReallocHook) hook = alloc ? alloc->realloc : s_pml_realloc_hook;
+    alloc = pml_scope_(alloc);
+    PML_TYPE(ReallocHook) hook = alloc ? alloc->realloc : pml_hooks_()->hooks.realloc;
     PML_ASSERT(hook);
 
+    /* the old block is forgotten before the hook runs (once it has moved,
+     * another thread could be given the same address), and the result is
+     * sampled as a fresh allocation */
+    pml_unsample_(ptr, alloc);
+
     void *out = hook(ptr, size, alloc, hint);
+    pml_sample_(out, size, alloc, hint);
+
     PML_DEBUG_HOOK(REALLOC, 0, size, out, ptr, alloc, hint);
 
     return out;
@@ -229,20 +1073,28 @@ void *PML_APINAME(realloc)(void *ptr, size_t size,
 /*----------------------------------------------------------------------------*/
 /* emulate_calloc() */
 
-/** This is quite easy - malloc(count * size) then memset() to zero...
+/** This is quite easy - malloc(count * size) then memset() to zero... (unless
+ *  the block was freshly mapped by the default malloc hook).
  */
 void *PML_APINAME(emulate_calloc)(
     size_t count, size_t size,
     PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
 
-    PML_TYPE(MallocHook) hook = alloc ? alloc->malloc : s_pml_malloc_hook;
+    PML_TYPE(MallocHook) hook = alloc ? alloc->malloc : pml_hooks_()->hooks.malloc;
     PML_ASSERT(hook);
 
     size_t bytes = count * size;
     PML_ASSERT(bytes >= (uint64_t)count * size); /* or we have an overflow */
 
     void *ptr = hook(bytes, alloc, hint);
-    if(ptr) {
+    bool fresh = false;
+
+#ifdef pml_MMAP_
+    /* a mapped block from the default engine is already zeroed */
+    fresh = ptr && hook == pml_malloc_ && pml_mapped_(ptr);
+#endif/*pml_MMAP_*/
+
+    if(ptr && !fresh) {
         memset(ptr, 0, bytes);
     }
 
@@ -255,34 +1107,46 @@ void *PML_APINAME(emulate_calloc)(
 /*----------------------------------------------------------------------------*/
 /* emulate_realloc() */
 
-/** Without a portable means to query the size of an existing allocation returned
- *  from malloc(), our hands are tied - all we can do is use malloc() to create a
- *  new block, copy up to size from the old ptr, then free(ptr). We have to hope
- *  this doesn't cause an invalid read past the end of ptr, and we can't optimise
- *  shrinking the block by returning the existing ptr either. Anyone who cares
- *  strongly enough about this will provide their own realloc() implementation
- *  instead of using this one.
+/** If the allocator provides a usable_size() hook, a block which already has
+ *  room for size is returned as-is (so shrinking never moves), and a try_expand()
+ *  hook gets a chance to grow it in place. Otherwise, we use malloc() to create
+ *  a new block, copy from the old ptr, then free(ptr). With usable_size(), only
+ *  the bytes valid in both blocks are copied. Without it, there's no portable
+ *  means to query the size of the old block, so all we can do is copy up to
+ *  size and hope this doesn't cause an invalid read past the end of ptr. Anyone
+ *  who cares strongly enough about this will provide these hooks, or their own
+ *  realloc().
  */
 void *PML_APINAME(emulate_realloc)(
     void *ptr, size_t size,
     PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
 
-    PML_TYPE(MallocHook) malloc_hook = alloc ? alloc->malloc : s_pml_malloc_hook;
-    PML_TYPE(FreeHook) free_hook = alloc ? alloc->free : s_pml_free_hook;
-    PML_ASSERT(malloc_hook && free_hook);
+    const PML_TYPE(Allocator) *hooks = alloc ? alloc : &pml_hooks_()->hooks;
+    PML_ASSERT(hooks->malloc && hooks->free);
 
     void *out = 0;
+    size_t old = (ptr && hooks->usable_size) ?
+        hooks->usable_size(ptr, alloc, hint) : 0; /* 0 if unknown */
+
+    if( ptr && size > 0 &&
+        (size <= old ||
+            (hooks->try_expand && hooks->try_expand(ptr, size, alloc, hint))) ) {
+
+        PML_DEBUG_HOOK(REALLOC, 0, size, ptr, ptr, alloc, hint);
+        return ptr;
+    }
 
     if(size > 0) {
-        out = malloc_hook(size, alloc, hint);
+        out = hooks->malloc(size, alloc, hint);
     }
 
-    if(out) {
-        memcpy(out, ptr, size);
+    if(out && ptr) {
+        memcpy(out, ptr, (old && old < size) ? old : size);
     }
 
-    if(ptr && out) {
-        free_hook(ptr, alloc, hint);
+    /* (size 0 frees ptr, as with realloc()) */
+    if(ptr && (out || !size)) {
+        hooks->free(ptr, alloc, hint);
     }
 
     PML_DEBUG_HOOK(REALLOC, 0, size, out, ptr, alloc, hint);
@@ -291,4 +1155,53 @@ void *PML_APINAME(emulate_realloc)(
 }
 
 
+/*----------------------------------------------------------------------------*/
+/* emulate_aligned_malloc() */
+
+/** Over-allocate with malloc(), and keep the pointer malloc() returned just in
+ *  front of the aligned block, for emulate_aligned_free().
+ */
+void *PML_APINAME(emulate_aligned_malloc)(
+    size_t align, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    PML_TYPE(MallocHook) hook = alloc ? alloc->malloc : pml_hooks_()->hooks.malloc;
+    PML_ASSERT(hook);
+
+    if(align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+
+    size_t bytes = size + align - 1 + sizeof(void*);
+    if(bytes < size) {
+        return 0; /* overflow */
+    }
+
+    char *base = (char*)hook(bytes, alloc, hint);
+    if(!base) {
+        return 0;
+    }
+
+    void **ptr = (void**)pml_ALIGN_UP((uintptr_t)(base + sizeof(void*)), align);
+    ptr[-1] = base;
+
+    return ptr;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* emulate_aligned_free() */
+
+void PML_APINAME(emulate_aligned_free)(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    PML_TYPE(FreeHook) hook = alloc ? alloc->free : pml_hooks_()->hooks.free;
+    PML_ASSERT(hook);
+
+    if(ptr) {
+        hook(((void**)ptr)[-1], alloc, hint);
+    }
+}
+
+
 
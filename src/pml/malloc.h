@@ -27,6 +27,8 @@ typedef const char *PML_TYPE(Hint);
 PML_FORWARD_STRUCT(Allocator);
 PML_FORWARD_STRUCT(DebugHookInfo);
 PML_FORWARD_STRUCT(AssertHookInfo);
+PML_FORWARD_STRUCT(HintSite);
+PML_FORWARD_STRUCT(HookTable);
 
 
 /** Debug hook type.
@@ -44,6 +46,12 @@ PML_ENUM(DebugHookType,
     PML_VALUE(DELETE)
     PML_VALUE(NEWA)
     PML_VALUE(DELETEA)
+
+    PML_VALUE(ALIGNED_MALLOC) /* count is the alignment */
+    PML_VALUE(ALIGNED_FREE)
+
+    PML_VALUE(MALLOC_BATCH) /* ptr is the array of blocks */
+    PML_VALUE(FREE_BATCH) /* in is the array of blocks */
 );
 
 
@@ -75,6 +83,16 @@ PML_STRUCT(
 );
 
 
+/*----------------------------------------------------------------------------*/
+/* HintSite */
+
+PML_STRUCT(
+    HintSite,
+
+    const char *name; /**< Hint string, as PML_HINT() would otherwise give. */
+);
+
+
 /*----------------------------------------------------------------------------*/
 /* Hooks */
 
@@ -86,6 +104,18 @@ typedef void *(*PML_TYPE(CallocHook))(size_t c, size_t s,
     PML_TYPE(Allocator) *a, PML_TYPE(Hint) h);
 typedef void *(*PML_TYPE(ReallocHook))(void *p, size_t s,
     PML_TYPE(Allocator) *a, PML_TYPE(Hint) h);
+typedef void (*PML_TYPE(FreeSizedHook))(void *p, size_t s,
+    PML_TYPE(Allocator) *a, PML_TYPE(Hint) h);
+typedef void *(*PML_TYPE(AlignedMallocHook))(size_t al, size_t s,
+    PML_TYPE(Allocator) *a, PML_TYPE(Hint) h);
+typedef size_t (*PML_TYPE(UsableSizeHook))(void *p,
+    PML_TYPE(Allocator) *a, PML_TYPE(Hint) h);
+typedef bool (*PML_TYPE(TryExpandHook))(void *p, size_t s,
+    PML_TYPE(Allocator) *a, PML_TYPE(Hint) h);
+typedef size_t (*PML_TYPE(MallocBatchHook))(size_t c, size_t s, void **o,
+    PML_TYPE(Allocator) *a, PML_TYPE(Hint) h);
+typedef void (*PML_TYPE(FreeBatchHook))(void **p, size_t c,
+    PML_TYPE(Allocator) *a, PML_TYPE(Hint) h);
 
 typedef void (*PML_TYPE(DebugHook))(const PML_TYPE(DebugHookInfo) *i);
 typedef void (*PML_TYPE(AssertHook))(const PML_TYPE(AssertHookInfo) *i);
@@ -102,6 +132,45 @@ PML_STRUCT(
 
     PML_TYPE(CallocHook) calloc;
     PML_TYPE(ReallocHook) realloc;
+
+    /* Optional - free() with the size which was originally requested. If this
+     * is null, the free hook is called instead. */
+    PML_TYPE(FreeSizedHook) free_sized;
+
+    /* Optional - allocate with a given alignment. If this is null, aligned
+     * blocks are emulated by over-allocating with malloc(). Blocks are freed
+     * with aligned_free, or with free if that is null. */
+    PML_TYPE(AlignedMallocHook) aligned_malloc;
+    PML_TYPE(FreeHook) aligned_free;
+
+    /* Optional - the number of bytes which can be used in a block (0 if not
+     * known). */
+    PML_TYPE(UsableSizeHook) usable_size;
+
+    /* Optional - resize a block in place (growing or shrinking it), returning
+     * false if it can't be. */
+    PML_TYPE(TryExpandHook) try_expand;
+
+    /* Optional - allocate/free count blocks of the same size in one call. If
+     * these are null, malloc/free are called for each block. malloc_batch
+     * returns the number of blocks allocated (fewer than count on failure). */
+    PML_TYPE(MallocBatchHook) malloc_batch;
+    PML_TYPE(FreeBatchHook) free_batch;
+);
+
+
+/*----------------------------------------------------------------------------*/
+/* HookTable */
+
+/** The complete set of global hooks. Tables are published as a whole, so a
+ *  thread never sees a mix of hooks from two different tables.
+ */
+PML_STRUCT(
+    HookTable,
+
+    PML_TYPE(Allocator) hooks; /**< Default malloc/free/calloc/realloc. */
+    PML_TYPE(DebugHook) debug_hook; /**< Debug hook (0 for none). */
+    PML_TYPE(AssertHook) assert_hook; /**< Assert hook (0 for none). */
 );
 
 
@@ -125,6 +194,44 @@ PML_API(bool, set_free_hook)(PML_Q_TYPE(FreeHook) hook);
 PML_API(bool, set_calloc_hook)(PML_Q_TYPE(CallocHook) hook);
 PML_API(bool, set_realloc_hook)(PML_Q_TYPE(ReallocHook) hook);
 
+/** Install a complete hook table in one step. The table is copied, and any
+ *  null malloc/free/calloc/realloc entries are replaced by the defaults (a
+ *  null table restores all the defaults). Threads calling into PML
+ *  concurrently will see either the old or the new table, never a mixture.
+ */
+PML_API(bool, set_hooks)(const PML_Q_TYPE(HookTable) *table);
+
+/** Copy the global hook table into *table.
+ */
+PML_API(void, get_hooks)(PML_Q_TYPE(HookTable) *table);
+
+/** Override the global hook table for the calling thread only (a null table
+ *  removes the override). The table is copied as for set_hooks(). This doesn't
+ *  affect other threads, and takes no locks unless it adds or removes a debug
+ *  hook. (A thread which exits with a debug hook still set keeps the debug
+ *  events enabled.)
+ */
+PML_API(bool, set_thread_hooks)(const PML_Q_TYPE(HookTable) *table);
+
+/** Set the size from which the default hooks map blocks directly from the OS,
+ *  rather than calling malloc() (0 turns this off, and sizes below PML_MMAP_MIN
+ *  are raised to it). Mapped blocks are grown by remapping their pages, so
+ *  realloc() never copies them, and calloc() knows they're already zeroed.
+ *  This is only supported on Linux (with glibc), elsewhere the setting is kept
+ *  but has no effect.
+ */
+PML_API(void, set_mmap_threshold)(size_t size);
+PML_API(size_t, get_mmap_threshold)();
+
+/** Internal - true if ptr is a block which the default hooks mapped. */
+PML_API(bool, is_mapped_)(const void *ptr);
+
+/** Internal - the default hooks (which free and resize the blocks they mapped,
+ *  as well as those from the C library), for an engine to pass on blocks which
+ *  aren't its own. The hooks don't use their Allocator argument.
+ */
+PML_API(const PML_Q_TYPE(Allocator)*, default_allocator_)();
+
 
 /*----------------------------------------------------------------------------*/
 /* C memory API */
@@ -138,6 +245,61 @@ PML_API(void*, calloc)(size_t count, size_t size,
 PML_API(void*, realloc)(void *ptr, size_t size,
     PML_Q_TYPE(Allocator) *alloc PML_DEFAULT(0), PML_Q_TYPE(Hint) hint PML_DEFAULT(0));
 
+/** Free a block, passing on the size it was allocated with, so that allocators
+ *  which provide a free_sized hook don't need to look it up. A size of 0 means
+ *  "unknown", and is the same as calling free().
+ */
+PML_API(void, free_sized)(void *ptr, size_t size,
+    PML_Q_TYPE(Allocator) *alloc PML_DEFAULT(0), PML_Q_TYPE(Hint) hint PML_DEFAULT(0));
+
+/** Allocate size bytes aligned to align (a power of two). Blocks must be freed
+ *  with aligned_free().
+ */
+PML_API(void*, aligned_malloc)(size_t align, size_t size,
+    PML_Q_TYPE(Allocator) *alloc PML_DEFAULT(0), PML_Q_TYPE(Hint) hint PML_DEFAULT(0));
+PML_API(void, aligned_free)(void *ptr,
+    PML_Q_TYPE(Allocator) *alloc PML_DEFAULT(0), PML_Q_TYPE(Hint) hint PML_DEFAULT(0));
+
+/** The number of bytes which can be used in the block at ptr (at least the size
+ *  requested), or 0 if the allocator can't tell.
+ */
+PML_API(size_t, usable_size)(void *ptr,
+    PML_Q_TYPE(Allocator) *alloc PML_DEFAULT(0), PML_Q_TYPE(Hint) hint PML_DEFAULT(0));
+
+/** Allocate count blocks of size bytes into out[0..count). Returns the number of
+ *  blocks allocated - if this is less than count, the allocation failed part
+ *  way through, and the remaining entries of out are set to null. Blocks can be
+ *  freed individually, or together with free_batch().
+ */
+PML_API(size_t, malloc_batch)(size_t count, size_t size, void **out,
+    PML_Q_TYPE(Allocator) *alloc PML_DEFAULT(0), PML_Q_TYPE(Hint) hint PML_DEFAULT(0));
+
+/** Free the count blocks in ptrs (null entries are allowed).
+ */
+PML_API(void, free_batch)(void **ptrs, size_t count,
+    PML_Q_TYPE(Allocator) *alloc PML_DEFAULT(0), PML_Q_TYPE(Hint) hint PML_DEFAULT(0));
+
+
+/*----------------------------------------------------------------------------*/
+/* Scoped allocators */
+
+/** Set the calling thread's scoped allocator, which the calls above use when
+ *  they're passed a null alloc, and return the previous one (0 if there was
+ *  none). Passing 0 (or global_allocator()) restores the global hooks.
+ *
+ *  Blocks allocated while a scoped allocator is set must be freed through the
+ *  same allocator - either inside the same scope, or by passing it explicitly.
+ *  In C++, ScopedAllocator sets and restores this for the lifetime of a scope.
+ */
+PML_API(PML_Q_TYPE(Allocator)*, set_scoped_allocator)(PML_Q_TYPE(Allocator) *alloc);
+PML_API(PML_Q_TYPE(Allocator)*, get_scoped_allocator)();
+
+/** An Allocator which always uses the global hooks, whatever the scoped
+ *  allocator is (e.g. as the parent of an arena which may be created, or
+ *  grow, inside a scope which uses it).
+ */
+PML_API(PML_Q_TYPE(Allocator)*, global_allocator)();
+
 
 /*----------------------------------------------------------------------------*/
 /* Proxy routines for allocators which want to provide these C APIs but only want
@@ -148,17 +310,70 @@ PML_API(void*, emulate_calloc)(size_t count, size_t size,
     PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
 PML_API(void*, emulate_realloc)(void *ptr, size_t size,
     PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+PML_API(void*, emulate_aligned_malloc)(size_t align, size_t size,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+PML_API(void, emulate_aligned_free)(void *ptr,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+
+/*----------------------------------------------------------------------------*/
+/* Hint ids */
+
+/* With PML_HINT_ID_S defined, PML_HINT() gives each callsite a small id (cast
+ * to Hint) rather than a string - so per-callsite data can be kept in an array
+ * indexed by pml_hint_id(), with no hashing or string compares. Ids are dense
+ * from 1: those for C callsites are assigned by the linker (from a table in
+ * the pml_hints section of the executable or shared library PML is linked
+ * into), and those for C++ callsites are registered the first time they're
+ * reached (up to PML_HINT_IDS of them, after which they fall back to
+ * strings). Code using ids and code using strings can be mixed freely, as a
+ * string pointer is never mistaken for an id.
+ */
+
+#if defined(__GNUC__) && defined(__ELF__)
+/** Internal - bounds of the C callsite table (defined by the linker). */
+PML_EXTERN PML_Q_TYPE(HintSite) __start_pml_hints[] __attribute__((weak));
+PML_EXTERN PML_Q_TYPE(HintSite) __stop_pml_hints[] __attribute__((weak));
+#endif/*__GNUC__ && __ELF__*/
+
+/** Number of callsite ids in use.
+ */
+PML_API(size_t, hint_count)();
+
+/** The callsite id of hint, or 0 if it isn't one.
+ */
+PML_API(size_t, hint_id)(PML_Q_TYPE(Hint) hint);
+
+/** The string for hint (which is hint itself, unless it's a callsite id).
+ */
+PML_API(const char*, hint_name)(PML_Q_TYPE(Hint) hint);
+
+/** Internal - register a C++ callsite, and return its id (or name, if there
+ *  are no ids left).
+ */
+PML_API(PML_Q_TYPE(Hint), hint_register_)(const char *name);
 
 
 /*----------------------------------------------------------------------------*/
 /* Debugging */
 
+/** Select which events reach the debug hook, as a mask of PML_DEBUG_EVENT()
+ *  bits (PML_DEBUG_EVENTS_ALL by default). Events outside the mask cost a
+ *  single relaxed load, as does every event while no debug hook is installed
+ *  (globally or for any thread).
+ */
+PML_API(void, set_debug_events)(unsigned mask);
+PML_API(unsigned, get_debug_events)();
+
 #ifdef PML_DEBUG_HOOK_S
 PML_API(void, debug_hook)(PML_Q_TYPE(DebugHookType) type,
     size_t count, size_t size, void *ptr, void *in,
     PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
 #endif/*PML_DEBUG_HOOK_S*/
 
+/** Internal - the debug event mask in effect (0 while no debug hook is set). */
+PML_EXTERN unsigned PML_APINAME(debug_events_);
+
 
 #ifdef PML_ASSERT_HOOK_S
 PML_API(void, assert_hook)(bool test, const char *expr,
@@ -174,13 +389,27 @@ PML_INLINE_API(void, init_allocator)(
     PML_Q_TYPE(MallocHook) mhk,
     PML_Q_TYPE(FreeHook) fhk,
     PML_Q_TYPE(CallocHook) chk PML_DEFAULT(0),
-    PML_Q_TYPE(ReallocHook) rhk PML_DEFAULT(0)) {
+    PML_Q_TYPE(ReallocHook) rhk PML_DEFAULT(0),
+    PML_Q_TYPE(FreeSizedHook) fshk PML_DEFAULT(0),
+    PML_Q_TYPE(AlignedMallocHook) amhk PML_DEFAULT(0),
+    PML_Q_TYPE(FreeHook) afhk PML_DEFAULT(0),
+    PML_Q_TYPE(UsableSizeHook) ushk PML_DEFAULT(0),
+    PML_Q_TYPE(TryExpandHook) tehk PML_DEFAULT(0),
+    PML_Q_TYPE(MallocBatchHook) mbhk PML_DEFAULT(0),
+    PML_Q_TYPE(FreeBatchHook) fbhk PML_DEFAULT(0)) {
 
     PML_ASSERT(alloc);
     alloc->malloc = mhk;
     alloc->free = fhk;
     alloc->calloc = chk;
     alloc->realloc = rhk;
+    alloc->free_sized = fshk;
+    alloc->aligned_malloc = amhk;
+    alloc->aligned_free = afhk;
+    alloc->usable_size = ushk;
+    alloc->try_expand = tehk;
+    alloc->malloc_batch = mbhk;
+    alloc->free_batch = fbhk;
 }
 
 
@@ -244,6 +473,7 @@ PML_END_NAMESPACE
  *
  * Array allocation:
  *     pml_new<T>(...)[n] --> new T[n] 
+ *     pml_new<T>(...).init_array(n) --> new T[n]()
  *
  * (++) This syntax can be removed by #define PML_NO_EMPTY_NEW_S. This makes it
  *      an error if pml_new<T>() is not followed by () or [], i.e. you must then
@@ -261,10 +491,11 @@ PML_END_NAMESPACE
     void *ptr = pml_NEW_OPERATOR_ALLOC(); \
      \
     if(ptr) { \
-        SetAllocatorTagCheck<T>::call_set_allocator(*static_cast<T*>(ptr), alloc); \
+        SetAllocatorTagCheck<T>::call_set_allocator( \
+            *static_cast<T*>(ptr), backend.allocator()); \
         new(::PML_Q_TYPE(Placement)(ptr)) T ARGS_; \
     } \
-    PML_DEBUG_HOOK(NEW, 1, size, ptr, 0, alloc, hint); \
+    PML_DEBUG_HOOK(NEW, 1, size, ptr, 0, backend.allocator(), hint); \
      \
     return static_cast<T*>(ptr)
 
@@ -274,11 +505,213 @@ PML_END_NAMESPACE
 #define pml_NEW_OPERATOR_ALLOC() alloc_n(1, true)
 #else/*PML_CHECK_S*/
 /* No checking, just allocate space for one T. */
-#define pml_NEW_OPERATOR_ALLOC() PML_CALL(malloc)(size, alloc, hint)
+#define pml_NEW_OPERATOR_ALLOC() alloc_block(size)
 #endif/*PML_CHECK_S*/
 
 
 PML_BEGIN_NAMESPACE
+/** Backends for pml_new()/pml_delete().
+ *  A backend provides malloc(), calloc() (of a single zeroed block),
+ *  free_sized(), aligned_malloc() and aligned_free() (taking a hint), and
+ *  allocator(), the Allocator to report to the debug hook and
+ *  PML_REGISTER_SET_ALLOCATOR().
+ */
+
+/** The default backend routes through an Allocator pointer (or the global
+ *  hooks, if it is null), which is resolved at runtime.
+ */
+struct DynamicBackend {
+
+    explicit DynamicBackend(Allocator *a): alloc(a) {}
+
+    void *malloc(size_t size, Hint h) {
+        return PML_CALL(malloc)(size, alloc, h);
+    }
+
+    void *calloc(size_t size, Hint h) {
+        return PML_CALL(calloc)(1, size, alloc, h);
+    }
+
+    void free_sized(void *ptr, size_t size, Hint h) {
+        PML_CALL(free_sized)(ptr, size, alloc, h);
+    }
+
+    void *aligned_malloc(size_t align, size_t size, Hint h) {
+        return PML_CALL(aligned_malloc)(align, size, alloc, h);
+    }
+
+    void aligned_free(void *ptr, Hint h) {
+        PML_CALL(aligned_free)(ptr, alloc, h);
+    }
+
+    Allocator *allocator() const {
+        return alloc;
+    }
+
+private:
+    Allocator *alloc;
+};
+
+
+template<typename POLICY> struct StaticAllocator;
+
+
+/** Defaults for the optional parts of a static allocation policy. A policy is
+ *  a type with (at least) static malloc(size, hint) and free(ptr, hint)
+ *  functions, which derives from StaticPolicy<itself>:
+ *
+ *      struct FramePolicy: pml::StaticPolicy<FramePolicy> {
+ *          static void *malloc(size_t size, pml::Hint h);
+ *          static void free(void *ptr, pml::Hint h);
+ *      };
+ *
+ *      Node *n = pml_new<Node, FramePolicy>()(a, b);
+ *      pml_delete<FramePolicy>()(n);
+ *
+ *  The policy can also provide its own calloc(), free_sized(),
+ *  aligned_malloc() and aligned_free() (with the same signatures as the
+ *  defaults below).
+ */
+template<typename POLICY>
+struct StaticPolicy {
+
+    static void *calloc(size_t size, Hint h) {
+        return PML_CALL(emulate_calloc)(
+            1, size, &StaticAllocator<POLICY>::instance, h);
+    }
+
+    static void free_sized(void *ptr, size_t size, Hint h) {
+        POLICY::free(ptr, h);
+    }
+
+    static void *aligned_malloc(size_t align, size_t size, Hint h) {
+        return PML_CALL(emulate_aligned_malloc)(
+            align, size, &StaticAllocator<POLICY>::instance, h);
+    }
+
+    static void aligned_free(void *ptr, Hint h) {
+        PML_CALL(emulate_aligned_free)(ptr, &StaticAllocator<POLICY>::instance, h);
+    }
+};
+
+
+/** An Allocator which routes to POLICY. StaticAllocator<POLICY>::instance can
+ *  be passed to any API which takes an Allocator pointer (through the usual
+ *  indirect calls), and is what the debug hook sees for pml_new<T, POLICY>().
+ *  The instance is a brace-initialized Allocator, so it's constant-initialized
+ *  and usable during any other translation unit's static initialization.
+ */
+template<typename POLICY>
+struct StaticAllocator {
+
+    static Allocator instance;
+
+private:
+    static void *static_malloc(size_t size, Allocator *a, Hint h) {
+        return POLICY::malloc(size, h);
+    }
+
+    static void static_free(void *ptr, Allocator *a, Hint h) {
+        POLICY::free(ptr, h);
+    }
+
+    static void static_free_sized(void *ptr, size_t size, Allocator *a, Hint h) {
+        POLICY::free_sized(ptr, size, h);
+    }
+
+    static void *static_aligned_malloc(size_t align, size_t size, Allocator *a, Hint h) {
+        return POLICY::aligned_malloc(align, size, h);
+    }
+
+    static void static_aligned_free(void *ptr, Allocator *a, Hint h) {
+        POLICY::aligned_free(ptr, h);
+    }
+};
+
+
+template<typename POLICY>
+Allocator StaticAllocator<POLICY>::instance = {
+    StaticAllocator<POLICY>::static_malloc,
+    StaticAllocator<POLICY>::static_free,
+    PML_CALL(emulate_calloc),
+    PML_CALL(emulate_realloc),
+    StaticAllocator<POLICY>::static_free_sized,
+    StaticAllocator<POLICY>::static_aligned_malloc,
+    StaticAllocator<POLICY>::static_aligned_free,
+    0, 0, 0, 0
+};
+
+
+/** The backend for pml_new<T, POLICY>(). The policy is part of the type, so
+ *  this calls it directly (with no indirect calls, so it can be inlined).
+ */
+template<typename POLICY>
+struct StaticBackend {
+
+    void *malloc(size_t size, Hint h) {
+        return POLICY::malloc(size, h);
+    }
+
+    void *calloc(size_t size, Hint h) {
+        return POLICY::calloc(size, h);
+    }
+
+    void free_sized(void *ptr, size_t size, Hint h) {
+        POLICY::free_sized(ptr, size, h);
+    }
+
+    void *aligned_malloc(size_t align, size_t size, Hint h) {
+        return POLICY::aligned_malloc(align, size, h);
+    }
+
+    void aligned_free(void *ptr, Hint h) {
+        POLICY::aligned_free(ptr, h);
+    }
+
+    Allocator *allocator() const {
+        return &StaticAllocator<POLICY>::instance;
+    }
+};
+
+
+/** Memory layout used by pml_new() for a T.
+ *  Arrays (and checked single objects) have a count stored in front of them.
+ *  The count's header is PML_MALLOC_ALIGN bytes (or the alignment of T, if
+ *  that's more), and types which need more alignment than malloc() provides
+ *  are allocated with aligned_malloc(). So every type which isn't over-aligned
+ *  has its header at the same offset, and an object can be deleted through a
+ *  pointer to its (polymorphic) base. An over-aligned polymorphic type can't
+ *  be, as the base wouldn't know its layout, so these are rejected at compile
+ *  time (as is any over-aligned type, where PML_IS_POLYMORPHIC() can't tell).
+ *  Arrays of a trivially destructible T have no destructors to run, so unless
+ *  checking is enabled they don't need the count, and are laid out just as
+ *  malloc(sizeof(T) * n) would be. Trivial constructors and destructors are
+ *  skipped altogether, and value-initialized arrays of a trivially constructible
+ *  T come straight from calloc().
+ */
+template<typename T>
+struct NewLayout {
+
+    enum {
+        ALIGN = PML_ALIGNOF(T),
+        HEADER = ALIGN > PML_MALLOC_ALIGN ? ALIGN : PML_MALLOC_ALIGN,
+        OVER_ALIGNED = ALIGN > PML_MALLOC_ALIGN,
+
+        TRIVIAL_CTOR = PML_IS_TRIVIALLY_CONSTRUCTIBLE(T),
+        TRIVIAL_DTOR = PML_IS_TRIVIALLY_DESTRUCTIBLE(T),
+#ifdef PML_CHECK_S
+        COUNTED = true,
+#else/*PML_CHECK_S*/
+        COUNTED = !TRIVIAL_DTOR,
+#endif/*PML_CHECK_S*/
+        ARRAY_HEADER = COUNTED ? HEADER : 0,
+    };
+
+    typedef char over_aligned_polymorphic_types_are_not_supported[
+        OVER_ALIGNED && PML_IS_POLYMORPHIC(T) ? -1 : 1];
+};
+
+
 /** `pml_new()` result.
  *  This is the result value of a call to `pml_new()`. It supports two further
  *  operators, () and []. () takes any* arguments, and is used to construct a
@@ -287,12 +720,15 @@ PML_BEGIN_NAMESPACE
  *
  *
  *  (*) up to 5 args in C++98
+ *
+ *  BACKEND is DynamicBackend for pml_new<T>(alloc), or a StaticBackend for
+ *  pml_new<T, POLICY>().
  */
-template<typename T>
+template<typename T, typename BACKEND = DynamicBackend>
 struct NewResult {
 
-    NewResult(PML_Q_TYPE(Allocator) *a, PML_Q_TYPE(Hint) h):
-        alloc(a), hint(h) {}
+    NewResult(const BACKEND &b, PML_Q_TYPE(Hint) h):
+        backend(b), hint(h) {}
 
 #ifdef PML_EMPTY_NEW_S
     /* This allows 'parameterless' pml_new by allowing it to decay into a T* by
@@ -353,38 +789,59 @@ struct NewResult {
 
 #endif/*PML_HAS_CPP11*/
 
-    /* TODO: this implementation can't handle types needing alignment > sizeof(size_t) */
     T *operator[](size_t count) {
 
-        /* allocate array plus one 'size_t' to store the array count... */
+        /* allocate array plus a header to store the array count... */
         void *ptr = alloc_n(count);
 
         /* call ctors for each object in the array */
         T *arr = static_cast<T*>(ptr);
-        for(size_t i = 0; i < count; i++) {
+        for(size_t i = 0; !NewLayout<T>::TRIVIAL_CTOR && ptr && i < count; i++) {
             new(PML_Q_TYPE(Placement)(arr + i)) T;
         }
 
-        size_t size = (sizeof(T) * count) + sizeof(count);
-        PML_DEBUG_HOOK(NEWA, count, size, ptr, 0, alloc, hint);
+        size_t size = (sizeof(T) * count) + NewLayout<T>::ARRAY_HEADER;
+        PML_DEBUG_HOOK(NEWA, count, size, ptr, 0, backend.allocator(), hint);
 
-        return static_cast<T*>(ptr);
+        return arr;
+    }
+
+    /* As operator[], but value-initializes the objects (as new T[n]()). */
+    T *init_array(size_t count) {
+
+        /* a trivially constructible T is value-initialized by zeroing it */
+        bool zeroed = NewLayout<T>::TRIVIAL_CTOR && !NewLayout<T>::OVER_ALIGNED;
+        void *ptr = alloc_n(count, false, zeroed);
+
+        T *arr = static_cast<T*>(ptr);
+        for(size_t i = 0; !zeroed && ptr && i < count; i++) {
+            new(PML_Q_TYPE(Placement)(arr + i)) T();
+        }
+
+        size_t size = (sizeof(T) * count) + NewLayout<T>::ARRAY_HEADER;
+        PML_DEBUG_HOOK(NEWA, count, size, ptr, 0, backend.allocator(), hint);
+
+        return arr;
     }
 
 private:
-    PML_Q_TYPE(Allocator) *alloc;
+    BACKEND backend;
     PML_Q_TYPE(Hint) hint;
 
-    void *alloc_n(size_t count, bool checked_single = false) {
+    void *alloc_n(size_t count,
+        bool checked_single = false, bool zeroed = false) {
 
 #ifdef PML_CHECK_S
         if(checked_single) { PML_ASSERT(1 == count); }
 #endif/*PML_CHECK_S*/
 
-        /* allocate array plus one 'size_t' to store the array count... */
-        size_t size = (sizeof(T) * count) + sizeof(count);
-        void *ptr = PML_CALL(malloc)(size, alloc, hint);
-        size_t *data = static_cast<size_t*>(ptr);
+        /* allocate array plus a header to store the array count... */
+        size_t size = (sizeof(T) * count) + NewLayout<T>::ARRAY_HEADER;
+        char *ptr = static_cast<char*>(alloc_block(size, zeroed));
+
+        if(!ptr || !NewLayout<T>::COUNTED) {
+            return ptr;
+        }
 
 #ifdef PML_CHECK_S
         /* Write a 'count' of -1 for a single alloc if checking is enabled */
@@ -393,11 +850,20 @@ private:
         }
 #endif/*PML_CHECK_S*/
 
-        *data = count;
-        ptr = data + 1;
+        /* ...the count goes at the end of the header, next to the array */
+        ptr += NewLayout<T>::HEADER;
+        reinterpret_cast<size_t*>(ptr)[-1] = count;
 
         return ptr;
     }
+
+    void *alloc_block(size_t size, bool zeroed = false) {
+
+        if(NewLayout<T>::OVER_ALIGNED) {
+            return backend.aligned_malloc(NewLayout<T>::ALIGN, size, hint);
+        }
+        return zeroed ? backend.calloc(size, hint) : backend.malloc(size, hint);
+    }
 };
 PML_END_NAMESPACE
 
@@ -406,14 +872,27 @@ template<typename T>
 inline PML_Q_TYPE(NewResult)<T>
 pml_new(PML_Q_TYPE(Allocator) *alloc = 0, PML_Q_TYPE(Hint) hint = 0) {
 
-    return PML_Q_TYPE(NewResult)<T>(alloc, hint);
+    return PML_Q_TYPE(NewResult)<T>(PML_Q_TYPE(DynamicBackend)(alloc), hint);
 }
 
 
 template<typename T>
 inline PML_Q_TYPE(NewResult)<T> pml_new(PML_Q_TYPE(Hint) hint) {
 
-    return PML_Q_TYPE(NewResult)<T>(0, hint);
+    return PML_Q_TYPE(NewResult)<T>(PML_Q_TYPE(DynamicBackend)(0), hint);
+}
+
+
+/** pml_new<T, POLICY>([hint])
+ *  Allocates through a static allocation policy (see StaticPolicy) which is
+ *  bound at compile time, instead of through an Allocator pointer.
+ */
+template<typename T, typename POLICY>
+inline PML_Q_TYPE(NewResult)<T, PML_Q_TYPE(StaticBackend)<POLICY> >
+pml_new(PML_Q_TYPE(Hint) hint = 0) {
+
+    return PML_Q_TYPE(NewResult)<T, PML_Q_TYPE(StaticBackend)<POLICY> >(
+        PML_Q_TYPE(StaticBackend)<POLICY>(), hint);
 }
 
 
@@ -431,14 +910,49 @@ template<typename T>
 inline T *pml_newa(size_t count = 0,
     PML_Q_TYPE(Allocator) *alloc = 0, PML_Q_TYPE(Hint) hint = 0) {
 
-    return PML_Q_TYPE(NewResult)<T>(alloc, hint)[count];
+    return pml_new<T>(alloc, hint)[count];
 }
 
 
 template<typename T>
 inline T *pml_newa(size_t count, PML_Q_TYPE(Hint) hint) {
 
-    return PML_Q_TYPE(NewResult)<T>(0, hint)[count];
+    return pml_new<T>(hint)[count];
+}
+
+
+template<typename T, typename POLICY>
+inline T *pml_newa(size_t count, PML_Q_TYPE(Hint) hint = 0) {
+
+    return pml_new<T, POLICY>(hint)[count];
+}
+
+
+/** pml_newa_init(count, [alloc], [hint])
+ *  As pml_newa(), but value-initializes the array (so an array of a trivial
+ *  type, like int, is allocated with calloc()):
+ *      pml_newa_init<T>(100)    ->    new T[100]()
+ *      pml_newa_init<T>(100, a, h)    ->    pml_new<T>(a, h).init_array(100)
+ */
+template<typename T>
+inline T *pml_newa_init(size_t count = 0,
+    PML_Q_TYPE(Allocator) *alloc = 0, PML_Q_TYPE(Hint) hint = 0) {
+
+    return pml_new<T>(alloc, hint).init_array(count);
+}
+
+
+template<typename T>
+inline T *pml_newa_init(size_t count, PML_Q_TYPE(Hint) hint) {
+
+    return pml_new<T>(hint).init_array(count);
+}
+
+
+template<typename T, typename POLICY>
+inline T *pml_newa_init(size_t count, PML_Q_TYPE(Hint) hint = 0) {
+
+    return pml_new<T, POLICY>(hint).init_array(count);
 }
 
 
@@ -460,11 +974,14 @@ PML_BEGIN_NAMESPACE
  *  array of objects.
  *
  *  (*) up to 5 args in C++98
+ *
+ *  BACKEND is as for NewResult, and must match the one used to allocate.
  */
-struct DeleteResult {
+template<typename BACKEND>
+struct BasicDeleteResult {
 
-    DeleteResult(PML_Q_TYPE(Allocator) *a, PML_Q_TYPE(Hint) h):
-        alloc(a), hint(h) {}
+    BasicDeleteResult(const BACKEND &b, PML_Q_TYPE(Hint) h):
+        backend(b), hint(h) {}
 
     template<typename T>
     void operator()(const T *p) {
@@ -472,14 +989,18 @@ struct DeleteResult {
          * `void*`. For now, we'll just use `const_cast` to allow for this.
          */
         if(T *ptr = const_cast<T*>(p)) {
-            PML_DEBUG_HOOK(DELETE, 1, 0, ptr, 0, alloc, hint);
+            PML_DEBUG_HOOK(DELETE, 1, 0, ptr, 0, backend.allocator(), hint);
+
+            /* A polymorphic T may be a base of the object actually allocated,
+             * so we only know the size if it isn't. */
+            size_t size = PML_IS_POLYMORPHIC(T) ? 0 : sizeof(T);
 #ifdef PML_CHECK_S
             size_t count;
             void *data = delete_n(ptr, count, false);
-            PML_CALL(free)(data, alloc, hint);
+            free_block<T>(data, size ? size + NewLayout<T>::HEADER : 0);
 #else/*PML_CHECK_S*/
             ptr->~T();
-            PML_CALL(free)(ptr, alloc, hint);
+            free_block<T>(ptr, size);
 #endif/*PML_CHECK_S*/
         }
     }
@@ -490,23 +1011,24 @@ struct DeleteResult {
          * `void*`. For now, we'll just use `const_cast` to allow for this.
          */
         if(T *ptr = const_cast<T*>(p)) {
-            size_t count;
-            void *data = delete_n(ptr, count);
-            PML_DEBUG_HOOK(DELETEA, count, 0, ptr, 0, alloc, hint);
-            PML_CALL(free)(data, alloc, hint);
+            /* (an uncounted array's count, and so its size, are unknown) */
+            size_t count = 0;
+            void *data = NewLayout<T>::COUNTED ? delete_n(ptr, count) : ptr;
+            PML_DEBUG_HOOK(DELETEA, count, 0, ptr, 0, backend.allocator(), hint);
+            free_block<T>(data,
+                count ? (sizeof(T) * count) + NewLayout<T>::HEADER : 0);
         }
     }
 
 private:
-    PML_Q_TYPE(Allocator) *alloc;
+    BACKEND backend;
     PML_Q_TYPE(Hint) hint;
 
     template<typename T>
     void *delete_n(T *ptr, size_t &count, bool array = true) {
         /* retrieve array count from just in front of the passed-in pointer... */
         void *p = ptr;
-        size_t *data = static_cast<size_t*>(p) - 1;
-        count = *data;
+        count = static_cast<size_t*>(p)[-1];
 
 #ifdef PML_CHECK_S
         if(static_cast<size_t>(-1) == count) {
@@ -518,27 +1040,54 @@ private:
 #endif/*PML_CHECK_S*/
 
         /* call dtors in reverse order than ctors were called... */
-        for(size_t i = 0, j = count - 1; i < count; i++, j--) {
+        for(size_t i = 0, j = count - 1;
+            !NewLayout<T>::TRIVIAL_DTOR && i < count; i++, j--) {
             ptr[j].~T();
         }
 
-        return data;
+        return static_cast<char*>(p) - NewLayout<T>::HEADER;
+    }
+
+    template<typename T>
+    void free_block(void *data, size_t size) {
+
+        if(NewLayout<T>::OVER_ALIGNED) {
+            backend.aligned_free(data, hint);
+        } else {
+            backend.free_sized(data, size, hint);
+        }
     }
 
 };
+
+
+typedef BasicDeleteResult<DynamicBackend> DeleteResult;
 PML_END_NAMESPACE
 
 
 inline PML_Q_TYPE(DeleteResult) pml_delete(
     PML_Q_TYPE(Allocator) *alloc = 0, PML_Q_TYPE(Hint) hint = 0) {
 
-    return PML_Q_TYPE(DeleteResult)(alloc, hint);
+    return PML_Q_TYPE(DeleteResult)(PML_Q_TYPE(DynamicBackend)(alloc), hint);
 }
 
 
 inline PML_Q_TYPE(DeleteResult) pml_delete(PML_Q_TYPE(Hint) hint) {
 
-    return PML_Q_TYPE(DeleteResult)(0, hint);
+    return PML_Q_TYPE(DeleteResult)(PML_Q_TYPE(DynamicBackend)(0), hint);
+}
+
+
+/** pml_delete<POLICY>([hint])
+ *  Frees through a static allocation policy, for objects allocated with
+ *  pml_new<T, POLICY>().
+ */
+template<typename POLICY>
+inline PML_Q_TYPE(BasicDeleteResult)<PML_Q_TYPE(StaticBackend)<POLICY> >
+pml_delete(PML_Q_TYPE(Hint) hint = 0) {
+
+    return PML_Q_TYPE(BasicDeleteResult)<PML_Q_TYPE(StaticBackend)<POLICY> >(
+        PML_Q_TYPE(StaticBackend)<POLICY>(), hint);
 }
 
 
@@ -554,14 +1103,14 @@ template<typename T>
 inline void pml_deletea(
     const T *ptr, PML_Q_TYPE(Allocator) *alloc = 0, PML_Q_TYPE(Hint) hint = 0) {
 
-    PML_Q_TYPE(DeleteResult)(alloc, hint)[ptr];
+    pml_delete(alloc, hint)[ptr];
 }
 
 
 template<typename T>
 inline void pml_deletea(const T *ptr, PML_Q_TYPE(Hint) hint) {
 
-    PML_Q_TYPE(DeleteResult)(0, hint)[ptr];
+    pml_delete(hint)[ptr];
 }
 
 
@@ -576,7 +1125,10 @@ struct IAllocator: Allocator {
 
     IAllocator() {
         PML_CALL(init_allocator)(this,
-            static_malloc, static_free, static_calloc, static_realloc);
+            static_malloc, static_free, static_calloc, static_realloc,
+            static_free_sized, static_aligned_malloc, static_aligned_free,
+            static_usable_size, static_try_expand,
+            static_malloc_batch, static_free_batch);
     };
 
     virtual ~IAllocator() {}
@@ -594,6 +1146,47 @@ struct IAllocator: Allocator {
         return PML_CALL(emulate_realloc)(ptr, size, this, h);
     }
 
+    /* size is as requested from malloc(), or 0 if unknown */
+    virtual void free_sized(void *ptr, size_t size, Hint h = 0) {
+        free(ptr, h);
+    }
+
+    /* by default, aligned blocks are emulated with malloc()/free() */
+    virtual void *aligned_malloc(size_t align, size_t size, Hint h = 0) {
+        return PML_CALL(emulate_aligned_malloc)(align, size, this, h);
+    }
+
+    virtual void aligned_free(void *ptr, Hint h = 0) {
+        PML_CALL(emulate_aligned_free)(ptr, this, h);
+    }
+
+    /* by default, sizes are unknown, and blocks can't be resized in place */
+    virtual size_t usable_size(void *ptr, Hint h = 0) {
+        return 0;
+    }
+
+    virtual bool try_expand(void *ptr, size_t size, Hint h = 0) {
+        return false;
+    }
+
+    /* by default, batches are allocated/freed one block at a time */
+    virtual size_t malloc_batch(size_t count, size_t size, void **out, Hint h = 0) {
+        size_t done = 0;
+        while(done < count && (out[done] = malloc(size, h))) {
+            done++;
+        }
+        for(size_t i = done; i < count; i++) {
+            out[i] = 0;
+        }
+        return done;
+    }
+
+    virtual void free_batch(void **ptrs, size_t count, Hint h = 0) {
+        for(size_t i = 0; i < count; i++) {
+            free(ptrs[i], h);
+        }
+    }
+
 private:
     static inline void *static_malloc(size_t size, Allocator *a, Hint h) {
         return static_cast<IAllocator*>(a)->malloc(size, h);
@@ -610,7 +1203,511 @@ private:
     static inline void *static_realloc(void *ptr, size_t size, Allocator *a, Hint h) {
         return static_cast<IAllocator*>(a)->realloc(ptr, size, h);
     }
+
+    static inline void static_free_sized(void *ptr, size_t size, Allocator *a, Hint h) {
+        return static_cast<IAllocator*>(a)->free_sized(ptr, size, h);
+    }
+
+    static inline void *static_aligned_malloc(size_t align, size_t size, Allocator *a, Hint h) {
+        return static_cast<IAllocator*>(a)->aligned_malloc(align, size, h);
+    }
+
+    static inline void static_aligned_free(void *ptr, Allocator *a, Hint h) {
+        return static_cast<IAllocator*>(a)->aligned_free(ptr, h);
+    }
+
+    static inline size_t static_usable_size(void *ptr, Allocator *a, Hint h) {
+        return static_cast<IAllocator*>(a)->usable_size(ptr, h);
+    }
+
+    static inline bool static_try_expand(void *ptr, size_t size, Allocator *a, Hint h) {
+        return static_cast<IAllocator*>(a)->try_expand(ptr, size, h);
+    }
+
+    static inline size_t static_malloc_batch(size_t count, size_t size, void **out,
+        Allocator *a, Hint h) {
+        return static_cast<IAllocator*>(a)->malloc_batch(count, size, out, h);
+    }
+
+    static inline void static_free_batch(void **ptrs, size_t count, Allocator *a, Hint h) {
+        return static_cast<IAllocator*>(a)->free_batch(ptrs, count, h);
+    }
+};
+PML_END_NAMESPACE
+
+
+/*----------------------------------------------------------------------------*/
+/* AllocatorBase */
+
+PML_BEGIN_NAMESPACE
+/** A compile-time alternative to IAllocator. DERIVED provides (non-virtual)
+ *  malloc() and free(), with the same signatures as IAllocator's, and can hide
+ *  any of the other defaults below:
+ *
+ *      struct FrameAllocator: pml::AllocatorBase<FrameAllocator> {
+ *          void *malloc(size_t size, pml::Hint h = 0);
+ *          void free(void *ptr, pml::Hint h = 0);
+ *      };
+ *
+ *  The Allocator hooks call straight into DERIVED, so a call through an
+ *  Allocator pointer makes one indirect call (rather than IAllocator's two,
+ *  the hook and then the virtual function). When the type is known statically,
+ *  pml_new()/pml_delete() (and pml_newa()/pml_deletea()) call DERIVED directly,
+ *  with no indirect calls at all:
+ *
+ *      FrameAllocator frame;
+ *      Node *n = pml_new<Node>(&frame)(a, b);
+ *      pml_delete(&frame)(n);
+ *
+ *  Unlike with an Allocator pointer, a null AllocatorBase pointer doesn't mean
+ *  the global hooks.
+ */
+template<typename DERIVED>
+struct AllocatorBase: Allocator {
+
+    AllocatorBase() {
+        PML_CALL(init_allocator)(this,
+            static_malloc, static_free, static_calloc, static_realloc,
+            static_free_sized, static_aligned_malloc, static_aligned_free,
+            static_usable_size, static_try_expand,
+            static_malloc_batch, static_free_batch);
+    }
+
+    /* The defaults match IAllocator's (calloc()/realloc() and aligned blocks
+     * are emulated, sizes are unknown, batches are one block at a time). */
+    void *calloc(size_t count, size_t size, Hint h = 0) {
+        return PML_CALL(emulate_calloc)(count, size, this, h);
+    }
+
+    void *realloc(void *ptr, size_t size, Hint h = 0) {
+        return PML_CALL(emulate_realloc)(ptr, size, this, h);
+    }
+
+    void free_sized(void *ptr, size_t size, Hint h = 0) {
+        derived(this)->free(ptr, h);
+    }
+
+    void *aligned_malloc(size_t align, size_t size, Hint h = 0) {
+        return PML_CALL(emulate_aligned_malloc)(align, size, this, h);
+    }
+
+    void aligned_free(void *ptr, Hint h = 0) {
+        PML_CALL(emulate_aligned_free)(ptr, this, h);
+    }
+
+    size_t usable_size(void *ptr, Hint h = 0) {
+        return 0;
+    }
+
+    bool try_expand(void *ptr, size_t size, Hint h = 0) {
+        return false;
+    }
+
+    size_t malloc_batch(size_t count, size_t size, void **out, Hint h = 0) {
+        size_t done = 0;
+        while(done < count && (out[done] = derived(this)->malloc(size, h))) {
+            done++;
+        }
+        for(size_t i = done; i < count; i++) {
+            out[i] = 0;
+        }
+        return done;
+    }
+
+    void free_batch(void **ptrs, size_t count, Hint h = 0) {
+        for(size_t i = 0; i < count; i++) {
+            derived(this)->free(ptrs[i], h);
+        }
+    }
+
+private:
+    static inline DERIVED *derived(Allocator *a) {
+        return static_cast<DERIVED*>(static_cast<AllocatorBase*>(a));
+    }
+
+    static void *static_malloc(size_t size, Allocator *a, Hint h) {
+        return derived(a)->malloc(size, h);
+    }
+
+    static void static_free(void *ptr, Allocator *a, Hint h) {
+        derived(a)->free(ptr, h);
+    }
+
+    static void *static_calloc(size_t count, size_t size, Allocator *a, Hint h) {
+        return derived(a)->calloc(count, size, h);
+    }
+
+    static void *static_realloc(void *ptr, size_t size, Allocator *a, Hint h) {
+        return derived(a)->realloc(ptr, size, h);
+    }
+
+    static void static_free_sized(void *ptr, size_t size, Allocator *a, Hint h) {
+        derived(a)->free_sized(ptr, size, h);
+    }
+
+    static void *static_aligned_malloc(size_t align, size_t size, Allocator *a, Hint h) {
+        return derived(a)->aligned_malloc(align, size, h);
+    }
+
+    static void static_aligned_free(void *ptr, Allocator *a, Hint h) {
+        derived(a)->aligned_free(ptr, h);
+    }
+
+    static size_t static_usable_size(void *ptr, Allocator *a, Hint h) {
+        return derived(a)->usable_size(ptr, h);
+    }
+
+    static bool static_try_expand(void *ptr, size_t size, Allocator *a, Hint h) {
+        return derived(a)->try_expand(ptr, size, h);
+    }
+
+    static size_t static_malloc_batch(size_t count, size_t size, void **out,
+        Allocator *a, Hint h) {
+        return derived(a)->malloc_batch(count, size, out, h);
+    }
+
+    static void static_free_batch(void **ptrs, size_t count, Allocator *a, Hint h) {
+        derived(a)->free_batch(ptrs, count, h);
+    }
+};
+
+
+/** The backend for pml_new<T>(alloc) when alloc is an AllocatorBase<DERIVED>.
+ *  The allocator's type is known, so this calls it directly.
+ */
+template<typename DERIVED>
+struct InstanceBackend {
+
+    explicit InstanceBackend(DERIVED *a): alloc(a) {}
+
+    void *malloc(size_t size, Hint h) {
+        return alloc->malloc(size, h);
+    }
+
+    void *calloc(size_t size, Hint h) {
+        return alloc->calloc(1, size, h);
+    }
+
+    void free_sized(void *ptr, size_t size, Hint h) {
+        alloc->free_sized(ptr, size, h);
+    }
+
+    void *aligned_malloc(size_t align, size_t size, Hint h) {
+        return alloc->aligned_malloc(align, size, h);
+    }
+
+    void aligned_free(void *ptr, Hint h) {
+        alloc->aligned_free(ptr, h);
+    }
+
+    Allocator *allocator() const {
+        return alloc;
+    }
+
+private:
+    DERIVED *alloc;
+};
+PML_END_NAMESPACE
+
+
+/* These overloads are preferred over the Allocator pointer versions for any
+ * type derived from AllocatorBase<DERIVED> (its base conversion is the better
+ * match), so the static path is picked without any extra syntax.
+ */
+template<typename T, typename DERIVED>
+inline PML_Q_TYPE(NewResult)<T, PML_Q_TYPE(InstanceBackend)<DERIVED> >
+pml_new(PML_Q_TYPE(AllocatorBase)<DERIVED> *alloc, PML_Q_TYPE(Hint) hint = 0) {
+
+    return PML_Q_TYPE(NewResult)<T, PML_Q_TYPE(InstanceBackend)<DERIVED> >(
+        PML_Q_TYPE(InstanceBackend)<DERIVED>(static_cast<DERIVED*>(alloc)), hint);
+}
+
+
+template<typename T, typename DERIVED>
+inline T *pml_newa(size_t count,
+    PML_Q_TYPE(AllocatorBase)<DERIVED> *alloc, PML_Q_TYPE(Hint) hint = 0) {
+
+    return pml_new<T>(alloc, hint)[count];
+}
+
+
+template<typename T, typename DERIVED>
+inline T *pml_newa_init(size_t count,
+    PML_Q_TYPE(AllocatorBase)<DERIVED> *alloc, PML_Q_TYPE(Hint) hint = 0) {
+
+    return pml_new<T>(alloc, hint).init_array(count);
+}
+
+
+template<typename DERIVED>
+inline PML_Q_TYPE(BasicDeleteResult)<PML_Q_TYPE(InstanceBackend)<DERIVED> >
+pml_delete(PML_Q_TYPE(AllocatorBase)<DERIVED> *alloc, PML_Q_TYPE(Hint) hint = 0) {
+
+    return PML_Q_TYPE(BasicDeleteResult)<PML_Q_TYPE(InstanceBackend)<DERIVED> >(
+        PML_Q_TYPE(InstanceBackend)<DERIVED>(static_cast<DERIVED*>(alloc)), hint);
+}
+
+
+template<typename T, typename DERIVED>
+inline void pml_deletea(const T *ptr,
+    PML_Q_TYPE(AllocatorBase)<DERIVED> *alloc, PML_Q_TYPE(Hint) hint = 0) {
+
+    pml_delete(alloc, hint)[ptr];
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Scoped allocators */
+
+PML_BEGIN_NAMESPACE
+/** Scoped allocator for the lifetime of a scope. Guards nest, each restoring
+ *  the allocator which was in effect before it:
+ *
+ *      void handle(Request *request) {
+ *          pml::Arena arena(16384, PML_CALL(global_allocator)());
+ *          pml::ScopedAllocator guard(&arena);
+ *          process(request); // pml_malloc(size), pml_new(T)(...) use arena
+ *      }
+ */
+struct ScopedAllocator {
+
+    explicit ScopedAllocator(Allocator *alloc):
+        m_previous(PML_CALL(set_scoped_allocator)(alloc)) {}
+
+    ~ScopedAllocator() {
+        PML_CALL(set_scoped_allocator)(m_previous);
+    }
+
+    /** The allocator which a null alloc means on this thread at the moment,
+     *  for objects which hold on to an allocator (this is never null). */
+    static Allocator *current() {
+        Allocator *alloc = PML_CALL(get_scoped_allocator)();
+        return alloc ? alloc : PML_CALL(global_allocator)();
+    }
+
+private:
+    Allocator *m_previous;
+
+    ScopedAllocator(const ScopedAllocator&);
+    ScopedAllocator &operator=(const ScopedAllocator&);
+};
+PML_END_NAMESPACE
+
+
+/*----------------------------------------------------------------------------*/
+/* Standard library adapters */
+
+/* Failure to allocate for the standard library throws (if exceptions are
+ * enabled), as it would for std::allocator. */
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define pml_THROW_BAD_ALLOC() throw std::bad_alloc()
+#else/*__cpp_exceptions || __EXCEPTIONS*/
+#define pml_THROW_BAD_ALLOC() PML_ASSERT(!"bad_alloc")
+#endif/*__cpp_exceptions || __EXCEPTIONS*/
+
+PML_BEGIN_NAMESPACE
+/** A standard library allocator which allocates through an Allocator (or, if
+ *  it is null, the scoped allocator or global hooks in effect when it was
+ *  constructed), so that containers can use PML engines and be seen by its
+ *  instrumentation:
+ *
+ *      typedef pml::StdAllocator<Node*> NodeAlloc;
+ *      std::vector<Node*, NodeAlloc> nodes(NodeAlloc(&arena, PML_HINT("nodes")));
+ *
+ *  Copies (and rebound copies) share the Allocator and hint. As the memory
+ *  belongs to the Allocator, it follows the container on copy/move assignment
+ *  and swap, and two StdAllocators are equal if they share an Allocator.
+ */
+template<typename T>
+struct StdAllocator {
+
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template<typename U>
+    struct rebind { typedef StdAllocator<U> other; };
+
+#ifdef PML_HAS_CPP11
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+#endif/*PML_HAS_CPP11*/
+
+    StdAllocator(): m_alloc(ScopedAllocator::current()), m_hint(0) {}
+
+    explicit StdAllocator(Allocator *a, Hint h = 0):
+        m_alloc(a ? a : ScopedAllocator::current()), m_hint(h) {}
+
+    template<typename U>
+    StdAllocator(const StdAllocator<U> &other):
+        m_alloc(other.allocator()), m_hint(other.hint()) {}
+
+    T *allocate(size_t count, const void * = 0) {
+
+        void *ptr = 0;
+
+        if(count <= max_size()) {
+            ptr = NewLayout<T>::OVER_ALIGNED ?
+                PML_CALL(aligned_malloc)(
+                    NewLayout<T>::ALIGN, count * sizeof(T), m_alloc, m_hint) :
+                PML_CALL(malloc)(count * sizeof(T), m_alloc, m_hint);
+        }
+
+        if(!ptr) {
+            pml_THROW_BAD_ALLOC();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T *ptr, size_t count) {
+
+        if(NewLayout<T>::OVER_ALIGNED) {
+            PML_CALL(aligned_free)(ptr, m_alloc, m_hint);
+        } else {
+            PML_CALL(free_sized)(ptr, count * sizeof(T), m_alloc, m_hint);
+        }
+    }
+
+    size_t max_size() const {
+        return static_cast<size_t>(-1) / sizeof(T);
+    }
+
+    /* (C++98 containers construct and destroy through the allocator) */
+    void construct(T *ptr, const T &value) {
+        new(PML_Q_TYPE(Placement)(ptr)) T(value);
+    }
+
+    void destroy(T *ptr) {
+        ptr->~T();
+    }
+
+    T *address(T &ref) const { return &ref; }
+    const T *address(const T &ref) const { return &ref; }
+
+    Allocator *allocator() const { return m_alloc; }
+    Hint hint() const { return m_hint; }
+
+private:
+    Allocator *m_alloc;
+    Hint m_hint;
+};
+
+
+template<typename T, typename U>
+inline bool operator==(const StdAllocator<T> &a, const StdAllocator<U> &b) {
+    return a.allocator() == b.allocator();
+}
+
+
+template<typename T, typename U>
+inline bool operator!=(const StdAllocator<T> &a, const StdAllocator<U> &b) {
+    return a.allocator() != b.allocator();
+}
+
+
+#ifdef PML_HAS_PMR
+/** A std::pmr::memory_resource which allocates through an Allocator (or, as
+ *  for StdAllocator, the one in effect when it was constructed), for std::pmr
+ *  containers:
+ *
+ *      pml::MemoryResource resource(&arena);
+ *      std::pmr::vector<int> values(&resource);
+ */
+struct MemoryResource: std::pmr::memory_resource {
+
+    explicit MemoryResource(Allocator *a = 0, Hint h = 0):
+        m_alloc(a ? a : ScopedAllocator::current()), m_hint(h) {}
+
+    Allocator *allocator() const { return m_alloc; }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override {
+
+        void *ptr = align > PML_MALLOC_ALIGN ?
+            PML_CALL(aligned_malloc)(align, bytes, m_alloc, m_hint) :
+            PML_CALL(malloc)(bytes, m_alloc, m_hint);
+
+        if(!ptr) {
+            pml_THROW_BAD_ALLOC();
+        }
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, size_t bytes, size_t align) override {
+
+        if(align > PML_MALLOC_ALIGN) {
+            PML_CALL(aligned_free)(ptr, m_alloc, m_hint);
+        } else {
+            PML_CALL(free_sized)(ptr, bytes, m_alloc, m_hint);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+
+        const MemoryResource *resource = dynamic_cast<const MemoryResource*>(&other);
+        return resource && resource->m_alloc == m_alloc;
+    }
+
+private:
+    Allocator *m_alloc;
+    Hint m_hint;
+};
+
+
+/** The other direction: an Allocator which allocates from a
+ *  std::pmr::memory_resource (the default resource, if none is given), so
+ *  that PML code can use memory managed by the standard library. The size of
+ *  each block is kept in a header in front of it, as free() doesn't pass one.
+ */
+struct ResourceAllocator: AllocatorBase<ResourceAllocator> {
+
+    enum { HEADER = PML_MALLOC_ALIGN };
+
+    explicit ResourceAllocator(std::pmr::memory_resource *r = 0):
+        m_resource(r ? r : std::pmr::get_default_resource()) {}
+
+    std::pmr::memory_resource *resource() const { return m_resource; }
+
+    void *malloc(size_t size, Hint h = 0) {
+
+        if(size > static_cast<size_t>(-1) - HEADER) {
+            return 0;
+        }
+
+        char *block;
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+        try {
+            block = static_cast<char*>(m_resource->allocate(size + HEADER, HEADER));
+        } catch(const std::bad_alloc&) {
+            return 0;
+        }
+#else/*__cpp_exceptions || __EXCEPTIONS*/
+        block = static_cast<char*>(m_resource->allocate(size + HEADER, HEADER));
+#endif/*__cpp_exceptions || __EXCEPTIONS*/
+
+        *reinterpret_cast<size_t*>(block) = size;
+        return block + HEADER;
+    }
+
+    void free(void *ptr, Hint h = 0) {
+
+        if(ptr) {
+            char *block = static_cast<char*>(ptr) - HEADER;
+            m_resource->deallocate(
+                block, *reinterpret_cast<size_t*>(block) + HEADER, HEADER);
+        }
+    }
+
+private:
+    std::pmr::memory_resource *m_resource;
 };
+#endif/*PML_HAS_PMR*/
 PML_END_NAMESPACE
 
 
@@ -638,6 +1735,37 @@ inline void *PML_APINAME(realloc)(void *ptr, size_t size, PML_Q_TYPE(Hint) hint)
 }
 
 
+inline void PML_APINAME(free_sized)(void *ptr, size_t size, PML_Q_TYPE(Hint) hint) {
+    PML_CALL(free_sized)(ptr, size, 0, hint);
+}
+
+
+inline void *PML_APINAME(aligned_malloc)(size_t align, size_t size, PML_Q_TYPE(Hint) hint) {
+    return PML_CALL(aligned_malloc)(align, size, 0, hint);
+}
+
+
+inline void PML_APINAME(aligned_free)(void *ptr, PML_Q_TYPE(Hint) hint) {
+    PML_CALL(aligned_free)(ptr, 0, hint);
+}
+
+
+inline size_t PML_APINAME(usable_size)(void *ptr, PML_Q_TYPE(Hint) hint) {
+    return PML_CALL(usable_size)(ptr, 0, hint);
+}
+
+
+inline size_t PML_APINAME(malloc_batch)(size_t count, size_t size, void **out,
+    PML_Q_TYPE(Hint) hint) {
+    return PML_CALL(malloc_batch)(count, size, out, 0, hint);
+}
+
+
+inline void PML_APINAME(free_batch)(void **ptrs, size_t count, PML_Q_TYPE(Hint) hint) {
+    PML_CALL(free_batch)(ptrs, count, 0, hint);
+}
+
+
 #else/*__cplusplus*/
 
 /*----------------------------------------------------------------------------*/
@@ -645,7 +1773,9 @@ inline void *PML_APINAME(realloc)(void *ptr, size_t size, PML_Q_TYPE(Hint) hint)
 
 #ifdef PML_HAS_C99
 /** Variadic macro versions of pml_malloc(), pml_free(), pml_calloc(),
- *  pml_realloc() and pml_init_allocator() which can be used to simulate
+ *  pml_realloc(), pml_free_sized(), pml_aligned_malloc(), pml_aligned_free(),
+ *  pml_usable_size(), pml_malloc_batch(), pml_free_batch() and
+ *  pml_init_allocator() which can be used to simulate
  *  optional/default arguments for these functions.
  *  (On a C11 compiler, we do additional testing with _Generic() to allow the
  *  user to specify just a hint parameter.)
@@ -662,6 +1792,24 @@ inline void *PML_APINAME(realloc)(void *ptr, size_t size, PML_Q_TYPE(Hint) hint)
 #define pml_realloc(...) \
     pml_VA_EXPAND(pml_realloc, __VA_ARGS__)
 
+#define pml_free_sized(...) \
+    pml_VA_EXPAND(pml_free_sized, __VA_ARGS__)
+
+#define pml_aligned_malloc(...) \
+    pml_VA_EXPAND(pml_aligned_malloc, __VA_ARGS__)
+
+#define pml_aligned_free(...) \
+    pml_VA_EXPAND(pml_aligned_free, __VA_ARGS__)
+
+#define pml_usable_size(...) \
+    pml_VA_EXPAND(pml_usable_size, __VA_ARGS__)
+
+#define pml_malloc_batch(...) \
+    pml_VA_EXPAND(pml_malloc_batch, __VA_ARGS__)
+
+#define pml_free_batch(...) \
+    pml_VA_EXPAND(pml_free_batch, __VA_ARGS__)
+
 #define pml_init_allocator(...) \
     pml_VA_EXPAND(pml_init_allocator, __VA_ARGS__)
 
@@ -687,12 +1835,59 @@ inline void *PML_APINAME(realloc)(void *ptr, size_t size, PML_Q_TYPE(Hint) hint)
 #define pml_realloc_4(PTR_, SIZE_, ALLOC_, HINT_) \
     pml_realloc(PTR_, SIZE_, ALLOC_, HINT_)
 
+#define pml_free_sized_2(PTR_, SIZE_) pml_free_sized(PTR_, SIZE_, 0, 0)
+#define pml_free_sized_3(PTR_, SIZE_, ARG_) pml_free_sized_3args(PTR_, SIZE_, ARG_)
+#define pml_free_sized_4(PTR_, SIZE_, ALLOC_, HINT_) \
+    pml_free_sized(PTR_, SIZE_, ALLOC_, HINT_)
+
+#define pml_aligned_malloc_2(ALIGN_, SIZE_) pml_aligned_malloc(ALIGN_, SIZE_, 0, 0)
+#define pml_aligned_malloc_3(ALIGN_, SIZE_, ARG_) \
+    pml_aligned_malloc_3args(ALIGN_, SIZE_, ARG_)
+#define pml_aligned_malloc_4(ALIGN_, SIZE_, ALLOC_, HINT_) \
+    pml_aligned_malloc(ALIGN_, SIZE_, ALLOC_, HINT_)
+
+#define pml_aligned_free_1(PTR_) pml_aligned_free(PTR_, 0, 0)
+#define pml_aligned_free_2(PTR_, ARG_) pml_aligned_free_2args(PTR_, ARG_)
+#define pml_aligned_free_3(PTR_, ALLOC_, HINT_) pml_aligned_free(PTR_, ALLOC_, HINT_)
+
+#define pml_usable_size_1(PTR_) pml_usable_size(PTR_, 0, 0)
+#define pml_usable_size_2(PTR_, ARG_) pml_usable_size_2args(PTR_, ARG_)
+#define pml_usable_size_3(PTR_, ALLOC_, HINT_) pml_usable_size(PTR_, ALLOC_, HINT_)
+
+#define pml_malloc_batch_3(COUNT_, SIZE_, OUT_) \
+    pml_malloc_batch(COUNT_, SIZE_, OUT_, 0, 0)
+#define pml_malloc_batch_4(COUNT_, SIZE_, OUT_, ARG_) \
+    pml_malloc_batch_4args(COUNT_, SIZE_, OUT_, ARG_)
+#define pml_malloc_batch_5(COUNT_, SIZE_, OUT_, ALLOC_, HINT_) \
+    pml_malloc_batch(COUNT_, SIZE_, OUT_, ALLOC_, HINT_)
+
+#define pml_free_batch_2(PTRS_, COUNT_) pml_free_batch(PTRS_, COUNT_, 0, 0)
+#define pml_free_batch_3(PTRS_, COUNT_, ARG_) pml_free_batch_3args(PTRS_, COUNT_, ARG_)
+#define pml_free_batch_4(PTRS_, COUNT_, ALLOC_, HINT_) \
+    pml_free_batch(PTRS_, COUNT_, ALLOC_, HINT_)
+
 #define pml_init_allocator_3(ALLOC_, MALLOC_, FREE_) \
-    pml_init_allocator(ALLOC_, MALLOC_, FREE_, 0, 0)
+    pml_init_allocator(ALLOC_, MALLOC_, FREE_, 0, 0, 0, 0, 0, 0, 0, 0, 0)
 #define pml_init_allocator_4(ALLOC_, MALLOC_, FREE_, CALLOC_) \
-    pml_init_allocator(ALLOC_, MALLOC_, FREE_, CALLOC_, 0)
+    pml_init_allocator(ALLOC_, MALLOC_, FREE_, CALLOC_, 0, 0, 0, 0, 0, 0, 0, 0)
 #define pml_init_allocator_5(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_) \
-    pml_init_allocator(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_)
+    pml_init_allocator(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_, \
+        0, 0, 0, 0, 0, 0, 0)
+#define pml_init_allocator_6(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_, FSIZED_) \
+    pml_init_allocator(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_, FSIZED_, \
+        0, 0, 0, 0, 0, 0)
+#define pml_init_allocator_8(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_, FSIZED_, \
+    AMALLOC_, AFREE_) \
+    pml_init_allocator(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_, FSIZED_, \
+        AMALLOC_, AFREE_, 0, 0, 0, 0)
+#define pml_init_allocator_10(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_, FSIZED_, \
+    AMALLOC_, AFREE_, USIZE_, EXPAND_) \
+    pml_init_allocator(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_, FSIZED_, \
+        AMALLOC_, AFREE_, USIZE_, EXPAND_, 0, 0)
+#define pml_init_allocator_12(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_, FSIZED_, \
+    AMALLOC_, AFREE_, USIZE_, EXPAND_, MBATCH_, FBATCH_) \
+    pml_init_allocator(ALLOC_, MALLOC_, FREE_, CALLOC_, REALLOC_, FSIZED_, \
+        AMALLOC_, AFREE_, USIZE_, EXPAND_, MBATCH_, FBATCH_)
 
 
 #ifdef PML_HAS_C11
@@ -717,6 +1912,30 @@ inline void *PML_APINAME(realloc)(void *ptr, size_t size, PML_Q_TYPE(Hint) hint)
     PmlAllocator*: pml_realloc(PTR_, SIZE_, ARG_, 0), \
     default: pml_realloc(PTR_, SIZE_, 0, ARG_))
 
+#define pml_free_sized_3args(PTR_, SIZE_, ARG_) _Generic((ARG_), \
+    PmlAllocator*: pml_free_sized(PTR_, SIZE_, ARG_, 0), \
+    default: pml_free_sized(PTR_, SIZE_, 0, ARG_))
+
+#define pml_aligned_malloc_3args(ALIGN_, SIZE_, ARG_) _Generic((ARG_), \
+    PmlAllocator*: pml_aligned_malloc(ALIGN_, SIZE_, ARG_, 0), \
+    default: pml_aligned_malloc(ALIGN_, SIZE_, 0, ARG_))
+
+#define pml_aligned_free_2args(PTR_, ARG_) _Generic((ARG_), \
+    PmlAllocator*: pml_aligned_free(PTR_, ARG_, 0), \
+    default: pml_aligned_free(PTR_, 0, ARG_))
+
+#define pml_usable_size_2args(PTR_, ARG_) _Generic((ARG_), \
+    PmlAllocator*: pml_usable_size(PTR_, ARG_, 0), \
+    default: pml_usable_size(PTR_, 0, ARG_))
+
+#define pml_malloc_batch_4args(COUNT_, SIZE_, OUT_, ARG_) _Generic((ARG_), \
+    PmlAllocator*: pml_malloc_batch(COUNT_, SIZE_, OUT_, ARG_, 0), \
+    default: pml_malloc_batch(COUNT_, SIZE_, OUT_, 0, ARG_))
+
+#define pml_free_batch_3args(PTRS_, COUNT_, ARG_) _Generic((ARG_), \
+    PmlAllocator*: pml_free_batch(PTRS_, COUNT_, ARG_, 0), \
+    default: pml_free_batch(PTRS_, COUNT_, 0, ARG_))
+
 #else/*PML_HAS_C11*/
 
 /* If we don't have C11, then you'll just have to specify a null ALLOC_ before
@@ -726,6 +1945,15 @@ inline void *PML_APINAME(realloc)(void *ptr, size_t size, PML_Q_TYPE(Hint) hint)
 #define pml_free_2args(PTR_, ALLOC_) pml_free(PTR_, ALLOC_, 0)
 #define pml_calloc_3args(COUNT_, SIZE_, ALLOC_) pml_calloc(COUNT_, SIZE_, ALLOC_, 0)
 #define pml_realloc_3args(PTR_, SIZE_, ALLOC_) pml_realloc(PTR_, SIZE_, ALLOC_, 0)
+#define pml_free_sized_3args(PTR_, SIZE_, ALLOC_) pml_free_sized(PTR_, SIZE_, ALLOC_, 0)
+#define pml_aligned_malloc_3args(ALIGN_, SIZE_, ALLOC_) \
+    pml_aligned_malloc(ALIGN_, SIZE_, ALLOC_, 0)
+#define pml_aligned_free_2args(PTR_, ALLOC_) pml_aligned_free(PTR_, ALLOC_, 0)
+#define pml_usable_size_2args(PTR_, ALLOC_) pml_usable_size(PTR_, ALLOC_, 0)
+#define pml_malloc_batch_4args(COUNT_, SIZE_, OUT_, ALLOC_) \
+    pml_malloc_batch(COUNT_, SIZE_, OUT_, ALLOC_, 0)
+#define pml_free_batch_3args(PTRS_, COUNT_, ALLOC_) \
+    pml_free_batch(PTRS_, COUNT_, ALLOC_, 0)
 
 #endif/*PML_HAS_C11*/
 #endif/*PML_HAS_C99*/
@@ -24,6 +24,21 @@
 #endif/*PML_HAS_CPP11*/
 #endif/*__cplusplus >= 201103L*/
 
+#if __cplusplus >= 201703L
+#ifndef PML_HAS_CPP17
+#define PML_HAS_CPP17 /* C++17 */
+#endif/*PML_HAS_CPP17*/
+#endif/*__cplusplus >= 201703L*/
+
+/* std::pmr needs library support as well as C++17. */
+#if defined(PML_HAS_CPP17) && defined(__has_include)
+#if __has_include(<memory_resource>)
+#ifndef PML_HAS_PMR
+#define PML_HAS_PMR /* std::pmr::memory_resource */
+#endif/*PML_HAS_PMR*/
+#endif/*__has_include(<memory_resource>)*/
+#endif/*PML_HAS_CPP17 && __has_include*/
+
 #if __STDC_VERSION__ >= 199901L
 #ifndef PML_HAS_C99
 #define PML_HAS_C99 /* C99 */
@@ -43,9 +58,16 @@
 #include <stddef.h> /* for size_t */
 #include <stdbool.h> /* for bool/true/false (C99) */
 #include <assert.h>
+#ifdef __cplusplus
+#include <new> /* for std::bad_alloc */
+#endif/*__cplusplus*/
 #ifdef PML_HAS_CPP11
+#include <type_traits> /* for std::is_trivially_*() */
 #include <utility> /* for std::forward() */
 #endif/*PML_HAS_CPP11*/
+#ifdef PML_HAS_PMR
+#include <memory_resource> /* for std::pmr::memory_resource */
+#endif/*PML_HAS_PMR*/
 
 #ifndef PML_MALLOC_H
 #error "Please use \"pml/malloc.h\", don't include this directly"
@@ -62,6 +84,20 @@
 #endif/*PML_NO_DEBUG_HOOK_S*/
 #endif/*PML_DEBUG_HOOK_S*/
 
+/* Enable USDT probes at each debug event (where <sys/sdt.h> is available,
+ * unless PML_NO_USDT_S is defined) */
+#ifndef PML_USDT_S
+#if !defined(PML_NO_USDT_S) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PML_USDT_S
+#endif/*__has_include(<sys/sdt.h>)*/
+#endif/*!PML_NO_USDT_S && __has_include*/
+#endif/*PML_USDT_S*/
+
+#ifdef PML_USDT_S
+#include <sys/sdt.h>
+#endif/*PML_USDT_S*/
+
 /* Enable assert hook (unless PML_NO_ASSERT_HOOK_S is defined) */
 #ifndef PML_ASSERT_HOOK_S
 #ifndef PML_NO_ASSERT_HOOK_S
@@ -76,6 +112,19 @@
 #endif/*PML_NO_HINT_S*/
 #endif/*PML_HINT_S*/
 
+/* Intern hints as dense callsite ids (only if PML_HINT_ID_S is defined, and
+ * the compiler supports it - see "Hint ids" in pml/malloc.h) */
+#ifdef PML_HINT_ID_S
+#if !defined(__GNUC__) || (!defined(__cplusplus) && !defined(__ELF__))
+#undef PML_HINT_ID_S
+#endif/*!__GNUC__ || (!__cplusplus && !__ELF__)*/
+#endif/*PML_HINT_ID_S*/
+
+/* Maximum number of callsite ids registered at runtime (from C++) */
+#ifndef PML_HINT_IDS
+#define PML_HINT_IDS 4096
+#endif/*PML_HINT_IDS*/
+
 /* Enable checks (unless PML_NO_CHECK_S is defined) */
 #ifndef PML_CHECK_S
 #ifndef PML_NO_CHECK_S
@@ -94,6 +143,23 @@
 #endif/*PML_NO_EMPTY_NEW_S*/
 #endif/*PML_EMPTY_NEW_S*/
 
+/* Alignment which malloc() (and any Allocator's malloc hook) is relied upon to
+ * provide. pml_new() uses aligned_malloc() for types needing more than this.
+ */
+#ifndef PML_MALLOC_ALIGN
+#define PML_MALLOC_ALIGN (2 * sizeof(void*))
+#endif/*PML_MALLOC_ALIGN*/
+
+/* Requests of at least this many bytes to the default hooks are mapped directly
+ * from the OS, where supported (see pml_set_mmap_threshold()). PML_MMAP_MIN is
+ * the smallest threshold allowed.
+ */
+#ifndef PML_MMAP_THRESHOLD
+#define PML_MMAP_THRESHOLD (1024 * 1024)
+#endif/*PML_MMAP_THRESHOLD*/
+
+#define PML_MMAP_MIN (64 * 1024)
+
 
 /*----------------------------------------------------------------------------*/
 /* API namespace - contains every type and enum value in C++
@@ -112,13 +178,51 @@
 #endif/*PML_TYPE_NAMESPACE*/
 
 
-/* Option to remove the debug hook from release code */
+/* Bit for a DebugHookType in the debug event mask (e.g.
+ * PML_DEBUG_EVENT(MALLOC) | PML_DEBUG_EVENT(FREE)).
+ */
+#define PML_DEBUG_EVENT(TYPE_) (1u << PML_Q_NAME(TYPE_))
+
+/* All debug events. */
+#define PML_DEBUG_EVENTS_ALL (~0u)
+
+/* USDT probe for a debug event (provider "pml", named after the event type).
+ * This is a nop until a tracer attaches to it, and doesn't depend on the debug
+ * hook being compiled in or enabled.
+ */
+#ifdef PML_USDT_S
+#define pml_USDT_PROBE(TYPE_, COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_) \
+    STAP_PROBE6(pml, TYPE_, COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_)
+#else/*PML_USDT_S*/
+#define pml_USDT_PROBE(TYPE_, COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_) \
+    ((void)0)
+#endif/*PML_USDT_S*/
+
+/* Relaxed load of the debug event mask. */
+#ifdef __GNUC__
+#define pml_DEBUG_EVENTS_LOAD() \
+    __atomic_load_n(&PML_CALL(debug_events_), __ATOMIC_RELAXED)
+#else/*__GNUC__*/
+#define pml_DEBUG_EVENTS_LOAD() \
+    (*(volatile const unsigned*)&PML_CALL(debug_events_))
+#endif/*__GNUC__*/
+
+/* Option to remove the debug hook from release code. Otherwise, the hook is
+ * only called for events in the mask (which is empty while no hook is set).
+ */
 #ifdef PML_DEBUG_HOOK_S
 #define PML_DEBUG_HOOK(TYPE_, COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_) \
-    (PML_CALL(debug_hook)(PML_Q_NAME(TYPE_), COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_))
+    do { \
+        pml_USDT_PROBE(TYPE_, COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_); \
+        if(pml_DEBUG_EVENTS_LOAD() & PML_DEBUG_EVENT(TYPE_)) { \
+            PML_CALL(debug_hook)(PML_Q_NAME(TYPE_), \
+                COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_); \
+        } \
+    } while(0)
 
 #else/*PML_DEBUG_HOOK_S*/
-#define PML_DEBUG_HOOK(TYPE_, COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_)
+#define PML_DEBUG_HOOK(TYPE_, COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_) \
+    pml_USDT_PROBE(TYPE_, COUNT_, SIZE_, PTR_, IN_, ALLOC_, HINT_)
 #endif/*PML_DEBUG_HOOK_S*/
 
 /* Assert macro */
@@ -134,7 +238,9 @@
 #endif/*PML_ASSERT_HOOK_S*/
 
 
-#ifdef PML_HINT_S
+#if defined(PML_HINT_S) && defined(PML_HINT_ID_S)
+#define PML_HINT(HINT_) pml_MAKE_HINT_ID_0(HINT_, __FILE__, __LINE__)
+#elif defined(PML_HINT_S)
 #define PML_HINT(HINT_) pml_MAKE_HINT_0(HINT_, __FILE__, __LINE__)
 #else/*PML_HINT_S*/
 #define PML_HINT(HINT_) 0
@@ -200,6 +306,37 @@
 #define PML_NEW_PARAM(NAME_) const NAME_&
 #endif//PML_NEW_BY_VALUE
 
+/* Alignment of type T. */
+#ifdef PML_HAS_CPP11
+#define PML_ALIGNOF(T_) alignof(T_)
+#elif defined(_MSC_VER)
+#define PML_ALIGNOF(T_) __alignof(T_)
+#else/*PML_HAS_CPP11*/
+#define PML_ALIGNOF(T_) __alignof__(T_)
+#endif/*PML_HAS_CPP11*/
+
+/* Is T a polymorphic class? (If we can't tell, assume it might be.) */
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define PML_IS_POLYMORPHIC(T_) __is_polymorphic(T_)
+#else/*__GNUC__ || _MSC_VER*/
+#define PML_IS_POLYMORPHIC(T_) true
+#endif/*__GNUC__ || _MSC_VER*/
+
+/* Can a T be default constructed/destroyed without running any code? (If we
+ * can't tell, assume not.)
+ */
+#ifdef PML_HAS_CPP11
+#define PML_IS_TRIVIALLY_CONSTRUCTIBLE(T_) \
+    std::is_trivially_default_constructible<T_>::value
+#define PML_IS_TRIVIALLY_DESTRUCTIBLE(T_) std::is_trivially_destructible<T_>::value
+#elif defined(__GNUC__) || defined(_MSC_VER)
+#define PML_IS_TRIVIALLY_CONSTRUCTIBLE(T_) __has_trivial_constructor(T_)
+#define PML_IS_TRIVIALLY_DESTRUCTIBLE(T_) __has_trivial_destructor(T_)
+#else/*PML_HAS_CPP11*/
+#define PML_IS_TRIVIALLY_CONSTRUCTIBLE(T_) false
+#define PML_IS_TRIVIALLY_DESTRUCTIBLE(T_) false
+#endif/*PML_HAS_CPP11*/
+
 #else/*__cplusplus*/
 
 /* C specifics */
@@ -265,8 +402,8 @@ inline void *operator new(size_t size, const PML_Q_TYPE(Placement) &p) {
 #define pml_JOIN3(A, B, C) pml_JOIN(A, pml_JOIN(B, C))
 
 /** Count (the number of commas plus one in) __VA_ARGS__.
- *  We support up to 12 args for now, the max we actually need is 5, but there's
- *  some room for future expansion.
+ *  We support up to 12 args for now, which is exactly what pml_init_allocator()
+ *  needs, so adding any more hooks means extending this.
  */
 #define pml_VA_COUNT(...) pml_VA_COUNT_0(__VA_ARGS__)
 
@@ -293,4 +430,26 @@ inline void *operator new(size_t size, const PML_Q_TYPE(Placement) &p) {
 #define pml_MAKE_HINT_0(H_, F_, L_) pml_MAKE_HINT_1(H_, F_, L_)
 #define pml_MAKE_HINT_1(H_, F_, L_) (F_ "(" #L_ "): \"" H_ "\"")
 
+/* In C, each callsite's record is placed in the pml_hints section, and the
+ * linker gathers them into one array - so a record's index is its id (from 1).
+ * A C++ callsite in an inline function or template can't share that section
+ * (its record belongs to a COMDAT group), so C++ callsites register their ids
+ * on first use instead.
+ */
+#define pml_MAKE_HINT_ID_0(H_, F_, L_) pml_MAKE_HINT_ID_1(H_, F_, L_)
+
+#ifdef __cplusplus
+#define pml_MAKE_HINT_ID_1(H_, F_, L_) (__extension__({ \
+    static const PML_Q_TYPE(Hint) pml_hint_id_ = \
+        PML_CALL(hint_register_)(pml_MAKE_HINT_1(H_, F_, L_)); \
+    pml_hint_id_; }))
+
+#else/*__cplusplus*/
+#define pml_MAKE_HINT_ID_1(H_, F_, L_) (__extension__({ \
+    static PML_Q_TYPE(HintSite) pml_hint_site_ \
+        __attribute__((section("pml_hints"), used)) = { \
+            pml_MAKE_HINT_1(H_, F_, L_) }; \
+    (PML_Q_TYPE(Hint))(size_t)(&pml_hint_site_ - __start_pml_hints + 1); }))
+#endif/*__cplusplus*/
+
 #endif/*PML_MALLOC_IMPL_H*/
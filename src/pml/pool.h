@@ -0,0 +1,302 @@
+#ifndef PML_POOL_H
+#define PML_POOL_H
+
+/** \file pml/pool.h
+ *  Fixed-size object pools (C++ only).
+ *
+ *  A pool serves blocks of a single size from slabs, which are allocated from a
+ *  parent allocator (the global hooks by default, even inside a ScopedAllocator)
+ *  and carved into an intrusive free list. Allocating and freeing a block are
+ *  O(1) list operations, and the parent is only called when a new slab is
+ *  needed:
+ *
+ *      pml::Pool<Node> pool;
+ *
+ *      Node *n = pml_new<Node>(&pool)(a, b);
+ *      ...
+ *      pml_delete(&pool)(n);
+ *
+ *  Pool<T> is sized for single pml_new<T>() allocations, including the count
+ *  word which is written when PML_CHECK_S is enabled (#define PML_NO_CHECK_S to
+ *  drop it). FixedPool<SIZE, ALIGN> can be used directly for raw blocks.
+ *  Requests larger than the block size fail.
+ *
+ *  Slabs are kept until trim() is called, or the pool is destroyed. Pools are
+ *  not thread-safe.
+ */
+
+#include "pml/malloc.h"
+
+#ifdef __cplusplus
+
+PML_BEGIN_NAMESPACE
+/** Pool statistics, as returned by FixedPool::stats(). */
+struct PoolStats {
+    size_t block_size; /* bytes per block */
+    size_t slab_blocks; /* blocks per slab */
+    size_t slabs; /* slabs currently held */
+    size_t peak_slabs; /* highest number of slabs held at once */
+    size_t grows; /* slabs allocated */
+    size_t shrinks; /* slabs released by trim() */
+    size_t in_use; /* blocks currently allocated */
+    size_t peak_in_use; /* highest number of blocks allocated at once */
+};
+
+
+template<size_t SIZE, size_t ALIGN = sizeof(void*)>
+struct FixedPool: IAllocator {
+
+    /** Size of each block - at least SIZE, and big enough for a link pointer. */
+    enum { BLOCK_SIZE =
+        ((SIZE < sizeof(void*) ? sizeof(void*) : SIZE) + (ALIGN - 1)) & ~(ALIGN - 1) };
+
+    /* (the rounding above needs ALIGN to be a power of two, and each block
+     * holds a link pointer, so must be aligned for one) */
+    typedef char align_must_be_a_power_of_two_no_less_than_a_pointer[
+        (ALIGN & (ALIGN - 1)) || ALIGN < sizeof(void*) ? -1 : 1];
+
+    /** Default slab size, in bytes. */
+    enum { SLAB_SIZE = 16384 };
+
+    /** slab_blocks is the number of blocks carved from each slab (0 picks a
+     *  number which fills roughly SLAB_SIZE bytes).
+     */
+    explicit FixedPool(size_t slab_blocks = 0,
+        Allocator *parent = 0, Hint hint = 0):
+        m_parent(parent ? parent : PML_CALL(global_allocator)()),
+        m_hint(hint),
+        m_slabs(0),
+        m_free(0) {
+
+        if(!slab_blocks) {
+            slab_blocks = SLAB_SIZE / BLOCK_SIZE;
+        }
+
+        m_stats.block_size = BLOCK_SIZE;
+        m_stats.slab_blocks = slab_blocks ? slab_blocks : 1;
+        m_stats.slabs = 0;
+        m_stats.peak_slabs = 0;
+        m_stats.grows = 0;
+        m_stats.shrinks = 0;
+        m_stats.in_use = 0;
+        m_stats.peak_in_use = 0;
+    }
+
+    virtual ~FixedPool() {
+        while(m_slabs) {
+            Slab *next = m_slabs->next;
+            PML_CALL(free)(m_slabs, m_parent, m_hint);
+            m_slabs = next;
+        }
+    }
+
+    virtual void *malloc(size_t size, Hint h = 0) {
+        PML_ASSERT(size <= BLOCK_SIZE);
+
+        if(size > BLOCK_SIZE || (!m_free && !grow())) {
+            return 0;
+        }
+
+        Link *block = m_free;
+        m_free = block->next;
+
+        if(++m_stats.in_use > m_stats.peak_in_use) {
+            m_stats.peak_in_use = m_stats.in_use;
+        }
+
+        return block;
+    }
+
+    virtual void free(void *ptr, Hint h = 0) {
+        if(ptr) {
+            Link *block = static_cast<Link*>(ptr);
+            block->next = m_free;
+            m_free = block;
+            m_stats.in_use--;
+        }
+    }
+
+    /* Pops up to count blocks, growing as often as needed. */
+    virtual size_t malloc_batch(size_t count, size_t size, void **out, Hint h = 0) {
+        PML_ASSERT(size <= BLOCK_SIZE);
+
+        size_t done = 0;
+
+        while( size <= BLOCK_SIZE && done < count &&
+            (m_free || grow()) ) {
+
+            Link *block = m_free;
+            m_free = block->next;
+            out[done++] = block;
+        }
+
+        if((m_stats.in_use += done) > m_stats.peak_in_use) {
+            m_stats.peak_in_use = m_stats.in_use;
+        }
+
+        return done;
+    }
+
+    /* Blocks can't change size, so realloc() succeeds in place or not at all. */
+    virtual void *realloc(void *ptr, size_t size, Hint h = 0) {
+        if(!ptr) {
+            return malloc(size, h);
+        }
+        if(!size) {
+            free(ptr, h);
+            return 0;
+        }
+        return try_expand(ptr, size, h) ? ptr : 0;
+    }
+
+    virtual size_t usable_size(void *ptr, Hint h = 0) {
+        return BLOCK_SIZE;
+    }
+
+    virtual bool try_expand(void *ptr, size_t size, Hint h = 0) {
+        return size <= BLOCK_SIZE;
+    }
+
+    /* Every block is aligned to ALIGN, so that's all we can offer. */
+    virtual void *aligned_malloc(size_t align, size_t size, Hint h = 0) {
+        PML_ASSERT(align <= ALIGN);
+        return align <= ALIGN ? malloc(size, h) : 0;
+    }
+
+    virtual void aligned_free(void *ptr, Hint h = 0) {
+        free(ptr, h);
+    }
+
+    /** Return slabs with no blocks in use to the parent allocator. This walks
+     *  the whole free list for each slab, so it is intended to be called
+     *  occasionally (e.g. after a burst of activity), not on a hot path.
+     *  Returns the number of slabs released.
+     */
+    size_t trim() {
+        size_t released = 0;
+        Slab **link = &m_slabs;
+
+        while(Slab *slab = *link) {
+            char *begin = data(slab);
+            char *end = begin + m_stats.slab_blocks * BLOCK_SIZE;
+            size_t unused = 0;
+
+            for(Link *b = m_free; b; b = b->next) {
+                char *p = reinterpret_cast<char*>(b);
+                unused += (p >= begin && p < end);
+            }
+
+            if(unused < m_stats.slab_blocks) {
+                link = &slab->next;
+                continue;
+            }
+
+            /* unlink this slab's blocks from the free list, then release it */
+            Link **f = &m_free;
+            while(*f) {
+                char *p = reinterpret_cast<char*>(*f);
+                if(p >= begin && p < end) {
+                    *f = (*f)->next;
+                } else {
+                    f = &(*f)->next;
+                }
+            }
+
+            *link = slab->next;
+            PML_CALL(free)(slab, m_parent, m_hint);
+            m_stats.slabs--;
+            m_stats.shrinks++;
+            released++;
+        }
+
+        return released;
+    }
+
+    const PoolStats &stats() const {
+        return m_stats;
+    }
+
+private:
+    struct Link {
+        Link *next;
+    };
+
+    struct Slab {
+        Slab *next;
+    };
+
+    Allocator *m_parent;
+    Hint m_hint;
+    Slab *m_slabs; /* all slabs, most recent first */
+    Link *m_free; /* free blocks, most recently freed first */
+    PoolStats m_stats;
+
+    FixedPool(const FixedPool&);
+    FixedPool &operator=(const FixedPool&);
+
+    /* First block in a slab. Slabs are over-allocated by ALIGN - 1 bytes, as the
+     * parent only guarantees malloc() alignment.
+     */
+    static char *data(Slab *slab) {
+        size_t p = reinterpret_cast<size_t>(slab + 1);
+        return reinterpret_cast<char*>((p + (ALIGN - 1)) & ~(ALIGN - 1));
+    }
+
+    bool grow() {
+        size_t count = m_stats.slab_blocks;
+        size_t bytes = sizeof(Slab) + (ALIGN - 1) + count * BLOCK_SIZE;
+
+        Slab *slab = static_cast<Slab*>(PML_CALL(malloc)(bytes, m_parent, m_hint));
+        if(!slab) {
+            return false;
+        }
+
+        slab->next = m_slabs;
+        m_slabs = slab;
+
+        /* thread the blocks onto the free list, lowest address first */
+        char *p = data(slab) + count * BLOCK_SIZE;
+        for(size_t i = 0; i < count; i++) {
+            p -= BLOCK_SIZE;
+            Link *block = reinterpret_cast<Link*>(p);
+            block->next = m_free;
+            m_free = block;
+        }
+
+        m_stats.grows++;
+        if(++m_stats.slabs > m_stats.peak_slabs) {
+            m_stats.peak_slabs = m_stats.slabs;
+        }
+
+        return true;
+    }
+};
+
+
+/** Block size and alignment needed for a single pml_new<T>() allocation. */
+template<typename T>
+struct PoolBlock {
+#ifdef PML_CHECK_S
+    enum { SIZE = NewLayout<T>::HEADER + sizeof(T) }; /* count + object */
+#else/*PML_CHECK_S*/
+    enum { SIZE = sizeof(T) };
+#endif/*PML_CHECK_S*/
+    enum { ALIGN = static_cast<size_t>(NewLayout<T>::ALIGN) > sizeof(void*) ?
+        static_cast<size_t>(NewLayout<T>::ALIGN) : sizeof(void*) };
+};
+
+
+/** A FixedPool sized for objects of type T allocated with pml_new<T>().
+ */
+template<typename T>
+struct Pool: FixedPool<PoolBlock<T>::SIZE, PoolBlock<T>::ALIGN> {
+
+    explicit Pool(size_t slab_blocks = 0, Allocator *parent = 0, Hint hint = 0):
+        FixedPool<PoolBlock<T>::SIZE, PoolBlock<T>::ALIGN>(
+            slab_blocks, parent, hint) {}
+};
+PML_END_NAMESPACE
+
+#endif/*__cplusplus*/
+
+#endif/*PML_POOL_H*/
@@ -0,0 +1,436 @@
+#include "pml/profile.h"
+#include "pml/sys_impl.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __GLIBC__
+#include <execinfo.h> /* for backtrace() */
+#endif/*__GLIBC__*/
+#ifndef _WIN32
+#include <fcntl.h>
+#endif/*_WIN32*/
+
+/*----------------------------------------------------------------------------*/
+/* Constants */
+
+enum {
+    /* Number of distinct callstacks (a sample with a new stack is dropped
+     * once they're all used). */
+    PF_BUCKETS = 8192,
+    PF_BUCKET_SLOTS = 2 * PF_BUCKETS, /* (a power of two) */
+
+    /* Capacity of the live sample table (a power of two), which is kept at
+     * most 3/4 full - later samples are dropped. */
+    PF_SAMPLES = 65536,
+    PF_MAX_LIVE = PF_SAMPLES / 4 * 3,
+
+    /* Frames belonging to the profiler (profile_sample_(), and the PML entry
+     * point which called it). */
+    PF_SKIP = 2,
+};
+
+
+/*----------------------------------------------------------------------------*/
+/* State */
+
+/** Sampled allocations from one callstack.
+ */
+typedef struct PfBucket {
+
+    uint64_t hash;
+    uint64_t alloc_objs;
+    uint64_t alloc_bytes;
+    uint64_t inuse_objs;
+    uint64_t inuse_bytes;
+    size_t depth;
+    void *pcs[PML_PROFILE_DEPTH];
+
+} PfBucket;
+
+
+/** A live sample, in an open addressed table keyed by pointer.
+ */
+typedef struct PfSample {
+
+    void *ptr; /* 0 for an empty slot */
+    size_t size;
+    size_t bucket;
+
+} PfSample;
+
+
+/** Everything the profiler keeps, mapped from the OS so that we don't touch
+ *  the heap being profiled (the pages are only committed as they're used).
+ *  All of it is guarded by s_pf_lock, except for the filter - which counts the
+ *  samples in each home slot of the sample table, so most frees can see they
+ *  weren't sampled with a relaxed load.
+ */
+typedef struct PfState {
+
+    size_t buckets;
+    uint32_t bucket_slots[PF_BUCKET_SLOTS]; /* bucket index + 1, or 0 */
+    PfBucket bucket[PF_BUCKETS];
+    uint16_t filter[PF_SAMPLES];
+    PfSample samples[PF_SAMPLES];
+
+} PfState;
+
+
+size_t pml_profile_rate_;
+size_t pml_profile_live_;
+
+static PfState *s_pf;
+static size_t s_pf_rate = PML_PROFILE_RATE; /* last rate, for the profile */
+static pml_Mutex s_pf_lock = pml_MUTEX_INIT;
+
+/* Set while a thread is inside the profiler, so that any allocations made
+ * by backtrace() or stdio (which may come back through PML) are ignored. */
+static pml_TLS bool s_pf_busy;
+
+static pml_TLS uint64_t s_pf_random;
+
+
+static inline size_t pf_slot(const void *ptr) {
+
+    return (size_t)((((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ull) >> 48)
+        & (PF_SAMPLES - 1);
+}
+
+
+static size_t pf_state_bytes() {
+
+    return pml_ALIGN_UP(sizeof(PfState), 4096);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Sampling interval */
+
+static uint64_t pf_random() {
+
+    uint64_t x = s_pf_random;
+
+    if(!x) {
+        x = pml_now_ns() ^ (uint64_t)(uintptr_t)&s_pf_random;
+        x |= 1;
+    }
+
+    /* xorshift64* */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    s_pf_random = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+
+/** Bytes until the next sample - an exponential variate with mean rate, so
+ *  that the samples form a Poisson process over the allocated bytes. This is
+ *  -ln(u) * rate, for u uniform in (0, 1], with log2() approximated by the
+ *  exponent and a quadratic in the mantissa (which is plenty, here), so we
+ *  don't need libm.
+ */
+static int64_t pf_interval(size_t rate) {
+
+    uint32_t q = (uint32_t)(pf_random() >> 32) | 1; /* u = q / 2^32 */
+
+    int e = 31 - __builtin_clz(q);
+    double m = (double)(q - (1u << e)) / (double)(1u << e); /* [0, 1) */
+    double log2q = e + m * (1.3465 - 0.3465 * m);
+
+    return (int64_t)((32.0 - log2q) * 0.6931471805599453 * (double)rate) + 1;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Buckets and samples */
+
+static size_t pf_capture(void **pcs) {
+
+#ifdef __GLIBC__
+    void *frames[PML_PROFILE_DEPTH + PF_SKIP];
+    int depth = backtrace(frames, PML_PROFILE_DEPTH + PF_SKIP);
+
+    if(depth <= PF_SKIP) {
+        return 0;
+    }
+
+    memcpy(pcs, frames + PF_SKIP, (size_t)(depth - PF_SKIP) * sizeof(void*));
+    return (size_t)(depth - PF_SKIP);
+#else/*__GLIBC__*/
+    (void)pcs;
+    return 0;
+#endif/*__GLIBC__*/
+}
+
+
+/** Find (or add) the bucket for a callstack. Called with s_pf_lock held. */
+static PfBucket *pf_bucket(PfState *s, void **pcs, size_t depth) {
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for(size_t i = 0; i < depth; i++) {
+        hash = (hash ^ (uint64_t)(uintptr_t)pcs[i]) * 0x100000001b3ull;
+    }
+
+    for(size_t n = 0; n < PF_BUCKET_SLOTS; n++) {
+        uint32_t *slot = &s->bucket_slots[(hash + n) & (PF_BUCKET_SLOTS - 1)];
+
+        if(!*slot) {
+            if(s->buckets == PF_BUCKETS) {
+                return 0;
+            }
+
+            PfBucket *b = &s->bucket[s->buckets++];
+            b->hash = hash;
+            b->depth = depth;
+            memcpy(b->pcs, pcs, depth * sizeof(void*));
+
+            *slot = (uint32_t)s->buckets;
+            return b;
+        }
+
+        PfBucket *b = &s->bucket[*slot - 1];
+        if( b->hash == hash && b->depth == depth &&
+            !memcmp(b->pcs, pcs, depth * sizeof(void*)) ) {
+
+            return b;
+        }
+    }
+
+    return 0;
+}
+
+
+/** Remove the sample in slot i, shifting back any later entries in its probe
+ *  sequence (so the table never needs tombstones). Called with s_pf_lock held.
+ */
+static void pf_remove(PfState *s, size_t i) {
+
+    size_t j = i;
+
+    for(;;) {
+        j = (j + 1) & (PF_SAMPLES - 1);
+
+        if(!s->samples[j].ptr) {
+            break;
+        }
+
+        /* move j into the hole, unless its home slot lies in (i, j] */
+        size_t home = pf_slot(s->samples[j].ptr);
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+
+        if(!stays) {
+            s->samples[i] = s->samples[j];
+            i = j;
+        }
+    }
+
+    s->samples[i].ptr = 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Internal */
+
+int64_t PML_APINAME(profile_sample_)(void *ptr, size_t size,
+    PML_TYPE(Hint) hint) {
+
+    (void)hint;
+
+    size_t rate = pml_LOAD(&pml_profile_rate_);
+    PfState *s = pml_LOAD_ACQ(&s_pf);
+
+    if(!rate || !s || s_pf_busy) {
+        return rate ? pf_interval(rate) : 0;
+    }
+
+    s_pf_busy = true;
+
+    void *pcs[PML_PROFILE_DEPTH];
+    size_t depth = pf_capture(pcs);
+
+    pml_LOCK(&s_pf_lock);
+
+    PfBucket *b;
+
+    if(pml_LOAD(&pml_profile_live_) < PF_MAX_LIVE &&
+        (b = pf_bucket(s, pcs, depth))) {
+
+        size_t i = pf_slot(ptr);
+        size_t home = i;
+
+        while(s->samples[i].ptr) {
+            i = (i + 1) & (PF_SAMPLES - 1);
+        }
+
+        s->samples[i].ptr = ptr;
+        s->samples[i].size = size;
+        s->samples[i].bucket = (size_t)(b - s->bucket);
+
+        b->alloc_objs++;
+        b->alloc_bytes += size;
+        b->inuse_objs++;
+        b->inuse_bytes += size;
+
+        pml_STORE(&s->filter[home], (uint16_t)(s->filter[home] + 1));
+        pml_STORE(&pml_profile_live_, pml_profile_live_ + 1);
+    }
+
+    pml_UNLOCK(&s_pf_lock);
+
+    s_pf_busy = false;
+
+    return pf_interval(rate);
+}
+
+
+void PML_APINAME(profile_forget_)(void *ptr) {
+
+    PfState *s = pml_LOAD_ACQ(&s_pf);
+    size_t home = pf_slot(ptr);
+
+    if(!s || s_pf_busy || !pml_LOAD(&s->filter[home])) {
+        return;
+    }
+
+    pml_LOCK(&s_pf_lock);
+
+    for(size_t i = home; s->samples[i].ptr; i = (i + 1) & (PF_SAMPLES - 1)) {
+        PfSample *sample = &s->samples[i];
+
+        if(sample->ptr == ptr) {
+            PfBucket *b = &s->bucket[sample->bucket];
+            b->inuse_objs--;
+            b->inuse_bytes -= sample->size;
+
+            pf_remove(s, i);
+
+            pml_STORE(&s->filter[home], (uint16_t)(s->filter[home] - 1));
+            pml_STORE(&pml_profile_live_, pml_profile_live_ - 1);
+            break;
+        }
+    }
+
+    pml_UNLOCK(&s_pf_lock);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Profiler API */
+
+bool PML_APINAME(profile_start)(size_t rate) {
+
+    pml_LOCK(&s_pf_lock);
+
+    if(!s_pf) {
+        pml_STORE_REL(&s_pf, (PfState*)pml_os_map(pf_state_bytes(), 4096));
+    }
+
+    bool result = !!s_pf;
+
+    if(result) {
+        s_pf_rate = rate ? rate : (size_t)PML_PROFILE_RATE;
+        pml_STORE(&pml_profile_rate_, s_pf_rate);
+    }
+
+    pml_UNLOCK(&s_pf_lock);
+
+    return result;
+}
+
+
+void PML_APINAME(profile_stop)() {
+
+    pml_STORE(&pml_profile_rate_, 0);
+}
+
+
+/* The maps are copied with read()/fwrite(), as they're generated by the
+ * kernel as they're read (so we can't size a buffer up front anyway). */
+static void pf_write_maps(FILE *out) {
+
+#ifndef _WIN32
+    int fd = open("/proc/self/maps", O_RDONLY);
+
+    if(fd >= 0) {
+        char buffer[4096];
+        ssize_t n;
+
+        while((n = read(fd, buffer, sizeof(buffer))) > 0) {
+            fwrite(buffer, 1, (size_t)n, out);
+        }
+
+        close(fd);
+    }
+#else/*_WIN32*/
+    (void)out;
+#endif/*_WIN32*/
+}
+
+
+/** The format is gperftools' heap profile (which pprof reads as heap_v2) -
+ *  a header with the totals and sampling rate, then a line for each stack:
+ *
+ *      heap profile: <inuse objs>: <inuse bytes> [<alloc objs>: <alloc bytes>] @ heap_v2/<rate>
+ *      <inuse objs>: <inuse bytes> [<alloc objs>: <alloc bytes>] @ <pc> <pc> ...
+ *      ...
+ *
+ *      MAPPED_LIBRARIES:
+ *      <contents of /proc/self/maps>
+ *
+ *  Counts are of samples - pprof scales them up by the rate.
+ */
+bool PML_APINAME(profile_write)(FILE *out) {
+
+    PfState *s = pml_LOAD_ACQ(&s_pf);
+
+    if(!out) {
+        return false;
+    }
+
+    bool busy = s_pf_busy;
+    s_pf_busy = true;
+
+    pml_LOCK(&s_pf_lock);
+
+    uint64_t inuse_objs = 0, inuse_bytes = 0, alloc_objs = 0, alloc_bytes = 0;
+    size_t buckets = s ? s->buckets : 0;
+
+    for(size_t i = 0; i < buckets; i++) {
+        inuse_objs += s->bucket[i].inuse_objs;
+        inuse_bytes += s->bucket[i].inuse_bytes;
+        alloc_objs += s->bucket[i].alloc_objs;
+        alloc_bytes += s->bucket[i].alloc_bytes;
+    }
+
+    fprintf(out, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu\n",
+        (unsigned long long)inuse_objs, (unsigned long long)inuse_bytes,
+        (unsigned long long)alloc_objs, (unsigned long long)alloc_bytes,
+        s_pf_rate);
+
+    for(size_t i = 0; i < buckets; i++) {
+        PfBucket *b = &s->bucket[i];
+
+        fprintf(out, "%llu: %llu [%llu: %llu] @",
+            (unsigned long long)b->inuse_objs, (unsigned long long)b->inuse_bytes,
+            (unsigned long long)b->alloc_objs, (unsigned long long)b->alloc_bytes);
+
+        for(size_t f = 0; f < b->depth; f++) {
+            fprintf(out, " %p", b->pcs[f]);
+        }
+        fprintf(out, "\n");
+    }
+
+    pml_UNLOCK(&s_pf_lock);
+
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    pf_write_maps(out);
+
+    bool result = !ferror(out);
+
+    s_pf_busy = busy;
+
+    return result;
+}
@@ -0,0 +1,76 @@
+#ifndef PML_PROFILE_H
+#define PML_PROFILE_H
+
+/** \file pml/profile.h
+ *  Sampling heap profiler.
+ *
+ *  While the profiler is running, the PML allocation entry points (malloc,
+ *  calloc, realloc, aligned_malloc, malloc_batch, and so pml_new() as well)
+ *  sample roughly one allocation per `rate` bytes. The gaps between samples
+ *  are drawn from an exponential distribution, so allocations of every size
+ *  are sampled in proportion to their size, and periodic allocation patterns
+ *  don't alias with the sampling. Each sample records the callstack of the
+ *  allocation (with glibc's backtrace() - on other platforms stacks are left
+ *  empty), and is tracked until the block is freed.
+ *
+ *  The profile can be written at any time, in the text format used by
+ *  gperftools' heap profiler (heap_v2), which pprof reads directly:
+ *
+ *      pml_profile_start(0);
+ *      ...
+ *      pml_profile_write(file);
+ *
+ *      $ pprof --text ./app heap.prof
+ *
+ *  Addresses are written raw, along with /proc/self/maps, so pprof does the
+ *  symbolization offline. Unsampled allocations cost a thread-local counter
+ *  update, and frees a table lookup (which rarely takes a lock).
+ */
+
+#include "pml/malloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** Default sampling rate, in bytes (the same as gperftools). */
+#define PML_PROFILE_RATE (512 * 1024)
+
+/** Maximum number of frames recorded for each sample. */
+#define PML_PROFILE_DEPTH 32
+
+
+/*----------------------------------------------------------------------------*/
+/* Profiler API */
+
+/** Start (or restart) sampling, one sample per rate bytes on average (0 for
+ *  PML_PROFILE_RATE). Samples which are already live are kept.
+ */
+PML_API(bool, profile_start)(size_t rate);
+
+/** Stop taking new samples. Live samples are still tracked until they're
+ *  freed, so the profile stays accurate for the blocks it has seen.
+ */
+PML_API(void, profile_stop)();
+
+/** Write the current profile to out. Returns false if it couldn't be written.
+ */
+PML_API(bool, profile_write)(FILE *out);
+
+
+/*----------------------------------------------------------------------------*/
+/* Internal - called from the entry points in malloc.c (not part of the API) */
+
+/** Current sampling rate (0 when stopped). */
+PML_EXTERN size_t pml_profile_rate_;
+
+/** Number of live samples (frees skip the lookup while this is 0). */
+PML_EXTERN size_t pml_profile_live_;
+
+/** Record a sample, and return the number of bytes until the next one. */
+PML_API(int64_t, profile_sample_)(void *ptr, size_t size, PML_Q_TYPE(Hint) hint);
+
+/** Forget ptr, if it was sampled. */
+PML_API(void, profile_forget_)(void *ptr);
+
+
+#endif/*PML_PROFILE_H*/
@@ -0,0 +1,169 @@
+#include "pml/recorder.h"
+#include "pml/sys_impl.h"
+
+/*----------------------------------------------------------------------------*/
+/* Rings */
+
+/** A single-producer/single-consumer ring of events. head and tail count
+ *  events since the ring was created (so head - tail is the number waiting),
+ *  and live on separate cache lines, as they're written by different threads.
+ */
+typedef struct RcRing {
+
+    pml_Record link; /* in s_rc_rings */
+    size_t mask; /* events - 1 */
+
+    uint64_t head __attribute__((aligned(pml_CACHE_LINE))); /* written by owner */
+    uint64_t tail_cache; /* owner's last view of tail */
+
+    uint64_t tail __attribute__((aligned(pml_CACHE_LINE))); /* written by drain */
+
+    PmlRecorderEvent events[] __attribute__((aligned(pml_CACHE_LINE)));
+
+} RcRing;
+
+
+static pml_Record *s_rc_rings;
+static size_t s_rc_ring_size = PML_RECORDER_RING_SIZE;
+static uint32_t s_rc_threads;
+static uint64_t s_rc_dropped;
+static pml_Mutex s_rc_drain_lock = pml_MUTEX_INIT;
+
+static pml_TLS RcRing *s_rc_ring;
+static pml_TLS uint32_t s_rc_thread;
+
+/* (undrained events stay in a ring when its thread exits) */
+static pml_ThreadExit s_rc_exit = pml_THREAD_EXIT_INIT(pml_record_exit);
+
+
+static void rc_ring_init(pml_Record *record, size_t size) {
+
+    ((RcRing*)record)->mask =
+        (size - sizeof(RcRing)) / sizeof(PmlRecorderEvent) - 1;
+}
+
+
+/** Find a ring for the calling thread - one left behind by an exited thread
+ *  if there is one, otherwise a newly mapped one.
+ */
+static RcRing *rc_attach() {
+
+    size_t events = pml_LOAD(&s_rc_ring_size);
+    RcRing *ring = (RcRing*)pml_record_attach(&s_rc_rings,
+        sizeof(RcRing) + events * sizeof(PmlRecorderEvent),
+        rc_ring_init, &s_rc_exit);
+
+    if(ring) {
+        s_rc_thread = pml_ADD(&s_rc_threads, 1);
+        s_rc_ring = ring;
+    }
+
+    return ring;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Hook */
+
+void PML_APINAME(recorder_hook)(const PML_TYPE(DebugHookInfo) *info) {
+
+    RcRing *ring = s_rc_ring;
+
+    if(!ring && !(ring = rc_attach())) {
+        pml_ADD(&s_rc_dropped, 1);
+        return;
+    }
+
+    uint64_t head = ring->head;
+
+    /* only reload tail (from the drain's cache line) when we appear to be full */
+    if(head - ring->tail_cache > ring->mask) {
+        ring->tail_cache = pml_LOAD_ACQ(&ring->tail);
+
+        if(head - ring->tail_cache > ring->mask) {
+            pml_ADD(&s_rc_dropped, 1);
+            return;
+        }
+    }
+
+    PmlRecorderEvent *e = &ring->events[head & ring->mask];
+    e->time = pml_now_ns();
+    e->ptr = info->ptr;
+    e->in = info->in;
+    e->size = info->size;
+    e->count = info->count;
+    e->alloc = info->alloc;
+    e->hint = info->hint;
+    e->thread = s_rc_thread;
+    e->type = (uint32_t)info->type;
+
+    pml_STORE_REL(&ring->head, head + 1);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Recorder API */
+
+bool PML_APINAME(recorder_install)(size_t ring_size) {
+
+    size_t events = 2;
+
+    if(!ring_size) {
+        ring_size = PML_RECORDER_RING_SIZE;
+    }
+
+    while(events < ring_size) {
+        events <<= 1;
+    }
+
+    pml_STORE(&s_rc_ring_size, events);
+
+    return PML_CALL(set_debug_hook)(PML_APINAME(recorder_hook));
+}
+
+
+/** Each ring is consumed in (at most two) contiguous runs, and its tail is only
+ *  published once the consumer is done with them, so the owner can't overwrite
+ *  events which are still being read.
+ */
+size_t PML_APINAME(recorder_drain)(
+    PML_TYPE(RecorderConsumer) consume, void *context) {
+
+    size_t total = 0;
+
+    pml_LOCK(&s_rc_drain_lock);
+
+    for(pml_Record *r = pml_LOAD_ACQ(&s_rc_rings); r; r = r->next) {
+        RcRing *ring = (RcRing*)r;
+        uint64_t tail = ring->tail;
+        uint64_t head = pml_LOAD_ACQ(&ring->head);
+
+        while(tail != head) {
+            size_t index = (size_t)(tail & ring->mask);
+            size_t run = ring->mask + 1 - index;
+
+            if(run > head - tail) {
+                run = (size_t)(head - tail);
+            }
+
+            if(consume) {
+                consume(&ring->events[index], run, context);
+            }
+
+            tail += run;
+            total += run;
+        }
+
+        pml_STORE_REL(&ring->tail, tail);
+    }
+
+    pml_UNLOCK(&s_rc_drain_lock);
+
+    return total;
+}
+
+
+uint64_t PML_APINAME(recorder_dropped)() {
+
+    return pml_LOAD(&s_rc_dropped);
+}
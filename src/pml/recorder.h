@@ -0,0 +1,95 @@
+#ifndef PML_RECORDER_H
+#define PML_RECORDER_H
+
+/** \file pml/recorder.h
+ *  Event recorder, a built-in PML debug hook.
+ *
+ *  Each memory event is written as a fixed-size RecorderEvent into a ring
+ *  buffer owned by the calling thread. A ring has a single producer (its
+ *  thread) and a single consumer (whoever drains it), so recording takes no
+ *  locks and no atomic read-modify-write operations - just a couple of loads
+ *  and a release store. If a ring is full, the event is dropped and counted,
+ *  the producer never waits for the consumer.
+ *
+ *  The recorder is installed as the global debug hook:
+ *
+ *      pml_recorder_install(0);
+ *
+ *  and events are collected on demand, from any thread:
+ *
+ *      pml_recorder_drain(consume, context);
+ *
+ *  A thread's ring is mapped directly from the OS the first time it records
+ *  an event, so recording never allocates through PML itself. Rings are kept
+ *  when their thread exits (any events left in them can still be drained),
+ *  and are reused by new threads.
+ */
+
+#include "pml/malloc.h"
+
+#include <stdint.h>
+
+/** Default number of events per ring (a power of two). */
+#define PML_RECORDER_RING_SIZE 4096
+
+
+PML_BEGIN_NAMESPACE
+PML_FORWARD_STRUCT(RecorderEvent);
+
+/** A recorded event (64 bytes). The fields match DebugHookInfo, plus a
+ *  timestamp and the recording thread. Pointers are only recorded, they may
+ *  well be invalid by the time an event is drained.
+ */
+PML_STRUCT(
+    RecorderEvent,
+
+    uint64_t time; /**< Monotonic timestamp (ns). */
+    void *ptr; /**< Alloc pointer. */
+    void *in; /**< Free pointer. */
+    size_t size; /**< Size of allocation. */
+    size_t count; /**< Number of objects. */
+    PML_TYPE(Allocator) *alloc; /**< Allocator. */
+    PML_TYPE(Hint) hint; /**< Hint. */
+    uint32_t thread; /**< Recording thread (numbered from 1). */
+    uint32_t type; /**< DebugHookType. */
+);
+
+
+/** Called by pml_recorder_drain() with a run of count events from one ring,
+ *  in the order they were recorded.
+ */
+typedef void (*PML_TYPE(RecorderConsumer))(
+    const PML_TYPE(RecorderEvent) *events, size_t count, void *context);
+PML_END_NAMESPACE
+
+
+/*----------------------------------------------------------------------------*/
+/* Hook - this matches the PML debug hook signature, so it can be installed
+ * with pml_set_debug_hook() or placed into a HookTable.
+ */
+
+PML_API(void, recorder_hook)(const PML_Q_TYPE(DebugHookInfo) *info);
+
+
+/*----------------------------------------------------------------------------*/
+/* Recorder API */
+
+/** Install the recorder as the global debug hook. ring_size is the number of
+ *  events in each thread's ring (rounded up to a power of two, 0 for the
+ *  default), and applies to rings created after this call.
+ */
+PML_API(bool, recorder_install)(size_t ring_size);
+
+/** Pass every event recorded so far to consume, and remove them from their
+ *  rings. Drains are serialized with each other, but never block a recording
+ *  thread. Returns the number of events consumed.
+ */
+PML_API(size_t, recorder_drain)(
+    PML_Q_TYPE(RecorderConsumer) consume, void *context);
+
+/** Number of events dropped (on all threads) because a ring was full.
+ */
+PML_API(uint64_t, recorder_dropped)();
+
+
+#endif/*PML_RECORDER_H*/
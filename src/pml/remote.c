@@ -0,0 +1,570 @@
+#include "pml/remote.h"
+#include "pml/sys_impl.h"
+
+#include <string.h>
+
+/*----------------------------------------------------------------------------*/
+/* Constants */
+
+enum {
+    /* Chunks are the unit of memory handed to a heap's size class. Every chunk
+     * is aligned to its size, and starts with an RfChunk header, so a block's
+     * owner and class can be found from its address alone. */
+    RF_CHUNK_SHIFT = 17,
+    RF_CHUNK_SIZE = 1 << RF_CHUNK_SHIFT,
+    RF_HEADER = 64,
+
+    /* Chunks are carved out of larger mappings, to save on system calls. */
+    RF_ARENA_SIZE = 32 * RF_CHUNK_SIZE,
+
+    /* Size classes - 16 byte steps up to 128, then four classes per power of
+     * two up to PML_REMOTE_MAX_SIZE. */
+    RF_CLASSES = 36,
+
+    /* Class of a large (mapped) block. */
+    RF_LARGE = 0xffff,
+
+    /* Marks a header we wrote (checked by debug builds). */
+    RF_MAGIC = 0x52454d54,
+
+    RF_PAGE_SIZE = 4096,
+
+    /* Slots in each thread's buffer of remote frees (see RfPending). */
+    RF_PENDING = 16,
+};
+
+
+/** Map a (small) request size to its size class.
+ */
+static inline unsigned rf_size_class(size_t size) {
+
+    if(size <= 128) {
+        return size ? (unsigned)((size - 1) >> 4) : 0;
+    }
+
+    /* (2^lg, 2^(lg+1)] is split into four classes */
+    unsigned s = (unsigned)(size - 1);
+    unsigned lg = 31 - __builtin_clz(s);
+    return 8 + ((lg - 7) << 2) + ((s >> (lg - 2)) & 3);
+}
+
+
+/** Block size of a class (the inverse of rf_size_class()).
+ */
+static inline size_t rf_class_size(unsigned cls) {
+
+    if(cls < 8) {
+        return (cls + 1) << 4;
+    }
+
+    unsigned lg = 7 + ((cls - 8) >> 2);
+    return ((size_t)1 << lg) + (((cls - 8) & 3) + 1) * ((size_t)1 << (lg - 2));
+}
+
+
+/** Free blocks are linked through their first word.
+ */
+#define rf_NEXT(BLOCK_) (((void**)(BLOCK_))[0])
+
+
+/*----------------------------------------------------------------------------*/
+/* Types */
+
+typedef struct RfHeap RfHeap;
+
+
+/** The start of every chunk (and of every large block's mapping).
+ */
+typedef struct RfChunk {
+
+    RfHeap *heap; /* owner (0 for large blocks) */
+    size_t size; /* block size, or mapped size of a large block */
+    uint32_t cls; /* size class, or RF_LARGE */
+    uint32_t magic; /* RF_MAGIC */
+
+} RfChunk;
+
+
+/** A heap's free list for one class, only touched by its owner.
+ */
+typedef struct RfBin {
+
+    void *head;
+    char *carve; /* unused remainder of the class's most recent chunk */
+    char *carve_end;
+
+} RfBin;
+
+
+/** Blocks of one class freed by other threads. Pushed with compare-and-swap,
+ *  and emptied with a single exchange by the owner - so there's no ABA problem,
+ *  as nothing is ever popped from the middle.
+ */
+typedef struct RfRemote {
+
+    void *head;
+
+} __attribute__((aligned(pml_CACHE_LINE))) RfRemote;
+
+
+struct RfHeap {
+
+    RfRemote remote[RF_CLASSES]; /* a cache line each, as they're shared */
+    RfBin bin[RF_CLASSES];
+    RfHeap *next; /* in the abandoned list */
+};
+
+
+/** Remote frees for one heap and class, waiting to be published as a chain.
+ */
+typedef struct RfPending {
+
+    RfHeap *heap;
+    unsigned cls;
+    unsigned count;
+    void *head;
+    void *tail;
+
+} RfPending;
+
+
+typedef struct RfThread {
+
+    RfHeap *heap; /* 0 until the thread first allocates */
+    RfPending pending[RF_PENDING];
+    bool registered; /* thread exit handler is set */
+
+} RfThread;
+
+
+static pml_TLS RfThread s_rf_thread;
+
+static void rf_thread_exit(void *thread);
+
+static pml_ThreadExit s_rf_exit = pml_THREAD_EXIT_INIT(rf_thread_exit);
+
+
+static inline RfChunk *rf_chunk(const void *ptr) {
+
+    return (RfChunk*)((uintptr_t)ptr & ~(uintptr_t)(RF_CHUNK_SIZE - 1));
+}
+
+
+/** Find the start of the small block containing ptr (which may have been
+ *  offset by an aligned allocation).
+ */
+static inline char *rf_block_start(RfChunk *c, void *ptr) {
+
+    char *data = (char*)c + RF_HEADER;
+    return data + ((size_t)((char*)ptr - data) / c->size) * c->size;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Chunks and heaps */
+
+static pml_Mutex s_rf_lock = pml_MUTEX_INIT;
+static char *s_rf_arena;
+static char *s_rf_arena_end;
+static RfHeap *s_rf_abandoned;
+
+
+/** Hand out a new chunk for heap's class cls.
+ */
+static RfChunk *rf_chunk_alloc(RfHeap *heap, unsigned cls) {
+
+    RfChunk *chunk = 0;
+
+    pml_LOCK(&s_rf_lock);
+
+    if(s_rf_arena == s_rf_arena_end) {
+        s_rf_arena = (char*)pml_os_map(RF_ARENA_SIZE, RF_CHUNK_SIZE);
+        s_rf_arena_end = s_rf_arena ? s_rf_arena + RF_ARENA_SIZE : 0;
+    }
+
+    if(s_rf_arena) {
+        chunk = (RfChunk*)s_rf_arena;
+        s_rf_arena += RF_CHUNK_SIZE;
+    }
+
+    pml_UNLOCK(&s_rf_lock);
+
+    if(chunk) {
+        chunk->heap = heap;
+        chunk->size = rf_class_size(cls);
+        chunk->cls = cls;
+        chunk->magic = RF_MAGIC;
+    }
+
+    return chunk;
+}
+
+
+/** Make sure the calling thread's buffered frees are published (and its heap
+ *  abandoned) when it exits.
+ */
+static void rf_register() {
+
+    pml_thread_exit_set(&s_rf_exit, &s_rf_thread);
+    s_rf_thread.registered = true;
+}
+
+
+/** Give the calling thread a heap - one abandoned by an exited thread if there
+ *  is one, otherwise a new one.
+ */
+static RfHeap *rf_heap_acquire() {
+
+    if(!s_rf_thread.registered) {
+        rf_register();
+    }
+
+    pml_LOCK(&s_rf_lock);
+
+    RfHeap *heap = s_rf_abandoned;
+    if(heap) {
+        s_rf_abandoned = heap->next;
+    }
+
+    pml_UNLOCK(&s_rf_lock);
+
+    if(!heap) {
+        heap = (RfHeap*)pml_os_map(
+            pml_ALIGN_UP(sizeof(RfHeap), RF_PAGE_SIZE), RF_PAGE_SIZE);
+    }
+
+    s_rf_thread.heap = heap;
+    return heap;
+}
+
+
+static void rf_thread_exit(void *thread) {
+
+    PML_APINAME(remote_flush)();
+
+    RfHeap *heap = s_rf_thread.heap;
+
+    if(heap) {
+        pml_LOCK(&s_rf_lock);
+        heap->next = s_rf_abandoned;
+        s_rf_abandoned = heap;
+        pml_UNLOCK(&s_rf_lock);
+
+        s_rf_thread.heap = 0;
+    }
+
+    s_rf_thread.registered = false;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Large blocks */
+
+static void *rf_large_alloc(size_t size, size_t align) {
+
+    size_t offset = align > RF_HEADER ? align : RF_HEADER;
+    size_t bytes = pml_ALIGN_UP(size + offset, RF_PAGE_SIZE);
+
+    if(bytes < size) {
+        return 0; /* overflow */
+    }
+
+    RfChunk *base = (RfChunk*)pml_os_map(bytes, RF_CHUNK_SIZE);
+
+    if(base) {
+        base->heap = 0;
+        base->size = bytes;
+        base->cls = RF_LARGE;
+        base->magic = RF_MAGIC;
+        return (char*)base + offset;
+    }
+
+    return 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Remote frees */
+
+/** Push the pending chain onto its heap's remote list.
+ */
+static void rf_publish(RfPending *p) {
+
+    RfRemote *remote = &p->heap->remote[p->cls];
+    void *head = pml_LOAD(&remote->head);
+
+    do {
+        rf_NEXT(p->tail) = head;
+    } while(!pml_CAS(&remote->head, &head, p->head));
+
+    p->head = 0;
+    p->count = 0;
+}
+
+
+/** Add ptr to the calling thread's pending chain for its heap and class. The
+ *  buffer is direct-mapped, so a thread feeding a few heaps keeps a chain for
+ *  each, and publishes a full batch at a time.
+ */
+static void rf_remote_free(void *ptr, RfChunk *c) {
+
+    if(!s_rf_thread.registered) {
+        rf_register();
+    }
+
+    unsigned slot = (unsigned)(((uintptr_t)c->heap >> 12) * 31 + c->cls);
+    RfPending *p = &s_rf_thread.pending[slot & (RF_PENDING - 1)];
+
+    if(p->count && (p->heap != c->heap || p->cls != c->cls)) {
+        rf_publish(p);
+    }
+
+    if(!p->count) {
+        p->heap = c->heap;
+        p->cls = c->cls;
+        p->tail = ptr;
+    }
+
+    rf_NEXT(ptr) = p->head;
+    p->head = ptr;
+
+    if(++p->count >= PML_REMOTE_BATCH) {
+        rf_publish(p);
+    }
+}
+
+
+/** The calling thread's list for cls is empty (or it has no heap yet): reclaim
+ *  the blocks other threads have freed back to it, or carve a new block.
+ */
+static void *rf_refill(unsigned cls) {
+
+    RfHeap *heap = s_rf_thread.heap;
+
+    if(!heap && !(heap = rf_heap_acquire())) {
+        return 0;
+    }
+
+    RfBin *bin = &heap->bin[cls];
+    RfRemote *remote = &heap->remote[cls];
+    void *ptr = bin->head;
+
+    /* (an abandoned heap is adopted with whatever was left in its bins) */
+    if(ptr) {
+        bin->head = rf_NEXT(ptr);
+        return ptr;
+    }
+
+    /* (the plain load keeps us off the shared line when there's nothing) */
+    if(pml_LOAD(&remote->head)) {
+        void *head = pml_EXCHANGE(&remote->head, (void*)0);
+
+        if(head) {
+            /* splice the rest of the list in front of the bin's blocks */
+            void *tail = head;
+
+            if(bin->head) {
+                while(rf_NEXT(tail)) {
+                    tail = rf_NEXT(tail);
+                }
+                rf_NEXT(tail) = bin->head;
+            }
+
+            bin->head = rf_NEXT(head);
+            return head;
+        }
+    }
+
+    if(bin->carve == bin->carve_end) {
+        RfChunk *chunk = rf_chunk_alloc(heap, cls);
+        if(!chunk) {
+            return 0;
+        }
+
+        size_t size = chunk->size;
+        bin->carve = (char*)chunk + RF_HEADER;
+        bin->carve_end = bin->carve + ((RF_CHUNK_SIZE - RF_HEADER) / size) * size;
+    }
+
+    ptr = bin->carve;
+    bin->carve += rf_class_size(cls);
+    return ptr;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Hooks */
+
+void *PML_APINAME(remote_malloc)(size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(size <= PML_REMOTE_MAX_SIZE) {
+        unsigned cls = rf_size_class(size);
+        RfHeap *heap = s_rf_thread.heap;
+
+        if(heap) {
+            RfBin *bin = &heap->bin[cls];
+            void *ptr = bin->head;
+
+            if(ptr) {
+                bin->head = rf_NEXT(ptr);
+                return ptr;
+            }
+        }
+
+        return rf_refill(cls);
+    }
+
+    return rf_large_alloc(size, 0);
+}
+
+
+void PML_APINAME(remote_free)(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(!ptr) {
+        return;
+    }
+
+    RfChunk *c = rf_chunk(ptr);
+    PML_ASSERT(RF_MAGIC == c->magic);
+
+    if(RF_LARGE == c->cls) {
+        pml_os_unmap(c, c->size);
+    } else if(c->heap == s_rf_thread.heap) {
+        RfBin *bin = &c->heap->bin[c->cls];
+        rf_NEXT(ptr) = bin->head;
+        bin->head = ptr;
+    } else {
+        rf_remote_free(ptr, c);
+    }
+}
+
+
+/** Small blocks don't have any natural alignment (beyond 16), so an aligned
+ *  request is served from a class large enough to hold the block at an aligned
+ *  offset. Large blocks are offset from their (chunk-aligned) mapping.
+ */
+void *PML_APINAME(remote_aligned_malloc)(size_t align, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(align <= 16) {
+        return PML_APINAME(remote_malloc)(size, alloc, hint);
+    }
+
+    if(align > PML_REMOTE_MAX_SIZE) {
+        return 0;
+    }
+
+    if(size <= PML_REMOTE_MAX_SIZE && size + align - 16 <= PML_REMOTE_MAX_SIZE) {
+        char *ptr = (char*)PML_APINAME(remote_malloc)(size + align - 16, alloc, hint);
+        return ptr ? (void*)pml_ALIGN_UP((uintptr_t)ptr, align) : 0;
+    }
+
+    return rf_large_alloc(size, align);
+}
+
+
+void PML_APINAME(remote_aligned_free)(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(ptr) {
+        RfChunk *c = rf_chunk(ptr);
+
+        if(RF_LARGE != c->cls) {
+            ptr = rf_block_start(c, ptr);
+        }
+
+        PML_APINAME(remote_free)(ptr, alloc, hint);
+    }
+}
+
+
+size_t PML_APINAME(remote_usable_size)(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(!ptr) {
+        return 0;
+    }
+
+    RfChunk *c = rf_chunk(ptr);
+    PML_ASSERT(RF_MAGIC == c->magic);
+
+    if(RF_LARGE == c->cls) {
+        return (size_t)((char*)c + c->size - (char*)ptr);
+    }
+
+    return (size_t)(rf_block_start(c, ptr) + c->size - (char*)ptr);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Engine API */
+
+static PML_TYPE(Allocator) s_rf_allocator = {
+    PML_APINAME(remote_malloc),
+    PML_APINAME(remote_free),
+    PML_APINAME(emulate_calloc),
+    PML_APINAME(emulate_realloc),
+    0, /* free_sized is just free */
+    PML_APINAME(remote_aligned_malloc),
+    PML_APINAME(remote_aligned_free),
+    PML_APINAME(remote_usable_size),
+    0, /* try_expand */
+    0, /* malloc_batch */
+    0, /* free_batch */
+};
+
+
+PML_TYPE(Allocator) *PML_APINAME(remote_allocator)() {
+
+    return &s_rf_allocator;
+}
+
+
+bool PML_APINAME(remote_install)() {
+
+    PML_TYPE(HookTable) table;
+
+    PML_CALL(get_hooks)(&table);
+    table.hooks = s_rf_allocator;
+
+    return PML_CALL(set_hooks)(&table);
+}
+
+
+void PML_APINAME(remote_flush)() {
+
+    for(unsigned i = 0; i < RF_PENDING; i++) {
+        if(s_rf_thread.pending[i].count) {
+            rf_publish(&s_rf_thread.pending[i]);
+        }
+    }
+}
+
+
+size_t PML_APINAME(remote_collect)() {
+
+    RfHeap *heap = s_rf_thread.heap;
+    size_t count = 0;
+
+    for(unsigned i = 0; heap && i < RF_CLASSES; i++) {
+        if(pml_LOAD(&heap->remote[i].head)) {
+            void *head = pml_EXCHANGE(&heap->remote[i].head, (void*)0);
+            void *tail = head;
+
+            if(!head) {
+                continue;
+            }
+
+            for(count++; rf_NEXT(tail); count++) {
+                tail = rf_NEXT(tail);
+            }
+
+            rf_NEXT(tail) = heap->bin[i].head;
+            heap->bin[i].head = head;
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,97 @@
+#ifndef PML_REMOTE_H
+#define PML_REMOTE_H
+
+/** \file pml/remote.h
+ *  Owner-reclaiming allocator with remote-free queues, a built-in PML engine.
+ *
+ *  Every thread allocates from its own heap: small requests (up to
+ *  PML_REMOTE_MAX_SIZE bytes) are rounded up to a size class, and carved from
+ *  chunks which belong to that heap. Each chunk records its owner, so a free
+ *  can tell whether it comes from the owning thread:
+ *
+ *   - the owner pushes the block straight onto its own free list (no locks or
+ *     atomic operations);
+ *   - any other thread pushes it onto the owner's remote-free list for the
+ *     block's class, a lock-free multi-producer/single-consumer stack.
+ *
+ *  The owner reclaims a whole remote list with one atomic exchange, when its
+ *  own list for that class runs dry. Freeing threads also collect their remote
+ *  frees in a small per-thread buffer, and publish them PML_REMOTE_BATCH at a
+ *  time (one compare-and-swap per batch), so the cost of a cross-thread free
+ *  doesn't grow with the number of threads freeing into the same heap. This
+ *  suits producer/consumer pipelines, where messages are allocated on one
+ *  thread and freed on another:
+ *
+ *      // I/O thread
+ *      Message *m = pml_malloc(sizeof(Message), pml_remote_allocator());
+ *
+ *      // worker thread
+ *      pml_free(m, pml_remote_allocator());
+ *
+ *  Memory is mapped directly from the OS, and never handed back (except for
+ *  large blocks, which are mapped individually). When a thread exits, its
+ *  buffered frees are published, and its heap - remote lists and all - is
+ *  adopted by the next thread to start allocating.
+ *
+ *  Only pointers allocated by the engine (or null) may be freed by it.
+ */
+
+#include "pml/malloc.h"
+
+/** Largest request served from the size classes (larger ones are mapped). */
+#define PML_REMOTE_MAX_SIZE 16384
+
+/** Number of remote frees a thread buffers for one heap and class, before
+ *  publishing them. */
+#define PML_REMOTE_BATCH 32
+
+
+/*----------------------------------------------------------------------------*/
+/* Hooks - these match the PML hook signatures, so they can be installed with
+ * pml_set_malloc_hook() et al. or placed into an Allocator.
+ */
+
+PML_API(void*, remote_malloc)(size_t size,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+PML_API(void, remote_free)(void *ptr,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+/** Alignments up to PML_REMOTE_MAX_SIZE are supported. Aligned blocks must be
+ *  freed with pml_remote_aligned_free() (which also accepts other blocks). */
+PML_API(void*, remote_aligned_malloc)(size_t align, size_t size,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+PML_API(void, remote_aligned_free)(void *ptr,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+/** Bytes available from ptr to the end of its class (or mapping). */
+PML_API(size_t, remote_usable_size)(void *ptr,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+
+/*----------------------------------------------------------------------------*/
+/* Engine API */
+
+/** An Allocator instance routing to the engine (calloc and realloc are
+ *  emulated).
+ */
+PML_API(PML_Q_TYPE(Allocator)*, remote_allocator)();
+
+/** Install the engine as the global default malloc/free/calloc/realloc.
+ */
+PML_API(bool, remote_install)();
+
+/** Publish the calling thread's buffered remote frees to their owners. This
+ *  happens automatically when a batch fills up, or the thread exits, but a
+ *  consumer which goes idle can call this so the blocks it has freed can be
+ *  reused straight away.
+ */
+PML_API(void, remote_flush)();
+
+/** Reclaim every block which other threads have freed back to the calling
+ *  thread's heap (normally this is done a class at a time, as needed). Returns
+ *  the number of blocks reclaimed.
+ */
+PML_API(size_t, remote_collect)();
+
+
+#endif/*PML_REMOTE_H*/
@@ -0,0 +1,532 @@
+#include "pml/stats.h"
+#include "pml/sys_impl.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*----------------------------------------------------------------------------*/
+/* Constants */
+
+enum {
+    /* Every block starts with a header, which keeps the user pointer aligned
+     * as malloc() would. */
+    ST_HEADER = 16,
+
+    /* The low bits of a header's size field are a tag, telling plain blocks
+     * from aligned ones (which have the offset back to the parent's block in
+     * front of the header). Every block passed to the hooks must have been
+     * allocated by them - the tag is only checked by assertions. */
+    ST_TAG_BITS = 16,
+    ST_TAG = 0x5a7e,
+    ST_ALIGNED_TAG = 0xa7e5,
+
+    /* Capacity of the table used to merge shards. */
+    ST_MERGE_SITES = 4 * PML_STATS_SITES,
+};
+
+
+static const char s_st_unhinted[] = "(no hint)";
+static const char s_st_other[] = "(other)";
+
+
+/*----------------------------------------------------------------------------*/
+/* Shards */
+
+typedef struct StHeader {
+
+    uint64_t tagged; /* size << ST_TAG_BITS | ST_TAG */
+    PML_TYPE(Hint) site;
+
+} StHeader;
+
+
+typedef struct StEntry {
+
+    PML_TYPE(Hint) hint; /* 0 for an unused entry */
+    uint64_t allocs;
+    uint64_t frees;
+    int64_t live;
+    int64_t peak;
+    uint64_t histogram[PML_STATS_BUCKETS];
+
+} StEntry;
+
+
+/** Counters for the callsites seen by one thread. Only the owning thread
+ *  writes to a shard, readers merge it with relaxed loads.
+ */
+typedef struct StShard {
+
+    pml_Record link; /* in s_st_shards */
+    StEntry other; /* callsites which didn't fit in entries */
+    StEntry entries[PML_STATS_SITES];
+
+} StShard;
+
+
+static pml_Record *s_st_shards;
+static PML_TYPE(Allocator) s_st_parent;
+static pml_Mutex s_st_install_lock = pml_MUTEX_INIT;
+static bool s_st_installed;
+
+static pml_TLS StShard *s_st_shard;
+
+static pml_ThreadExit s_st_exit = pml_THREAD_EXIT_INIT(pml_record_exit);
+
+
+/** Owner-only update of a shard counter (readers may see either value). */
+#define st_ADD(P_, V_) pml_STORE(P_, *(P_) + (V_))
+
+
+static void st_shard_init(pml_Record *record, size_t size) {
+
+    ((StShard*)record)->other.hint = s_st_other;
+}
+
+
+/** Find a shard for the calling thread. Shards are kept when a thread exits,
+ *  as the counts in them still matter, and are reused by new threads.
+ */
+static StShard *st_attach() {
+
+    s_st_shard = (StShard*)pml_record_attach(
+        &s_st_shards, sizeof(StShard), st_shard_init, &s_st_exit);
+
+    return s_st_shard;
+}
+
+
+static StEntry *st_entry(PML_TYPE(Hint) hint) {
+
+    StShard *shard = s_st_shard;
+
+    if(!shard && !(shard = st_attach())) {
+        return 0;
+    }
+
+    if(!hint) {
+        hint = s_st_unhinted;
+    }
+
+    /* a callsite id is its own slot (until the ids run past the table) */
+    size_t i = PML_CALL(hint_id)(hint);
+
+    if(!i) {
+        i = (size_t)(((uintptr_t)hint >> 3) * 0x9e3779b97f4a7c15ull);
+    }
+
+    for(size_t n = 0; n < PML_STATS_SITES; n++) {
+        StEntry *e = &shard->entries[(i + n) & (PML_STATS_SITES - 1)];
+
+        if(e->hint == hint) {
+            return e;
+        }
+
+        if(!e->hint) {
+            pml_STORE_REL(&e->hint, hint);
+            return e;
+        }
+    }
+
+    return &shard->other;
+}
+
+
+static inline unsigned st_bucket(size_t size) {
+
+    unsigned bucket = 0;
+
+    while(size > 16 && bucket < PML_STATS_BUCKETS - 1) {
+        size = (size + 1) >> 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+
+static void st_record_alloc(PML_TYPE(Hint) site, size_t size) {
+
+    StEntry *e = st_entry(site);
+
+    if(e) {
+        st_ADD(&e->allocs, 1);
+        st_ADD(&e->live, (int64_t)size);
+        st_ADD(&e->histogram[st_bucket(size)], 1);
+
+        if(e->live > e->peak) {
+            pml_STORE(&e->peak, e->live);
+        }
+    }
+}
+
+
+static void st_record_free(PML_TYPE(Hint) site, size_t size) {
+
+    StEntry *e = st_entry(site);
+
+    if(e) {
+        st_ADD(&e->frees, 1);
+        st_ADD(&e->live, -(int64_t)size);
+    }
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Hooks */
+
+static inline StHeader *st_header(void *ptr) {
+
+    return (StHeader*)((char*)ptr - ST_HEADER);
+}
+
+
+static inline unsigned st_tag(void *ptr) {
+
+    return (unsigned)(st_header(ptr)->tagged & ((1u << ST_TAG_BITS) - 1));
+}
+
+
+static inline bool st_tagged(void *ptr) {
+
+    unsigned tag = st_tag(ptr);
+    return ST_TAG == tag || ST_ALIGNED_TAG == tag;
+}
+
+
+static inline size_t st_size(void *ptr) {
+
+    return (size_t)(st_header(ptr)->tagged >> ST_TAG_BITS);
+}
+
+
+static inline void *st_track(void *base, size_t size, PML_TYPE(Hint) site,
+    unsigned tag) {
+
+    StHeader *header = (StHeader*)base;
+    header->tagged = ((uint64_t)size << ST_TAG_BITS) | tag;
+    header->site = site;
+
+    st_record_alloc(site, size);
+
+    return (char*)base + ST_HEADER;
+}
+
+
+/* Aligned blocks come from the parent's aligned_malloc hook, or are emulated on
+ * top of its malloc hook (freeing them as aligned_free() would). */
+static void *st_parent_aligned_malloc(size_t align, size_t size,
+    PML_TYPE(Hint) hint) {
+
+    return s_st_parent.aligned_malloc ?
+        s_st_parent.aligned_malloc(align, size, &s_st_parent, hint) :
+        PML_CALL(emulate_aligned_malloc)(align, size, &s_st_parent, hint);
+}
+
+
+static void st_parent_aligned_free(void *ptr, PML_TYPE(Hint) hint) {
+
+    if(!s_st_parent.aligned_malloc) {
+        PML_CALL(emulate_aligned_free)(ptr, &s_st_parent, hint);
+    } else if(s_st_parent.aligned_free) {
+        s_st_parent.aligned_free(ptr, &s_st_parent, hint);
+    } else {
+        s_st_parent.free(ptr, &s_st_parent, hint);
+    }
+}
+
+
+static void *st_malloc(size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(size > (size_t)-1 - ST_HEADER) {
+        return 0;
+    }
+
+    void *base = s_st_parent.malloc(size + ST_HEADER, &s_st_parent, hint);
+
+    return base ? st_track(base, size, hint, ST_TAG) : 0;
+}
+
+
+static void st_free(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(!ptr) {
+        return;
+    }
+
+    PML_ASSERT(st_tagged(ptr));
+
+    StHeader *header = st_header(ptr);
+    st_record_free(header->site, st_size(ptr));
+
+    if(ST_ALIGNED_TAG == st_tag(ptr)) {
+        header->tagged = 0;
+        st_parent_aligned_free((char*)ptr - ((size_t*)header)[-1], hint);
+    } else {
+        header->tagged = 0;
+        s_st_parent.free(header, &s_st_parent, hint);
+    }
+}
+
+
+static void *st_calloc(size_t count, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    size_t bytes = count * size;
+
+    if( (size && (bytes / size != count)) ||
+        bytes > (size_t)-1 - ST_HEADER ) {
+
+        return 0; /* overflow */
+    }
+
+    void *base = s_st_parent.calloc(1, bytes + ST_HEADER, &s_st_parent, hint);
+
+    return base ? st_track(base, bytes, hint, ST_TAG) : 0;
+}
+
+
+/** A realloc counts as a free of the old block and an allocation of the new
+ *  one, charged to the realloc's hint (or the original callsite, if none).
+ */
+static void *st_realloc(void *ptr, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(!ptr) {
+        return st_malloc(size, alloc, hint);
+    }
+
+    if(!size) {
+        st_free(ptr, alloc, hint);
+        return 0;
+    }
+
+    PML_ASSERT(st_tagged(ptr));
+
+    if(size > (size_t)-1 - ST_HEADER) {
+        return 0;
+    }
+
+    StHeader *header = st_header(ptr);
+    PML_TYPE(Hint) site = header->site;
+    size_t old = st_size(ptr);
+
+    /* (the result of realloc() needn't be aligned, as with the C library) */
+    if(ST_ALIGNED_TAG == st_tag(ptr)) {
+        void *out = st_malloc(size, alloc, hint ? hint : site);
+
+        if(out) {
+            memcpy(out, ptr, size < old ? size : old);
+            st_free(ptr, alloc, hint);
+        }
+
+        return out;
+    }
+
+    void *base =
+        s_st_parent.realloc(header, size + ST_HEADER, &s_st_parent, hint);
+
+    if(!base) {
+        return 0;
+    }
+
+    st_record_free(site, old);
+
+    return st_track(base, size, hint ? hint : site, ST_TAG);
+}
+
+
+/** Alignments up to the header size are free, larger ones get a block of their
+ *  own from the parent, with the user pointer align bytes in.
+ */
+static void *st_aligned_malloc(size_t align, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(align <= ST_HEADER) {
+        return st_malloc(size, alloc, hint);
+    }
+
+    if(size > (size_t)-1 - align) {
+        return 0;
+    }
+
+    char *base = (char*)st_parent_aligned_malloc(align, size + align, hint);
+
+    if(!base) {
+        return 0;
+    }
+
+    void *ptr = st_track(base + align - ST_HEADER, size, hint, ST_ALIGNED_TAG);
+    ((size_t*)st_header(ptr))[-1] = align;
+
+    return ptr;
+}
+
+
+static size_t st_usable_size(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    PML_ASSERT(st_tagged(ptr));
+
+    return st_size(ptr);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Merging */
+
+/** Merge every shard into sites (a table of ST_MERGE_SITES entries), and
+ *  return the number of callsites.
+ */
+static size_t st_merge(PML_TYPE(StatsSite) *sites) {
+
+    size_t count = 0;
+
+    for(pml_Record *r = pml_LOAD_ACQ(&s_st_shards); r; r = r->next) {
+        StShard *shard = (StShard*)r;
+
+        for(size_t i = 0; i <= PML_STATS_SITES; i++) {
+            StEntry *e = i < PML_STATS_SITES ? &shard->entries[i] : &shard->other;
+            PML_TYPE(Hint) hint = pml_LOAD_ACQ(&e->hint);
+
+            if(!hint || !(pml_LOAD(&e->allocs) | pml_LOAD(&e->frees))) {
+                continue;
+            }
+
+            size_t j = 0;
+            while(j < count && sites[j].hint != hint) {
+                j++;
+            }
+
+            if(j == count) {
+                if(count == ST_MERGE_SITES) {
+                    continue; /* (can't happen with a sane number of threads) */
+                }
+                memset(&sites[count], 0, sizeof(sites[count]));
+                sites[count++].hint = hint;
+            }
+
+            PML_TYPE(StatsSite) *site = &sites[j];
+            site->allocs += pml_LOAD(&e->allocs);
+            site->frees += pml_LOAD(&e->frees);
+            site->live_bytes += pml_LOAD(&e->live);
+            site->peak_bytes += pml_LOAD(&e->peak);
+
+            for(unsigned b = 0; b < PML_STATS_BUCKETS; b++) {
+                site->histogram[b] += pml_LOAD(&e->histogram[b]);
+            }
+        }
+    }
+
+    return count;
+}
+
+
+static size_t st_merge_bytes() {
+
+    return pml_ALIGN_UP(ST_MERGE_SITES * sizeof(PML_TYPE(StatsSite)), 4096);
+}
+
+
+static int st_compare_live(const void *a, const void *b) {
+
+    int64_t la = ((const PML_TYPE(StatsSite)*)a)->live_bytes;
+    int64_t lb = ((const PML_TYPE(StatsSite)*)b)->live_bytes;
+
+    return (la < lb) - (la > lb);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Stats API */
+
+bool PML_APINAME(stats_install)() {
+
+    bool result = false;
+
+    pml_LOCK(&s_st_install_lock);
+
+    if(!s_st_installed) {
+        PML_TYPE(HookTable) table;
+        PML_CALL(get_hooks)(&table);
+
+        s_st_parent = table.hooks;
+
+        memset(&table.hooks, 0, sizeof(table.hooks));
+        table.hooks.malloc = st_malloc;
+        table.hooks.free = st_free;
+        table.hooks.calloc = st_calloc;
+        table.hooks.realloc = st_realloc;
+        table.hooks.aligned_malloc = st_aligned_malloc; /* (freed by st_free) */
+        table.hooks.usable_size = st_usable_size;
+
+        result = s_st_installed = PML_CALL(set_hooks)(&table);
+    }
+
+    pml_UNLOCK(&s_st_install_lock);
+
+    return result;
+}
+
+
+size_t PML_APINAME(stats_collect)(PML_TYPE(StatsSite) *sites, size_t max) {
+
+    /* merge into a scratch table (from the OS, so we don't disturb the heap
+     * we're measuring) */
+    PML_TYPE(StatsSite) *merged =
+        (PML_TYPE(StatsSite)*)pml_os_map(st_merge_bytes(), 4096);
+
+    if(!merged) {
+        return 0;
+    }
+
+    size_t count = st_merge(merged);
+    memcpy(sites, merged, (count < max ? count : max) * sizeof(*sites));
+
+    pml_os_unmap(merged, st_merge_bytes());
+
+    return count;
+}
+
+
+void PML_APINAME(stats_dump)(FILE *out) {
+
+    PML_TYPE(StatsSite) *merged =
+        (PML_TYPE(StatsSite)*)pml_os_map(st_merge_bytes(), 4096);
+
+    if(!merged) {
+        return;
+    }
+
+    size_t count = st_merge(merged);
+    qsort(merged, count, sizeof(*merged), st_compare_live);
+
+    fprintf(out, "%12s %12s %14s %14s  %s\n",
+        "allocs", "frees", "live", "peak", "callsite");
+
+    for(size_t i = 0; i < count; i++) {
+        PML_TYPE(StatsSite) *site = &merged[i];
+
+        fprintf(out, "%12llu %12llu %14lld %14lld  %s\n",
+            (unsigned long long)site->allocs, (unsigned long long)site->frees,
+            (long long)site->live_bytes, (long long)site->peak_bytes,
+            PML_CALL(hint_name)(site->hint));
+
+        fprintf(out, "%12s", "sizes:");
+        for(unsigned b = 0; b < PML_STATS_BUCKETS - 1; b++) {
+            if(site->histogram[b]) {
+                fprintf(out, " <=%zu:%llu", (size_t)16 << b,
+                    (unsigned long long)site->histogram[b]);
+            }
+        }
+        if(site->histogram[PML_STATS_BUCKETS - 1]) {
+            fprintf(out, " >%zu:%llu", (size_t)16 << (PML_STATS_BUCKETS - 2),
+                (unsigned long long)site->histogram[PML_STATS_BUCKETS - 1]);
+        }
+        fprintf(out, "\n");
+    }
+
+    pml_os_unmap(merged, st_merge_bytes());
+}
@@ -0,0 +1,89 @@
+#ifndef PML_STATS_H
+#define PML_STATS_H
+
+/** \file pml/stats.h
+ *  Per-callsite allocation statistics, a built-in PML engine.
+ *
+ *  PML_HINT() expands to a unique string literal (or, with PML_HINT_ID_S, a
+ *  unique id) for each callsite, so the hint pointer is a cheap, stable key.
+ *  Callsite ids index the per-thread tables directly. The stats engine wraps
+ *  the global hooks, and keeps the following for each hint:
+ *
+ *    - the number of allocations and frees;
+ *    - live bytes, and the peak number of live bytes;
+ *    - a histogram of allocation sizes (in power-of-two buckets).
+ *
+ *  Each block carries a small header recording its callsite and size, so that
+ *  a free is charged to the callsite which allocated the block, wherever it is
+ *  freed (aligned blocks included - these can be freed with either free hook,
+ *  and usable_size() is the size requested). Counters are kept in per-thread
+ *  shards (updated with no locks or atomic read-modify-write operations) which
+ *  are merged when they are read:
+ *
+ *      pml_stats_install();
+ *      ...
+ *      pml_stats_dump(stderr);
+ *
+ *  The engine must be installed before any blocks are allocated through the
+ *  global hooks (it can't tell blocks allocated earlier from its own, so they
+ *  mustn't be freed or resized once it's installed), and stays installed.
+ *  Allocations with no hint are counted together, as are any callsites beyond
+ *  the first PML_STATS_SITES seen by a thread.
+ */
+
+#include "pml/malloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** Number of callsites tracked by each thread (a power of two). */
+#define PML_STATS_SITES 1024
+
+/** Number of histogram buckets. Bucket 0 counts sizes up to 16 bytes, bucket
+ *  n counts sizes in (16 << (n - 1), 16 << n], and the last bucket also counts
+ *  everything larger. */
+#define PML_STATS_BUCKETS 16
+
+
+PML_BEGIN_NAMESPACE
+PML_FORWARD_STRUCT(StatsSite);
+
+/** Merged statistics for one callsite.
+ */
+PML_STRUCT(
+    StatsSite,
+
+    PML_TYPE(Hint) hint; /**< Callsite hint ("(no hint)"/"(other)" if none). */
+    uint64_t allocs; /**< Number of allocations (reallocs count as one). */
+    uint64_t frees; /**< Number of frees (reallocs count as one). */
+    int64_t live_bytes; /**< Bytes currently allocated. */
+    int64_t peak_bytes; /**< Peak live bytes (*). */
+    uint64_t histogram[PML_STATS_BUCKETS]; /**< Allocation sizes. */
+);
+
+/* (*) Each shard tracks the peak of its own live bytes, and the merged peak
+ * is their sum - so it's exact for a callsite which allocates and frees on a
+ * single thread, and an upper bound otherwise.
+ */
+PML_END_NAMESPACE
+
+
+/*----------------------------------------------------------------------------*/
+/* Stats API */
+
+/** Wrap the current global hooks with the stats engine. Returns false if it
+ *  was already installed.
+ */
+PML_API(bool, stats_install)();
+
+/** Merge the shards, and copy up to max callsites into sites (in no particular
+ *  order). Returns the total number of callsites, which may be more than max.
+ */
+PML_API(size_t, stats_collect)(PML_Q_TYPE(StatsSite) *sites, size_t max);
+
+/** Write a table of callsites to out, in order of live bytes (largest first).
+ */
+PML_API(void, stats_dump)(FILE *out);
+
+
+#endif/*PML_STATS_H*/
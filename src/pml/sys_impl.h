@@ -0,0 +1,276 @@
+#ifndef PML_SYS_IMPL_H
+#define PML_SYS_IMPL_H
+
+/** \file pml/sys_impl.h
+ *  System primitives shared by the built-in PML engines.
+ *
+ *  Thin wrappers around thread-local storage, the gcc __atomic builtins,
+ *  pthread mutexes and OS page mapping, so that each engine doesn't need to
+ *  repeat the same platform tests - along with thread exit callbacks and the
+ *  per-thread records which several engines keep. This header is only meant
+ *  to be included by PML implementation (.c) files, it is not part of the
+ *  public API.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else/*_WIN32*/
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#endif/*_WIN32*/
+
+
+/*----------------------------------------------------------------------------*/
+/* Thread-local storage */
+
+/* A shared library which is loaded at startup can build the engines with
+ * PML_TLS_INITIAL_EXEC defined (see pmlpreload), so that each access to their
+ * thread-locals is a single load, rather than a call to __tls_get_addr() -
+ * which can itself allocate. It isn't the default, as a library using the
+ * initial-exec model may fail to dlopen(). */
+#if defined(PML_TLS_INITIAL_EXEC) && defined(__GNUC__) && !defined(_WIN32)
+#define pml_TLS __thread __attribute__((tls_model("initial-exec")))
+#else/*PML_TLS_INITIAL_EXEC && __GNUC__ && !_WIN32*/
+#define pml_TLS __thread
+#endif/*PML_TLS_INITIAL_EXEC && __GNUC__ && !_WIN32*/
+
+
+/*----------------------------------------------------------------------------*/
+/* Atomics (relaxed unless stated otherwise) */
+
+#define pml_LOAD(P_) __atomic_load_n(P_, __ATOMIC_RELAXED)
+#define pml_LOAD_ACQ(P_) __atomic_load_n(P_, __ATOMIC_ACQUIRE)
+#define pml_STORE(P_, V_) __atomic_store_n(P_, V_, __ATOMIC_RELAXED)
+#define pml_STORE_REL(P_, V_) __atomic_store_n(P_, V_, __ATOMIC_RELEASE)
+#define pml_EXCHANGE(P_, V_) __atomic_exchange_n(P_, V_, __ATOMIC_ACQ_REL)
+#define pml_CAS(P_, EXPECT_, V_) __atomic_compare_exchange_n( \
+    P_, EXPECT_, V_, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define pml_ADD(P_, V_) __atomic_add_fetch(P_, V_, __ATOMIC_RELAXED)
+#define pml_ADD_ACQ_REL(P_, V_) __atomic_add_fetch(P_, V_, __ATOMIC_ACQ_REL)
+#define pml_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+
+/*----------------------------------------------------------------------------*/
+/* Mutexes */
+
+typedef pthread_mutex_t pml_Mutex;
+
+#define pml_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define pml_LOCK(M_) pthread_mutex_lock(M_)
+#define pml_UNLOCK(M_) pthread_mutex_unlock(M_)
+
+
+/*----------------------------------------------------------------------------*/
+/* Misc */
+
+/** Size of a cache line, used to pad shared structures. */
+#define pml_CACHE_LINE 64
+
+/** Round SIZE_ up to a multiple of ALIGN_ (which must be a power of two). */
+#define pml_ALIGN_UP(SIZE_, ALIGN_) \
+    (((SIZE_) + ((ALIGN_) - 1)) & ~((size_t)(ALIGN_) - 1))
+
+
+/*----------------------------------------------------------------------------*/
+/* Time */
+
+/** Monotonic time in nanoseconds (from an arbitrary starting point).
+ */
+static inline uint64_t pml_now_ns() {
+
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else/*_WIN32*/
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif/*_WIN32*/
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* OS pages */
+
+/** Map size bytes of zeroed memory, aligned to align (a power of two, which may
+ *  be larger than the page size). size should be a multiple of the page size.
+ *  Returns 0 on failure.
+ */
+static inline void *pml_os_map(size_t size, size_t align) {
+
+#ifdef _WIN32
+    /* VirtualAlloc() is always 64k aligned, which is all we ask of it. */
+    return VirtualAlloc(0, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else/*_WIN32*/
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif/*MAP_ANONYMOUS*/
+    /* Over-map by align, then trim the unaligned head and the excess tail. */
+    size_t span = size + align;
+    char *base = (char*)mmap(0, span,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(MAP_FAILED == (void*)base) {
+        return 0;
+    }
+
+    char *ptr = (char*)pml_ALIGN_UP((uintptr_t)base, align);
+    size_t head = ptr - base;
+    size_t tail = span - head - size;
+
+    if(head) { munmap(base, head); }
+    if(tail) { munmap(ptr + size, tail); }
+
+    return ptr;
+#endif/*_WIN32*/
+}
+
+
+/** Unmap memory returned by pml_os_map().
+ */
+static inline void pml_os_unmap(void *ptr, size_t size) {
+
+#ifdef _WIN32
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else/*_WIN32*/
+    munmap(ptr, size);
+#endif/*_WIN32*/
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Thread exit */
+
+/** Calls callback (with the value the thread last passed to
+ *  pml_thread_exit_set()) when a thread exits. The pthread key is created on
+ *  first use.
+ */
+typedef struct pml_ThreadExit {
+
+    void (*callback)(void *value);
+    pml_Mutex lock;
+    bool created;
+    pthread_key_t key;
+
+} pml_ThreadExit;
+
+#define pml_THREAD_EXIT_INIT(CALLBACK_) { CALLBACK_, pml_MUTEX_INIT, false }
+
+
+static inline void pml_thread_exit_set(pml_ThreadExit *at_exit, void *value) {
+
+    if(!pml_LOAD_ACQ(&at_exit->created)) {
+        pml_LOCK(&at_exit->lock);
+
+        if(!at_exit->created) {
+            pthread_key_create(&at_exit->key, at_exit->callback);
+            pml_STORE_REL(&at_exit->created, true);
+        }
+
+        pml_UNLOCK(&at_exit->lock);
+    }
+
+    pthread_setspecific(at_exit->key, value);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Per-thread records */
+
+/** The header of a record which belongs to one thread at a time (a stats
+ *  shard, say). Records are kept on a push-only list, so they can be walked
+ *  with no locks, and one released by an exited thread is claimed by the next
+ *  thread which needs one.
+ */
+typedef struct pml_Record {
+
+    struct pml_Record *next;
+    bool active; /* owned by a live thread */
+
+} pml_Record;
+
+
+/** Claim a released record from list, or return 0 if there isn't one.
+ */
+static inline pml_Record *pml_record_claim(pml_Record **list) {
+
+    pml_Record *rec;
+
+    for(rec = pml_LOAD_ACQ(list); rec; rec = rec->next) {
+        bool expect = false;
+        if(!pml_LOAD(&rec->active) && pml_CAS(&rec->active, &expect, true)) {
+            break;
+        }
+    }
+
+    return rec;
+}
+
+
+/** Push a new record (which is then active) onto list.
+ */
+static inline void pml_record_push(pml_Record **list, pml_Record *rec) {
+
+    pml_Record *head = pml_LOAD(list);
+
+    rec->active = true;
+
+    do {
+        rec->next = head;
+    } while(!pml_CAS(list, &head, rec));
+}
+
+
+/** Release a record, for another thread to claim.
+ */
+static inline void pml_record_release(pml_Record *rec) {
+
+    pml_STORE_REL(&rec->active, false);
+}
+
+
+/** A pml_ThreadExit callback which releases the thread's record. */
+static inline void pml_record_exit(void *rec) {
+
+    pml_record_release((pml_Record*)rec);
+}
+
+
+/** Attach the calling thread to a record from list: one released by an exited
+ *  thread if there is one, otherwise a new one of size bytes (zeroed, from the
+ *  OS), which init (if not null) sets up before it's pushed. at_exit is set to
+ *  the record. Returns 0 if a new record can't be mapped.
+ */
+static inline pml_Record *pml_record_attach(pml_Record **list, size_t size,
+    void (*init)(pml_Record *rec, size_t size), pml_ThreadExit *at_exit) {
+
+    pml_Record *rec = pml_record_claim(list);
+
+    if(!rec) {
+        rec = (pml_Record*)pml_os_map(pml_ALIGN_UP(size, 4096), 4096);
+        if(!rec) {
+            return 0;
+        }
+
+        if(init) {
+            init(rec, size);
+        }
+
+        pml_record_push(list, rec);
+    }
+
+    pml_thread_exit_set(at_exit, rec);
+
+    return rec;
+}
+
+
+#endif/*PML_SYS_IMPL_H*/
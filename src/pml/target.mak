@@ -2,7 +2,14 @@
 LIB_TARGET:=pml
 
 SOURCE:= \
+	epoch.c \
 	malloc.c \
+	profile.c \
+	recorder.c \
+	remote.c \
+	stats.c \
+	tcache.c \
+	trace.c \
 	# SOURCE
 
 # publish pml headers to include/
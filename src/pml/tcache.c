@@ -0,0 +1,694 @@
+#include "pml/tcache.h"
+#include "pml/sys_impl.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*----------------------------------------------------------------------------*/
+/* Constants */
+
+enum {
+    /* Chunks are the unit of memory handed to a size class. Every chunk is
+     * aligned to its size, so the page map can find a block's class from its
+     * address alone. */
+    TC_CHUNK_SHIFT = 16,
+    TC_CHUNK_SIZE = 1 << TC_CHUNK_SHIFT,
+
+    /* Chunks are carved out of larger mappings, to save on system calls. */
+    TC_ARENA_SIZE = 32 * TC_CHUNK_SIZE,
+
+    /* Number of size classes (see s_tc_class_size). */
+    TC_CLASSES = 40,
+
+    /* Page map entry for the first chunk of a large (mapped) block. Small
+     * blocks are marked with (class + 1), so 0 means "not ours". */
+    TC_LARGE = 0xff,
+
+    /* Large blocks are mapped chunk-aligned, and store their mapped size at the
+     * start of the mapping. The user pointer follows at an offset of at least
+     * TC_LARGE_HEADER (more for aligned blocks), within the first chunk. */
+    TC_LARGE_HEADER = 16,
+    TC_PAGE_SIZE = 4096,
+
+    /* The page map is a two-level radix tree over chunk indices. */
+    TC_MAP_BITS = 16,
+    TC_MAP_SIZE = 1 << TC_MAP_BITS,
+};
+
+
+/** Block size for each class - 16 byte steps up to 128, then four classes per
+ *  power of two up to PML_TCACHE_MAX_SIZE.
+ */
+static const size_t s_tc_class_size[TC_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096, 5120, 6144, 7168, 8192,
+    10240, 12288, 14336, 16384, 20480, 24576, 28672, 32768,
+};
+
+
+/** Number of blocks moved between a thread cache and the central heap at a
+ *  time (roughly 16k worth, between 2 and 64 blocks). A thread keeps at most
+ *  twice this many blocks of each class.
+ */
+static const unsigned s_tc_batch[TC_CLASSES] = {
+    64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 51, 42, 36, 32,
+    25, 21, 18, 16, 12, 10, 9, 8,
+    6, 5, 4, 4, 3, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2,
+};
+
+
+/** Map a (small) request size to its size class.
+ */
+static inline unsigned tc_size_class(size_t size) {
+
+    if(size <= 128) {
+        return size ? (unsigned)((size - 1) >> 4) : 0;
+    }
+
+    /* (2^lg, 2^(lg+1)] is split into four classes */
+    unsigned s = (unsigned)(size - 1);
+    unsigned lg = 31 - __builtin_clz(s);
+    return 8 + ((lg - 7) << 2) + ((s >> (lg - 2)) & 3);
+}
+
+
+/** Free blocks are linked through their first word.
+ */
+#define tc_NEXT(BLOCK_) (((void**)(BLOCK_))[0])
+
+/** Batches in the central heap are linked through the second word of their
+ *  first block (every block is at least 16 bytes).
+ */
+#define tc_NEXT_BATCH(BLOCK_) (((void**)(BLOCK_))[1])
+
+
+/*----------------------------------------------------------------------------*/
+/* Page map */
+
+static unsigned char *s_tc_map[TC_MAP_SIZE];
+
+
+/** Look up the page map entry for ptr. Entries are only written while the
+ *  chunk lock is held, and a block is always registered before it is handed
+ *  out, so a relaxed load (a plain load on every target we care about) is all
+ *  the free path needs.
+ */
+static inline unsigned tc_map_get(const void *ptr) {
+
+    uint64_t chunk = (uintptr_t)ptr >> TC_CHUNK_SHIFT;
+
+    if(chunk >> (2 * TC_MAP_BITS)) {
+        return 0; /* beyond the range of the map, so not one of ours */
+    }
+
+    unsigned char *leaf = pml_LOAD(&s_tc_map[chunk >> TC_MAP_BITS]);
+    return leaf ? pml_LOAD(&leaf[chunk & (TC_MAP_SIZE - 1)]) : 0;
+}
+
+
+/** Set the page map entry for the chunk starting at ptr.
+ *  (Call with s_tc_chunk_lock held.)
+ */
+static bool tc_map_set(const void *ptr, unsigned value) {
+
+    uint64_t chunk = (uintptr_t)ptr >> TC_CHUNK_SHIFT;
+
+    if(chunk >> (2 * TC_MAP_BITS)) {
+        return false;
+    }
+
+    unsigned char **slot = &s_tc_map[chunk >> TC_MAP_BITS];
+    unsigned char *leaf = *slot;
+
+    if(!leaf) {
+        leaf = (unsigned char*)pml_os_map(TC_MAP_SIZE, TC_PAGE_SIZE);
+        if(!leaf) {
+            return false;
+        }
+        pml_STORE_REL(slot, leaf);
+    }
+
+    pml_STORE(&leaf[chunk & (TC_MAP_SIZE - 1)], (unsigned char)value);
+    return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Chunks */
+
+static pml_Mutex s_tc_chunk_lock = pml_MUTEX_INIT;
+static char *s_tc_arena;
+static char *s_tc_arena_end;
+
+
+/** Hand out a new chunk, registered in the page map as value.
+ */
+static char *tc_chunk_alloc(unsigned value) {
+
+    char *chunk = 0;
+
+    pml_LOCK(&s_tc_chunk_lock);
+
+    if(s_tc_arena == s_tc_arena_end) {
+        s_tc_arena = (char*)pml_os_map(TC_ARENA_SIZE, TC_CHUNK_SIZE);
+        s_tc_arena_end = s_tc_arena ? s_tc_arena + TC_ARENA_SIZE : 0;
+    }
+
+    if( s_tc_arena &&
+        tc_map_set(s_tc_arena, value) ) {
+
+        chunk = s_tc_arena;
+        s_tc_arena += TC_CHUNK_SIZE;
+    }
+
+    pml_UNLOCK(&s_tc_chunk_lock);
+
+    return chunk;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Large blocks */
+
+static void *tc_large_alloc(size_t size, size_t align) {
+
+    size_t offset = align > TC_LARGE_HEADER ? align : TC_LARGE_HEADER;
+    size_t bytes = pml_ALIGN_UP(size + offset, TC_PAGE_SIZE);
+
+    if(bytes < size) {
+        return 0; /* overflow */
+    }
+
+    char *base = (char*)pml_os_map(bytes, TC_CHUNK_SIZE);
+
+    if(base) {
+        pml_LOCK(&s_tc_chunk_lock);
+        bool mapped = tc_map_set(base, TC_LARGE);
+        pml_UNLOCK(&s_tc_chunk_lock);
+
+        if(!mapped) {
+            pml_os_unmap(base, bytes);
+            return 0;
+        }
+
+        *(size_t*)base = bytes;
+        return base + offset;
+    }
+
+    return 0;
+}
+
+
+static inline char *tc_large_base(void *ptr) {
+
+    return (char*)((uintptr_t)ptr & ~(uintptr_t)(TC_CHUNK_SIZE - 1));
+}
+
+
+static void tc_large_free(void *ptr) {
+
+    char *base = tc_large_base(ptr);
+
+    pml_LOCK(&s_tc_chunk_lock);
+    tc_map_set(base, 0);
+    pml_UNLOCK(&s_tc_chunk_lock);
+
+    pml_os_unmap(base, *(size_t*)base);
+}
+
+
+static inline size_t tc_large_size(void *ptr) {
+
+    char *base = tc_large_base(ptr);
+    return *(size_t*)base - ((char*)ptr - base);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Central heap */
+
+typedef struct TcCentral {
+
+    pml_Mutex lock;
+    void *batches; /* stack of full batches (linked by tc_NEXT_BATCH) */
+    void *loose; /* partial batch leftovers from exiting threads */
+    char *carve; /* unused remainder of the most recent chunk */
+    char *carve_end;
+
+} __attribute__((aligned(pml_CACHE_LINE))) TcCentral;
+
+
+static TcCentral s_tc_central[TC_CLASSES];
+
+
+/*----------------------------------------------------------------------------*/
+/* Thread cache */
+
+typedef struct TcBin {
+
+    void *head;
+    unsigned count;
+
+} TcBin;
+
+
+typedef struct TcCache {
+
+    TcBin bin[TC_CLASSES];
+    bool registered; /* thread exit handler is set */
+
+} TcCache;
+
+
+static pml_TLS TcCache s_tc_cache;
+
+static void tc_thread_exit(void *cache);
+
+static pthread_once_t s_tc_once = PTHREAD_ONCE_INIT;
+static pml_ThreadExit s_tc_exit = pml_THREAD_EXIT_INIT(tc_thread_exit);
+
+
+static void tc_init_once() {
+
+    for(unsigned i = 0; i < TC_CLASSES; i++) {
+        pthread_mutex_init(&s_tc_central[i].lock, 0);
+    }
+}
+
+
+/** Make sure the calling thread's cache gets flushed when it exits.
+ */
+static void tc_register() {
+
+    pthread_once(&s_tc_once, tc_init_once);
+    pml_thread_exit_set(&s_tc_exit, &s_tc_cache);
+    s_tc_cache.registered = true;
+}
+
+
+/** Take a batch of blocks from the central heap, and return one of them.
+ *  (The bin is empty when this is called.)
+ */
+static void *tc_refill(TcBin *bin, unsigned cls) {
+
+    if(!s_tc_cache.registered) {
+        tc_register();
+    }
+
+    TcCentral *c = &s_tc_central[cls];
+    size_t size = s_tc_class_size[cls];
+    unsigned batch = s_tc_batch[cls];
+    unsigned count = 0;
+    void *head = 0;
+
+    pml_LOCK(&c->lock);
+
+    if(c->batches) {
+        head = c->batches;
+        c->batches = tc_NEXT_BATCH(head);
+        count = batch;
+    } else {
+        /* leftovers first... */
+        while(c->loose && count < batch) {
+            void *block = c->loose;
+            c->loose = tc_NEXT(block);
+            tc_NEXT(block) = head;
+            head = block;
+            count++;
+        }
+
+        /* ...then carve fresh blocks */
+        while(count < batch) {
+            if(c->carve == c->carve_end) {
+                char *chunk = tc_chunk_alloc(cls + 1);
+                if(!chunk) {
+                    break;
+                }
+                c->carve = chunk;
+                c->carve_end = chunk + (TC_CHUNK_SIZE / size) * size;
+            }
+
+            void *block = c->carve;
+            c->carve += size;
+            tc_NEXT(block) = head;
+            head = block;
+            count++;
+        }
+    }
+
+    pml_UNLOCK(&c->lock);
+
+    if(head) {
+        bin->head = tc_NEXT(head);
+        bin->count = count - 1;
+    }
+
+    return head;
+}
+
+
+/** Return one batch from the front of the bin to the central heap.
+ */
+static void tc_flush_batch(TcBin *bin, unsigned cls) {
+
+    TcCentral *c = &s_tc_central[cls];
+    unsigned batch = s_tc_batch[cls];
+    void *head = bin->head;
+    void *tail = head;
+
+    for(unsigned i = 1; i < batch; i++) {
+        tail = tc_NEXT(tail);
+    }
+
+    bin->head = tc_NEXT(tail);
+    bin->count -= batch;
+    tc_NEXT(tail) = 0;
+
+    pml_LOCK(&c->lock);
+    tc_NEXT_BATCH(head) = c->batches;
+    c->batches = head;
+    pml_UNLOCK(&c->lock);
+}
+
+
+/** Return everything in the bin to the central heap.
+ */
+static void tc_flush_bin(TcBin *bin, unsigned cls) {
+
+    while(bin->count >= s_tc_batch[cls]) {
+        tc_flush_batch(bin, cls);
+    }
+
+    if(bin->count) {
+        TcCentral *c = &s_tc_central[cls];
+        void *head = bin->head;
+        void *tail = head;
+
+        while(tc_NEXT(tail)) {
+            tail = tc_NEXT(tail);
+        }
+
+        pml_LOCK(&c->lock);
+        tc_NEXT(tail) = c->loose;
+        c->loose = head;
+        pml_UNLOCK(&c->lock);
+
+        bin->head = 0;
+        bin->count = 0;
+    }
+}
+
+
+static void tc_thread_exit(void *cache) {
+
+    PML_APINAME(tcache_flush)();
+    s_tc_cache.registered = false;
+}
+
+
+static inline void tc_free_small(void *ptr, unsigned cls) {
+
+    TcBin *bin = &s_tc_cache.bin[cls];
+
+    if(!s_tc_cache.registered) {
+        tc_register();
+    }
+
+    tc_NEXT(ptr) = bin->head;
+    bin->head = ptr;
+
+    if(++bin->count > 2 * s_tc_batch[cls]) {
+        tc_flush_batch(bin, cls);
+    }
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Hooks */
+
+void *PML_APINAME(tcache_malloc)(size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(size <= PML_TCACHE_MAX_SIZE) {
+        unsigned cls = tc_size_class(size);
+        TcBin *bin = &s_tc_cache.bin[cls];
+        void *ptr = bin->head;
+
+        if(ptr) {
+            bin->head = tc_NEXT(ptr);
+            bin->count--;
+            return ptr;
+        }
+
+        return tc_refill(bin, cls);
+    }
+
+    return tc_large_alloc(size, 0);
+}
+
+
+void PML_APINAME(tcache_free)(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    unsigned entry = tc_map_get(ptr);
+
+    if(entry && entry <= TC_CLASSES) {
+        tc_free_small(ptr, entry - 1);
+    } else if(TC_LARGE == entry) {
+        tc_large_free(ptr);
+    } else {
+        /* not ours (or null) - perhaps mapped by the default hooks */
+        PML_CALL(default_allocator_)()->free(ptr, 0, hint);
+    }
+}
+
+
+/** With the size, a small block's class is known without consulting the page
+ *  map. (Debug builds still check it.)
+ */
+void PML_APINAME(tcache_free_sized)(void *ptr, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(size <= PML_TCACHE_MAX_SIZE) {
+        unsigned cls = tc_size_class(size);
+#ifdef DEBUG_S
+        PML_ASSERT(tc_map_get(ptr) == cls + 1);
+#endif/*DEBUG_S*/
+        tc_free_small(ptr, cls);
+    } else {
+        PML_APINAME(tcache_free)(ptr, alloc, hint);
+    }
+}
+
+
+/** Small batches are popped straight off the thread's bin (refilling it as
+ *  needed), without going through tcache_malloc() for each block.
+ */
+size_t PML_APINAME(tcache_malloc_batch)(size_t count, size_t size, void **out,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    size_t done = 0;
+
+    if(size <= PML_TCACHE_MAX_SIZE) {
+        unsigned cls = tc_size_class(size);
+        TcBin *bin = &s_tc_cache.bin[cls];
+
+        while(done < count) {
+            void *ptr = bin->head;
+
+            if(ptr) {
+                bin->head = tc_NEXT(ptr);
+                bin->count--;
+            } else if(!(ptr = tc_refill(bin, cls))) {
+                break;
+            }
+
+            out[done++] = ptr;
+        }
+    } else {
+        while(done < count && (out[done] = tc_large_alloc(size, 0))) {
+            done++;
+        }
+    }
+
+    return done;
+}
+
+
+void PML_APINAME(tcache_free_batch)(void **ptrs, size_t count,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    for(size_t i = 0; i < count; i++) {
+        PML_APINAME(tcache_free)(ptrs[i], alloc, hint);
+    }
+}
+
+
+/** Blocks in the power-of-two size classes are naturally aligned to their size
+ *  (as chunks are aligned to TC_CHUNK_SIZE), so a small aligned request is
+ *  served from the first power-of-two class which holds both. Large blocks are
+ *  offset from their (chunk-aligned) mapping.
+ */
+void *PML_APINAME(tcache_aligned_malloc)(size_t align, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(align <= 16) {
+        return PML_APINAME(tcache_malloc)(size, alloc, hint);
+    }
+
+    if(align > PML_TCACHE_MAX_SIZE) {
+        return 0;
+    }
+
+    if(size <= PML_TCACHE_MAX_SIZE) {
+        size_t pow2 = align;
+        while(pow2 < size) {
+            pow2 <<= 1;
+        }
+        return PML_APINAME(tcache_malloc)(pow2, alloc, hint);
+    }
+
+    return tc_large_alloc(size, align);
+}
+
+
+void *PML_APINAME(tcache_calloc)(size_t count, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    size_t bytes = count * size;
+
+    if(size && (bytes / size != count)) {
+        return 0; /* overflow */
+    }
+
+    void *ptr = PML_APINAME(tcache_malloc)(bytes, alloc, hint);
+
+    /* large blocks are freshly mapped, so already zeroed */
+    if(ptr && bytes <= PML_TCACHE_MAX_SIZE) {
+        memset(ptr, 0, bytes);
+    }
+
+    return ptr;
+}
+
+
+size_t PML_APINAME(tcache_usable_size)(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    unsigned entry = tc_map_get(ptr);
+
+    if(entry && entry <= TC_CLASSES) {
+        return s_tc_class_size[entry - 1];
+    } else if(TC_LARGE == entry) {
+        return tc_large_size(ptr);
+    }
+
+    return 0; /* not ours */
+}
+
+
+/** Small blocks are kept in place if the new size maps to the same class (so
+ *  the block can still be freed with its new size). Large blocks are kept if
+ *  the new size is still large, fits, and doesn't waste more than half of the
+ *  block.
+ */
+bool PML_APINAME(tcache_try_expand)(void *ptr, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    unsigned entry = tc_map_get(ptr);
+
+    if(entry && entry <= TC_CLASSES) {
+        return size <= PML_TCACHE_MAX_SIZE && tc_size_class(size) == entry - 1;
+    } else if(TC_LARGE == entry) {
+        size_t usable = tc_large_size(ptr);
+        return size <= usable && size > usable / 2 && size > PML_TCACHE_MAX_SIZE;
+    }
+
+    return false;
+}
+
+
+/** Resize in place if tcache_try_expand() allows it, otherwise move to a new
+ *  block, copying only the bytes which are valid in both.
+ */
+void *PML_APINAME(tcache_realloc)(void *ptr, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    if(!ptr) {
+        return PML_APINAME(tcache_malloc)(size, alloc, hint);
+    }
+
+    if(!size) {
+        PML_APINAME(tcache_free)(ptr, alloc, hint);
+        return 0;
+    }
+
+    size_t usable = PML_APINAME(tcache_usable_size)(ptr, alloc, hint);
+
+    if(!usable) {
+        /* not ours */
+        return PML_CALL(default_allocator_)()->realloc(ptr, size, 0, hint);
+    }
+
+    if(PML_APINAME(tcache_try_expand)(ptr, size, alloc, hint)) {
+        return ptr;
+    }
+
+    void *out = PML_APINAME(tcache_malloc)(size, alloc, hint);
+
+    if(out) {
+        memcpy(out, ptr, size < usable ? size : usable);
+        PML_APINAME(tcache_free)(ptr, alloc, hint);
+    }
+
+    return out;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Engine API */
+
+static PML_TYPE(Allocator) s_tc_allocator = {
+    PML_APINAME(tcache_malloc),
+    PML_APINAME(tcache_free),
+    PML_APINAME(tcache_calloc),
+    PML_APINAME(tcache_realloc),
+    PML_APINAME(tcache_free_sized),
+    PML_APINAME(tcache_aligned_malloc),
+    0, /* aligned blocks are freed by tcache_free() */
+    PML_APINAME(tcache_usable_size),
+    PML_APINAME(tcache_try_expand),
+    PML_APINAME(tcache_malloc_batch),
+    PML_APINAME(tcache_free_batch),
+};
+
+
+PML_TYPE(Allocator) *PML_APINAME(tcache_allocator)() {
+
+    return &s_tc_allocator;
+}
+
+
+bool PML_APINAME(tcache_install)() {
+
+    PML_TYPE(HookTable) table;
+
+    PML_CALL(get_hooks)(&table);
+    table.hooks = s_tc_allocator;
+
+    return PML_CALL(set_hooks)(&table);
+}
+
+
+void PML_APINAME(tcache_flush)() {
+
+    for(unsigned i = 0; i < TC_CLASSES; i++) {
+        if(s_tc_cache.bin[i].count) {
+            tc_flush_bin(&s_tc_cache.bin[i], i);
+        }
+    }
+}
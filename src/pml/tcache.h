@@ -0,0 +1,93 @@
+#ifndef PML_TCACHE_H
+#define PML_TCACHE_H
+
+/** \file pml/tcache.h
+ *  Thread-caching size-class allocator, a built-in PML engine.
+ *
+ *  Small requests (up to PML_TCACHE_MAX_SIZE bytes) are rounded up to one of a
+ *  fixed set of size classes, and served from a per-thread free list for that
+ *  class. The per-thread fast path takes no locks and uses no atomic
+ *  operations. When a thread's list runs dry it is refilled with a batch of
+ *  blocks from a central heap (one lock per size class), and when it grows too
+ *  long a batch is flushed back. Memory for the central heap is mapped directly
+ *  from the OS in 64k chunks, so the engine never calls into the system
+ *  allocator itself. Larger requests are mapped individually.
+ *
+ *  The engine can be installed as the global default:
+ *
+ *      pml_tcache_install();
+ *
+ *  or used as an allocator instance:
+ *
+ *      void *p = pml_malloc(64, pml_tcache_allocator());
+ *
+ *  Blocks can be freed from any thread. Pointers which were not allocated by
+ *  the engine are passed on to PML's default hooks, so blocks allocated before
+ *  the engine was installed (including those the default hooks mapped) can
+ *  still be freed or reallocated once it is.
+ */
+
+#include "pml/malloc.h"
+
+/** Largest request served from the size classes (larger ones are mapped). */
+#define PML_TCACHE_MAX_SIZE 32768
+
+
+/*----------------------------------------------------------------------------*/
+/* Hooks - these match the PML hook signatures, so they can be installed with
+ * pml_set_malloc_hook() et al. or placed into an Allocator.
+ */
+
+PML_API(void*, tcache_malloc)(size_t size,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+PML_API(void, tcache_free)(void *ptr,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+PML_API(void*, tcache_calloc)(size_t count, size_t size,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+PML_API(void*, tcache_realloc)(void *ptr, size_t size,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+/** ptr must have been allocated by the engine, and size must be the size it
+ *  was last (re)allocated with. */
+PML_API(void, tcache_free_sized)(void *ptr, size_t size,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+/** Batches of small blocks are served from the thread cache in one pass. */
+PML_API(size_t, tcache_malloc_batch)(size_t count, size_t size, void **out,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+PML_API(void, tcache_free_batch)(void **ptrs, size_t count,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+/** Alignments up to PML_TCACHE_MAX_SIZE are supported. Blocks are freed with
+ *  pml_tcache_free() (not free_sized, as they may come from a larger class). */
+PML_API(void*, tcache_aligned_malloc)(size_t align, size_t size,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+/** Size of the class (or mapping) holding ptr, or 0 if it's not one of ours. */
+PML_API(size_t, tcache_usable_size)(void *ptr,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+/** Succeeds if ptr can be resized to size without moving or changing class. */
+PML_API(bool, tcache_try_expand)(void *ptr, size_t size,
+    PML_Q_TYPE(Allocator) *alloc, PML_Q_TYPE(Hint) hint);
+
+
+/*----------------------------------------------------------------------------*/
+/* Engine API */
+
+/** An Allocator instance routing to the thread cache.
+ */
+PML_API(PML_Q_TYPE(Allocator)*, tcache_allocator)();
+
+/** Install the thread cache as the global default malloc/free/calloc/realloc.
+ */
+PML_API(bool, tcache_install)();
+
+/** Return every block cached by the calling thread to the central heap. This
+ *  happens automatically when a thread exits, but long-lived threads which go
+ *  idle (e.g. in a pool) can call this to make their cache available to others.
+ */
+PML_API(void, tcache_flush)();
+
+
+#endif/*PML_TCACHE_H*/
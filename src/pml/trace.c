@@ -0,0 +1,434 @@
+#include "pml/trace.h"
+#include "pml/sys_impl.h"
+
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sched.h>
+#endif/*_WIN32*/
+
+#ifndef _WIN32
+
+/*----------------------------------------------------------------------------*/
+/* Constants */
+
+enum {
+    TR_RECORD = sizeof(PML_TYPE(TraceRecord)),
+    TR_HEADER = sizeof(PML_TYPE(TraceHeader)),
+    TR_HINT_SLOTS = 2 * PML_TRACE_HINTS, /* (a power of two) */
+};
+
+
+/*----------------------------------------------------------------------------*/
+/* State */
+
+/** Interned hints, mapped from the OS. Guarded by s_tr_hint_lock (except for
+ *  reading a hint which has already been published).
+ */
+typedef struct TrHints {
+
+    uint32_t count;
+    uint32_t slots[TR_HINT_SLOTS]; /* hint id, or 0 */
+    PML_TYPE(Hint) list[PML_TRACE_HINTS + 1]; /* by id, from 1 */
+
+} TrHints;
+
+
+/* The writer. The current window of the file is mapped at s_tr_map, and its
+ * record slots start at s_tr_base. Writers reserve a slot by incrementing
+ * s_tr_used, and count it in s_tr_committed once it's written. The writer
+ * which reserves the first slot past the end of the window moves the window
+ * on, once every slot in it has been committed. */
+static int s_tr_fd = -1;
+static char *s_tr_map;
+static uint64_t s_tr_map_offset;
+static PML_TYPE(TraceRecord) *s_tr_base;
+static size_t s_tr_capacity;
+static size_t s_tr_used;
+static size_t s_tr_committed;
+static uint64_t s_tr_flushed; /* records in previous windows */
+
+/* Writers count themselves in s_tr_inflight while they may touch the window,
+ * so pml_trace_stop() can wait for them to leave. */
+static bool s_tr_enabled;
+static size_t s_tr_inflight;
+
+static pml_Mutex s_tr_lock = pml_MUTEX_INIT; /* start/stop, moving windows */
+static pml_Mutex s_tr_hint_lock = pml_MUTEX_INIT;
+
+static TrHints *s_tr_hints;
+static PML_TYPE(DebugHook) s_tr_previous;
+static uint32_t s_tr_session; /* incremented by each start */
+static uint32_t s_tr_threads;
+static uint64_t s_tr_records; /* total, once stopped */
+
+/* Per-thread ids, and the last hint seen (valid for one session). */
+static pml_TLS uint32_t s_tr_thread_session;
+static pml_TLS uint32_t s_tr_thread;
+static pml_TLS PML_TYPE(Hint) s_tr_last_hint;
+static pml_TLS uint32_t s_tr_last_hint_id;
+
+
+static size_t tr_hints_bytes() {
+
+    return pml_ALIGN_UP(sizeof(TrHints), 4096);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Ids */
+
+static void tr_attach(uint32_t session) {
+
+    s_tr_thread_session = session;
+    s_tr_thread = pml_ADD(&s_tr_threads, 1);
+    s_tr_last_hint = 0;
+    s_tr_last_hint_id = 0;
+}
+
+
+static uint32_t tr_hint_id(PML_TYPE(Hint) hint) {
+
+    if(!hint) {
+        return 0;
+    }
+
+    if(hint == s_tr_last_hint) {
+        return s_tr_last_hint_id;
+    }
+
+    TrHints *h = s_tr_hints;
+    uint32_t id = 0;
+    size_t i = (size_t)(((uintptr_t)hint >> 3) * 0x9e3779b97f4a7c15ull);
+
+    pml_LOCK(&s_tr_hint_lock);
+
+    for(size_t n = 0; n < TR_HINT_SLOTS; n++) {
+        uint32_t *slot = &h->slots[(i + n) & (TR_HINT_SLOTS - 1)];
+
+        if(!*slot) {
+            if(h->count < PML_TRACE_HINTS) {
+                id = *slot = ++h->count;
+                h->list[id] = hint;
+            }
+            break;
+        }
+
+        if(h->list[*slot] == hint) {
+            id = *slot;
+            break;
+        }
+    }
+
+    pml_UNLOCK(&s_tr_hint_lock);
+
+    s_tr_last_hint = hint;
+    s_tr_last_hint_id = id;
+
+    return id;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Writer */
+
+/** Map the window of the file starting at offset (growing the file to fit).
+ *  Called with s_tr_lock held.
+ */
+static bool tr_map_window(uint64_t offset) {
+
+    if(ftruncate(s_tr_fd, (off_t)(offset + PML_TRACE_WINDOW))) {
+        return false;
+    }
+
+    void *map = mmap(0, PML_TRACE_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED,
+        s_tr_fd, (off_t)offset);
+
+    if(MAP_FAILED == map) {
+        return false;
+    }
+
+    /* the header lives at the start of the first window */
+    size_t skip = offset ? 0 : TR_HEADER;
+
+    s_tr_map = (char*)map;
+    s_tr_map_offset = offset;
+    s_tr_base = (PML_TYPE(TraceRecord)*)(s_tr_map + skip);
+    s_tr_capacity = (PML_TRACE_WINDOW - skip) / TR_RECORD;
+    s_tr_committed = 0;
+
+    return true;
+}
+
+
+/** Move on to the next window, once every slot in this one is written. If the
+ *  file can't be extended, tracing stops. Called with s_tr_lock held.
+ */
+static void tr_next_window() {
+
+    while(pml_LOAD_ACQ(&s_tr_committed) < s_tr_capacity) {
+        sched_yield();
+    }
+
+    munmap(s_tr_map, PML_TRACE_WINDOW);
+    s_tr_flushed += s_tr_capacity;
+
+    if(tr_map_window(s_tr_map_offset + PML_TRACE_WINDOW)) {
+        pml_STORE_REL(&s_tr_used, 0);
+    } else {
+        s_tr_map = 0;
+        pml_STORE(&s_tr_enabled, false);
+    }
+}
+
+
+static void tr_write(const PML_TYPE(TraceRecord) *record) {
+
+    for(;;) {
+        pml_ADD_ACQ_REL(&s_tr_inflight, 1);
+
+        if(!pml_LOAD_ACQ(&s_tr_enabled)) {
+            break;
+        }
+
+        size_t slot = pml_ADD_ACQ_REL(&s_tr_used, 1) - 1;
+
+        if(slot < s_tr_capacity) {
+            s_tr_base[slot] = *record;
+            pml_ADD_ACQ_REL(&s_tr_committed, 1);
+            break;
+        }
+
+        if(slot == s_tr_capacity) {
+            pml_LOCK(&s_tr_lock);
+            tr_next_window();
+            pml_UNLOCK(&s_tr_lock);
+        } else {
+            /* wait for whoever is moving the window on (without counting
+             * ourselves, so a stop doesn't wait for us) */
+            pml_ADD_ACQ_REL(&s_tr_inflight, -1);
+            pml_LOCK(&s_tr_lock);
+            pml_UNLOCK(&s_tr_lock);
+            continue;
+        }
+
+        pml_ADD_ACQ_REL(&s_tr_inflight, -1);
+    }
+
+    pml_ADD_ACQ_REL(&s_tr_inflight, -1);
+}
+
+
+/** Write the hint table and header, and trim the file to fit. Called with
+ *  s_tr_lock held, once every writer has left.
+ */
+static bool tr_finish() {
+
+    size_t used = pml_LOAD(&s_tr_used);
+    uint64_t records = s_tr_flushed +
+        (s_tr_map ? (used < s_tr_capacity ? used : s_tr_capacity) : 0);
+
+    if(s_tr_map) {
+        munmap(s_tr_map, PML_TRACE_WINDOW);
+        s_tr_map = 0;
+    }
+
+    uint64_t offset = TR_HEADER + records * TR_RECORD;
+    bool result = !ftruncate(s_tr_fd, (off_t)offset);
+
+    PML_TYPE(TraceHeader) header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PML_TRACE_MAGIC, sizeof(header.magic));
+    header.version = PML_TRACE_VERSION;
+    header.record_size = TR_RECORD;
+    header.records = records;
+    header.hints_offset = offset;
+    header.hints = s_tr_hints->count;
+    header.threads = pml_LOAD(&s_tr_threads);
+
+    for(uint32_t id = 1; result && id <= s_tr_hints->count; id++) {
+        const char *hint = PML_CALL(hint_name)(s_tr_hints->list[id]);
+        uint32_t length = (uint32_t)strlen(hint);
+
+        result =
+            sizeof(length) == pwrite(s_tr_fd, &length, sizeof(length), (off_t)offset) &&
+            length == (size_t)pwrite(s_tr_fd, hint, length, (off_t)(offset + sizeof(length)));
+
+        offset += sizeof(length) + length;
+    }
+
+    result = result &&
+        sizeof(header) == pwrite(s_tr_fd, &header, sizeof(header), 0);
+
+    s_tr_records = records;
+
+    return !close(s_tr_fd) && result;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Hook */
+
+static inline uint8_t tr_log2(size_t align) {
+
+    uint8_t log2 = 0;
+
+    while(((size_t)2 << log2) <= align) {
+        log2++;
+    }
+
+    return align ? log2 : 0;
+}
+
+
+void PML_APINAME(trace_hook)(const PML_TYPE(DebugHookInfo) *info) {
+
+    uint32_t session = pml_LOAD_ACQ(&s_tr_session);
+
+    if(!pml_LOAD(&s_tr_enabled)) {
+        return;
+    }
+
+    if(s_tr_thread_session != session) {
+        tr_attach(session);
+    }
+
+    PML_TYPE(TraceRecord) record;
+    memset(&record, 0, sizeof(record));
+    record.ptr = (uint64_t)(uintptr_t)info->ptr;
+    record.in = (uint64_t)(uintptr_t)info->in;
+    record.size = info->size;
+    record.hint = tr_hint_id(info->hint);
+    record.thread = (uint16_t)s_tr_thread;
+    record.type = (uint8_t)info->type;
+
+    switch(info->type) {
+        case pml_CALLOC: {
+            record.size = info->count * info->size;
+            break;
+        }
+
+        case pml_ALIGNED_MALLOC: {
+            record.align_log2 = tr_log2(info->count);
+            break;
+        }
+
+        case pml_MALLOC_BATCH:
+        case pml_FREE_BATCH: {
+            /* one record per block */
+            bool alloc = (pml_MALLOC_BATCH == info->type);
+            void **blocks = (void**)(alloc ? info->ptr : info->in);
+
+            record.type = (uint8_t)(alloc ? pml_MALLOC : pml_FREE);
+            record.in = 0;
+
+            for(size_t i = 0; i < info->count; i++) {
+                if(blocks[i]) {
+                    record.ptr = (uint64_t)(uintptr_t)blocks[i];
+                    tr_write(&record);
+                }
+            }
+            return;
+        }
+
+        default: {
+            break;
+        }
+    }
+
+    tr_write(&record);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Trace API */
+
+bool PML_APINAME(trace_start)(const char *path) {
+
+    bool result = false;
+
+    pml_LOCK(&s_tr_lock);
+
+    if(!s_tr_hints) {
+        s_tr_hints = (TrHints*)pml_os_map(tr_hints_bytes(), 4096);
+    }
+
+    if(s_tr_fd < 0 && s_tr_hints &&
+        (s_tr_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) >= 0) {
+
+        memset(s_tr_hints, 0, sizeof(*s_tr_hints));
+        s_tr_flushed = 0;
+        s_tr_records = 0;
+        pml_STORE(&s_tr_threads, 0);
+
+        if(tr_map_window(0)) {
+            PML_TYPE(HookTable) table;
+            PML_CALL(get_hooks)(&table);
+            s_tr_previous = table.debug_hook;
+
+            pml_STORE(&s_tr_used, 0);
+            pml_ADD_ACQ_REL(&s_tr_session, 1);
+            pml_STORE_REL(&s_tr_enabled, true);
+
+            result = PML_CALL(set_debug_hook)(PML_APINAME(trace_hook));
+        }
+
+        if(!result) {
+            pml_STORE(&s_tr_enabled, false);
+            tr_finish();
+            s_tr_fd = -1;
+        }
+    }
+
+    pml_UNLOCK(&s_tr_lock);
+
+    return result;
+}
+
+
+bool PML_APINAME(trace_stop)() {
+
+    if(!pml_EXCHANGE(&s_tr_enabled, false) && s_tr_fd < 0) {
+        return false;
+    }
+
+    PML_CALL(set_debug_hook)(s_tr_previous);
+
+    while(pml_LOAD_ACQ(&s_tr_inflight)) {
+        sched_yield();
+    }
+
+    pml_LOCK(&s_tr_lock);
+
+    bool result = false;
+
+    if(s_tr_fd >= 0) {
+        result = tr_finish();
+        s_tr_fd = -1;
+    }
+
+    pml_UNLOCK(&s_tr_lock);
+
+    return result;
+}
+
+
+uint64_t PML_APINAME(trace_records)() {
+
+    if(pml_LOAD_ACQ(&s_tr_enabled)) {
+        size_t used = pml_LOAD(&s_tr_used);
+        return s_tr_flushed + (used < s_tr_capacity ? used : s_tr_capacity);
+    }
+
+    return s_tr_records;
+}
+
+
+#else/*_WIN32*/
+
+void PML_APINAME(trace_hook)(const PML_TYPE(DebugHookInfo) *info) {}
+bool PML_APINAME(trace_start)(const char *path) { return false; }
+bool PML_APINAME(trace_stop)() { return false; }
+uint64_t PML_APINAME(trace_records)() { return 0; }
+
+#endif/*_WIN32*/
@@ -0,0 +1,112 @@
+#ifndef PML_TRACE_H
+#define PML_TRACE_H
+
+/** \file pml/trace.h
+ *  Allocation trace writer, a built-in PML debug hook.
+ *
+ *  While tracing, every memory event is appended to a binary trace file, as a
+ *  fixed-size TraceRecord carrying the block's address, its size, an id for
+ *  its hint and an id for the calling thread:
+ *
+ *      pml_trace_start("app.pmltrace");
+ *      ...
+ *      pml_trace_stop();
+ *
+ *  The file is written through a shared mapping, a window at a time. Each
+ *  event reserves its slot in the window with one atomic add, so records are
+ *  in a single global order, and threads only take a lock when the window
+ *  fills up. Hint strings are interned as they're seen, and written out after
+ *  the records by pml_trace_stop().
+ *
+ *  Batches are expanded into one record per block. new/delete events are
+ *  recorded too, although with the default backend the allocation itself is
+ *  also recorded as the malloc/free beneath it - so replay tools should treat
+ *  them as markers (see src/pmlreplay/ for one which does).
+ *
+ *  Tracing relies on the debug hook (PML_DEBUG_HOOK_S), and on mmap() - it
+ *  isn't available on Windows.
+ */
+
+#include "pml/malloc.h"
+
+#include <stdint.h>
+
+/** Trace file magic ("PMLTRACE"), and format version. */
+#define PML_TRACE_MAGIC "PMLTRACE"
+#define PML_TRACE_VERSION 1
+
+/** Size of each window of the file mapped by the writer (a multiple of the
+ *  page size). */
+#define PML_TRACE_WINDOW (4 * 1024 * 1024)
+
+/** Maximum number of distinct hints in a trace (others are written as 0). */
+#define PML_TRACE_HINTS 4096
+
+
+PML_BEGIN_NAMESPACE
+PML_FORWARD_STRUCT(TraceHeader);
+PML_FORWARD_STRUCT(TraceRecord);
+
+/** The start of a trace file (64 bytes). The records follow the header, and
+ *  then the hint table - for each hint id from 1, a uint32_t length followed
+ *  by that many characters (with no terminator).
+ */
+PML_STRUCT(
+    TraceHeader,
+
+    char magic[8]; /**< PML_TRACE_MAGIC. */
+    uint32_t version; /**< PML_TRACE_VERSION. */
+    uint32_t record_size; /**< sizeof(TraceRecord). */
+    uint64_t records; /**< Number of records. */
+    uint64_t hints_offset; /**< File offset of the hint table. */
+    uint64_t hints; /**< Number of hints in the table. */
+    uint64_t threads; /**< Number of threads seen. */
+    uint64_t reserved[2];
+);
+
+/** A recorded event (32 bytes). Addresses are only identifiers, to match
+ *  frees with their allocations.
+ */
+PML_STRUCT(
+    TraceRecord,
+
+    uint64_t ptr; /**< Block allocated or freed (the new block for realloc). */
+    uint64_t in; /**< The old block, for realloc. */
+    uint64_t size; /**< Bytes requested (count * size for calloc). */
+    uint32_t hint; /**< Hint id (0 for none). */
+    uint16_t thread; /**< Recording thread (numbered from 1). */
+    uint8_t type; /**< DebugHookType. */
+    uint8_t align_log2; /**< Alignment of an aligned_malloc (log2). */
+);
+PML_END_NAMESPACE
+
+
+/*----------------------------------------------------------------------------*/
+/* Hook - this matches the PML debug hook signature, so it can be installed
+ * with pml_set_debug_hook() or placed into a HookTable.
+ */
+
+PML_API(void, trace_hook)(const PML_Q_TYPE(DebugHookInfo) *info);
+
+
+/*----------------------------------------------------------------------------*/
+/* Trace API */
+
+/** Create (or truncate) the trace file at path, and install the writer as the
+ *  global debug hook. Returns false if a trace is already running, or the file
+ *  can't be created.
+ */
+PML_API(bool, trace_start)(const char *path);
+
+/** Restore the previous debug hook, write the hint table and header, and
+ *  close the file. Returns false if there was no trace running, or it couldn't
+ *  be completed.
+ */
+PML_API(bool, trace_stop)();
+
+/** Number of records written by the current (or last) trace.
+ */
+PML_API(uint64_t, trace_records)();
+
+
+#endif/*PML_TRACE_H*/
@@ -0,0 +1,479 @@
+/** \file pmlbench/main.cpp
+ *  Allocator microbenchmarks:
+ *
+ *      pmlbench [-n ops] [-t threads,...] [-w workload] [-p path]
+ *
+ *  Each workload is run on each allocation path, at each thread count, and
+ *  reported as ns/op (wall time per operation on one thread) and ops/s (over
+ *  all threads). An operation is one allocation or one free. The workloads:
+ *
+ *      pairs       malloc/free of the same size, back to back
+ *      churn       random sizes (16..4096) replacing random slots in a table
+ *      prodcons    producer threads allocate, consumer threads free
+ *      larson      churn, with the tables passed between threads each round
+ *      new         pml_new/pml_delete of a small object
+ *      newa        pml_newa/pml_deletea of a large (64KB) array
+ *
+ *  and the paths:
+ *
+ *      libc        malloc()/free() (new/delete) called directly
+ *      pml         the PML default hooks
+ *      debug       the PML default hooks, with a (no-op) debug hook installed
+ *      iallocator  an IAllocator subclass over malloc()/free()
+ *      tcache      the PML thread-caching engine
+ *      remote      the PML remote-free engine
+ *
+ *  libc vs pml is the cost of the proxy itself, and pml vs debug is the cost
+ *  of a debug hook (the debug path is left out if PML_NO_DEBUG_HOOK_S is set).
+ */
+
+#include "pml/malloc.h"
+#include "pml/remote.h"
+#include "pml/tcache.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+namespace {
+
+//------------------------------------------------------------------------------
+// Paths
+
+enum Path { LIBC, PML, DEBUG, IALLOCATOR, TCACHE, REMOTE, PATHS };
+
+const char *const s_path_names[PATHS] = {
+    "libc", "pml", "debug", "iallocator", "tcache", "remote"
+};
+
+
+/** An IAllocator over the C library, for the cost of the virtual calls. */
+struct LibcAllocator: pml::IAllocator {
+
+    virtual void *malloc(size_t size, pml::Hint h = 0) {
+        return ::malloc(size);
+    }
+
+    virtual void free(void *ptr, pml::Hint h = 0) {
+        ::free(ptr);
+    }
+};
+
+
+LibcAllocator s_libc_allocator;
+pml::Allocator *s_allocators[PATHS]; // per path, for the pml paths
+
+
+void debug_hook(const pml::DebugHookInfo *info) {}
+
+
+/** Make ptr (and what it points to) visible to the compiler as used, so it
+ *  can't elide a malloc()/free() pair. */
+inline void escape(void *ptr) {
+    __asm__ __volatile__("" : : "g"(ptr) : "memory");
+}
+
+
+inline void *bench_malloc(Path path, size_t size) {
+    void *ptr = (LIBC == path) ?
+        ::malloc(size) : pml_malloc(size, s_allocators[path], 0);
+
+    *static_cast<char*>(ptr) = 0;
+    escape(ptr);
+    return ptr;
+}
+
+
+inline void bench_free(Path path, void *ptr) {
+    if(LIBC == path) {
+        ::free(ptr);
+    } else {
+        pml_free(ptr, s_allocators[path], 0);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Threads
+
+struct Shared;
+
+struct Worker {
+    Shared *shared;
+    size_t index;
+    uint64_t random;
+    void **slots;
+    uint64_t start; // (ns)
+    uint64_t end;
+};
+
+
+typedef void (*WorkloadFunc)(Worker &w, Path path, size_t ops);
+
+
+enum { SLOTS = 1024, RING = 1024, LARGE = 8192 };
+
+struct Shared {
+    WorkloadFunc func;
+    Path path;
+    size_t ops;
+    size_t threads;
+    pthread_barrier_t barrier;
+    void **tables[64]; // larson tables, by thread
+    void **rings[32]; // prodcons rings, by pair
+    size_t heads[32][16]; // (padded)
+    size_t tails[32][16];
+};
+
+
+inline uint64_t next_random(Worker &w) {
+    // xorshift64*
+    w.random ^= w.random >> 12;
+    w.random ^= w.random << 25;
+    w.random ^= w.random >> 27;
+    return w.random * 0x2545f4914f6cdd1dull;
+}
+
+
+inline size_t random_size(Worker &w) {
+    return 16 + (next_random(w) >> 52); // 16..4111
+}
+
+
+//------------------------------------------------------------------------------
+// Workloads
+
+void run_pairs(Worker &w, Path path, size_t ops) {
+    for(size_t i = 0; i < ops / 2; i++) {
+        bench_free(path, bench_malloc(path, 64));
+    }
+}
+
+
+void churn(Worker &w, Path path, size_t ops, void **slots) {
+    for(size_t i = 0; i < ops / 2; i++) {
+        size_t k = next_random(w) & (SLOTS - 1);
+
+        if(slots[k]) {
+            bench_free(path, slots[k]);
+        }
+        slots[k] = bench_malloc(path, random_size(w));
+    }
+}
+
+
+void drain(Path path, void **slots) {
+    for(size_t k = 0; k < SLOTS; k++) {
+        if(slots[k]) {
+            bench_free(path, slots[k]);
+            slots[k] = 0;
+        }
+    }
+}
+
+
+void run_churn(Worker &w, Path path, size_t ops) {
+    churn(w, path, ops, w.slots);
+    drain(path, w.slots);
+}
+
+
+void run_larson(Worker &w, Path path, size_t ops) {
+    enum { ROUNDS = 8 };
+
+    Shared &s = *w.shared;
+    void **slots = w.slots;
+
+    for(size_t round = 0; round < ROUNDS; round++) {
+        churn(w, path, ops / ROUNDS, slots);
+
+        // pass our table on to the next thread, and take over the previous one
+        s.tables[w.index] = slots;
+        pthread_barrier_wait(&s.barrier);
+        slots = s.tables[(w.index + s.threads - 1) % s.threads];
+        pthread_barrier_wait(&s.barrier);
+    }
+
+    drain(path, slots);
+}
+
+
+void run_prodcons(Worker &w, Path path, size_t ops) {
+    Shared &s = *w.shared;
+    size_t pair = w.index / 2;
+    void **ring = s.rings[pair];
+    size_t *head = &s.heads[pair][0];
+    size_t *tail = &s.tails[pair][0];
+
+    // the producer makes ops allocations, and the consumer ops frees
+    if(!(w.index & 1)) {
+        for(size_t i = 0; i < ops; i++) {
+            void *ptr = bench_malloc(path, 64);
+            size_t h = *head;
+
+            while(h - __atomic_load_n(tail, __ATOMIC_ACQUIRE) == RING) {
+                sched_yield();
+            }
+
+            ring[h & (RING - 1)] = ptr;
+            __atomic_store_n(head, h + 1, __ATOMIC_RELEASE);
+        }
+    } else {
+        for(size_t i = 0; i < ops; i++) {
+            size_t t = *tail;
+
+            while(__atomic_load_n(head, __ATOMIC_ACQUIRE) == t) {
+                sched_yield();
+            }
+
+            bench_free(path, ring[t & (RING - 1)]);
+            __atomic_store_n(tail, t + 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+
+struct Small {
+    Small(int v): value(v), next(0) {}
+    int value;
+    Small *next;
+};
+
+
+void run_new(Worker &w, Path path, size_t ops) {
+    for(size_t i = 0; i < ops / 2; i++) {
+        if(LIBC == path) {
+            Small *p = new Small((int)i);
+            escape(p);
+            delete p;
+        } else {
+            Small *p = pml_new<Small>(s_allocators[path])((int)i);
+            pml_delete(s_allocators[path])(p);
+        }
+    }
+}
+
+
+void run_newa(Worker &w, Path path, size_t ops) {
+    // (large blocks are slow enough that we make fewer of them)
+    for(size_t i = 0; i < ops / 64; i++) {
+        if(LIBC == path) {
+            double *p = new double[LARGE];
+            p[0] = 0;
+            escape(p);
+            delete[] p;
+        } else {
+            double *p = pml_newa<double>(LARGE, s_allocators[path]);
+            p[0] = 0;
+            escape(p);
+            pml_deletea(p, s_allocators[path]);
+        }
+    }
+}
+
+
+struct Workload {
+    const char *name;
+    WorkloadFunc func;
+    size_t scale; // ops actually made per thread = ops / scale
+    bool pairs; // needs an even number of threads
+};
+
+const Workload s_workloads[] = {
+    { "pairs", run_pairs, 1, false },
+    { "churn", run_churn, 1, false },
+    { "prodcons", run_prodcons, 1, true },
+    { "larson", run_larson, 1, false },
+    { "new", run_new, 1, false },
+    { "newa", run_newa, 32, false },
+};
+
+const size_t WORKLOADS = sizeof(s_workloads) / sizeof(s_workloads[0]);
+
+
+//------------------------------------------------------------------------------
+// Driver
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+void *thread_main(void *param) {
+    Worker &w = *static_cast<Worker*>(param);
+    Shared &s = *w.shared;
+
+    pthread_barrier_wait(&s.barrier);
+    w.start = now_ns();
+    s.func(w, s.path, s.ops);
+    w.end = now_ns();
+
+    return 0;
+}
+
+
+/** Run one workload, and return the wall time (ns) - from the first thread
+ *  starting, to the last one finishing. */
+uint64_t run(const Workload &workload, Path path, size_t threads, size_t ops) {
+
+    Shared *s = static_cast<Shared*>(::calloc(1, sizeof(Shared)));
+    Worker workers[64];
+    pthread_t ids[64];
+
+    s->func = workload.func;
+    s->path = path;
+    s->ops = ops;
+    s->threads = threads;
+    pthread_barrier_init(&s->barrier, 0, (unsigned)threads);
+
+    for(size_t i = 0; i < threads; i++) {
+        workers[i].shared = s;
+        workers[i].index = i;
+        workers[i].random = 0x9e3779b97f4a7c15ull * (i + 1);
+        workers[i].slots = static_cast<void**>(::calloc(SLOTS, sizeof(void*)));
+
+        if(!(i & 1)) {
+            s->rings[i / 2] = static_cast<void**>(::calloc(RING, sizeof(void*)));
+        }
+    }
+
+    if(DEBUG == path) {
+        pml_set_debug_hook(debug_hook);
+    }
+
+    for(size_t i = 0; i < threads; i++) {
+        pthread_create(&ids[i], 0, thread_main, &workers[i]);
+    }
+
+    uint64_t start = (uint64_t)-1, end = 0;
+
+    for(size_t i = 0; i < threads; i++) {
+        pthread_join(ids[i], 0);
+
+        start = workers[i].start < start ? workers[i].start : start;
+        end = workers[i].end > end ? workers[i].end : end;
+    }
+
+    if(DEBUG == path) {
+        pml_set_debug_hook(0);
+    }
+
+    // tables moved between threads during larson, but they're all still here
+    for(size_t i = 0; i < threads; i++) {
+        ::free(workers[i].slots);
+        ::free(s->rings[i / 2]);
+        s->rings[i / 2] = 0;
+    }
+
+    pthread_barrier_destroy(&s->barrier);
+    ::free(s);
+
+    return end - start;
+}
+
+
+int usage() {
+    fprintf(stderr,
+        "usage: pmlbench [-n ops] [-t threads,...] [-w workload] [-p path]\n");
+    return 2;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+
+    size_t ops = 1000000;
+    size_t thread_counts[16] = { 1, 2, 4 };
+    size_t counts = 3;
+    const char *only_workload = 0;
+    const char *only_path = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-n") && i + 1 < argc) {
+            ops = strtoul(argv[++i], 0, 0);
+        } else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+            char *p = argv[++i];
+            counts = 0;
+            while(*p && counts < 16) {
+                size_t t = strtoul(p, &p, 0);
+                if(t < 1 || t > 64) {
+                    return usage();
+                }
+                thread_counts[counts++] = t;
+                p += (',' == *p);
+            }
+        } else if(!strcmp(argv[i], "-w") && i + 1 < argc) {
+            only_workload = argv[++i];
+        } else if(!strcmp(argv[i], "-p") && i + 1 < argc) {
+            only_path = argv[++i];
+        } else {
+            return usage();
+        }
+    }
+
+    if(!ops || !counts) {
+        return usage();
+    }
+
+    s_allocators[IALLOCATOR] = &s_libc_allocator;
+    s_allocators[TCACHE] = pml_tcache_allocator();
+    s_allocators[REMOTE] = pml_remote_allocator();
+
+    printf("%-10s %-11s %7s %10s %14s\n",
+        "workload", "path", "threads", "ns/op", "ops/s");
+
+    for(size_t w = 0; w < WORKLOADS; w++) {
+        const Workload &workload = s_workloads[w];
+
+        if(only_workload && strcmp(only_workload, workload.name)) {
+            continue;
+        }
+
+        size_t last = 0;
+
+        for(size_t c = 0; c < counts; c++) {
+            size_t threads = thread_counts[c];
+
+            if(workload.pairs) {
+                threads += threads & 1; // a consumer for every producer
+            }
+
+            if(threads == last) {
+                continue;
+            }
+            last = threads;
+
+            for(int p = 0; p < PATHS; p++) {
+#ifndef PML_DEBUG_HOOK_S
+                if(DEBUG == p) {
+                    continue;
+                }
+#endif/*PML_DEBUG_HOOK_S*/
+
+                if(only_path && strcmp(only_path, s_path_names[p])) {
+                    continue;
+                }
+
+                uint64_t elapsed = run(workload, (Path)p, threads, ops);
+                size_t per_thread = ops / workload.scale;
+
+                printf("%-10s %-11s %7zu %10.1f %14.0f\n",
+                    workload.name, s_path_names[p], threads,
+                    (double)elapsed / per_thread,
+                    (double)per_thread * threads * 1e9 / elapsed);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+# allocator microbenchmarks (see main.cpp for the workloads and paths)
+BIN_TARGET:=pmlbench
+
+SOURCE:= \
+	main.cpp \
+	# SOURCE
+
+LIBS:= \
+	pml \
+	# LIBS
+
+# the pml engines use pthreads
+LINUX_XLIBS:= \
+	-lpthread \
+	# LINUX_XLIBS
+
+
+#-------------------------------------------------------------------------------
+# Additional targets
+
+# Run the benchmarks on the current configuration (use RELEASE=1 for meaningful
+# numbers). D can be used to pass options, as with the test targets:
+#
+#     make bench RELEASE=1 D="-t 1,8 -w churn"
+
+bench: all
+	$(call bin_target,pmlbench) $(D)
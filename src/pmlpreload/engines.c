@@ -0,0 +1,19 @@
+/** \file pmlpreload/engines.c
+ *  The preload library's own build of libpml.
+ *
+ *  Rather than linking libpml.a (which is built for executables), the library
+ *  compiles the PML sources in here, position independent (see target.mak),
+ *  and with the initial-exec TLS model (see pml/sys_impl.h) - the library is
+ *  always loaded at startup, and malloc() mustn't call __tls_get_addr().
+ */
+
+#define PML_TLS_INITIAL_EXEC
+
+#include "pml/epoch.c"
+#include "pml/malloc.c"
+#include "pml/profile.c"
+#include "pml/recorder.c"
+#include "pml/remote.c"
+#include "pml/stats.c"
+#include "pml/tcache.c"
+#include "pml/trace.c"
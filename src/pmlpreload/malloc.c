@@ -0,0 +1,498 @@
+/** \file pmlpreload/malloc.c
+ *  An LD_PRELOAD library which routes a whole process through PML:
+ *
+ *      $ LD_PRELOAD=bin/release/pmlpreload.so PML_ENGINE=tcache PML_STATS=1 ./app
+ *
+ *  malloc(), free(), calloc(), realloc(), reallocarray(), posix_memalign(),
+ *  aligned_alloc(), memalign(), valloc(), pvalloc() and malloc_usable_size()
+ *  are replaced here (and the global operator new/delete in new.cpp). Each one
+ *  goes through the PML entry points, so the engines, debug hooks, stats and
+ *  sampling profiler see every allocation the program makes. The library is
+ *  configured from the environment:
+ *
+ *      PML_ENGINE          libc (the default), tcache or remote
+ *      PML_STATS           if set (and not 0), install the stats engine, and
+ *                          dump it to stderr at exit
+ *      PML_PROFILE         start the heap profiler, and write the profile to
+ *                          this file at exit
+ *      PML_PROFILE_RATE    the profiler's sampling rate, in bytes
+ *
+ *  The libc engine forwards to the next malloc() etc. in the link order (PML's
+ *  default hooks call malloc() themselves, so can't sit beneath it). Looking
+ *  those up can allocate, and so can other threads while the library starts
+ *  up. Those requests are served from a small static buffer, whose blocks are
+ *  never reused.
+ *
+ *  Aligned requests are limited to the alignments the engine supports (up to
+ *  PML_TCACHE_MAX_SIZE or PML_REMOTE_MAX_SIZE for the built-in engines).
+ */
+
+#include "pmlpreload/preload.h"
+#include "pml/profile.h"
+#include "pml/remote.h"
+#include "pml/stats.h"
+#include "pml/tcache.h"
+#include "pml/sys_impl.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Alignment of blocks from malloc(), as the C library guarantees. */
+#define PP_ALIGN 16
+
+/* Size of the bootstrap buffer. */
+#define PP_BOOTSTRAP_SIZE (64 * 1024)
+
+
+/*----------------------------------------------------------------------------*/
+/* Bootstrap */
+
+enum { PP_UNINITIALIZED, PP_STARTING, PP_READY };
+
+static int s_pp_state = PP_UNINITIALIZED;
+
+/* Bootstrap blocks are preceded by their size, so that realloc() and
+ * malloc_usable_size() work on them. */
+static char s_pp_bootstrap[PP_BOOTSTRAP_SIZE] __attribute__((aligned(PP_ALIGN)));
+static size_t s_pp_bootstrap_used;
+
+
+static inline bool pp_bootstrap_owns(const void *ptr) {
+
+    return (const char*)ptr >= s_pp_bootstrap &&
+        (const char*)ptr < s_pp_bootstrap + PP_BOOTSTRAP_SIZE;
+}
+
+
+static void *pp_bootstrap_malloc(size_t align, size_t size) {
+
+    size_t used = pml_LOAD(&s_pp_bootstrap_used), start, end;
+
+    if(align < PP_ALIGN) {
+        align = PP_ALIGN;
+    }
+
+    do {
+        start = pml_ALIGN_UP(used + sizeof(size_t), align);
+        end = start + pml_ALIGN_UP(size, PP_ALIGN);
+
+        if(size > PP_BOOTSTRAP_SIZE || end > PP_BOOTSTRAP_SIZE) {
+            errno = ENOMEM;
+            return 0;
+        }
+    } while(!pml_CAS(&s_pp_bootstrap_used, &used, end));
+
+    ((size_t*)(s_pp_bootstrap + start))[-1] = size;
+
+    return s_pp_bootstrap + start;
+}
+
+
+static inline size_t pp_bootstrap_size(const void *ptr) {
+
+    return ((const size_t*)ptr)[-1];
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* libc engine */
+
+/* The next definitions in the link order (normally the C library's). */
+static void *(*s_pp_next_malloc)(size_t);
+static void (*s_pp_next_free)(void*);
+static void *(*s_pp_next_calloc)(size_t, size_t);
+static void *(*s_pp_next_realloc)(void*, size_t);
+static int (*s_pp_next_memalign)(void**, size_t, size_t);
+static size_t (*s_pp_next_usable_size)(void*);
+
+
+static void *pp_libc_malloc(size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    return s_pp_next_malloc(size);
+}
+
+
+static void pp_libc_free(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    s_pp_next_free(ptr);
+}
+
+
+static void *pp_libc_calloc(size_t count, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    return s_pp_next_calloc(count, size);
+}
+
+
+static void *pp_libc_realloc(void *ptr, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    return s_pp_next_realloc(ptr, size);
+}
+
+
+static void *pp_libc_aligned_malloc(size_t align, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    void *ptr;
+    return s_pp_next_memalign(&ptr, align, size) ? 0 : ptr;
+}
+
+
+static size_t pp_libc_usable_size(void *ptr,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    return s_pp_next_usable_size(ptr);
+}
+
+
+static bool pp_libc_try_expand(void *ptr, size_t size,
+    PML_TYPE(Allocator) *alloc, PML_TYPE(Hint) hint) {
+
+    return size <= s_pp_next_usable_size(ptr);
+}
+
+
+static bool pp_libc_install() {
+
+    PML_TYPE(HookTable) table;
+
+    PML_CALL(get_hooks)(&table);
+    PML_CALL(init_allocator)(&table.hooks,
+        pp_libc_malloc, pp_libc_free, pp_libc_calloc, pp_libc_realloc,
+        0, pp_libc_aligned_malloc, 0, pp_libc_usable_size, pp_libc_try_expand,
+        0, 0);
+
+    return PML_CALL(set_hooks)(&table);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Startup and exit */
+
+static bool pp_flag(const char *name) {
+
+    const char *value = getenv(name);
+    return value && *value && strcmp(value, "0");
+}
+
+
+static void pp_install() {
+
+    /* (dlsym() may allocate - which is served from the bootstrap buffer) */
+    s_pp_next_malloc = (void *(*)(size_t))dlsym(RTLD_NEXT, "malloc");
+    s_pp_next_free = (void (*)(void*))dlsym(RTLD_NEXT, "free");
+    s_pp_next_calloc = (void *(*)(size_t, size_t))dlsym(RTLD_NEXT, "calloc");
+    s_pp_next_realloc = (void *(*)(void*, size_t))dlsym(RTLD_NEXT, "realloc");
+    s_pp_next_memalign =
+        (int (*)(void**, size_t, size_t))dlsym(RTLD_NEXT, "posix_memalign");
+    s_pp_next_usable_size =
+        (size_t (*)(void*))dlsym(RTLD_NEXT, "malloc_usable_size");
+
+    const char *engine = getenv("PML_ENGINE");
+
+    if(engine && !strcmp(engine, "tcache")) {
+        PML_CALL(tcache_install)();
+    } else if(engine && !strcmp(engine, "remote")) {
+        /* free() has to accept aligned blocks, which remote_aligned_free()
+         * does (along with every other block) */
+        PML_TYPE(HookTable) table;
+        PML_CALL(remote_install)();
+        PML_CALL(get_hooks)(&table);
+        table.hooks.free = table.hooks.aligned_free;
+        PML_CALL(set_hooks)(&table);
+    } else if( !s_pp_next_malloc || !s_pp_next_free || !s_pp_next_calloc ||
+        !s_pp_next_realloc || !s_pp_next_memalign || !s_pp_next_usable_size ||
+        !pp_libc_install() ) {
+
+        static const char message[] = "pmlpreload: can't find malloc()\n";
+        (void)!write(2, message, sizeof(message) - 1);
+        abort();
+    }
+
+    if(pp_flag("PML_STATS")) {
+        PML_CALL(stats_install)();
+    }
+
+    if(getenv("PML_PROFILE")) {
+        const char *rate = getenv("PML_PROFILE_RATE");
+        PML_CALL(profile_start)(rate ? (size_t)strtoull(rate, 0, 10) : 0);
+    }
+}
+
+
+/* Returns true once the library is ready, or false if it's still starting up
+ * (on this or another thread) and the caller should use the bootstrap buffer.
+ */
+static bool pp_start() {
+
+    int state = PP_UNINITIALIZED;
+
+    if(pml_CAS(&s_pp_state, &state, PP_STARTING)) {
+        pp_install();
+        pml_STORE_REL(&s_pp_state, PP_READY);
+        return true;
+    }
+
+    return PP_READY == state;
+}
+
+
+static inline bool pp_ready() {
+
+    return PP_READY == pml_LOAD_ACQ(&s_pp_state) || pp_start();
+}
+
+
+__attribute__((constructor))
+static void pp_constructor() {
+
+    pp_ready();
+}
+
+
+__attribute__((destructor))
+static void pp_destructor() {
+
+    if(pp_flag("PML_STATS")) {
+        PML_CALL(stats_dump)(stderr);
+    }
+
+    const char *path = getenv("PML_PROFILE");
+
+    if(path) {
+        /* (stopping first, so writing the profile doesn't sample itself) */
+        PML_CALL(profile_stop)();
+
+        FILE *out = fopen(path, "w");
+        if(!out || !PML_CALL(profile_write)(out)) {
+            fprintf(stderr, "pmlpreload: can't write profile to '%s'\n", path);
+        }
+        if(out) {
+            fclose(out);
+        }
+    }
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Shared with new.cpp */
+
+void *pp_malloc(size_t size, PML_TYPE(Hint) hint) {
+
+    if(!pp_ready()) {
+        return pp_bootstrap_malloc(PP_ALIGN, size);
+    }
+
+    void *ptr = PML_CALL(malloc)(size, 0, hint);
+
+    if(!ptr) {
+        errno = ENOMEM;
+    }
+
+    return ptr;
+}
+
+
+void pp_free(void *ptr, size_t size, PML_TYPE(Hint) hint) {
+
+    /* (nothing else can be freed before the library is ready) */
+    if(!ptr || pp_bootstrap_owns(ptr) || !pp_ready()) {
+        return;
+    }
+
+    PML_CALL(free_sized)(ptr, size, 0, hint);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Aligned allocation */
+
+/* Aligned blocks from the global hooks can be freed with free(): the C library
+ * allows it, and so do the engines which pp_install() sets up. */
+static int pp_memalign(void **out, size_t align, size_t size,
+    PML_TYPE(Hint) hint) {
+
+    if(align <= PP_ALIGN) {
+        *out = pp_malloc(size, hint);
+    } else if(!pp_ready()) {
+        *out = pp_bootstrap_malloc(align, size);
+    } else {
+        *out = PML_CALL(aligned_malloc)(align, size, 0, hint);
+    }
+
+    return *out ? 0 : ENOMEM;
+}
+
+
+/* memalign() et al. round align up to a power of two, as glibc's do. */
+static void *pp_aligned(size_t align, size_t size, PML_TYPE(Hint) hint) {
+
+    size_t pow2 = PP_ALIGN;
+    void *ptr;
+
+    while(pow2 < align && pow2) {
+        pow2 <<= 1;
+    }
+
+    if(!pow2 || pp_memalign(&ptr, pow2, size, hint)) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    return ptr;
+}
+
+
+static inline size_t pp_page_size() {
+
+    static size_t s_page;
+
+    if(!s_page) {
+        s_page = (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    return s_page;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/* Entry points */
+
+pp_EXPORT void *malloc(size_t size) {
+
+    return pp_malloc(size, PML_HINT("malloc"));
+}
+
+
+pp_EXPORT void free(void *ptr) {
+
+    pp_free(ptr, 0, PML_HINT("free"));
+}
+
+
+pp_EXPORT void *calloc(size_t count, size_t size) {
+
+    if(size && count > (size_t)-1 / size) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    if(!pp_ready()) {
+        /* (the buffer is zeroed, and never reused) */
+        return pp_bootstrap_malloc(PP_ALIGN, count * size);
+    }
+
+    void *ptr = PML_CALL(calloc)(count, size, 0, PML_HINT("calloc"));
+
+    if(!ptr) {
+        errno = ENOMEM;
+    }
+
+    return ptr;
+}
+
+
+pp_EXPORT void *realloc(void *ptr, size_t size) {
+
+    if(pp_bootstrap_owns(ptr)) {
+        void *out = pp_malloc(size, PML_HINT("realloc"));
+        size_t old = pp_bootstrap_size(ptr);
+
+        if(out) {
+            memcpy(out, ptr, size < old ? size : old);
+        }
+
+        return out;
+    }
+
+    if(!ptr) {
+        return pp_malloc(size, PML_HINT("realloc"));
+    }
+
+    if(!pp_ready()) {
+        return 0;
+    }
+
+    void *out = PML_CALL(realloc)(ptr, size, 0, PML_HINT("realloc"));
+
+    if(!out && size) {
+        errno = ENOMEM;
+    }
+
+    return out;
+}
+
+
+pp_EXPORT void *reallocarray(void *ptr, size_t count, size_t size) {
+
+    if(size && count > (size_t)-1 / size) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    return realloc(ptr, count * size);
+}
+
+
+pp_EXPORT int posix_memalign(void **out, size_t align, size_t size) {
+
+    if(!align || (align & (align - 1)) || (align % sizeof(void*))) {
+        return EINVAL;
+    }
+
+    return pp_memalign(out, align, size, PML_HINT("posix_memalign"));
+}
+
+
+pp_EXPORT void *aligned_alloc(size_t align, size_t size) {
+
+    return pp_aligned(align, size, PML_HINT("aligned_alloc"));
+}
+
+
+pp_EXPORT void *memalign(size_t align, size_t size) {
+
+    return pp_aligned(align, size, PML_HINT("memalign"));
+}
+
+
+pp_EXPORT void *valloc(size_t size) {
+
+    return pp_aligned(pp_page_size(), size, PML_HINT("valloc"));
+}
+
+
+pp_EXPORT void *pvalloc(size_t size) {
+
+    size_t page = pp_page_size();
+
+    if(size > (size_t)-1 - page) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    return pp_aligned(page, pml_ALIGN_UP(size ? size : 1, page), PML_HINT("pvalloc"));
+}
+
+
+pp_EXPORT size_t malloc_usable_size(void *ptr) {
+
+    if(!ptr) {
+        return 0;
+    }
+
+    if(pp_bootstrap_owns(ptr)) {
+        return pp_bootstrap_size(ptr);
+    }
+
+    return pp_ready() ? PML_CALL(usable_size)(ptr, 0, 0) : 0;
+}
@@ -0,0 +1,97 @@
+/** \file pmlpreload/new.cpp
+ *  Global operator new/delete for the preload library (see malloc.c).
+ *
+ *  These replace the C++ runtime's own, which would reach PML through malloc()
+ *  anyway - but this way the sizes which delete knows are passed on to the
+ *  engine (the sized forms are only called by code built with C++14 or later),
+ *  and stats can tell new and malloc() apart. The aligned forms (C++17) are
+ *  left to the runtime, which implements them with aligned_alloc() and free().
+ */
+
+#include "pmlpreload/preload.h"
+
+#include <new>
+
+
+namespace {
+
+void *pp_new(size_t size, pml::Hint hint) {
+
+    if(!size) {
+        size = 1;
+    }
+
+    for(;;) {
+        void *ptr = pp_malloc(size, hint);
+
+        if(ptr) {
+            return ptr;
+        }
+
+        // (C++98 has no get_new_handler())
+        std::new_handler handler = std::set_new_handler(0);
+        std::set_new_handler(handler);
+
+        if(!handler) {
+            throw std::bad_alloc();
+        }
+
+        handler();
+    }
+}
+
+
+void *pp_new_nothrow(size_t size, pml::Hint hint) throw() {
+
+    try {
+        return pp_new(size, hint);
+    } catch(...) {
+        return 0;
+    }
+}
+
+} // namespace
+
+
+pp_EXPORT void *operator new(size_t size) throw(std::bad_alloc) {
+    return pp_new(size, PML_HINT("operator new"));
+}
+
+pp_EXPORT void *operator new[](size_t size) throw(std::bad_alloc) {
+    return pp_new(size, PML_HINT("operator new[]"));
+}
+
+pp_EXPORT void *operator new(size_t size, const std::nothrow_t&) throw() {
+    return pp_new_nothrow(size, PML_HINT("operator new"));
+}
+
+pp_EXPORT void *operator new[](size_t size, const std::nothrow_t&) throw() {
+    return pp_new_nothrow(size, PML_HINT("operator new[]"));
+}
+
+
+pp_EXPORT void operator delete(void *ptr) throw() {
+    pp_free(ptr, 0, PML_HINT("operator delete"));
+}
+
+pp_EXPORT void operator delete[](void *ptr) throw() {
+    pp_free(ptr, 0, PML_HINT("operator delete[]"));
+}
+
+pp_EXPORT void operator delete(void *ptr, const std::nothrow_t&) throw() {
+    pp_free(ptr, 0, PML_HINT("operator delete"));
+}
+
+pp_EXPORT void operator delete[](void *ptr, const std::nothrow_t&) throw() {
+    pp_free(ptr, 0, PML_HINT("operator delete[]"));
+}
+
+// (in C++98 these are placement forms, with the same symbols as C++14's sized
+// delete)
+pp_EXPORT void operator delete(void *ptr, size_t size) throw() {
+    pp_free(ptr, size, PML_HINT("operator delete"));
+}
+
+pp_EXPORT void operator delete[](void *ptr, size_t size) throw() {
+    pp_free(ptr, size, PML_HINT("operator delete[]"));
+}
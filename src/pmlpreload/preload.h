@@ -0,0 +1,32 @@
+#ifndef PMLPRELOAD_PRELOAD_H
+#define PMLPRELOAD_PRELOAD_H
+
+/** \file pmlpreload/preload.h
+ *  Internal interface between the C entry points (malloc.c) and the C++ ones
+ *  (new.cpp) of the preload library.
+ */
+
+#include "pml/malloc.h"
+
+/** Entry points are exported from the library (even with -fvisibility=hidden),
+ *  and the functions shared between its sources never are. */
+#define pp_EXPORT __attribute__((visibility("default")))
+#define pp_INTERNAL __attribute__((visibility("hidden")))
+
+#ifdef __cplusplus
+extern "C" {
+#endif/*__cplusplus*/
+
+/** Allocate size bytes through PML (or from the bootstrap buffer, while the
+ *  library is starting up). */
+pp_INTERNAL void *pp_malloc(size_t size, PML_Q_TYPE(Hint) hint);
+
+/** Free a block from pp_malloc() (size may be 0, for "unknown"). */
+pp_INTERNAL void pp_free(void *ptr, size_t size, PML_Q_TYPE(Hint) hint);
+
+#ifdef __cplusplus
+}
+#endif/*__cplusplus*/
+
+
+#endif/*PMLPRELOAD_PRELOAD_H*/
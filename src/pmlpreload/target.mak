@@ -0,0 +1,20 @@
+# LD_PRELOAD library which routes a whole process through PML (see malloc.c)
+DLL_TARGET:=pmlpreload
+
+SOURCE:= \
+	engines.c \
+	malloc.c \
+	new.cpp \
+	# SOURCE
+
+# the DLL's objects (including its own build of libpml, see engines.c) are
+# position independent - other targets which use libpml.a aren't affected
+obj/$(TYPE)/pmlpreload/%.o: CFLAGS+=-fPIC
+
+# the pml engines use pthreads, the libc engine uses dlsym(), and operator new
+# needs the C++ runtime (the DLL is linked with gcc)
+LINUX_XLIBS:= \
+	-ldl \
+	-lpthread \
+	-lstdc++ \
+	# LINUX_XLIBS
@@ -0,0 +1,807 @@
+/** \file pmlreplay/main.cpp
+ *  Replays an allocation trace (see pml/trace.h) against a chosen engine, and
+ *  reports throughput, peak RSS and fragmentation:
+ *
+ *      pmlreplay [-e engine] [-v] trace
+ *      pmlreplay -g trace
+ *
+ *  The engines are:
+ *
+ *      libc        the default PML hooks (malloc()/free())
+ *      tcache      the PML thread-caching engine (pml/tcache.h)
+ *      iallocator  an IAllocator over malloc()/free() (virtual dispatch cost)
+ *      pool        size-classed pml::FixedPools, with a header per block
+ *      arena       a pml::Arena (frees are no-ops)
+ *
+ *  Every thread's events are replayed on one thread, in the order they were
+ *  recorded, so the results are repeatable (but don't show contention). Blocks
+ *  are written to once per page, as the application would have. new/delete
+ *  events are counted as markers only - the allocation beneath them is what's
+ *  replayed. If an address is allocated again before its free was recorded
+ *  (two threads racing to record), the old block is freed then, and the late
+ *  free is skipped.
+ *
+ *  -g records a small synthetic trace instead (every event type, and sizes
+ *  from 1 byte to 8MB), which 'make replaytest' replays on every engine.
+ */
+
+#include "pml/arena.h"
+#include "pml/pool.h"
+#include "pml/tcache.h"
+#include "pml/trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+namespace {
+
+//------------------------------------------------------------------------------
+// Engines
+
+/** An IAllocator over the C library, to compare with the plain hooks. */
+struct LibcAllocator: pml::IAllocator {
+
+    virtual void *malloc(size_t size, pml::Hint h = 0) {
+        return ::malloc(size);
+    }
+
+    virtual void free(void *ptr, pml::Hint h = 0) {
+        ::free(ptr);
+    }
+
+    virtual void *calloc(size_t count, size_t size, pml::Hint h = 0) {
+        return ::calloc(count, size);
+    }
+
+    virtual void *realloc(void *ptr, size_t size, pml::Hint h = 0) {
+        return ::realloc(ptr, size);
+    }
+};
+
+
+/** Power-of-two size classes served by FixedPools, with larger blocks going
+ *  to the global hooks. Each block starts with a header naming its class.
+ */
+struct ClassPool: pml::IAllocator {
+
+    enum { HEADER = 16, CLASSES = 8 };
+
+    virtual void *malloc(size_t size, pml::Hint h = 0) {
+        size_t bytes = size + HEADER;
+        unsigned c = 0;
+
+        while(c < CLASSES && bytes > ((size_t)32 << c)) {
+            c++;
+        }
+
+        char *block = static_cast<char*>(c < CLASSES ?
+            alloc_class(c, bytes, h) : pml_malloc(bytes, 0, h));
+
+        if(!block) {
+            return 0;
+        }
+
+        *reinterpret_cast<size_t*>(block) = c;
+        return block + HEADER;
+    }
+
+    // (so emulate_realloc() copies no more than the old block holds)
+    virtual size_t usable_size(void *ptr, pml::Hint h = 0) {
+        char *block = static_cast<char*>(ptr) - HEADER;
+        size_t c = *reinterpret_cast<size_t*>(block);
+
+        size_t bytes = c < CLASSES ?
+            (size_t)32 << c : pml_usable_size(block, 0, h); // (0 if unknown)
+
+        return bytes > HEADER ? bytes - HEADER : 0;
+    }
+
+    virtual void free(void *ptr, pml::Hint h = 0) {
+        if(!ptr) {
+            return;
+        }
+
+        char *block = static_cast<char*>(ptr) - HEADER;
+
+        switch(*reinterpret_cast<size_t*>(block)) {
+            case 0: m_p32.free(block, h); break;
+            case 1: m_p64.free(block, h); break;
+            case 2: m_p128.free(block, h); break;
+            case 3: m_p256.free(block, h); break;
+            case 4: m_p512.free(block, h); break;
+            case 5: m_p1k.free(block, h); break;
+            case 6: m_p2k.free(block, h); break;
+            case 7: m_p4k.free(block, h); break;
+            default: pml_free(block, 0, h); break;
+        }
+    }
+
+private:
+    void *alloc_class(unsigned c, size_t bytes, pml::Hint h) {
+        switch(c) {
+            case 0: return m_p32.malloc(bytes, h);
+            case 1: return m_p64.malloc(bytes, h);
+            case 2: return m_p128.malloc(bytes, h);
+            case 3: return m_p256.malloc(bytes, h);
+            case 4: return m_p512.malloc(bytes, h);
+            case 5: return m_p1k.malloc(bytes, h);
+            case 6: return m_p2k.malloc(bytes, h);
+            default: return m_p4k.malloc(bytes, h);
+        }
+    }
+
+    pml::FixedPool<32, 16> m_p32;
+    pml::FixedPool<64, 16> m_p64;
+    pml::FixedPool<128, 16> m_p128;
+    pml::FixedPool<256, 16> m_p256;
+    pml::FixedPool<512, 16> m_p512;
+    pml::FixedPool<1024, 16> m_p1k;
+    pml::FixedPool<2048, 16> m_p2k;
+    pml::FixedPool<4096, 16> m_p4k;
+};
+
+
+//------------------------------------------------------------------------------
+// Live block map (trace address -> replayed block)
+
+struct Block {
+    uint64_t key; // 0 for an empty slot
+    void *ptr;
+    uint64_t size;
+    uint32_t skip; // late frees to ignore
+    bool aligned;
+};
+
+
+/** An open addressed table with linear probing, sized up front for the
+ *  trace's peak number of live blocks (so replaying never grows it).
+ */
+struct BlockMap {
+
+    BlockMap(): m_blocks(0), m_mask(0) {}
+
+    ~BlockMap() {
+        ::free(m_blocks);
+    }
+
+    bool reserve(size_t live) {
+        size_t slots = 16;
+        while(slots < 2 * live) {
+            slots <<= 1;
+        }
+
+        ::free(m_blocks);
+        m_blocks = static_cast<Block*>(::malloc(slots * sizeof(Block)));
+        m_mask = slots - 1;
+
+        // (written out now, so the map is part of the baseline RSS)
+        if(m_blocks) {
+            memset(m_blocks, 0, slots * sizeof(Block));
+        }
+
+        return !!m_blocks;
+    }
+
+    Block *find(uint64_t key) {
+        for(size_t i = home(key); m_blocks[i].key; i = (i + 1) & m_mask) {
+            if(m_blocks[i].key == key) {
+                return &m_blocks[i];
+            }
+        }
+        return 0;
+    }
+
+    Block *insert(uint64_t key) {
+        size_t i = home(key);
+        while(m_blocks[i].key) {
+            i = (i + 1) & m_mask;
+        }
+
+        m_blocks[i].key = key;
+        return &m_blocks[i];
+    }
+
+    // remove b, shifting back any later entries in its probe sequence
+    void remove(Block *b) {
+        size_t i = b - m_blocks;
+        size_t j = i;
+
+        for(;;) {
+            j = (j + 1) & m_mask;
+
+            if(!m_blocks[j].key) {
+                break;
+            }
+
+            size_t h = home(m_blocks[j].key);
+            bool stays = (i <= j) ? (i < h && h <= j) : (i < h || h <= j);
+
+            if(!stays) {
+                m_blocks[i] = m_blocks[j];
+                i = j;
+            }
+        }
+
+        m_blocks[i].key = 0;
+    }
+
+private:
+    size_t home(uint64_t key) const {
+        return (size_t)(((key >> 4) * 0x9e3779b97f4a7c15ull) >> 32) & m_mask;
+    }
+
+    Block *m_blocks;
+    size_t m_mask;
+};
+
+
+//------------------------------------------------------------------------------
+// Trace file
+
+struct Trace {
+
+    Trace(): header(0), records(0), hints(0), m_map(0), m_size(0) {}
+
+    ~Trace() {
+        if(m_map) {
+            munmap(m_map, m_size);
+        }
+        ::free(hints);
+    }
+
+    bool open(const char *path) {
+        int fd = ::open(path, O_RDONLY);
+        struct stat st;
+
+        if(fd < 0 || fstat(fd, &st) || (size_t)st.st_size < sizeof(pml::TraceHeader)) {
+            if(fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+
+        m_size = st.st_size;
+        m_map = mmap(0, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if(MAP_FAILED == m_map) {
+            m_map = 0;
+            return false;
+        }
+
+        header = static_cast<const pml::TraceHeader*>(m_map);
+        records = reinterpret_cast<const pml::TraceRecord*>(header + 1);
+
+        return
+            !memcmp(header->magic, PML_TRACE_MAGIC, sizeof(header->magic)) &&
+            PML_TRACE_VERSION == header->version &&
+            sizeof(pml::TraceRecord) == header->record_size &&
+            header->hints_offset == sizeof(*header) + header->records * sizeof(*records) &&
+            header->hints_offset <= m_size &&
+            read_hints();
+    }
+
+    const pml::TraceHeader *header;
+    const pml::TraceRecord *records;
+    char **hints; // by id (0 is null), then the strings themselves
+
+private:
+    // copy the hint table out into terminated strings
+    bool read_hints() {
+        size_t count = header->hints;
+        size_t total = (count + 1) * sizeof(char*) + (m_size - header->hints_offset) + count;
+
+        hints = static_cast<char**>(::calloc(1, total));
+        if(!hints) {
+            return false;
+        }
+
+        const char *in = static_cast<const char*>(m_map) + header->hints_offset;
+        const char *end = static_cast<const char*>(m_map) + m_size;
+        char *out = reinterpret_cast<char*>(hints + count + 1);
+
+        for(size_t id = 1; id <= count; id++) {
+            uint32_t length;
+            if(in + sizeof(length) > end) {
+                return false;
+            }
+
+            memcpy(&length, in, sizeof(length));
+            in += sizeof(length);
+
+            if(length > (size_t)(end - in)) {
+                return false;
+            }
+
+            hints[id] = out;
+            memcpy(out, in, length);
+            out += length + 1;
+            in += length;
+        }
+
+        return true;
+    }
+
+    void *m_map;
+    size_t m_size;
+};
+
+
+//------------------------------------------------------------------------------
+// Measurement
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+// (read with no stdio, as that would allocate from the heap being measured)
+size_t rss_bytes() {
+    char text[128];
+    unsigned long pages = 0, resident = 0;
+    int fd = open("/proc/self/statm", O_RDONLY);
+
+    if(fd >= 0) {
+        ssize_t n = read(fd, text, sizeof(text) - 1);
+        text[n > 0 ? n : 0] = 0;
+
+        if(2 != sscanf(text, "%lu %lu", &pages, &resident)) {
+            resident = 0;
+        }
+        close(fd);
+    }
+
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+
+struct Counts {
+    uint64_t mallocs;
+    uint64_t frees;
+    uint64_t reallocs;
+    uint64_t markers;
+    uint64_t unmatched; // frees of blocks we never saw allocated
+    uint64_t late; // frees skipped after an address was reused
+    uint64_t failed;
+    uint64_t live_bytes;
+    uint64_t peak_live_bytes;
+    size_t live;
+    size_t peak_live;
+    size_t peak_rss;
+};
+
+
+bool is_alloc(uint8_t type) {
+    return pml::MALLOC == type || pml::CALLOC == type ||
+        pml::ALIGNED_MALLOC == type || pml::REALLOC == type;
+}
+
+
+/** Count the peak number of live blocks (to size the map). */
+size_t peak_live(const Trace &trace) {
+
+    BlockMap map;
+    size_t live = 0, peak = 0;
+
+    // (sized for every allocation, as we don't know any better yet)
+    size_t allocs = 0;
+    for(uint64_t i = 0; i < trace.header->records; i++) {
+        allocs += is_alloc(trace.records[i].type);
+    }
+
+    if(!map.reserve(allocs)) {
+        return 0;
+    }
+
+    for(uint64_t i = 0; i < trace.header->records; i++) {
+        const pml::TraceRecord &r = trace.records[i];
+        bool frees = pml::FREE == r.type || pml::ALIGNED_FREE == r.type ||
+            (pml::REALLOC == r.type && r.in && (r.ptr != r.in || !r.size));
+
+        Block *b;
+        if(frees && (b = map.find(pml::REALLOC == r.type ? r.in : r.ptr))) {
+            map.remove(b);
+            live--;
+        }
+
+        if(is_alloc(r.type) && r.ptr && !map.find(r.ptr)) {
+            map.insert(r.ptr);
+            if(++live > peak) {
+                peak = live;
+            }
+        }
+    }
+
+    return peak;
+}
+
+
+//------------------------------------------------------------------------------
+// Replay
+
+struct Replay {
+
+    Replay(const Trace &t, pml::Allocator *a): trace(t), alloc(a) {
+        memset(&counts, 0, sizeof(counts));
+    }
+
+    void touch(void *ptr, uint64_t size, uint64_t from) {
+        char *p = static_cast<char*>(ptr);
+        for(uint64_t i = from; i < size; i += 4096) {
+            p[i] = 1;
+        }
+        if(size > from) {
+            p[size - 1] = 1;
+        }
+    }
+
+    void add(uint64_t key, void *ptr, uint64_t size, bool aligned, pml::Hint hint) {
+        if(!ptr) {
+            counts.failed++;
+            return;
+        }
+
+        uint32_t skip = 0;
+        Block *b = map.find(key);
+
+        if(b) {
+            // reused before its free was recorded
+            release(b, hint);
+            skip = b->skip + 1;
+            map.remove(b);
+        }
+
+        b = map.insert(key);
+        b->ptr = ptr;
+        b->size = size;
+        b->skip = skip;
+        b->aligned = aligned;
+
+        counts.live_bytes += size;
+        if(counts.live_bytes > counts.peak_live_bytes) {
+            counts.peak_live_bytes = counts.live_bytes;
+        }
+
+        if(++counts.live > counts.peak_live) {
+            counts.peak_live = counts.live;
+        }
+    }
+
+    void release(Block *b, pml::Hint hint) {
+        if(b->aligned) {
+            pml_aligned_free(b->ptr, alloc, hint);
+        } else {
+            pml_free_sized(b->ptr, b->size, alloc, hint);
+        }
+
+        counts.live_bytes -= b->size;
+        counts.live--;
+    }
+
+    void free(uint64_t key, pml::Hint hint) {
+        Block *b = map.find(key);
+
+        if(!b) {
+            counts.unmatched++;
+        } else if(b->skip) {
+            b->skip--;
+            counts.late++;
+        } else {
+            release(b, hint);
+            map.remove(b);
+        }
+    }
+
+    void realloc(const pml::TraceRecord &r, pml::Hint hint) {
+        Block *b = map.find(r.in);
+
+        if(!b) {
+            counts.unmatched++;
+            void *ptr = pml_malloc(r.size, alloc, hint);
+            if(ptr) {
+                touch(ptr, r.size, 0);
+            }
+            add(r.ptr, ptr, r.size, false, hint);
+            return;
+        }
+
+        uint64_t old = b->size;
+        void *ptr = pml_realloc(b->ptr, r.size, alloc, hint);
+
+        if(!ptr) {
+            counts.failed++;
+            return;
+        }
+
+        touch(ptr, r.size, old);
+
+        counts.live_bytes -= old;
+        counts.live--;
+        map.remove(b);
+
+        add(r.ptr, ptr, r.size, false, hint);
+    }
+
+    void step(const pml::TraceRecord &r) {
+        pml::Hint hint = trace.hints[r.hint <= trace.header->hints ? r.hint : 0];
+
+        switch(r.type) {
+            case pml::MALLOC:
+            case pml::CALLOC:
+            case pml::ALIGNED_MALLOC: {
+                bool aligned = (pml::ALIGNED_MALLOC == r.type);
+                void *ptr =
+                    aligned ? pml_aligned_malloc((size_t)1 << r.align_log2, r.size, alloc, hint) :
+                    pml::CALLOC == r.type ? pml_calloc(1, r.size, alloc, hint) :
+                    pml_malloc(r.size, alloc, hint);
+
+                if(ptr && pml::CALLOC != r.type) {
+                    touch(ptr, r.size, 0);
+                }
+
+                counts.mallocs++;
+                add(r.ptr, ptr, r.size, aligned, hint);
+                break;
+            }
+
+            case pml::FREE:
+            case pml::ALIGNED_FREE: {
+                if(r.ptr) {
+                    counts.frees++;
+                    free(r.ptr, hint);
+                }
+                break;
+            }
+
+            case pml::REALLOC: {
+                counts.reallocs++;
+                if(!r.in) {
+                    void *ptr = pml_malloc(r.size, alloc, hint);
+                    if(ptr) {
+                        touch(ptr, r.size, 0);
+                    }
+                    add(r.ptr, ptr, r.size, false, hint);
+                } else if(!r.size) {
+                    free(r.in, hint);
+                } else if(r.ptr) {
+                    realloc(r, hint);
+                }
+                break;
+            }
+
+            default: {
+                counts.markers++;
+                break;
+            }
+        }
+    }
+
+    // replay the trace, sampling RSS every 4096 records (outside the timed
+    // runs, so it isn't charged to the engine), and return the time taken
+    uint64_t run() {
+        uint64_t records = trace.header->records;
+        uint64_t elapsed = 0;
+
+        for(uint64_t i = 0; i < records; ) {
+            uint64_t end = records - i > 0x1000 ? i + 0x1000 : records;
+            uint64_t start = now_ns();
+
+            for(; i < end; i++) {
+                step(trace.records[i]);
+            }
+
+            elapsed += now_ns() - start;
+            sample_rss();
+        }
+
+        return elapsed;
+    }
+
+    // free whatever the trace left live (not timed)
+    void drain() {
+        for(uint64_t i = 0; i < trace.header->records; i++) {
+            const pml::TraceRecord &r = trace.records[i];
+            Block *b;
+
+            while(is_alloc(r.type) && (b = map.find(r.ptr))) {
+                release(b, 0);
+                map.remove(b);
+            }
+        }
+    }
+
+    void sample_rss() {
+        size_t rss = rss_bytes();
+        if(rss > counts.peak_rss) {
+            counts.peak_rss = rss;
+        }
+    }
+
+    const Trace &trace;
+    pml::Allocator *alloc;
+    BlockMap map;
+    Counts counts;
+};
+
+
+/** Record the -g trace. */
+bool generate(const char *path) {
+
+    static const size_t SIZES[] = {
+        1, 16, 24, 100, 500, 1000, 4000, 5000, 70000, 1 << 20,
+    };
+    enum { COUNT = sizeof(SIZES) / sizeof(SIZES[0]) };
+
+    if(!pml_trace_start(path)) {
+        return false;
+    }
+
+    void *blocks[COUNT];
+    void *aligned[COUNT];
+
+    for(int round = 0; round < 4; round++) {
+        for(size_t i = 0; i < COUNT; i++) {
+            blocks[i] = (round & 1) ?
+                pml_calloc(1, SIZES[i], 0, "calloc") :
+                pml_malloc(SIZES[i], 0, "malloc");
+            aligned[i] = pml_aligned_malloc(
+                (size_t)16 << (i % 8), SIZES[i], 0, "aligned");
+        }
+
+        // grow everything (the smallest blocks to 8MB), then shrink it again
+        for(size_t i = 0; i < COUNT; i++) {
+            size_t size = i < 2 ? 8 << 20 : SIZES[i] * 3;
+            blocks[i] = pml_realloc(blocks[i], size, 0, "grow");
+        }
+
+        for(size_t i = 0; i < COUNT; i++) {
+            blocks[i] = pml_realloc(blocks[i], SIZES[COUNT - 1 - i], 0, "shrink");
+        }
+
+        for(size_t i = 0; i < COUNT; i++) {
+            pml_free(blocks[i], 0, "malloc");
+            pml_aligned_free(aligned[i], 0, "aligned");
+        }
+    }
+
+    // realloc() as malloc() and free()
+    void *ptr = pml_realloc(0, 32, 0, "realloc");
+    pml_realloc(ptr, 0, 0, "realloc");
+
+    return pml_trace_stop();
+}
+
+
+int usage() {
+    fprintf(stderr,
+        "usage: pmlreplay [-e libc|tcache|iallocator|pool|arena] [-v] trace\n"
+        "       pmlreplay -g trace\n");
+    return 2;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+
+    const char *engine = "libc";
+    const char *path = 0;
+    bool verbose = false;
+    bool record = false;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-e") && i + 1 < argc) {
+            engine = argv[++i];
+        } else if(!strcmp(argv[i], "-v")) {
+            verbose = true;
+        } else if(!strcmp(argv[i], "-g")) {
+            record = true;
+        } else if(argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            return usage();
+        }
+    }
+
+    if(!path) {
+        return usage();
+    }
+
+    if(record) {
+        if(!generate(path)) {
+            fprintf(stderr, "pmlreplay: can't write trace '%s'\n", path);
+            return 1;
+        }
+        return 0;
+    }
+
+    Trace trace;
+    if(!trace.open(path)) {
+        fprintf(stderr, "pmlreplay: can't read trace '%s'\n", path);
+        return 1;
+    }
+
+    LibcAllocator libc;
+    ClassPool pool;
+    pml::Arena arena;
+    pml::Allocator *alloc = 0;
+
+    if(!strcmp(engine, "libc")) {
+        alloc = 0;
+    } else if(!strcmp(engine, "tcache")) {
+        alloc = pml_tcache_allocator();
+    } else if(!strcmp(engine, "iallocator")) {
+        alloc = &libc;
+    } else if(!strcmp(engine, "pool")) {
+        alloc = &pool;
+    } else if(!strcmp(engine, "arena")) {
+        alloc = &arena;
+    } else {
+        return usage();
+    }
+
+    Replay replay(trace, alloc);
+
+    if(!replay.map.reserve(peak_live(trace))) {
+        fprintf(stderr, "pmlreplay: out of memory\n");
+        return 1;
+    }
+
+    size_t baseline = rss_bytes();
+
+    uint64_t elapsed = replay.run();
+
+    const Counts &c = replay.counts;
+    uint64_t ops = c.mallocs + c.frees + c.reallocs;
+    double seconds = elapsed / 1e9;
+    size_t rss = c.peak_rss > baseline ? c.peak_rss - baseline : 0;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("trace:          %s (%llu records, %llu threads, %llu hints)\n", path,
+        (unsigned long long)trace.header->records,
+        (unsigned long long)trace.header->threads,
+        (unsigned long long)trace.header->hints);
+    printf("engine:         %s\n", engine);
+    printf("operations:     %llu (%llu malloc, %llu free, %llu realloc)\n",
+        (unsigned long long)ops, (unsigned long long)c.mallocs,
+        (unsigned long long)c.frees, (unsigned long long)c.reallocs);
+    printf("time:           %.3f ms (%.1f ns/op)\n",
+        seconds * 1e3, ops ? (double)elapsed / ops : 0.0);
+    printf("throughput:     %.0f ops/s\n", seconds > 0 ? ops / seconds : 0.0);
+    printf("peak live:      %llu bytes in %zu blocks\n",
+        (unsigned long long)c.peak_live_bytes, c.peak_live);
+    printf("peak rss:       %zu bytes above baseline (max rss %ld KB)\n",
+        rss, (long)usage.ru_maxrss);
+
+    // fragmentation is the share of the RSS growth not holding live data
+    if(rss) {
+        double used = c.peak_live_bytes < rss ? (double)c.peak_live_bytes / rss : 1.0;
+        printf("fragmentation:  %.1f%%\n", (1.0 - used) * 100.0);
+    } else {
+        printf("fragmentation:  n/a\n");
+    }
+
+    if(verbose || c.markers || c.unmatched || c.late || c.failed) {
+        printf("other:          %llu markers, %llu unmatched, %llu late, %llu failed\n",
+            (unsigned long long)c.markers, (unsigned long long)c.unmatched,
+            (unsigned long long)c.late, (unsigned long long)c.failed);
+    }
+
+    replay.drain();
+
+    return 0;
+}
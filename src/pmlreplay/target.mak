@@ -0,0 +1,30 @@
+# replays allocation traces (see pml/trace.h) against the PML engines
+BIN_TARGET:=pmlreplay
+
+SOURCE:= \
+	main.cpp \
+	# SOURCE
+
+LIBS:= \
+	pml \
+	# LIBS
+
+# the pml engines use pthreads
+LINUX_XLIBS:= \
+	-lpthread \
+	# LINUX_XLIBS
+
+
+#-------------------------------------------------------------------------------
+# Additional targets
+
+# Smoke test: record a synthetic trace (see -g), and replay it on every engine.
+
+replay_trace:=$(call bin_target,pmlreplay).pmltrace
+
+replaytest: all
+	$(call bin_target,pmlreplay) -g $(replay_trace)
+	@for engine in libc tcache iallocator pool arena; do \
+		$(call bin_target,pmlreplay) -e $$engine $(replay_trace) || exit 1; \
+	done
+	@rm -f $(replay_trace)
@@ -44,6 +44,16 @@ void TFR_main(int argc, char **argv) {
 
     c_declare_pml_tests();
     pml::declare_pml_tests();
+    c_declare_pml_hint_tests();
+    c_declare_pml_tcache_tests();
+    pml::declare_pml_arena_tests();
+    pml::declare_pml_pool_tests();
+    c_declare_pml_recorder_tests();
+    c_declare_pml_stats_tests();
+    c_declare_pml_profile_tests();
+    c_declare_pml_trace_tests();
+    c_declare_pml_remote_tests();
+    c_declare_pml_epoch_tests();
 
 }
 
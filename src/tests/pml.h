@@ -15,6 +15,14 @@ namespace pml {
 
 void declare_pml_tests();
 
+// pml/arena.cpp
+
+void declare_pml_arena_tests();
+
+// pml/pool.cpp
+
+void declare_pml_pool_tests();
+
 
 } // namespace pml
 } // namespace tests
@@ -26,6 +34,38 @@ extern "C" {
 
 void c_declare_pml_tests();
 
+// pml/hint.c
+
+void c_declare_pml_hint_tests();
+
+// pml/tcache.c
+
+void c_declare_pml_tcache_tests();
+
+// pml/recorder.c
+
+void c_declare_pml_recorder_tests();
+
+// pml/stats.c
+
+void c_declare_pml_stats_tests();
+
+// pml/profile.c
+
+void c_declare_pml_profile_tests();
+
+// pml/trace.c
+
+void c_declare_pml_trace_tests();
+
+// pml/remote.c
+
+void c_declare_pml_remote_tests();
+
+// pml/epoch.c
+
+void c_declare_pml_epoch_tests();
+
 #ifdef __cplusplus
 } // extern "C"
 #endif//__cplusplus
@@ -0,0 +1,280 @@
+#include "tests/pml.h"
+#include "pml/arena.h"
+
+
+namespace tests {
+namespace pml {
+
+//------------------------------------------------------------------------------
+
+struct Tracked {
+
+    Tracked(int *c): count(c) { (*count)++; }
+    ~Tracked() { (*count)--; }
+
+    int *count;
+};
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool test_arena_mark_release() {
+
+    ::pml::Arena arena(256);
+
+    ::pml::Arena::Mark m = arena.mark();
+    void *a = ::pml_malloc(100, &arena);
+    void *b = ::pml_malloc(100, &arena);
+    void *c = ::pml_malloc(100, &arena); // spills into a second chunk
+
+    bool result =
+        TFR_check(4, a && b && c) &&
+        TFR_check(4, 0 == (reinterpret_cast<size_t>(b) & (::pml::Arena::ALIGN - 1))) &&
+        TFR_check(4, static_cast<char*>(b) == static_cast<char*>(a) + 112);
+
+    ::pml_free(a, &arena); // no-op
+
+    arena.release(m);
+
+    // same memory is handed out again, including the second chunk
+    result &=
+        TFR_check(4, a == ::pml_malloc(100, &arena)) &&
+        TFR_check(4, b == ::pml_malloc(100, &arena)) &&
+        TFR_check(4, c == ::pml_malloc(100, &arena));
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool test_arena_new_delete() {
+
+    ::pml::Arena arena;
+    int count = 0;
+
+    ::pml::Arena::Mark m = arena.mark();
+
+    Tracked *t = pml_new<Tracked>(&arena)(&count);
+    int *arr = pml_new<int>(&arena)[64];
+
+    bool result = TFR_check(4, t && arr && 1 == count);
+
+    pml_delete(&arena)(t);
+    pml_delete(&arena)[arr];
+
+    result &= TFR_check(4, 0 == count);
+
+    arena.release(m);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool test_arena_track() {
+
+    int count = 0;
+    bool result;
+
+    {
+        ::pml::Arena arena;
+
+        arena.track(pml_new<Tracked>(&arena)(&count));
+        ::pml::Arena::Mark m = arena.mark();
+        arena.track(pml_new<Tracked>(&arena)(&count));
+        arena.track(pml_new<Tracked>(&arena)(&count));
+
+        result = TFR_check(4, 3 == count);
+
+        arena.release(m);
+        result &= TFR_check(4, 1 == count);
+    }
+
+    // arena destructor releases everything
+    result &= TFR_check(4, 0 == count);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool test_arena_realloc() {
+
+    ::pml::Arena arena(256);
+
+    char *a = static_cast<char*>(::pml_malloc(16, &arena));
+    for(int i = 0; i < 16; i++) { a[i] = static_cast<char>(i); }
+
+    // last allocation grows in place
+    char *b = static_cast<char*>(::pml_realloc(a, 64, &arena));
+    bool result = TFR_check(4, a == b);
+
+    // ...until it doesn't fit any more
+    b = static_cast<char*>(::pml_realloc(b, 1024, &arena));
+    result &= TFR_check(4, a != b);
+
+    for(int i = 0; i < 16; i++) {
+        if(b[i] != static_cast<char>(i)) {
+            result = false;
+        }
+    }
+
+    // an earlier block is copied, up to the end of the chunk's used space
+    // (which is where the copy goes, so the two don't overlap)
+    arena.reset();
+    a = static_cast<char*>(::pml_malloc(32, &arena));
+    for(int i = 0; i < 32; i++) { a[i] = static_cast<char>(i); }
+    ::pml_malloc(16, &arena);
+
+    b = static_cast<char*>(::pml_realloc(a, 64, &arena));
+    result &= TFR_check(4, b == a + 48);
+
+    for(int i = 0; i < 32; i++) {
+        if(b[i] != static_cast<char>(i)) {
+            result = false;
+        }
+    }
+
+    // sizes which would wrap when aligned fail
+    const size_t huge = ~static_cast<size_t>(0);
+
+    result &=
+        TFR_check(4, !::pml_malloc(huge, &arena)) &&
+        TFR_check(4, !::pml_malloc(huge - 4096, &arena)) &&
+        TFR_check(4, !::pml_realloc(b, huge, &arena)) &&
+        TFR_check(4, !::pml_aligned_malloc(64, huge - 32, &arena));
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+struct CountingParent: ::pml::IAllocator {
+
+    CountingParent(): live(0) {}
+
+    virtual void *malloc(size_t size, ::pml::Hint h = 0) {
+        live++;
+        return ::pml_malloc(size, 0, h);
+    }
+
+    virtual void free(void *ptr, ::pml::Hint h = 0) {
+        live--;
+        ::pml_free(ptr, 0, h);
+    }
+
+    int live;
+};
+
+
+TFR_Bool test_inline_arena() {
+
+    CountingParent parent;
+    ::pml::InlineArena<256> arena(&parent);
+    int count = 0;
+
+    Tracked *t = pml_new<Tracked>(&arena)(&count);
+    int *arr = pml_newa<int>(16, &arena);
+    int *big = pml_newa<int>(64, &arena); // doesn't fit, so from the parent
+
+    bool result =
+        TFR_check(4, t && arr && big && 1 == count) &&
+        TFR_check(4, arena.owns(t) && arena.owns(arr) && !arena.owns(big)) &&
+        TFR_check(4, 1 == parent.live);
+
+    // the fallback is transparent to pml_delete()
+    pml_deletea(big, &arena);
+    result &= TFR_check(4, 0 == parent.live);
+
+    // freeing the last inline block rewinds over it
+    size_t available = arena.available();
+    pml_deletea(arr, &arena);
+
+    result &=
+        TFR_check(4, arena.available() > available) &&
+        TFR_check(4, arr == pml_newa<int>(16, &arena));
+
+    // also usable through an Allocator pointer, and the C API
+    ::pml::Allocator *alloc = &arena;
+    char *a = static_cast<char*>(::pml_malloc(16, alloc));
+    for(int i = 0; i < 16; i++) { a[i] = static_cast<char>(i); }
+
+    char *b = static_cast<char*>(::pml_realloc(a, 32, alloc)); // grows in place
+    result &= TFR_check(4, a == b && arena.owns(b));
+
+    b = static_cast<char*>(::pml_realloc(b, 1000, alloc)); // moves to the parent
+    result &= TFR_check(4, !arena.owns(b) && 1 == parent.live);
+
+    for(int i = 0; i < 16; i++) {
+        result &= TFR_check(5, b[i] == static_cast<char>(i));
+    }
+
+    void *d = ::pml_malloc(8, alloc);
+    result &= TFR_check(4, 0 == (reinterpret_cast<size_t>(d) & (arena.ALIGN - 1)));
+
+    void *c = ::pml_aligned_malloc(64, 8, alloc);
+    result &= TFR_check(4, c && 0 == (reinterpret_cast<size_t>(c) & 63));
+    ::pml_aligned_free(c, alloc);
+
+    ::pml_free(b, alloc);
+    pml_delete(&arena)(t);
+
+    return result &&
+        TFR_check(4, 0 == count) &&
+        TFR_check(4, 0 == parent.live);
+}
+
+
+//------------------------------------------------------------------------------
+// An arena can be the scoped allocator for the code which fills it - its own
+// chunks still come from the global hooks.
+
+TFR_Bool test_arena_scoped() {
+
+    ::pml::Arena arena(256);
+    ::pml::Arena::Mark m = arena.mark();
+    int count = 0;
+
+    void *a, *b;
+
+    {
+        ::pml::ScopedAllocator guard(&arena);
+        a = ::pml_malloc(100);
+        b = ::pml_malloc(1000); // a chunk of its own
+        arena.track(::pml_new<Tracked>()(&count));
+    }
+
+    void *c = ::pml_malloc(100);
+
+    bool result =
+        TFR_check(4, a && b && c) &&
+        TFR_check(4, 1 == count) &&
+        TFR_check(4, 0 == ::pml_get_scoped_allocator());
+
+    ::pml_free(c);
+    arena.release(m);
+
+    return result && TFR_check(4, 0 == count);
+}
+
+
+//------------------------------------------------------------------------------
+
+void declare_pml_arena_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::arena", 0, 0);
+    TFR_SUITE_ADD_M(test_arena_mark_release);
+    TFR_SUITE_ADD_M(test_arena_new_delete);
+    TFR_SUITE_ADD_M(test_arena_track);
+    TFR_SUITE_ADD_M(test_arena_realloc);
+    TFR_SUITE_ADD_M(test_inline_arena);
+    TFR_SUITE_ADD_M(test_arena_scoped);
+}
+
+
+} // namespace pml
+} // namespace tests
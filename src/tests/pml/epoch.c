@@ -0,0 +1,256 @@
+#include "tests/pml.h"
+#include "pml/epoch.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NB: this is C99 code, we can use // line comment format
+
+//------------------------------------------------------------------------------
+// Blocks are poisoned when they're freed, so readers can tell if they've been
+// handed a block too early.
+
+enum { EP_MAGIC = 0x600d600d, EP_POISON = 0xdd };
+
+typedef struct EpNode {
+
+    uint32_t magic;
+    uint32_t value;
+    struct EpNode *next;
+
+} EpNode;
+
+
+static size_t s_ep_frees;
+
+
+static void *c_epoch_malloc(size_t size, PmlAllocator *alloc, PmlHint hint) {
+
+    return malloc(size);
+}
+
+
+static void c_epoch_free(void *ptr, PmlAllocator *alloc, PmlHint hint) {
+
+    if(ptr) {
+        __atomic_add_fetch(&s_ep_frees, 1, __ATOMIC_RELAXED);
+        memset(ptr, EP_POISON, sizeof(EpNode));
+        free(ptr);
+    }
+}
+
+
+static PmlAllocator *c_epoch_allocator() {
+
+    static PmlAllocator alloc;
+    pml_init_allocator(&alloc, c_epoch_malloc, c_epoch_free);
+    return &alloc;
+}
+
+
+static EpNode *c_epoch_node(uint32_t value) {
+
+    EpNode *node = pml_malloc(sizeof(EpNode), c_epoch_allocator());
+    node->magic = EP_MAGIC;
+    node->value = value;
+    node->next = 0;
+    return node;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_epoch_basic() {
+
+    PmlAllocator *alloc = c_epoch_allocator();
+    s_ep_frees = 0;
+
+    pml_epoch_enter(0);
+    pml_epoch_enter(0); // nested
+
+    for(int i = 0; i < 10; i++) {
+        pml_retire(c_epoch_node(i), alloc);
+    }
+
+    // nothing can be freed while we're still in a section...
+    pml_epoch_exit(0);
+
+    TFR_Bool result =
+        TFR_check(4, 0 == pml_epoch_collect(0)) &&
+        TFR_check(4, 0 == pml_epoch_collect(0)) &&
+        TFR_check(4, 0 == s_ep_frees);
+
+    pml_epoch_exit(0);
+
+    // ...but everything can once we're out
+    return result &&
+        TFR_check(4, 10 == pml_epoch_synchronize(0)) &&
+        TFR_check(4, 10 == s_ep_frees) &&
+        TFR_check(4, 0 == pml_epoch_synchronize(0));
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_epoch_batch() {
+
+    PmlAllocator *alloc = c_epoch_allocator();
+    s_ep_frees = 0;
+
+    // with no readers, reclamation keeps up as we go
+    for(int i = 0; i < 1000; i++) {
+        pml_retire(c_epoch_node(i), alloc);
+    }
+
+    TFR_Bool result =
+        TFR_check(4, s_ep_frees > 0) &&
+        TFR_check(4, s_ep_frees <= 1000 - PML_EPOCH_BATCH);
+
+    pml_epoch_synchronize(0);
+
+    return result && TFR_check(4, 1000 == s_ep_frees);
+}
+
+
+//------------------------------------------------------------------------------
+// Another thread in a read-side section holds back reclamation, in its domain
+// only.
+
+static pthread_barrier_t s_ep_barrier;
+
+
+static void *c_epoch_reader(void *param) {
+
+    pml_epoch_enter(param);
+    pthread_barrier_wait(&s_ep_barrier); // main thread retires...
+    pthread_barrier_wait(&s_ep_barrier);
+    pml_epoch_exit(param);
+
+    return 0;
+}
+
+
+TFR_Bool c_test_epoch_domains() {
+
+    PmlAllocator *alloc = c_epoch_allocator();
+    PmlEpochDomain *domain = pml_epoch_create();
+    pthread_t thread;
+
+    s_ep_frees = 0;
+
+    TFR_Bool result = TFR_check(4, !!domain);
+
+    pthread_barrier_init(&s_ep_barrier, 0, 2);
+    pthread_create(&thread, 0, c_epoch_reader, domain);
+    pthread_barrier_wait(&s_ep_barrier);
+
+    for(int i = 0; i < 5; i++) {
+        pml_epoch_retire(domain, c_epoch_node(i), alloc, 0);
+        pml_retire(c_epoch_node(i), alloc);
+    }
+
+    result &=
+        TFR_check(4, 5 == pml_epoch_synchronize(0)) &&
+        TFR_check(4, 0 == pml_epoch_collect(domain)) &&
+        TFR_check(4, 0 == pml_epoch_collect(domain)) &&
+        TFR_check(4, 5 == s_ep_frees);
+
+    pthread_barrier_wait(&s_ep_barrier);
+    pthread_join(thread, 0);
+    pthread_barrier_destroy(&s_ep_barrier);
+
+    result &= TFR_check(4, 5 == pml_epoch_synchronize(domain));
+
+    // destroying a domain frees whatever is left in it
+    pml_epoch_retire(domain, c_epoch_node(0), alloc, 0);
+    pml_epoch_destroy(domain);
+
+    return result && TFR_check(4, 11 == s_ep_frees);
+}
+
+
+//------------------------------------------------------------------------------
+// Readers walk a shared list, while a writer keeps replacing its nodes and
+// retiring the old ones.
+
+enum { EP_READERS = 3, EP_LENGTH = 8, EP_UPDATES = 20000 };
+
+static EpNode *s_ep_list[EP_LENGTH];
+static int s_ep_done;
+static TFR_Bool s_ep_reader_ok[EP_READERS];
+
+
+static void *c_epoch_list_reader(void *param) {
+
+    TFR_Bool ok = TFR_true;
+
+    while(!__atomic_load_n(&s_ep_done, __ATOMIC_ACQUIRE)) {
+        pml_epoch_enter(0);
+
+        for(int i = 0; i < EP_LENGTH; i++) {
+            EpNode *node = __atomic_load_n(&s_ep_list[i], __ATOMIC_ACQUIRE);
+            if(EP_MAGIC != node->magic) {
+                ok = TFR_false;
+            }
+        }
+
+        pml_epoch_exit(0);
+    }
+
+    s_ep_reader_ok[(size_t)param] = ok;
+    return 0;
+}
+
+
+TFR_Bool c_test_epoch_readers() {
+
+    PmlAllocator *alloc = c_epoch_allocator();
+    pthread_t threads[EP_READERS];
+    TFR_Bool result = TFR_true;
+
+    s_ep_frees = 0;
+    s_ep_done = 0;
+
+    for(int i = 0; i < EP_LENGTH; i++) {
+        s_ep_list[i] = c_epoch_node(i);
+    }
+
+    for(size_t i = 0; i < EP_READERS; i++) {
+        pthread_create(&threads[i], 0, c_epoch_list_reader, (void*)i);
+    }
+
+    for(uint32_t n = 0; n < EP_UPDATES; n++) {
+        EpNode *old = __atomic_exchange_n(
+            &s_ep_list[n % EP_LENGTH], c_epoch_node(n), __ATOMIC_ACQ_REL);
+        pml_retire(old, alloc);
+    }
+
+    __atomic_store_n(&s_ep_done, 1, __ATOMIC_RELEASE);
+
+    for(size_t i = 0; i < EP_READERS; i++) {
+        pthread_join(threads[i], 0);
+        result &= TFR_check(4, s_ep_reader_ok[i]);
+    }
+
+    pml_epoch_synchronize(0);
+
+    result &= TFR_check(4, EP_UPDATES == s_ep_frees);
+
+    for(int i = 0; i < EP_LENGTH; i++) {
+        pml_free(s_ep_list[i], alloc);
+    }
+
+    return result;
+}
+
+
+void c_declare_pml_epoch_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::epoch", 0, 0);
+    TFR_SUITE_ADD_M(c_test_epoch_basic);
+    TFR_SUITE_ADD_M(c_test_epoch_batch);
+    TFR_SUITE_ADD_M(c_test_epoch_domains);
+    TFR_SUITE_ADD_M(c_test_epoch_readers);
+}
@@ -0,0 +1,111 @@
+// callsite ids for the hints in this file
+#define PML_HINT_ID_S
+
+#include "tests/pml.h"
+#include "pml/malloc.h"
+
+#include <string.h>
+
+// NB: this is C99 code, we can use // line comment format
+
+//------------------------------------------------------------------------------
+
+static PmlHint c_hint_loop() {
+
+    return PML_HINT("loop");
+}
+
+
+TFR_Bool c_test_hint_ids() {
+
+    PmlHint a = PML_HINT("a");
+    PmlHint b = PML_HINT("b");
+    size_t id = pml_hint_id(a);
+
+    TFR_Bool result =
+        TFR_check(4, 0 != id) &&
+        TFR_check(4, 0 != pml_hint_id(b)) &&
+        TFR_check(4, id != pml_hint_id(b)) &&
+        TFR_check(4, pml_hint_count() >= 3) &&
+        TFR_check(4, pml_hint_id(c_hint_loop()) <= pml_hint_count());
+
+    // each callsite has a single id...
+    for(int i = 0; i < 3; i++) {
+        result &= TFR_check(4, c_hint_loop() == c_hint_loop());
+    }
+
+    // ...which still names it
+    const char *name = pml_hint_name(a);
+    result &=
+        TFR_check(4, !!name) &&
+        TFR_check(4, !!strstr(name, "hint.c(")) &&
+        TFR_check(4, !!strstr(name, ": \"a\""));
+
+    // callsites registered at runtime (as from C++) follow on from the table
+    static const char registered[] = "registered";
+    PmlHint hint = pml_hint_register_(registered);
+
+    result &=
+        TFR_check(4, pml_hint_id(hint) == pml_hint_count()) &&
+        TFR_check(4, pml_hint_id(hint) > pml_hint_id(c_hint_loop())) &&
+        TFR_check(4, registered == pml_hint_name(hint));
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_hint_strings() {
+
+    static const char string[] = "not an id";
+
+    return
+        TFR_check(4, 0 == pml_hint_id(string)) &&
+        TFR_check(4, string == pml_hint_name(string)) &&
+        TFR_check(4, 0 == pml_hint_id(0)) &&
+        TFR_check(4, 0 == pml_hint_name(0));
+}
+
+
+//------------------------------------------------------------------------------
+// Ids are passed through to the hooks unchanged.
+
+static PmlHint s_hint_seen;
+
+
+static void c_hint_debug_hook(const PmlDebugHookInfo *info) {
+
+    if(pml_MALLOC == info->type) {
+        s_hint_seen = info->hint;
+    }
+}
+
+
+TFR_Bool c_test_hint_hooks() {
+
+    PmlHookTable table;
+    pml_get_hooks(&table);
+    table.debug_hook = c_hint_debug_hook;
+
+    pml_set_thread_hooks(&table);
+
+    PmlHint hint = PML_HINT("hooked");
+    void *ptr = pml_malloc(16, 0, hint);
+    pml_free(ptr);
+
+    pml_set_thread_hooks(0);
+
+    return
+        TFR_check(4, hint == s_hint_seen) &&
+        TFR_check(4, !!strstr(pml_hint_name(s_hint_seen), "\"hooked\""));
+}
+
+
+void c_declare_pml_hint_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::hint", 0, 0);
+    TFR_SUITE_ADD_M(c_test_hint_ids);
+    TFR_SUITE_ADD_M(c_test_hint_strings);
+    TFR_SUITE_ADD_M(c_test_hint_hooks);
+}
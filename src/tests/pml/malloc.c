@@ -2,6 +2,9 @@
 #include "pml/malloc.h"
 
 #include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
 
 // NB: this is C99 code, we can use // line comment format
 
@@ -58,6 +61,10 @@ static void c_debug_hook(const PmlDebugHookInfo *info) {
         case pml_DELETE: { counters.deletes++; break; }
         case pml_NEWA: { counters.newas++; break; }
         case pml_DELETEA: { counters.deleteas++; break; }
+        case pml_ALIGNED_MALLOC: { counters.mallocs++; break; }
+        case pml_ALIGNED_FREE: { counters.frees++; break; }
+        case pml_MALLOC_BATCH: { counters.mallocs++; break; }
+        case pml_FREE_BATCH: { counters.frees++; break; }
     }
 
     if(info->hint) {
@@ -303,6 +310,484 @@ TFR_Bool c_test_emulate_realloc() {
 }
 
 
+//------------------------------------------------------------------------------
+
+size_t sized = 0;
+
+void c_free_sized_alloc(void *ptr, size_t size, PmlAllocator *a, PmlHint h) {
+
+    sized = size;
+    c_free_alloc(ptr, a, h);
+}
+
+
+TFR_Bool c_test_free_sized() {
+
+    TFR_Bool result = TFR_check(4, 0 == test);
+
+    PmlAllocator alloc;
+    pml_init_allocator(&alloc,
+        c_malloc_alloc, c_free_alloc, 0, 0, c_free_sized_alloc);
+
+    void *ptr = pml_malloc(48, &alloc);
+    pml_free_sized(ptr, 48, &alloc);
+
+    result &=
+        TFR_check(4, 48 == sized) &&
+        TFR_check(4, 0 == test);
+
+    // unknown size goes to free()
+    sized = 0;
+    ptr = pml_malloc(48, &alloc);
+    pml_free_sized(ptr, 0, &alloc);
+
+    result &=
+        TFR_check(4, 0 == sized) &&
+        TFR_check(4, 0 == test);
+
+    // no sized hook - falls back to free()
+    pml_init_allocator(&alloc, c_malloc_alloc, c_free_alloc);
+    ptr = pml_malloc(48, &alloc);
+    pml_free_sized(ptr, 48, &alloc);
+
+    result &= TFR_check(4, 0 == test);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+// Blocks are rounded up to 64 bytes, with the capacity stored in front.
+enum { SLACK_HEADER = 16, SLACK_ROUND = 64 };
+
+void *c_slack_malloc(size_t size, PmlAllocator *a, PmlHint h) {
+
+    size_t capacity = (size + SLACK_ROUND - 1) & ~(size_t)(SLACK_ROUND - 1);
+    char *base = c_malloc_alloc(SLACK_HEADER + capacity, a, h);
+
+    *(size_t*)base = capacity;
+    return base + SLACK_HEADER;
+}
+
+
+void c_slack_free(void *ptr, PmlAllocator *a, PmlHint h) {
+
+    c_free_alloc((char*)ptr - SLACK_HEADER, a, h);
+}
+
+
+size_t c_slack_usable_size(void *ptr, PmlAllocator *a, PmlHint h) {
+
+    return *(size_t*)((char*)ptr - SLACK_HEADER);
+}
+
+
+bool c_slack_try_expand(void *ptr, size_t size, PmlAllocator *a, PmlHint h) {
+
+    return size <= c_slack_usable_size(ptr, a, h);
+}
+
+
+TFR_Bool c_test_usable_size() {
+
+    TFR_Bool result = TFR_check(4, 0 == test);
+
+    PmlAllocator alloc;
+    pml_init_allocator(&alloc,
+        c_slack_malloc, c_slack_free, 0, pml_emulate_realloc, 0, 0, 0,
+        c_slack_usable_size, c_slack_try_expand);
+
+    char *ptr = pml_malloc(20, &alloc);
+    for(int i = 0; i < 20; i++) { ptr[i] = (char)i; }
+
+    // grow into the slack, and shrink, in place
+    result &=
+        TFR_check(4, 64 == pml_usable_size(ptr, &alloc)) &&
+        TFR_check(4, ptr == pml_realloc(ptr, 60, &alloc)) &&
+        TFR_check(4, ptr == pml_realloc(ptr, 8, &alloc));
+
+    // no room - moves, copying no more than the old block holds
+    char *ptr2 = pml_realloc(ptr, 200, &alloc);
+
+    result &=
+        TFR_check(4, ptr2 && ptr2 != ptr) &&
+        TFR_check(4, 256 == pml_usable_size(ptr2, &alloc)) &&
+        TFR_check(4, 1 == test) &&
+        TFR_check(4, 19 == ptr2[19]);
+
+    // with only usable_size, shrinking still keeps the block
+    pml_init_allocator(&alloc,
+        c_slack_malloc, c_slack_free, 0, pml_emulate_realloc, 0, 0, 0,
+        c_slack_usable_size, 0);
+
+    result &=
+        TFR_check(4, ptr2 == pml_realloc(ptr2, 16, &alloc)) &&
+        TFR_check(4, 0 == pml_realloc(ptr2, 0, &alloc)) &&
+        TFR_check(4, 0 == test);
+
+    // no hook - size unknown
+    pml_init_allocator(&alloc, c_malloc_alloc, c_free_alloc);
+    ptr = pml_malloc(20, &alloc);
+
+    result &= TFR_check(4, 0 == pml_usable_size(ptr, &alloc));
+
+    pml_free(ptr, &alloc);
+
+    return result && TFR_check(4, 0 == test);
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_aligned_malloc() {
+
+    TFR_Bool result = TFR_true;
+
+    reset(&counters);
+
+    // the suite's hooks have no aligned_malloc, so this is emulated by them
+    for(size_t align = 1; align <= 4096; align <<= 1) {
+        char *ptr = pml_aligned_malloc(align, 100);
+
+        result &=
+            TFR_check(4, !!ptr) &&
+            TFR_check(4, 0 == ((uintptr_t)ptr & (align - 1)));
+
+        memset(ptr, 0xcd, 100);
+        pml_aligned_free(ptr);
+    }
+
+    result &=
+        TFR_check(4, 13 == counters.mallocs) &&
+        TFR_check(4, 13 == counters.hook_allocs) &&
+        TFR_check(4, 13 == counters.hook_frees);
+
+    // and through an allocator
+    PmlAllocator alloc;
+    pml_init_allocator(&alloc, c_malloc_alloc, c_free_alloc);
+
+    void *ptr = pml_aligned_malloc(256, 1000, &alloc);
+
+    result &=
+        TFR_check(4, 0 == ((uintptr_t)ptr & 255)) &&
+        TFR_check(4, 1 == test);
+
+    pml_aligned_free(ptr, &alloc);
+
+    result &= TFR_check(4, 0 == test);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+size_t batches = 0;
+
+size_t c_malloc_batch_alloc(size_t count, size_t size, void **out,
+    PmlAllocator *a, PmlHint h) {
+
+    batches++;
+
+    // fail after 8 blocks, to test partial batches
+    size_t done = 0;
+    while(done < count && done < 8) {
+        out[done++] = c_malloc_alloc(size, a, h);
+    }
+    return done;
+}
+
+
+void c_free_batch_alloc(void **ptrs, size_t count, PmlAllocator *a, PmlHint h) {
+
+    batches++;
+
+    for(size_t i = 0; i < count; i++) {
+        if(ptrs[i]) { c_free_alloc(ptrs[i], a, h); }
+    }
+}
+
+
+TFR_Bool c_test_batch() {
+
+    TFR_Bool result = TFR_true;
+    void *ptrs[100];
+
+    reset(&counters);
+
+    // the suite's hooks have no batch hooks, so these loop over malloc/free,
+    // with a single debug event for each batch
+    size_t done = pml_malloc_batch(100, 32, ptrs);
+
+    result &=
+        TFR_check(4, 100 == done) &&
+        TFR_check(4, ptrs[0] && ptrs[99] && ptrs[0] != ptrs[99]) &&
+        TFR_check(4, 1 == counters.mallocs) &&
+        TFR_check(4, 100 == counters.hook_allocs);
+
+    pml_free_batch(ptrs, 100);
+
+    result &=
+        TFR_check(4, 1 == counters.frees) &&
+        TFR_check(4, 100 == counters.hook_frees);
+
+    // through an allocator's batch hooks
+    PmlAllocator alloc;
+    pml_init_allocator(&alloc,
+        c_malloc_alloc, c_free_alloc, 0, 0, 0, 0, 0, 0, 0,
+        c_malloc_batch_alloc, c_free_batch_alloc);
+
+    done = pml_malloc_batch(6, 100, ptrs, &alloc);
+
+    result &=
+        TFR_check(4, 6 == done) &&
+        TFR_check(4, 1 == batches) &&
+        TFR_check(4, 6 == test);
+
+    pml_free_batch(ptrs, 6, &alloc);
+
+    result &=
+        TFR_check(4, 2 == batches) &&
+        TFR_check(4, 0 == test);
+
+    // a partial batch nulls the rest of the array
+    ptrs[10] = ptrs;
+    done = pml_malloc_batch(12, 100, ptrs, &alloc);
+
+    result &=
+        TFR_check(4, 8 == done) &&
+        TFR_check(4, 8 == test) &&
+        TFR_check(4, !ptrs[8] && !ptrs[10] && !ptrs[11]);
+
+    pml_free_batch(ptrs, 12, &alloc);
+
+    return result && TFR_check(4, 0 == test);
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_hook_table() {
+
+    PmlHookTable table;
+    pml_get_hooks(&table);
+
+    TFR_Bool result =
+        TFR_check(4, c_malloc_hook == table.hooks.malloc) &&
+        TFR_check(4, c_debug_hook == table.debug_hook);
+
+    // swap the malloc/free hooks together
+    PmlHookTable swapped = table;
+    swapped.hooks.malloc = c_malloc_alloc;
+    swapped.hooks.free = c_free_alloc;
+
+    reset(&counters);
+
+    if(TFR_check(4, pml_set_hooks(&swapped))) {
+
+        void *ptr = pml_malloc(16);
+        result &= TFR_check(4, 1 == test);
+        pml_free(ptr);
+
+        result &=
+            TFR_check(4, 0 == test) &&
+            TFR_check(4, 0 == counters.hook_allocs) &&
+            TFR_check(4, 1 == counters.mallocs);
+    }
+
+    return pml_set_hooks(&table) && result;
+}
+
+
+//------------------------------------------------------------------------------
+
+static void *c_thread_hooks_worker(void *param) {
+
+    PmlHookTable table;
+    pml_get_hooks(&table);
+    table.hooks.malloc = c_malloc_alloc;
+    table.hooks.free = c_free_alloc;
+
+    pml_set_thread_hooks(&table);
+
+    void *ptr = pml_malloc(16);
+    *(size_t*)param = test;
+    pml_free(ptr);
+
+    pml_set_thread_hooks(0);
+
+    return 0;
+}
+
+
+TFR_Bool c_test_thread_hooks() {
+
+    size_t seen = 0;
+    pthread_t thread;
+
+    reset(&counters);
+
+    pthread_create(&thread, 0, c_thread_hooks_worker, &seen);
+    pthread_join(thread, 0);
+
+    // the override only applied to the worker thread
+    void *ptr = pml_malloc(16);
+    pml_free(ptr);
+
+    return
+        TFR_check(4, 1 == seen) &&
+        TFR_check(4, 0 == test) &&
+        TFR_check(4, 1 == counters.hook_allocs) &&
+        TFR_check(4, 1 == counters.hook_frees);
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_debug_events() {
+
+    reset(&counters);
+
+    // only frees reach the hook...
+    pml_set_debug_events(PML_DEBUG_EVENT(FREE));
+    pml_free(pml_malloc(16));
+
+    TFR_Bool result =
+        TFR_check(4, PML_DEBUG_EVENT(FREE) == pml_get_debug_events()) &&
+        TFR_check(4, 0 == counters.mallocs) &&
+        TFR_check(4, 1 == counters.frees) &&
+        TFR_check(4, 1 == counters.hook_allocs);
+
+    pml_set_debug_events(PML_DEBUG_EVENTS_ALL);
+
+    // ...and nothing does while there's no hook to call...
+    PmlHookTable table;
+    pml_get_hooks(&table);
+    pml_set_debug_hook(0);
+
+    result &= TFR_check(4, 0 == pml_debug_events_);
+
+    // ...except on a thread with its own debug hook
+    pml_set_thread_hooks(&table);
+    pml_free(pml_malloc(16));
+    result &= TFR_check(4, 0 != pml_debug_events_);
+    pml_set_thread_hooks(0);
+
+    result &=
+        TFR_check(4, 0 == pml_debug_events_) &&
+        TFR_check(4, 1 == counters.mallocs) &&
+        TFR_check(4, 2 == counters.frees);
+
+    pml_set_debug_hook(c_debug_hook);
+
+    return result &&
+        TFR_check(4, PML_DEBUG_EVENTS_ALL == pml_debug_events_);
+}
+
+
+#ifdef __GLIBC__
+// Large blocks from the default hooks are mapped (which pml_is_mapped_() asks
+// the page map, as glibc maps large blocks of its own too).
+
+static bool c_check_pattern(const unsigned char *ptr, size_t size) {
+
+    for(size_t i = 0; i < size; i += 997) {
+        if(ptr[i] != (unsigned char)(i * 7)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static void c_fill_pattern(unsigned char *ptr, size_t size) {
+
+    for(size_t i = 0; i < size; i += 997) {
+        ptr[i] = (unsigned char)(i * 7);
+    }
+}
+
+
+TFR_Bool c_test_mmap() {
+
+    PmlHookTable saved;
+    pml_get_hooks(&saved);
+    pml_set_hooks(0);
+
+    size_t threshold = pml_get_mmap_threshold();
+
+    pml_set_mmap_threshold(1);
+    TFR_Bool result = TFR_check(4, PML_MMAP_MIN == pml_get_mmap_threshold());
+
+    pml_set_mmap_threshold(0);
+    result &= TFR_check(4, 0 == pml_get_mmap_threshold());
+
+    // (with no threshold, large blocks come from malloc())
+    void *large = pml_malloc(300000);
+    result &= TFR_check(4, large && !pml_is_mapped_(large));
+    pml_free(large);
+
+    pml_set_mmap_threshold(256 * 1024);
+
+    // a heap block which outgrows the threshold moves into a mapping...
+    unsigned char *ptr = pml_malloc(1000);
+    c_fill_pattern(ptr, 1000);
+    ptr = pml_realloc(ptr, 300000);
+
+    result &=
+        TFR_check(4, pml_is_mapped_(ptr) && c_check_pattern(ptr, 1000)) &&
+        TFR_check(4, 300000 <= pml_usable_size(ptr) && 304096 > pml_usable_size(ptr));
+
+    // ...which then grows without copying...
+    c_fill_pattern(ptr, 300000);
+    ptr = pml_realloc(ptr, 64 * 1024 * 1024);
+
+    result &=
+        TFR_check(4, pml_is_mapped_(ptr) && c_check_pattern(ptr, 300000)) &&
+        TFR_check(4, 64 * 1024 * 1024 <= pml_usable_size(ptr));
+
+    // ...and moves back to the heap when it shrinks below the threshold
+    ptr = pml_realloc(ptr, 100);
+
+    result &=
+        TFR_check(4, !pml_is_mapped_(ptr)) &&
+        TFR_check(4, 100 <= pml_usable_size(ptr) && 256 * 1024 > pml_usable_size(ptr)) &&
+        TFR_check(4, c_check_pattern(ptr, 100));
+
+    pml_free(ptr);
+
+    // mapped blocks are zeroed already
+    unsigned *zeroed[2] = {
+        pml_calloc(256 * 1024, sizeof(unsigned)),
+        pml_emulate_calloc(256 * 1024, sizeof(unsigned), 0, 0),
+    };
+
+    for(int i = 0; i < 2; i++) {
+        result &= TFR_check(4, pml_is_mapped_(zeroed[i]));
+
+        for(size_t j = 0; j < 256 * 1024; j += 1024) {
+            result &= TFR_check(5, 0 == zeroed[i][j]);
+        }
+
+        pml_free(zeroed[i]);
+    }
+
+    void *aligned = pml_aligned_malloc(4096, 300000);
+    result &=
+        TFR_check(4, aligned && 0 == ((uintptr_t)aligned & 4095)) &&
+        TFR_check(4, pml_is_mapped_(aligned)) &&
+        TFR_check(4, 300000 <= pml_usable_size(aligned));
+    pml_aligned_free(aligned);
+
+    pml_set_mmap_threshold(threshold);
+    pml_set_hooks(&saved);
+
+    return result;
+}
+#endif//__GLIBC__
+
+
 void c_declare_pml_tests() {
 
     TFR_SUITE_DECLARE_M("pml::c", c_pml_open, c_pml_close);
@@ -313,6 +798,16 @@ void c_declare_pml_tests() {
     TFR_SUITE_ADD_M(c_test_malloc_alloc);
     TFR_SUITE_ADD_M(c_test_emulate_calloc);
     TFR_SUITE_ADD_M(c_test_emulate_realloc);
+    TFR_SUITE_ADD_M(c_test_free_sized);
+    TFR_SUITE_ADD_M(c_test_usable_size);
+    TFR_SUITE_ADD_M(c_test_aligned_malloc);
+    TFR_SUITE_ADD_M(c_test_batch);
+    TFR_SUITE_ADD_M(c_test_hook_table);
+    TFR_SUITE_ADD_M(c_test_thread_hooks);
+    TFR_SUITE_ADD_M(c_test_debug_events);
+#ifdef __GLIBC__
+    TFR_SUITE_ADD_M(c_test_mmap);
+#endif//__GLIBC__
 }
 
 
@@ -2,6 +2,8 @@
 #include "pml/malloc.h"
 
 #include <malloc.h>
+#include <map>
+#include <vector>
 
 
 namespace tests {
@@ -82,6 +84,10 @@ void test_debug_hook(const ::pml::DebugHookInfo *info) {
         case ::pml::DELETE: { counters.deletes++; break; }
         case ::pml::NEWA: { counters.newas++; break; }
         case ::pml::DELETEA: { counters.deleteas++; break; }
+        case ::pml::ALIGNED_MALLOC: { counters.mallocs++; break; }
+        case ::pml::ALIGNED_FREE: { counters.frees++; break; }
+        case ::pml::MALLOC_BATCH: { counters.mallocs++; break; }
+        case ::pml::FREE_BATCH: { counters.frees++; break; }
     }
 
     if(info->hint) {
@@ -344,6 +350,81 @@ TFR_Bool test_new_array() {
 }
 
 
+//------------------------------------------------------------------------------
+
+struct Wide {
+
+    Wide() { counters.objects++; }
+    ~Wide() { counters.objects--; }
+
+    char data[64];
+} __attribute__((aligned(64)));
+
+
+TFR_Bool test_new_aligned() {
+
+    counters.reset();
+
+    Wide *w = ::pml_new<Wide>()();
+    Wide *arr = ::pml_new<Wide>()[7];
+
+    bool result =
+        TFR_check(4, w && arr) &&
+        TFR_check(4, 0 == (reinterpret_cast<size_t>(w) & 63)) &&
+        TFR_check(4, 0 == (reinterpret_cast<size_t>(arr) & 63)) &&
+        TFR_check(4, 8 == counters.objects) &&
+        TFR_check(4, 2 == counters.mallocs);
+
+    ::pml_delete()(w);
+    ::pml_delete()[arr];
+
+    result &=
+        TFR_check(4, 0 == counters.objects) &&
+        TFR_check(4, 2 == counters.frees) &&
+        TFR_check(4, counters.hook_allocs == counters.hook_frees);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+struct Base {
+
+    Base() { counters.objects++; }
+    virtual ~Base() { counters.objects--; }
+
+    int data;
+};
+
+
+struct Derived: Base {
+
+    long double more; // more aligned than Base
+};
+
+
+TFR_Bool test_delete_base() {
+
+    counters.reset();
+
+    Base *b = ::pml_new<Derived>()();
+
+    bool result =
+        TFR_check(4, b) &&
+        TFR_check(4, 1 == counters.objects);
+
+    ::pml_delete()(b);
+
+    result &=
+        TFR_check(4, 0 == counters.objects) &&
+        TFR_check(4, 1 == counters.frees) &&
+        TFR_check(4, counters.hook_allocs == counters.hook_frees);
+
+    return result;
+}
+
+
 //------------------------------------------------------------------------------
 
 struct MyAllocator: ::pml::IAllocator {
@@ -429,6 +510,280 @@ TFR_Bool test_iallocator2() {
 }
 
 
+//------------------------------------------------------------------------------
+
+struct SizedAllocator: MyAllocator {
+
+    size_t last_size;
+    int sized_frees;
+
+    SizedAllocator(): last_size(0), sized_frees(0) {}
+
+    virtual void free_sized(void *ptr, size_t size, ::pml::Hint h = 0) {
+        last_size = size;
+        sized_frees++;
+        free(ptr, h);
+    }
+};
+
+
+struct Polymorphic {
+
+    virtual ~Polymorphic() {}
+    int data;
+};
+
+
+TFR_Bool test_free_sized() {
+
+    SizedAllocator s;
+#ifdef PML_CHECK_S
+    const size_t header = PML_MALLOC_ALIGN;
+#else//PML_CHECK_S
+    const size_t header = 0;
+#endif//PML_CHECK_S
+
+    Object *o = pml_new<Object>(&s)(1, 2, 3, 4, 5);
+    pml_delete(&s)(o);
+
+    bool result =
+        TFR_check(4, 1 == s.sized_frees) &&
+        TFR_check(4, sizeof(Object) + header == s.last_size);
+
+    o = pml_new<Object>(&s)[10];
+    pml_delete(&s)[o];
+
+    result &=
+        TFR_check(4, 2 == s.sized_frees) &&
+        TFR_check(4, 10 * sizeof(Object) + PML_MALLOC_ALIGN == s.last_size);
+
+    // the static type of a polymorphic object may not be the allocated type,
+    // so its size isn't passed on
+    Polymorphic *p = pml_new<Polymorphic>(&s)();
+    pml_delete(&s)(p);
+
+    result &=
+        TFR_check(4, 2 == s.sized_frees) &&
+        TFR_check(4, 0 == s.allocs);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+struct CountingPolicy: ::pml::StaticPolicy<CountingPolicy> {
+
+    static int allocs;
+
+    static void *malloc(size_t size, ::pml::Hint) {
+        allocs++;
+        return ::malloc(size);
+    }
+
+    static void free(void *ptr, ::pml::Hint) {
+        allocs--;
+        ::free(ptr);
+    }
+};
+
+int CountingPolicy::allocs = 0;
+
+
+// pml_new<T, POLICY>() from another static initializer (which may run before
+// the template's static members are initialized, unless they're constant)
+static bool static_init_aligned() {
+
+    Wide *w = pml_new<Wide, CountingPolicy>()(); // emulated aligned_malloc()
+    bool result = w && 0 == (reinterpret_cast<size_t>(w) & 63);
+
+    pml_delete<CountingPolicy>()(w);
+    return result;
+}
+
+static bool s_static_init_aligned = static_init_aligned();
+
+
+TFR_Bool test_static_allocator() {
+
+    counters.reset();
+
+    Object *o = pml_new<Object, CountingPolicy>()(1, 2, 3, 4, 5);
+    Object *arr = pml_new<Object, CountingPolicy>()[4];
+    Object *arr2 = pml_newa<Object, CountingPolicy>(3, "static");
+    Wide *w = pml_new<Wide, CountingPolicy>()(); // emulated aligned_malloc()
+
+    bool result =
+        TFR_check(4, s_static_init_aligned) &&
+        TFR_check(4, 4 == CountingPolicy::allocs) &&
+        TFR_check(4, 9 == counters.objects) &&
+        TFR_check(4, 0 == (reinterpret_cast<size_t>(w) & 63)) &&
+        TFR_check(4, 2 == counters.news && 2 == counters.newas) &&
+        TFR_check(4, 0 == counters.hook_allocs);
+
+    pml_delete<CountingPolicy>()(o);
+    pml_delete<CountingPolicy>()[arr];
+    pml_delete<CountingPolicy>("static")[arr2];
+    pml_delete<CountingPolicy>()(w);
+
+    result &=
+        TFR_check(4, 0 == CountingPolicy::allocs) &&
+        TFR_check(4, 0 == counters.objects) &&
+        TFR_check(4, 2 == counters.deletes && 2 == counters.deleteas) &&
+        TFR_check(4, 0 == counters.hook_frees);
+
+    // the policy is also available as an Allocator instance
+    ::pml::Allocator *alloc = &::pml::StaticAllocator<CountingPolicy>::instance;
+    void *ptr = ::pml_malloc(32, alloc);
+
+    result &= TFR_check(4, ptr && 1 == CountingPolicy::allocs);
+
+    ::pml_free(ptr, alloc);
+
+    return result && TFR_check(4, 0 == CountingPolicy::allocs);
+}
+
+
+//------------------------------------------------------------------------------
+
+struct CountingAllocator: ::pml::AllocatorBase<CountingAllocator> {
+
+    CountingAllocator(): allocs(0), sized_frees(0) {}
+
+    void *malloc(size_t size, ::pml::Hint = 0) {
+        allocs++;
+        return ::malloc(size);
+    }
+
+    void free(void *ptr, ::pml::Hint = 0) {
+        allocs--;
+        ::free(ptr);
+    }
+
+    void free_sized(void *ptr, size_t, ::pml::Hint h = 0) {
+        sized_frees++;
+        free(ptr, h);
+    }
+
+    int allocs;
+    int sized_frees;
+};
+
+
+TFR_Bool test_allocator_base() {
+
+    counters.reset();
+
+    CountingAllocator alloc;
+
+    Object *o = pml_new<Object>(&alloc)(1, 2, 3, 4, 5);
+    Object *arr = pml_newa<Object>(3, &alloc, "base");
+    Wide *w = pml_new<Wide>(&alloc)(); // emulated aligned_malloc()
+
+    bool result =
+        TFR_check(4, 3 == alloc.allocs) &&
+        TFR_check(4, 5 == counters.objects) &&
+        TFR_check(4, 0 == (reinterpret_cast<size_t>(w) & 63)) &&
+        TFR_check(4, 0 == counters.hook_allocs);
+
+    pml_delete(&alloc)(o);
+    pml_deletea(arr, &alloc, "base");
+    pml_delete(&alloc)(w);
+
+    result &=
+        TFR_check(4, 0 == alloc.allocs) &&
+        TFR_check(4, 2 == alloc.sized_frees) &&
+        TFR_check(4, 0 == counters.objects) &&
+        TFR_check(4, 0 == counters.hook_frees);
+
+    // through the Allocator hooks, the C API reaches the same functions
+    void *ptrs[4];
+    void *ptr = ::pml_calloc(4, 8, &alloc);
+
+    result &=
+        TFR_check(4, ptr && 1 == alloc.allocs) &&
+        TFR_check(4, 4 == ::pml_malloc_batch(4, 16, ptrs, &alloc)) &&
+        TFR_check(4, 5 == alloc.allocs);
+
+    ::pml_free_batch(ptrs, 4, &alloc);
+    ::pml_free_sized(ptr, 32, &alloc);
+
+    return result &&
+        TFR_check(4, 0 == alloc.allocs) &&
+        TFR_check(4, 3 == alloc.sized_frees);
+}
+
+
+//------------------------------------------------------------------------------
+
+struct Pod {
+
+    int x;
+    double y;
+};
+
+
+TFR_Bool test_trivial_arrays() {
+
+    typedef ::pml::NewLayout<int> IntLayout;
+
+    counters.reset();
+    int callocs = counters.hook_callocs;
+
+    bool result =
+        TFR_check(4, IntLayout::TRIVIAL_CTOR && IntLayout::TRIVIAL_DTOR) &&
+        TFR_check(4, ::pml::NewLayout<Pod>::TRIVIAL_DTOR) &&
+        TFR_check(4, !::pml::NewLayout<Object>::TRIVIAL_CTOR) &&
+        TFR_check(4, !::pml::NewLayout<Object>::TRIVIAL_DTOR);
+
+#ifdef PML_CHECK_S
+    result &= TFR_check(4, IntLayout::ARRAY_HEADER == IntLayout::HEADER);
+#else//PML_CHECK_S
+    result &= TFR_check(4, 0 == IntLayout::ARRAY_HEADER);
+#endif//PML_CHECK_S
+
+    // value-initialized trivial arrays come from calloc()...
+    int *zeroed = ::pml_newa_init<int>(1000);
+    Pod *pods = ::pml_newa<Pod>(10);
+
+    result &=
+        TFR_check(4, zeroed && pods) &&
+        TFR_check(4, 1 == counters.hook_callocs - callocs) &&
+        TFR_check(4, 1 == counters.hook_allocs) &&
+        TFR_check(4, 2 == counters.newas);
+
+    for(int i = 0; zeroed && i < 1000; i++) {
+        result &= TFR_check(5, 0 == zeroed[i]);
+    }
+
+    // ...and anything else is constructed as usual
+    Object *objects = ::pml_newa_init<Object>(5);
+    result &= TFR_check(4, 5 == counters.objects);
+
+    ::pml_deletea(zeroed);
+    ::pml_deletea(pods);
+    ::pml_deletea(objects);
+
+    result &=
+        TFR_check(4, 0 == counters.objects) &&
+        TFR_check(4, 3 == counters.deleteas) &&
+        TFR_check(4, 3 == counters.hook_frees);
+
+    // and for the static backends, calloc() is emulated
+    CountingAllocator alloc;
+    double *values = ::pml_newa_init<double>(16, &alloc);
+
+    result &= TFR_check(4, values && 1 == alloc.allocs);
+    for(int i = 0; values && i < 16; i++) {
+        result &= TFR_check(5, 0.0 == values[i]);
+    }
+
+    ::pml_deletea(values, &alloc);
+
+    return result && TFR_check(4, 0 == alloc.allocs);
+}
+
+
 //------------------------------------------------------------------------------
 
 struct SetAllocatorTester {
@@ -498,6 +853,129 @@ TFR_Bool test_set_allocator() {
 
 //------------------------------------------------------------------------------
 
+//------------------------------------------------------------------------------
+
+TFR_Bool test_std_allocator() {
+
+    typedef std::pair<const int, int> Pair;
+    typedef ::pml::StdAllocator<int> IntAlloc;
+    typedef ::pml::StdAllocator<Pair> PairAlloc;
+
+    CountingAllocator alloc;
+    counters.reset();
+
+    bool result =
+        TFR_check(4, IntAlloc(&alloc) == PairAlloc(&alloc)) &&
+        TFR_check(4, IntAlloc(&alloc) != IntAlloc()) &&
+        TFR_check(4, &alloc == PairAlloc(IntAlloc(&alloc)).allocator());
+
+    {
+        std::vector<int, IntAlloc> values((IntAlloc(&alloc, "vector")));
+        std::map<int, int, std::less<int>, PairAlloc> pairs(
+            std::less<int>(), PairAlloc(&alloc, "map"));
+
+        for(int i = 0; i < 100; i++) {
+            values.push_back(i);
+            pairs[i] = i * i;
+        }
+
+        // node allocations are rebound from the pair allocator
+        result &=
+            TFR_check(4, 100 == values.size() && 99 == values[99]) &&
+            TFR_check(4, 100 == pairs.size() && 81 == pairs[9]) &&
+            TFR_check(4, 101 == alloc.allocs);
+
+        // copies keep their allocator
+        std::vector<int, IntAlloc> copy(values);
+        result &=
+            TFR_check(4, &alloc == copy.get_allocator().allocator()) &&
+            TFR_check(4, 102 == alloc.allocs);
+    }
+
+    result &=
+        TFR_check(4, 0 == alloc.allocs) &&
+        TFR_check(4, 0 < alloc.sized_frees);
+
+    // with no Allocator, containers use the global hooks
+    {
+        std::vector<int, IntAlloc> values(10, 1);
+        result &= TFR_check(4, 1 == counters.hook_allocs);
+    }
+
+    return result && TFR_check(4, 1 == counters.hook_frees);
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool test_scoped_allocator() {
+
+    CountingAllocator outer, inner;
+    counters.reset();
+
+    ::pml::Allocator *global = ::pml_global_allocator();
+    bool result = TFR_check(4, 0 == ::pml_get_scoped_allocator());
+
+    {
+        ::pml::ScopedAllocator guard(&outer);
+
+        void *a = ::pml_malloc(16);
+        Object *o = ::pml_new<Object>()(1, 2, 3, 4, 5);
+
+        result &=
+            TFR_check(4, &outer == ::pml_get_scoped_allocator()) &&
+            TFR_check(4, 2 == outer.allocs);
+
+        {
+            ::pml::ScopedAllocator nested(&inner);
+
+            void *b = ::pml_calloc(4, 4);
+            b = ::pml_realloc(b, 64);
+
+            // the global allocator bypasses the scope
+            void *c = ::pml_malloc(16, global);
+            ::pml_free(c, global);
+
+            result &=
+                TFR_check(4, 1 == inner.allocs) &&
+                TFR_check(4, 2 == outer.allocs) &&
+                TFR_check(4, 1 == counters.hook_allocs) &&
+                TFR_check(4, 1 == counters.hook_frees);
+
+            ::pml_free(b);
+        }
+
+        // the outer scope is back, and containers keep the allocator which
+        // was in effect when they were made
+        std::vector<int, ::pml::StdAllocator<int> > values(10, 1);
+
+        result &=
+            TFR_check(4, 0 == inner.allocs) &&
+            TFR_check(4, &outer == ::pml_get_scoped_allocator()) &&
+            TFR_check(4, &outer == values.get_allocator().allocator()) &&
+            TFR_check(4, 3 == outer.allocs);
+
+        ::pml_delete()(o);
+        ::pml_free(a);
+    }
+
+    result &=
+        TFR_check(4, 0 == ::pml_get_scoped_allocator()) &&
+        TFR_check(4, 0 == outer.allocs) &&
+        TFR_check(4, 1 == counters.hook_allocs);
+
+    // setting the global allocator is the same as setting none
+    ::pml::Allocator *previous = ::pml_set_scoped_allocator(&outer);
+    result &=
+        TFR_check(4, 0 == previous) &&
+        TFR_check(4, &outer == ::pml_set_scoped_allocator(global)) &&
+        TFR_check(4, 0 == ::pml_get_scoped_allocator()) &&
+        TFR_check(4, global == ::pml::ScopedAllocator::current());
+
+    return result;
+}
+
+
 void declare_pml_tests() {
 
     TFR_SUITE_DECLARE_M("pml::c++", pml_open, pml_close);
@@ -511,8 +989,16 @@ void declare_pml_tests() {
 #endif//PML_HAS_CPP11
     TFR_SUITE_ADD_M(test_newa);
     TFR_SUITE_ADD_M(test_new_array);
+    TFR_SUITE_ADD_M(test_new_aligned);
+    TFR_SUITE_ADD_M(test_delete_base);
     TFR_SUITE_ADD_M(test_iallocator);
     TFR_SUITE_ADD_M(test_iallocator2);
+    TFR_SUITE_ADD_M(test_free_sized);
+    TFR_SUITE_ADD_M(test_static_allocator);
+    TFR_SUITE_ADD_M(test_allocator_base);
+    TFR_SUITE_ADD_M(test_trivial_arrays);
+    TFR_SUITE_ADD_M(test_std_allocator);
+    TFR_SUITE_ADD_M(test_scoped_allocator);
     TFR_SUITE_ADD_M(test_set_allocator);
 }
 
@@ -0,0 +1,186 @@
+#include "tests/pml.h"
+#include "pml/pool.h"
+
+
+namespace tests {
+namespace pml {
+
+//------------------------------------------------------------------------------
+
+struct PoolNode {
+
+    PoolNode(int v, PoolNode *n): value(v), next(n) {}
+
+    int value;
+    PoolNode *next;
+};
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool test_pool_new_delete() {
+
+    ::pml::Pool<PoolNode> pool(16);
+    PoolNode *list = 0;
+
+    for(int i = 0; i < 40; i++) {
+        list = pml_new<PoolNode>(&pool)(i, list);
+    }
+
+    const ::pml::PoolStats &stats = pool.stats();
+
+    bool result =
+        TFR_check(4, 40 == stats.in_use) &&
+        TFR_check(4, 3 == stats.slabs) &&
+        TFR_check(4, 3 == stats.grows) &&
+        TFR_check(4, 39 == list->value && 36 == list->next->next->next->value);
+
+    while(list) {
+        PoolNode *next = list->next;
+        pml_delete(&pool)(list);
+        list = next;
+    }
+
+    result &=
+        TFR_check(4, 0 == stats.in_use) &&
+        TFR_check(4, 40 == stats.peak_in_use);
+
+    // freed blocks are reused, no further growth
+    PoolNode *a = pml_new<PoolNode>(&pool)(1, static_cast<PoolNode*>(0));
+    PoolNode *b = pml_new<PoolNode>(&pool)(2, a);
+
+    result &=
+        TFR_check(4, 3 == stats.grows) &&
+        TFR_check(4, a != b && b->next == a);
+
+    pml_delete(&pool)(b);
+    pml_delete(&pool)(a);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+struct PoolLine {
+
+    char data[40];
+} __attribute__((aligned(64)));
+
+
+TFR_Bool test_pool_aligned() {
+
+    ::pml::Pool<PoolLine> pool(4);
+    PoolLine *lines[10];
+    bool result = true;
+
+    for(int i = 0; i < 10; i++) {
+        lines[i] = pml_new<PoolLine>(&pool)();
+        result &= TFR_check(4, 0 == (reinterpret_cast<size_t>(lines[i]) & 63));
+    }
+
+    for(int i = 0; i < 10; i++) {
+        pml_delete(&pool)(lines[i]);
+    }
+
+    return result && TFR_check(4, 0 == pool.stats().in_use);
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool test_pool_trim() {
+
+    ::pml::FixedPool<24, 16> pool(8);
+    void *blocks[32];
+
+    for(int i = 0; i < 32; i++) {
+        blocks[i] = pool.malloc(24);
+    }
+
+    bool result =
+        TFR_check(4, 32 == pool.BLOCK_SIZE) &&
+        TFR_check(4, 0 == (reinterpret_cast<size_t>(blocks[5]) & 15)) &&
+        TFR_check(4, 4 == pool.stats().slabs) &&
+        TFR_check(4, 0 == pool.trim());
+
+    // empty the first two slabs completely, and half of the third
+    for(int i = 0; i < 20; i++) {
+        pool.free(blocks[i]);
+    }
+
+    result &=
+        TFR_check(4, 2 == pool.trim()) &&
+        TFR_check(4, 2 == pool.stats().slabs) &&
+        TFR_check(4, 2 == pool.stats().shrinks) &&
+        TFR_check(4, 4 == pool.stats().peak_slabs);
+
+    // the remaining free blocks are still usable
+    for(int i = 0; i < 4; i++) {
+        blocks[i] = pool.malloc(24);
+    }
+
+    result &= TFR_check(4, 2 == pool.stats().slabs);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool test_pool_realloc() {
+
+    ::pml::FixedPool<32> pool;
+
+    void *ptr = ::pml_realloc(0, 16, &pool);
+    void *ptr2 = ::pml_realloc(ptr, 32, &pool);
+
+    bool result =
+        TFR_check(4, ptr && ptr == ptr2) &&
+        TFR_check(4, 0 == ::pml_realloc(ptr2, 0, &pool)) &&
+        TFR_check(4, 0 == pool.stats().in_use);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool test_pool_batch() {
+
+    ::pml::FixedPool<48> pool(16);
+    void *ptrs[40];
+
+    size_t done = ::pml_malloc_batch(40, 48, ptrs, &pool);
+
+    bool result =
+        TFR_check(4, 40 == done) &&
+        TFR_check(4, 40 == pool.stats().in_use) &&
+        TFR_check(4, 3 == pool.stats().grows) &&
+        TFR_check(4, ptrs[0] != ptrs[39]);
+
+    ::pml_free_batch(ptrs, 40, &pool);
+
+    result &=
+        TFR_check(4, 0 == pool.stats().in_use) &&
+        TFR_check(4, 40 == pool.stats().peak_in_use);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+void declare_pml_pool_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::pool", 0, 0);
+    TFR_SUITE_ADD_M(test_pool_new_delete);
+    TFR_SUITE_ADD_M(test_pool_aligned);
+    TFR_SUITE_ADD_M(test_pool_trim);
+    TFR_SUITE_ADD_M(test_pool_realloc);
+    TFR_SUITE_ADD_M(test_pool_batch);
+}
+
+
+} // namespace pml
+} // namespace tests
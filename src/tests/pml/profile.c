@@ -0,0 +1,120 @@
+#include "tests/pml.h"
+#include "pml/profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// NB: this is C99 code, we can use // line comment format
+
+//------------------------------------------------------------------------------
+
+struct Totals {
+
+    unsigned long long inuse_objs;
+    unsigned long long inuse_bytes;
+    unsigned long long alloc_objs;
+    unsigned long long alloc_bytes;
+    unsigned long long rate;
+    bool stacks;
+    bool maps;
+};
+
+
+// write a profile, and read it back
+static struct Totals c_profile_read() {
+
+    struct Totals t;
+    memset(&t, 0, sizeof(t));
+
+    FILE *file = tmpfile();
+    if(!file || !pml_profile_write(file)) {
+        return t;
+    }
+
+    rewind(file);
+
+    char line[1024];
+    if( fgets(line, sizeof(line), file) &&
+        5 != sscanf(line, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu",
+            &t.inuse_objs, &t.inuse_bytes, &t.alloc_objs, &t.alloc_bytes,
+            &t.rate) ) {
+
+        t.rate = 0;
+    }
+
+    while(fgets(line, sizeof(line), file)) {
+        t.stacks |= !!strstr(line, "] @ 0x");
+        t.maps |= !strcmp(line, "MAPPED_LIBRARIES:\n");
+    }
+
+    if(TFR_get_verbosity() >= 5) {
+        rewind(file);
+        while(fgets(line, sizeof(line), file) && strcmp(line, "\n")) {
+            fputs(line, stdout);
+        }
+    }
+
+    fclose(file);
+
+    return t;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_profile() {
+
+    // with a rate of 1 byte, every allocation is sampled
+    TFR_Bool result = TFR_check(4, pml_profile_start(1));
+
+    void *blocks[100];
+    for(int i = 0; i < 100; i++) {
+        blocks[i] = pml_malloc(64, 0, "profiled");
+    }
+
+    for(int i = 0; i < 50; i++) {
+        pml_free(blocks[i], 0, 0);
+    }
+
+    // a realloc forgets the old block, and samples the new one
+    blocks[99] = pml_realloc(blocks[99], 128, 0, 0);
+
+    struct Totals t = c_profile_read();
+
+    result &=
+        TFR_check(4, 1 == t.rate) &&
+        TFR_check(4, 50 == t.inuse_objs && 49 * 64 + 128 == t.inuse_bytes) &&
+        TFR_check(4, 101 == t.alloc_objs && 100 * 64 + 128 == t.alloc_bytes) &&
+        TFR_check(4, t.maps);
+
+#ifdef __GLIBC__
+    result &= TFR_check(4, t.stacks);
+#endif/*__GLIBC__*/
+
+    // once stopped, nothing new is sampled, but frees are still tracked
+    pml_profile_stop();
+
+    void *unsampled = pml_malloc(64, 0, 0);
+    pml_free(unsampled, 0, 0);
+
+    for(int i = 50; i < 100; i++) {
+        pml_free(blocks[i], 0, 0);
+    }
+
+    t = c_profile_read();
+
+    result &=
+        TFR_check(4, 0 == t.inuse_objs && 0 == t.inuse_bytes) &&
+        TFR_check(4, 101 == t.alloc_objs);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+void c_declare_pml_profile_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::profile", 0, 0);
+    TFR_SUITE_ADD_M(c_test_profile);
+}
@@ -0,0 +1,123 @@
+#include "tests/pml.h"
+#include "pml/recorder.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// NB: this is C99 code, we can use // line comment format
+
+//------------------------------------------------------------------------------
+
+struct Drained {
+
+    size_t events;
+    size_t mallocs;
+    size_t frees;
+    size_t hinted;
+    uint32_t thread;
+    bool ordered;
+    uint64_t last;
+};
+
+
+static void c_recorder_consume(const PmlRecorderEvent *events, size_t count,
+    void *context) {
+
+    struct Drained *d = context;
+
+    for(size_t i = 0; i < count; i++) {
+        const PmlRecorderEvent *e = &events[i];
+
+        d->events++;
+        d->mallocs += (pml_MALLOC == e->type);
+        d->frees += (pml_FREE == e->type);
+        d->hinted += (e->hint && !strcmp(e->hint, "recorded"));
+        d->ordered &= (e->time >= d->last);
+        d->thread = e->thread;
+        d->last = e->time;
+    }
+}
+
+
+static struct Drained c_recorder_drain() {
+
+    struct Drained d;
+    memset(&d, 0, sizeof(d));
+    d.ordered = true;
+
+    pml_recorder_drain(c_recorder_consume, &d);
+    return d;
+}
+
+
+static void c_recorder_churn(size_t pairs) {
+
+    for(size_t i = 0; i < pairs; i++) {
+        void *ptr = pml_malloc(16, 0, "recorded");
+        pml_free(ptr, 0, "recorded");
+    }
+}
+
+
+static void *c_recorder_worker(void *param) {
+
+    c_recorder_churn(10);
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_recorder() {
+
+    PmlHookTable saved;
+    pml_get_hooks(&saved);
+
+    TFR_Bool result = TFR_check(4, pml_recorder_install(64));
+
+    pml_recorder_drain(0, 0); // discard anything already recorded
+
+    c_recorder_churn(10);
+    struct Drained d = c_recorder_drain();
+
+    result &=
+        TFR_check(4, 20 == d.events) &&
+        TFR_check(4, 10 == d.mallocs && 10 == d.frees) &&
+        TFR_check(4, 20 == d.hinted) &&
+        TFR_check(4, d.ordered && d.thread) &&
+        TFR_check(4, 0 == c_recorder_drain().events);
+
+    // a full ring drops events rather than waiting
+    uint64_t dropped = pml_recorder_dropped();
+    c_recorder_churn(50);
+    d = c_recorder_drain();
+
+    result &=
+        TFR_check(4, 64 == d.events) &&
+        TFR_check(4, 36 == pml_recorder_dropped() - dropped);
+
+    // another thread records into its own ring, which outlives it
+    uint32_t main_thread = d.thread;
+    pthread_t thread;
+    pthread_create(&thread, 0, c_recorder_worker, 0);
+    pthread_join(thread, 0);
+
+    d = c_recorder_drain();
+
+    result &=
+        TFR_check(4, 20 == d.events) &&
+        TFR_check(4, d.thread && d.thread != main_thread);
+
+    pml_set_hooks(&saved);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+void c_declare_pml_recorder_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::recorder", 0, 0);
+    TFR_SUITE_ADD_M(c_test_recorder);
+}
@@ -0,0 +1,301 @@
+#include "tests/pml.h"
+#include "pml/remote.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NB: this is C99 code, we can use // line comment format
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_remote_sizes() {
+
+    static const size_t sizes[] = {
+        0, 1, 16, 17, 100, 128, 129, 1000, 4096, 16384, 16385, 100000,
+    };
+
+    TFR_Bool result = TFR_true;
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+        unsigned char *ptr = pml_remote_malloc(sizes[i], 0, 0);
+
+        result &=
+            TFR_check(4, !!ptr) &&
+            TFR_check(4, 0 == ((uintptr_t)ptr & 15)) &&
+            TFR_check(4, sizes[i] <= pml_remote_usable_size(ptr, 0, 0));
+
+        if(ptr) {
+            memset(ptr, 0xab, sizes[i]);
+            pml_remote_free(ptr, 0, 0);
+        }
+    }
+
+    // the owner's frees are reused straight away
+    void *a = pml_remote_malloc(64, 0, 0);
+    pml_remote_free(a, 0, 0);
+    void *b = pml_remote_malloc(60, 0, 0);
+
+    result &= TFR_check(4, a == b);
+    pml_remote_free(b, 0, 0);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_remote_aligned() {
+
+    static const size_t sizes[] = { 1, 100, 5000, 40000 };
+    TFR_Bool result = TFR_true;
+
+    for(size_t align = 8; align <= PML_REMOTE_MAX_SIZE; align <<= 1) {
+        for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+            unsigned char *ptr = pml_aligned_malloc(
+                align, sizes[i], pml_remote_allocator());
+
+            result &=
+                TFR_check(5, !!ptr) &&
+                TFR_check(5, 0 == ((uintptr_t)ptr & (align - 1))) &&
+                TFR_check(5, sizes[i] <= pml_remote_usable_size(ptr, 0, 0));
+
+            if(ptr) {
+                memset(ptr, 0xab, sizes[i]);
+                pml_aligned_free(ptr, pml_remote_allocator());
+            }
+        }
+    }
+
+    // realloc() is emulated, and keeps the contents
+    char *ptr = pml_malloc(40, pml_remote_allocator());
+    for(int i = 0; i < 40; i++) { ptr[i] = (char)i; }
+
+    ptr = pml_realloc(ptr, 100000, pml_remote_allocator());
+
+    for(int i = 0; i < 40; i++) {
+        result &= TFR_check(5, ptr[i] == (char)i);
+    }
+
+    pml_free(ptr, pml_remote_allocator());
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+// A producer thread allocates blocks which the main thread frees. Once they've
+// been published, the producer's next allocations reclaim them.
+
+enum { RF_BLOCKS = 1000 };
+
+static void *s_rf_first[RF_BLOCKS];
+static void *s_rf_second[RF_BLOCKS];
+static pthread_barrier_t s_rf_barrier;
+
+
+static void *c_remote_producer(void *param) {
+
+    for(size_t i = 0; i < RF_BLOCKS; i++) {
+        s_rf_first[i] = pml_remote_malloc(64, 0, 0);
+    }
+
+    pthread_barrier_wait(&s_rf_barrier); // main thread frees...
+    pthread_barrier_wait(&s_rf_barrier);
+
+    for(size_t i = 0; i < RF_BLOCKS; i++) {
+        s_rf_second[i] = pml_remote_malloc(64, 0, 0);
+    }
+
+    for(size_t i = 0; i < RF_BLOCKS; i++) {
+        pml_remote_free(s_rf_second[i], 0, 0);
+    }
+
+    return 0;
+}
+
+
+static int c_remote_compare(const void *a, const void *b) {
+
+    uintptr_t x = (uintptr_t)*(void *const*)a, y = (uintptr_t)*(void *const*)b;
+    return x < y ? -1 : x > y;
+}
+
+
+TFR_Bool c_test_remote_reclaim() {
+
+    pthread_t thread;
+    pthread_barrier_init(&s_rf_barrier, 0, 2);
+    pthread_create(&thread, 0, c_remote_producer, 0);
+
+    pthread_barrier_wait(&s_rf_barrier);
+
+    for(size_t i = 0; i < RF_BLOCKS; i++) {
+        pml_free(s_rf_first[i], pml_remote_allocator());
+    }
+
+    pml_remote_flush();
+    pthread_barrier_wait(&s_rf_barrier);
+
+    pthread_join(thread, 0);
+    pthread_barrier_destroy(&s_rf_barrier);
+
+    qsort(s_rf_first, RF_BLOCKS, sizeof(void*), c_remote_compare);
+    qsort(s_rf_second, RF_BLOCKS, sizeof(void*), c_remote_compare);
+
+    // the owner's own frees are never pending, and nothing is left behind
+    return
+        TFR_check(4, !memcmp(s_rf_first, s_rf_second, sizeof(s_rf_first))) &&
+        TFR_check(4, 0 == pml_remote_collect());
+}
+
+
+//------------------------------------------------------------------------------
+// A thread exits with blocks in its own list and on its remote list. The next
+// new thread adopts its heap, and gets all of those blocks back.
+
+static void *c_remote_abandon(void *param) {
+
+    for(size_t i = 0; i < RF_BLOCKS; i++) {
+        s_rf_first[i] = pml_remote_malloc(64, 0, 0);
+    }
+
+    pthread_barrier_wait(&s_rf_barrier); // main thread frees half...
+    pthread_barrier_wait(&s_rf_barrier);
+
+    for(size_t i = 0; i < RF_BLOCKS; i += 2) {
+        pml_remote_free(s_rf_first[i], 0, 0);
+    }
+
+    return 0;
+}
+
+
+static void *c_remote_adopt(void *param) {
+
+    for(size_t i = 0; i < RF_BLOCKS; i++) {
+        s_rf_second[i] = pml_remote_malloc(64, 0, 0);
+    }
+
+    return 0;
+}
+
+
+TFR_Bool c_test_remote_adopt() {
+
+    pthread_t thread;
+    pthread_barrier_init(&s_rf_barrier, 0, 2);
+    pthread_create(&thread, 0, c_remote_abandon, 0);
+
+    pthread_barrier_wait(&s_rf_barrier);
+
+    for(size_t i = 1; i < RF_BLOCKS; i += 2) {
+        pml_remote_free(s_rf_first[i], 0, 0);
+    }
+
+    pml_remote_flush();
+    pthread_barrier_wait(&s_rf_barrier);
+
+    pthread_join(thread, 0);
+    pthread_barrier_destroy(&s_rf_barrier);
+
+    pthread_create(&thread, 0, c_remote_adopt, 0);
+    pthread_join(thread, 0);
+
+    qsort(s_rf_first, RF_BLOCKS, sizeof(void*), c_remote_compare);
+    qsort(s_rf_second, RF_BLOCKS, sizeof(void*), c_remote_compare);
+
+    TFR_Bool result =
+        TFR_check(4, !memcmp(s_rf_first, s_rf_second, sizeof(s_rf_first)));
+
+    for(size_t i = 0; i < RF_BLOCKS; i++) {
+        pml_remote_free(s_rf_second[i], 0, 0);
+    }
+
+    pml_remote_flush();
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+// Threads pass blocks around a ring, each freeing the blocks allocated by its
+// neighbour.
+
+enum { RF_THREADS = 4, RF_ROUNDS = 50, RF_RING_BLOCKS = 500 };
+
+static unsigned char *s_rf_ring[RF_THREADS][RF_RING_BLOCKS];
+static TFR_Bool s_rf_ring_ok[RF_THREADS];
+
+
+static void *c_remote_ring_worker(void *param) {
+
+    size_t id = (size_t)param;
+    size_t from = (id + 1) % RF_THREADS;
+    TFR_Bool ok = TFR_true;
+
+    for(size_t round = 0; round < RF_ROUNDS; round++) {
+
+        for(size_t i = 0; i < RF_RING_BLOCKS; i++) {
+            size_t size = 1 + ((i * 7919 + round) % 2048);
+            unsigned char *ptr = pml_remote_malloc(size, 0, 0);
+            memset(ptr, (int)(id + round), size);
+            s_rf_ring[id][i] = ptr;
+        }
+
+        pthread_barrier_wait(&s_rf_barrier);
+
+        for(size_t i = 0; i < RF_RING_BLOCKS; i++) {
+            size_t size = 1 + ((i * 7919 + round) % 2048);
+            unsigned char *ptr = s_rf_ring[from][i];
+
+            if( ptr[0] != (unsigned char)(from + round) ||
+                ptr[size - 1] != (unsigned char)(from + round) ) {
+                ok = TFR_false;
+            }
+
+            pml_remote_free(ptr, 0, 0);
+        }
+
+        pthread_barrier_wait(&s_rf_barrier);
+    }
+
+    s_rf_ring_ok[id] = ok;
+    return 0;
+}
+
+
+TFR_Bool c_test_remote_ring() {
+
+    TFR_Bool result = TFR_true;
+    pthread_t threads[RF_THREADS];
+
+    pthread_barrier_init(&s_rf_barrier, 0, RF_THREADS);
+
+    for(size_t i = 0; i < RF_THREADS; i++) {
+        pthread_create(&threads[i], 0, c_remote_ring_worker, (void*)i);
+    }
+
+    for(size_t i = 0; i < RF_THREADS; i++) {
+        pthread_join(threads[i], 0);
+        result &= TFR_check(4, s_rf_ring_ok[i]);
+    }
+
+    pthread_barrier_destroy(&s_rf_barrier);
+
+    return result;
+}
+
+
+void c_declare_pml_remote_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::remote", 0, 0);
+    TFR_SUITE_ADD_M(c_test_remote_sizes);
+    TFR_SUITE_ADD_M(c_test_remote_aligned);
+    TFR_SUITE_ADD_M(c_test_remote_reclaim);
+    TFR_SUITE_ADD_M(c_test_remote_adopt);
+    TFR_SUITE_ADD_M(c_test_remote_ring);
+}
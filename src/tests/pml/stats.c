@@ -0,0 +1,143 @@
+#include "tests/pml.h"
+#include "pml/stats.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// NB: this is C99 code, we can use // line comment format
+
+//------------------------------------------------------------------------------
+
+static const char *const s_site_a = "stats(a)";
+static const char *const s_site_b = "stats(b)";
+static const char *const s_site_c = "stats(c)";
+
+
+static PmlStatsSite c_stats_find(PmlHint hint) {
+
+    PmlStatsSite sites[64];
+    PmlStatsSite found;
+    memset(&found, 0, sizeof(found));
+
+    size_t count = pml_stats_collect(sites, 64);
+
+    for(size_t i = 0; i < count && i < 64; i++) {
+        if(sites[i].hint == hint) {
+            found = sites[i];
+        }
+    }
+
+    return found;
+}
+
+
+static void *c_stats_worker(void *param) {
+
+    // frees blocks allocated by the main thread, and allocates its own
+    void **blocks = param;
+
+    for(int i = 0; i < 4; i++) {
+        pml_free(blocks[i], 0, 0);
+    }
+
+    blocks[0] = pml_malloc(1000, 0, s_site_b);
+
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_stats() {
+
+    PmlHookTable saved;
+    pml_get_hooks(&saved);
+
+    TFR_Bool result =
+        TFR_check(4, pml_stats_install()) &&
+        TFR_check(4, !pml_stats_install());
+
+    void *blocks[8];
+    for(int i = 0; i < 8; i++) {
+        blocks[i] = pml_malloc(100, 0, s_site_a);
+    }
+
+    PmlStatsSite a = c_stats_find(s_site_a);
+
+    result &=
+        TFR_check(4, 8 == a.allocs && 0 == a.frees) &&
+        TFR_check(4, 800 == a.live_bytes && 800 == a.peak_bytes) &&
+        TFR_check(4, 8 == a.histogram[3]); // (64, 128]
+
+    // a realloc moves the bytes to the new callsite
+    blocks[7] = pml_realloc(blocks[7], 20000, 0, s_site_b);
+
+    // frees on another thread are charged back to the allocating callsite
+    pthread_t thread;
+    pthread_create(&thread, 0, c_stats_worker, blocks);
+    pthread_join(thread, 0);
+
+    a = c_stats_find(s_site_a);
+    PmlStatsSite b = c_stats_find(s_site_b);
+
+    result &=
+        TFR_check(4, 8 == a.allocs && 5 == a.frees) &&
+        TFR_check(4, 300 == a.live_bytes) &&
+        TFR_check(4, 2 == b.allocs && 0 == b.frees) &&
+        TFR_check(4, 21000 == b.live_bytes) &&
+        TFR_check(4, 1 == b.histogram[6] && 1 == b.histogram[11]);
+
+    pml_free(blocks[0], 0, 0);
+    for(int i = 4; i < 8; i++) {
+        pml_free(blocks[i], 0, 0);
+    }
+
+    a = c_stats_find(s_site_a);
+    b = c_stats_find(s_site_b);
+
+    result &=
+        TFR_check(4, 0 == a.live_bytes && 800 == a.peak_bytes) &&
+        TFR_check(4, 0 == b.live_bytes);
+
+    // aligned blocks are counted too, and can be freed either way
+    void *x = pml_aligned_malloc(64, 100, 0, s_site_c);
+    void *y = pml_aligned_malloc(4096, 5000, 0, s_site_c);
+    PmlStatsSite c = c_stats_find(s_site_c);
+
+    result &=
+        TFR_check(4, x && 0 == ((uintptr_t)x & 63)) &&
+        TFR_check(4, y && 0 == ((uintptr_t)y & 4095)) &&
+        TFR_check(4, 100 == pml_usable_size(x, 0, 0)) &&
+        TFR_check(4, 2 == c.allocs && 5100 == c.live_bytes);
+
+    memset(y, 0xab, 5000);
+    y = pml_realloc(y, 10000, 0, 0);
+
+    result &=
+        TFR_check(4, y && 0xab == ((unsigned char*)y)[4999]) &&
+        TFR_check(4, 10000 == pml_usable_size(y, 0, 0));
+
+    pml_free(x, 0, 0);
+    pml_aligned_free(y, 0, 0);
+
+    c = c_stats_find(s_site_c);
+    result &= TFR_check(4, 3 == c.allocs && 3 == c.frees && 0 == c.live_bytes);
+
+    if(TFR_get_verbosity() >= 5) {
+        pml_stats_dump(stdout);
+    }
+
+    pml_set_hooks(&saved);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+void c_declare_pml_stats_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::stats", 0, 0);
+    TFR_SUITE_ADD_M(c_test_stats);
+}
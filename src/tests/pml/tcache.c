@@ -0,0 +1,312 @@
+#include "tests/pml.h"
+#include "pml/tcache.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// NB: this is C99 code, we can use // line comment format
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_tcache_sizes() {
+
+    static const size_t sizes[] = {
+        0, 1, 16, 17, 100, 128, 129, 1000, 4096, 32768, 32769, 100000,
+    };
+
+    TFR_Bool result = TFR_true;
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+        unsigned char *ptr = pml_tcache_malloc(sizes[i], 0, 0);
+
+        result &=
+            TFR_check(4, !!ptr) &&
+            TFR_check(4, 0 == ((uintptr_t)ptr & 15));
+
+        if(ptr) {
+            memset(ptr, 0xab, sizes[i]);
+            pml_tcache_free(ptr, 0, 0);
+        }
+    }
+
+    // most recently freed block of a class is handed out first
+    void *a = pml_tcache_malloc(64, 0, 0);
+    pml_tcache_free(a, 0, 0);
+    void *b = pml_tcache_malloc(60, 0, 0);
+
+    result &= TFR_check(4, a == b);
+    pml_tcache_free(b, 0, 0);
+
+    // sized free goes to the same class
+    a = pml_tcache_malloc(100, 0, 0);
+    pml_tcache_free_sized(a, 100, 0, 0);
+    b = pml_tcache_malloc(112, 0, 0);
+
+    result &= TFR_check(4, a == b);
+    pml_tcache_free_sized(b, 112, 0, 0);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_tcache_aligned() {
+
+    static const size_t sizes[] = { 1, 100, 5000, 40000 };
+    TFR_Bool result = TFR_true;
+
+    for(size_t align = 8; align <= PML_TCACHE_MAX_SIZE; align <<= 1) {
+        for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+            unsigned char *ptr = pml_tcache_aligned_malloc(align, sizes[i], 0, 0);
+
+            result &=
+                TFR_check(5, !!ptr) &&
+                TFR_check(5, 0 == ((uintptr_t)ptr & (align - 1)));
+
+            if(ptr) {
+                memset(ptr, 0xab, sizes[i]);
+                pml_tcache_free(ptr, 0, 0);
+            }
+        }
+    }
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_tcache_realloc() {
+
+    TFR_Bool result = TFR_true;
+
+    char *ptr = pml_tcache_malloc(40, 0, 0);
+    for(int i = 0; i < 40; i++) { ptr[i] = (char)i; }
+
+    // same class - stays in place
+    char *ptr2 = pml_tcache_realloc(ptr, 48, 0, 0);
+    result &= TFR_check(4, ptr == ptr2);
+
+    // grow into a bigger class, then into a mapped block
+    ptr2 = pml_tcache_realloc(ptr2, 1000, 0, 0);
+    ptr2 = pml_tcache_realloc(ptr2, 100000, 0, 0);
+
+    for(int i = 0; i < 40; i++) {
+        if(ptr2[i] != (char)i) {
+            result = TFR_false;
+        }
+    }
+
+    result &= TFR_check(4, 0 == pml_tcache_realloc(ptr2, 0, 0, 0));
+
+    // usable size is the class size, and resizing within it stays in place
+    ptr = pml_tcache_malloc(100, 0, 0);
+
+    result &=
+        TFR_check(4, 112 == pml_tcache_usable_size(ptr, 0, 0)) &&
+        TFR_check(4, pml_tcache_try_expand(ptr, 112, 0, 0)) &&
+        TFR_check(4, !pml_tcache_try_expand(ptr, 113, 0, 0)) &&
+        TFR_check(4, !pml_tcache_try_expand(ptr, 90, 0, 0));
+
+    pml_tcache_free(ptr, 0, 0);
+
+    int foreign;
+    result &= TFR_check(4, 0 == pml_tcache_usable_size(&foreign, 0, 0));
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_tcache_calloc() {
+
+    TFR_Bool result = TFR_true;
+    static const size_t counts[] = { 10, 100000 };
+
+    for(size_t i = 0; i < 2; i++) {
+
+        // dirty the cache first, so the small block is recycled
+        int *dirty = pml_tcache_malloc(counts[i] * sizeof(int), 0, 0);
+        memset(dirty, 0xff, counts[i] * sizeof(int));
+        pml_tcache_free(dirty, 0, 0);
+
+        int *ptr = pml_tcache_calloc(counts[i], sizeof(int), 0, 0);
+
+        for(size_t j = 0; j < counts[i]; j++) {
+            if(ptr[j]) {
+                result = TFR_false;
+            }
+        }
+
+        pml_tcache_free(ptr, 0, 0);
+    }
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_tcache_allocator() {
+
+    PmlAllocator *alloc = pml_tcache_allocator();
+    void *ptr = pml_malloc(100, alloc);
+
+    if(TFR_check(4, !!ptr)) {
+        ptr = pml_realloc(ptr, 200, alloc);
+        pml_free(ptr, alloc);
+        return TFR_true;
+    }
+
+    return TFR_false;
+}
+
+
+//------------------------------------------------------------------------------
+
+// Blocks allocated before the engine was installed (including large ones which
+// the default hooks mapped) are passed back to the default hooks.
+
+TFR_Bool c_test_tcache_foreign() {
+
+    PmlHookTable saved;
+    pml_get_hooks(&saved);
+    pml_set_hooks(0);
+
+    size_t threshold = pml_get_mmap_threshold();
+    pml_set_mmap_threshold(256 * 1024);
+
+    void *small = pml_malloc(100);
+    void *large = pml_malloc(1 << 20);
+    unsigned char *grown = pml_malloc(1 << 20);
+
+    TFR_Bool result =
+        TFR_check(4, small && large && grown) &&
+        TFR_check(4, 0 == pml_tcache_usable_size(large, 0, 0)) &&
+        TFR_check(4, pml_tcache_install());
+
+    if(result) {
+        memset(grown, 0xab, 1 << 20);
+        grown = pml_realloc(grown, 2 << 20);
+
+        result &=
+            TFR_check(4, grown && 0xab == grown[0] && 0xab == grown[(1 << 20) - 1]) &&
+            TFR_check(4, 0 == pml_tcache_usable_size(grown, 0, 0));
+
+        pml_free(small);
+        pml_free(large);
+        pml_free(grown);
+    }
+
+    pml_set_mmap_threshold(threshold);
+    pml_set_hooks(&saved);
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_tcache_batch() {
+
+    TFR_Bool result = TFR_true;
+    void *ptrs[300]; // more than one refill's worth
+
+    static const size_t sizes[] = { 24, 40000 };
+
+    for(size_t i = 0; i < 2; i++) {
+        size_t count = i ? 3 : 300;
+        size_t done = pml_malloc_batch(count, sizes[i], ptrs, pml_tcache_allocator());
+
+        result &= TFR_check(4, count == done);
+
+        for(size_t j = 0; j < done; j++) {
+            result &= TFR_check(5, sizes[i] <= pml_tcache_usable_size(ptrs[j], 0, 0));
+            memset(ptrs[j], 0xab, sizes[i]);
+        }
+
+        pml_free_batch(ptrs, done, pml_tcache_allocator());
+    }
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+// Several threads allocate, and hand half of their blocks to the main thread to
+// free (cross-thread frees).
+
+enum { TC_THREADS = 4, TC_BLOCKS = 4000 };
+
+static void *s_tc_blocks[TC_THREADS][TC_BLOCKS];
+
+
+static void *c_tcache_worker(void *param) {
+
+    size_t id = (size_t)param;
+
+    for(size_t i = 0; i < TC_BLOCKS; i++) {
+        size_t size = 1 + ((i * 7919) % 2048);
+        unsigned char *ptr = pml_tcache_malloc(size, 0, 0);
+        memset(ptr, (int)id, size);
+
+        if(i & 1) {
+            s_tc_blocks[id][i] = ptr;
+        } else {
+            pml_tcache_free(ptr, 0, 0);
+        }
+    }
+
+    return 0;
+}
+
+
+TFR_Bool c_test_tcache_threads() {
+
+    TFR_Bool result = TFR_true;
+    pthread_t threads[TC_THREADS];
+
+    for(size_t i = 0; i < TC_THREADS; i++) {
+        pthread_create(&threads[i], 0, c_tcache_worker, (void*)i);
+    }
+
+    for(size_t i = 0; i < TC_THREADS; i++) {
+        pthread_join(threads[i], 0);
+    }
+
+    for(size_t id = 0; id < TC_THREADS; id++) {
+        for(size_t i = 1; i < TC_BLOCKS; i += 2) {
+            unsigned char *ptr = s_tc_blocks[id][i];
+            size_t size = 1 + ((i * 7919) % 2048);
+
+            if(ptr[0] != id || ptr[size - 1] != id) {
+                result = TFR_false;
+            }
+
+            pml_tcache_free(ptr, 0, 0);
+        }
+    }
+
+    pml_tcache_flush();
+
+    return result;
+}
+
+
+void c_declare_pml_tcache_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::tcache", 0, 0);
+    TFR_SUITE_ADD_M(c_test_tcache_sizes);
+    TFR_SUITE_ADD_M(c_test_tcache_aligned);
+    TFR_SUITE_ADD_M(c_test_tcache_realloc);
+    TFR_SUITE_ADD_M(c_test_tcache_calloc);
+    TFR_SUITE_ADD_M(c_test_tcache_allocator);
+    TFR_SUITE_ADD_M(c_test_tcache_foreign);
+    TFR_SUITE_ADD_M(c_test_tcache_batch);
+    TFR_SUITE_ADD_M(c_test_tcache_threads);
+}
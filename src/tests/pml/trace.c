@@ -0,0 +1,115 @@
+#include "tests/pml.h"
+#include "pml/trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// NB: this is C99 code, we can use // line comment format
+
+//------------------------------------------------------------------------------
+
+struct TraceFile {
+
+    PmlTraceHeader header;
+    PmlTraceRecord records[16];
+    char hints[4][32];
+    bool valid;
+};
+
+
+static struct TraceFile c_trace_read(const char *path) {
+
+    struct TraceFile t;
+    memset(&t, 0, sizeof(t));
+
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+        return t;
+    }
+
+    t.valid =
+        1 == fread(&t.header, sizeof(t.header), 1, file) &&
+        !memcmp(t.header.magic, PML_TRACE_MAGIC, 8) &&
+        t.header.records <= 16 &&
+        t.header.records == fread(t.records, sizeof(PmlTraceRecord),
+            t.header.records, file);
+
+    for(uint64_t id = 1; t.valid && id <= t.header.hints && id < 4; id++) {
+        uint32_t length = 0;
+        t.valid =
+            1 == fread(&length, sizeof(length), 1, file) && length < 32 &&
+            length == fread(t.hints[id], 1, length, file);
+    }
+
+    fclose(file);
+
+    return t;
+}
+
+
+//------------------------------------------------------------------------------
+
+TFR_Bool c_test_trace() {
+
+    char path[] = "/tmp/pml_trace_XXXXXX";
+    int fd = mkstemp(path);
+
+    TFR_Bool result =
+        TFR_check(4, fd >= 0) &&
+        TFR_check(4, pml_trace_start(path)) &&
+        TFR_check(4, !pml_trace_start(path));
+
+    void *a = pml_malloc(100, 0, "first");
+    void *b = pml_aligned_malloc(64, 32, 0, "second");
+    a = pml_realloc(a, 200, 0, "first");
+
+    void *batch[3];
+    pml_malloc_batch(3, 16, batch, 0, 0);
+    pml_free_batch(batch, 3, 0, 0);
+
+    pml_aligned_free(b, 0, 0);
+    pml_free(a, 0, "first");
+
+    result &=
+        TFR_check(4, 11 == pml_trace_records()) &&
+        TFR_check(4, pml_trace_stop()) &&
+        TFR_check(4, !pml_trace_stop());
+
+    // nothing is recorded once stopped
+    pml_free(pml_malloc(8, 0, 0), 0, 0);
+
+    struct TraceFile t = c_trace_read(path);
+    PmlTraceRecord *r = t.records;
+
+    result &=
+        TFR_check(4, t.valid) &&
+        TFR_check(4, 11 == t.header.records && 1 == t.header.threads) &&
+        TFR_check(4, 2 == t.header.hints) &&
+        TFR_check(4, !strcmp(t.hints[1], "first") && !strcmp(t.hints[2], "second")) &&
+        TFR_check(4, pml_MALLOC == r[0].type && 100 == r[0].size && 1 == r[0].hint) &&
+        TFR_check(4, pml_ALIGNED_MALLOC == r[1].type && 6 == r[1].align_log2) &&
+        TFR_check(4, pml_REALLOC == r[2].type && r[2].in == r[0].ptr) &&
+        TFR_check(4, pml_MALLOC == r[3].type && r[3].ptr == (uintptr_t)batch[0]) &&
+        TFR_check(4, pml_FREE == r[6].type && r[6].ptr == (uintptr_t)batch[0]) &&
+        TFR_check(4, pml_ALIGNED_FREE == r[9].type && r[9].ptr == r[1].ptr) &&
+        TFR_check(4, pml_FREE == r[10].type && r[10].ptr == r[2].ptr) &&
+        TFR_check(4, 1 == r[10].thread);
+
+    if(fd >= 0) {
+        close(fd);
+        unlink(path);
+    }
+
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+void c_declare_pml_trace_tests() {
+
+    TFR_SUITE_DECLARE_M("pml::trace", 0, 0);
+    TFR_SUITE_ADD_M(c_test_trace);
+}
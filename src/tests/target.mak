@@ -2,8 +2,18 @@ BIN_TARGET:=test
 
 SOURCE:= \
 	main.cpp \
+	pml/arena.cpp \
+	pml/epoch.c \
+	pml/hint.c \
 	pml/malloc.c \
 	pml/malloc.cpp \
+	pml/pool.cpp \
+	pml/profile.c \
+	pml/recorder.c \
+	pml/remote.c \
+	pml/stats.c \
+	pml/tcache.c \
+	pml/trace.c \
 	# SOURCE
 
 LIBS:= \
@@ -13,6 +23,11 @@ LIBS:= \
 	misc \
 	# LIBS
 
+# the pml engines use pthreads
+LINUX_XLIBS:= \
+	-lpthread \
+	# LINUX_XLIBS
+
 
 #-------------------------------------------------------------------------------
 # Additional targets